@@ -48,6 +48,17 @@
 #include "resource.h"
 #include "tfoc.h"
 #include "curfit.h"
+#include "tpool.h"						/* Persistent worker thread pool */
+#include "matdb.h"						/* Compiled (memory mapped) n,k database */
+#include "namehash.h"					/* Case-insensitive name index */
+#include "speclib.h"						/* Precomputed spectral library */
+#include "filmfit.h"						/* Reentrant reflectance evaluation and fitting */
+#include "tseries.h"						/* Time-series files */
+#include "awriter.h"						/* Background writing of logs and time series */
+#include "pipeline.h"						/* Overlapped acquire / fit / record while automeasuring */
+#include "scheduler.h"					/* Paces the acquisitions of automatic measurement */
+#include "recipe.h"						/* Stack descriptions (for fmcore.h) */
+#include "fmcore.h"						/* Reflectance, chi-square and fit values shared with fmfit */
 
 #include "server_support.h"		/* Server support */
 #include "spec.h"						/* Access to the spectrometer information */
@@ -73,6 +84,60 @@
 	#define PATH_MAX (260)
 #endif
 
+/* Spectra queued between the steps of automatic measurement -- at 50 Hz
+ * enough to ride out a fit or redraw taking about 150 ms */
+#define	AUTO_MEASURE_DEPTH		(8)
+
+/* One spectrum passing through the automatic measurement pipeline */
+typedef struct _MEASUREMENT {
+	int run;										/* Pipeline run that produced it */
+	int rc;										/* 0, or code of the failed acquisition */
+	double time;								/* Sched_Clock() at the start of the acquisition */
+	BOOL posted;								/* Handed out by pipe_post() -- owes a Pipeline_Done() */
+	int npt;
+	double *raw;								/* [npt] raw counts */
+	BOOL fitted;								/* Fit done and successful */
+	int layers;									/* Sample stack layers (incl. substrate) */
+	double nm[N_FILM_STACK+1];				/* Fitted thickness of each stack layer */
+	double sigma[N_FILM_STACK+1];			/* Its uncertainty (before chisqr scaling) */
+	double lower[N_FILM_STACK+1],			/* Fit limits for the next spectrum */
+			 upper[N_FILM_STACK+1];
+	double scaling;
+	int nvalues;								/* Fit values as info->last_fit */
+	double value[2*N_FILM_STACK+3];
+} MEASUREMENT;
+
+/* State of a pipeline run -- a snapshot of the calibration, sample stack
+ * and fit settings when it started, owned by the fit stage from then on */
+typedef struct _MEASURE_PIPE {
+	HWND hdlg;									/* Receives WMP_SHOW_MEASUREMENT */
+	int run;
+	int overrun;								/* SCHED_xxx -- also whether to fit every spectrum */
+	volatile BOOL discard;					/* Stopping -- spectra still queued are dropped */
+	int npt;
+	double *lambda, *ref, *dark, *tref;	/* [npt] copies (dark, tref may be NULL) */
+	double *refl, *sigma;					/* [npt] workspace of the fit stage */
+	BOOL autofit;								/* Fit each spectrum */
+	FMCORE *core;								/* Own fit (FMCore_Fit); shares pool, database, library */
+	int layers;
+	FILM_LAYERS stack[N_FILM_STACK+1];	/* Thickness and limits carried between fits */
+	int imat[N_FILM_STACK], substrate;	/* Settings compared by PipelineStale() */
+	BOOL vary[N_FILM_STACK];
+	struct _FIT_CONTROLS fit_parms;
+	double shown_nm[N_FILM_STACK],		/* Starting values as last put in the dialog */
+			 shown_tmin[N_FILM_STACK],		/* (dialog thread only) */
+			 shown_tmax[N_FILM_STACK];
+	double shown_scaling;
+} MEASURE_PIPE;
+
+/* Interned material -- one per entry in materials[], resolved at most once */
+typedef struct _MATERIAL_HANDLE {
+	char *name;									/* Name as listed (materials[].id)	*/
+	int index;									/* Index in materials[]					*/
+	TFOC_MATERIAL *tfoc;						/* From TFOC_FindMaterial (lazy)		*/
+	BOOL tfoc_tried;							/* Only ask TFOC once, even on failure	*/
+} MATERIAL_HANDLE;
+
 /* ------------------------------- */
 /* My external function prototypes */
 /* ------------------------------- */
@@ -90,14 +155,30 @@ static GRAPH_CURVE *ReallocResidualCurve(HWND hdlg, FILM_MEASURE_INFO *info, GRA
 static int Acquire_Raw_Spectrum(HWND hdlg, FILM_MEASURE_INFO *info, SPEC_SPECTRUM_INFO *spectrum_info, double **spectrum);
 
 TFOC_SAMPLE *MakeSample(int nlayers, FILM_LAYERS *film);
-int TFOC_GetReflData(TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, double temperature, int npt, double *lambda, double *refl);
+static void UpdateSample(TFOC_SAMPLE **psample, int nlayers, FILM_LAYERS *films);
 static char *Find_TFOC_Database(char *database, size_t len, int *ierr);
 
 static int InitMaterialsList(void);
+static int BuildMaterialIndex(void);
+static TFOC_MATERIAL *ResolveMaterial(char *name, char *database);
 static int FindMaterialIndex(char *text, char **endptr);
 
-static int CalcChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof);
 static int do_fit(HWND hdlg, FILM_MEASURE_INFO *info);
+static void MakeFitParms(HWND hdlg, FILM_MEASURE_INFO *info, FILMFIT_PARMS *parms);
+static void LoadFitControls(FILM_MEASURE_INFO *info, char *inifile);
+static void LogFit(HWND hdlg, FILM_MEASURE_INFO *info, double when);
+static void RecordTimeSeries(HWND hdlg, FILM_MEASURE_INFO *info, double when);
+static int StartAutoMeasure(HWND hdlg, FILM_MEASURE_INFO *info);
+static void StopAutoMeasure(void);
+static double AutoMeasurePeriod(HWND hdlg);
+static int StartPipeline(HWND hdlg, FILM_MEASURE_INFO *info);
+static void StopPipeline(void);
+static BOOL PipelineStale(HWND hdlg, FILM_MEASURE_INFO *info);
+static void ShowMeasurement(HWND hdlg, FILM_MEASURE_INFO *info, MEASUREMENT *m);
+static int auto_tick(void *arg, long n, double when);
+static int pipe_fit(void *arg, void *item);
+static int pipe_post(void *arg, void *item);
+static void CloseTimeSeries(FILM_MEASURE_INFO *info);
 
 static int QueryLogfile(HWND hdlg, int wID);
 static int QueryTimeSeriesFile(HWND hdlg, char *path, int pathlen);
@@ -125,6 +206,21 @@ static HWND main_hdlg = NULL;					/* Handle to primary dialog box */
 static CB_INT_LIST *materials = NULL;
 static int materials_dim=0;											/* Dimensioned size */
 static int materials_cnt=0;
+static MATDB *matdb = NULL;											/* Compiled database if available */
+static BOOL use_compiled_db = TRUE;								/* [Database] Use_Compiled in ini file */
+static MATERIAL_HANDLE *material_handles = NULL;				/* [materials_cnt] interned materials */
+static NAMEHASH *material_index = NULL;							/* Folded name -> material_handles[] */
+static SPECLIB *speclib = NULL;										/* Spectral library for the recipe (if built) */
+static char speclib_path[PATH_MAX] = SPECLIB_FILENAME;		/* [Fit] Spectral_Library in ini file */
+static AWRITER *writer = NULL;										/* Owns the log and time-series files */
+static int log_stream = -1;											/* Fit log stream and its pathname */
+static char log_path[PATH_MAX] = "";
+static PIPELINE *pipeline = NULL;										/* Running while automeasuring */
+static MEASURE_PIPE *measure_pipe = NULL;							/* and its state */
+static SCHEDULER *scheduler = NULL;									/* Acquisition thread while automeasuring */
+static int auto_overrun = SCHED_COALESCE;							/* [Measure] Overrun in ini file */
+static volatile LONG auto_posted = 0;								/* WMP_AUTO_MEASURE not yet handled */
+static CRITICAL_SECTION spec_lock;										/* One exchange with the spectrometer at a time */
 
 static int colors[7] = {						/* Color scheme for the graphs (and the legend) */
 	RGB(200,200,0),	/* Raw spectra - yellowish */
@@ -158,9 +254,13 @@ int WINAPI WinMain(HINSTANCE hThisInst, HINSTANCE hPrevInst, LPSTR lpszArgs, int
 	/* Load the class for the graph and bitmap windows */
 	Graph_StartUp(hThisInst);								/* Initialize the graphics control */
 
+	/* The acquisition thread and the dialog share the spectrometer connection */
+	InitializeCriticalSection(&spec_lock);
+
 	/* And show the dialog box */
 	hInstance = hThisInst;
 	DialogBoxParam(hInstance, "FILMMEASURE_DIALOG", HWND_DESKTOP, (DLGPROC) MainDlgProc, (LPARAM) main_info);			/* For re-entrant, use the previous saved values */
+	DeleteCriticalSection(&spec_lock);
 
 	/* And shut down the Spec server */
 	Shutdown_FilmMeasure_Server();
@@ -181,7 +281,6 @@ int WINAPI WinMain(HINSTANCE hThisInst, HINSTANCE hPrevInst, LPSTR lpszArgs, int
 --
 -- Return: return code, generally BOOL
 =========================================================================== */
-#define	TIMER_AUTO_MEASURE			(3)
 
 FILM_MEASURE_INFO *last_info;													/* For server calls that may not have this information otherwise */
 
@@ -190,7 +289,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 
 	BOOL rcode, enable;
 	int wID, wNotifyCode;
-	int i, ipt, ms, nvary, ilayer, rc;
+	int i, ipt, nvary, ilayer, rc;
 	char szBuf[256];
 	FILE *funit;
 
@@ -223,7 +322,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 	GRAPH_CURVE *cv;
 	GRAPH_SCALES scales;
 	GRAPH_ZFORCE zforce;
-	double rval, lower, upper, delta, chisqr, *data;
+	double rval, lower, upper, chisqr, period, *data;
 	int npt, dof;
 
 	/* List of controls which will respond to <ENTER> with a WM_NEXTDLGCTL message */
@@ -280,10 +379,11 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				info->lambda_min = 200.0;						/* Graph X-range limits */
 				info->lambda_max = 900.0;
 				info->lambda_autoscale = TRUE;
-				info->fit_parms.lambda_min  = 300.0;		/* Fitting parameters */
-				info->fit_parms.lambda_max  = 800.0;
-				info->fit_parms.scaling_min = 0.90;
-				info->fit_parms.scaling_max = 1.10;
+				LoadFitControls(info, NULL);					/* Fitting parameters (recipe.c defaults) */
+				info->fit = FilmFit_Create(NULL);			/* Pool attached once size is known */
+				FilmFit_SetMaterialDB(info->fit, matdb);
+				if (writer == NULL) writer = AWriter_Create(AWRITER_DFLT_DEPTH, AWRITER_DFLT_INTERVAL, AWRITER_DFLT_BYTES);
+				info->TimeSeries_Stream = -1;
 				info->sample.scaling        = 1.0;
 				info->reference.substrate = FindMaterialIndex("c-Si", NULL);
 				if (info->reference.substrate <= 0) info->reference.substrate = 1;
@@ -324,6 +424,9 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 
 			/* Reset to previous state via profile structure if available */
 			ReadProfileInfo(hdlg, info);								/* Loads parameters and modifies sample/reference */
+			TPool_SetDefaultThreads(info->fit_parms.threads);	/* Before first use of the shared pool */
+			FilmFit_SetThreadPool(info->fit, TPool_Default());
+			if ( (info->core = FMCore_Create(NULL)) != NULL) FMCore_SetMaterials(info->core, matdb, speclib);
 
 			/* Finally .. transfer parameters from INFO to the dialog box */
 			/* Autoscale and manual wavelength ranges for graph */
@@ -349,7 +452,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 			info->TimeSeries_Status = S_START;
 			info->TimeSeries_Initialized = FALSE;
 			info->TimeSeries_Count = 0;
-			strcpy_s(info->TimeSeries_Path, sizeof(info->TimeSeries_Path), "timeseries.csv");
+			strcpy_s(info->TimeSeries_Path, sizeof(info->TimeSeries_Path), "timeseries.fmts");
 			SetDlgItemText(hdlg, IDV_TIMESERIES_PATH, info->TimeSeries_Path);
 			SetDlgItemText(hdlg, IDB_TIMESERIES, "Start");
 			SetRadioButton(hdlg, IDR_TIMESERIES_REFL, IDR_TIMESERIES_RAW, IDR_TIMESERIES_REFL);
@@ -360,6 +463,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 			rcode = TRUE; break;
 
 		case WM_CLOSE:
+			StopAutoMeasure();								/* Uses the spectrometer connection */
 			if (info->spec_ok) { Shutdown_Spec_Client();	info->spec_ok = FALSE; }
 			WriteProfileInfo(hdlg, info);
 			info->hdlg = NULL;								/* Mark info structure as no longer in use */
@@ -373,14 +477,25 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				info->lambda_transferred = FALSE;
 				if (info->tfoc_reference != NULL) { free(info->tfoc_reference); info->tfoc_reference = NULL; }
 				if (info->tfoc_fit != NULL) { free(info->tfoc_fit); info->tfoc_fit = NULL; }
+				if (info->fit != NULL) { FilmFit_Free(info->fit); info->fit = NULL; }
+				if (info->core != NULL) { FMCore_Free(info->core); info->core = NULL; }
+				CloseTimeSeries(info);
+				AWriter_Free(writer);						/* Finishes any queued writes */
+				writer = NULL;
+				log_stream = -1;
 				free(info);										/* Which means we can free the structure */
 			}
 			EndDialog(hdlg,0);
 			rcode = TRUE; break;
 
-		case WM_TIMER:
-			if (wParam == TIMER_AUTO_MEASURE) {
-				if (info->spec_ok) SendMessage(hdlg, WM_COMMAND, MAKEWPARAM(IDB_MEASURE, BN_CLICKED), (LPARAM) hdlg);
+		/* Scheduler tick while there is no pipeline to feed (posted at most once) */
+		case WMP_AUTO_MEASURE:
+			InterlockedExchange(&auto_posted, 0);
+			if (scheduler == NULL) { rcode = TRUE; break; }			/* Stopped since it was posted */
+			if (info->spec_ok && info->cv_ref != NULL) {
+				StartAutoMeasure(hdlg, info);								/* Pipeline from now on, or turned off */
+			} else if (info->spec_ok) {										/* No reference yet -- measure in line */
+				SendMessage(hdlg, WM_COMMAND, MAKEWPARAM(IDB_MEASURE, BN_CLICKED), (LPARAM) hdlg);
 			}
 			rcode = TRUE; break;
 
@@ -427,6 +542,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 
 		/* Called only by CONNECT button */
 		case WMP_OPEN_SPEC:
+			StopAutoMeasure();									/* Uses the connection */
 			if (info->spec_ok) Shutdown_Spec_Client();	/* Close down cleanly */
 			info->spec_ok = FALSE;								/* Definitely no longer connected */
 			rc = Init_Spec_Client(info->spec_IP);
@@ -460,7 +576,9 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				info->npt = info->status.npoints;								/* Make sure this is still valid (may be different from a read) */
 
 				if (info->lambda != NULL) free(info->lambda);				/* Free previous copy */
+				EnterCriticalSection(&spec_lock);
 				rc = Spec_Remote_Get_Wavelengths(&npt, &info->lambda);
+				LeaveCriticalSection(&spec_lock);
 				if (rc != 0) {
 					sprintf_s(szBuf, sizeof(szBuf), "Unable to get wavelength data [rc=%d].\n\nProceed with caution.", rc);
 					MessageBox(hdlg, szBuf, "Spectrometer query failure", MB_ICONWARNING | MB_OK);
@@ -510,8 +628,12 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 
 		case WMP_LOAD_SPEC_PARMS:
 			if (info->spec_ok) {
-				if (Spec_Remote_Get_Spectrometer_Info(&info->status) != 0) {
+				EnterCriticalSection(&spec_lock);
+				rc = Spec_Remote_Get_Spectrometer_Info(&info->status);
+				LeaveCriticalSection(&spec_lock);
+				if (rc != 0) {
 					MessageBox(hdlg, "ERROR: Unable to get spectrometer information.\nClosing remote connection", "SPEC status failure", MB_ICONERROR | MB_OK);
+					StopAutoMeasure();
 					Shutdown_Spec_Client(); info->spec_ok = FALSE;
 
 				} else {			/* Output informationabout the spectrometer */
@@ -564,8 +686,12 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 		/* Just get a status and update the integration time and number of averages */
 		case WMP_UPDATE_SPEC_PARMS:
 			if (info->spec_ok) {
-				if (Spec_Remote_Get_Spectrometer_Info(&info->status) != 0) {
+				EnterCriticalSection(&spec_lock);
+				rc = Spec_Remote_Get_Spectrometer_Info(&info->status);
+				LeaveCriticalSection(&spec_lock);
+				if (rc != 0) {
 					MessageBox(hdlg, "ERROR: Unable to get spectrometer information.\nClosing remote connection", "SPEC status failure", MB_ICONERROR | MB_OK);
+					StopAutoMeasure();
 					Shutdown_Spec_Client(); 
 					info->spec_ok = FALSE;
 					SendMessage(hdlg, WMP_LOAD_SPEC_PARMS, 0, 0);	/* Disable controls */
@@ -666,8 +792,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 			stack[nlayers].nm = 100.0;			/* Doesn't matter */
 			nlayers++;
 
-			if (info->reference.tfoc != NULL) free(info->reference.tfoc);
-			info->reference.tfoc = MakeSample(nlayers, stack);
+			UpdateSample(&info->reference.tfoc, nlayers, stack);		/* Edited in place when possible */
 			info->reference.layers = nlayers;
 			rcode = TRUE; break;
 
@@ -728,8 +853,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 			stack[nlayers].nm = 100.0;			/* Doesn't matter */
 			nlayers++;
 
-			if (info->sample.tfoc != NULL) free(info->sample.tfoc);
-			info->sample.tfoc = MakeSample(nlayers, stack);
+			UpdateSample(&info->sample.tfoc, nlayers, stack);			/* Edited in place when possible */
 			info->sample.layers = nlayers;
 
 			rcode = TRUE; break;
@@ -742,7 +866,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				info->tfoc_reference = realloc(info->tfoc_reference, info->npt * sizeof(*info->tfoc_reference));
 				if (! info->reference.mirror) {
 					SendMessage(hdlg, WMP_MAKE_REFERENCE_STACK, 0, 0);
-					TFOC_GetReflData(info->reference.tfoc, 1.0, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, info->tfoc_reference);
+					FilmFit_Refl(info->fit, info->reference.tfoc, 1.0, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, info->tfoc_reference);
 				} else {
 					for (i=0; i<info->npt; i++) info->tfoc_reference[i] = 1.0;
 				}
@@ -769,29 +893,9 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 
 		case WMP_RECALC_RAW_REFLECTANCE:
 			if (info->cv_raw != NULL && info->cv_ref != NULL) {			/* Don't have to have dark */
-				double *raw, *dark, *ref;
-
 				cv = info->cv_refl = ReallocReflCurve(hdlg, info, info->cv_refl, info->npt, 0, "reflectance", colors[0]);
-				raw  = info->cv_raw->y; 
-				ref  = info->cv_ref->y; 
-				dark = (info->cv_dark != NULL) ? info->cv_dark->y : NULL ;
-				for (i=0; i<cv->npt; i++) {										/* Calculate the normalized reflectance */
-					if (dark != NULL) {
-						cv->y[i] = (raw[i]-dark[i]) / max(1.0,ref[i]-dark[i]) ;
-						cv->s[i]  = pow(1.0/max(1.0,fabs(ref[i]-dark[i])),2) * fabs(raw[i]);								/* First term in sigma^2 */
-						cv->s[i] += pow((raw[i]-dark[i])/pow(max(1.0,fabs(ref[i]-dark[i])),2),2) * fabs(ref[i]);	/* Second term in sigma^2 */
-						cv->s[i] += pow(-1.0/max(1.0,fabs(ref[i]-dark[i])) + (raw[i]-dark[i])/pow(max(1.0,fabs(ref[i]-dark[i])),2),2) * fabs(dark[i]);
-						cv->s[i] = sqrt(cv->s[i]);
-					} else {
-						cv->y[i] = raw[i] / max(1.0,ref[i]) ;
-						cv->s[i] = cv->y[i] * sqrt(1.0/max(1.0,raw[i]) + 1.0/max(1.0,ref[i]));	/* Fractional uncertainty ... no dark */
-					}
-					if (info->tfoc_reference != NULL) {							/* Scale by known reflectance of given sample */
-						cv->y[i] *= info->tfoc_reference[i];					/* Now absolute ... */
-						cv->s[i] *= info->tfoc_reference[i];					/* Also scale the uncertainty */
-					}
-					cv->y[i] = max(-1.0, min(2.0, cv->y[i]));					/* Limit so graphing clean */
-				}
+				FMCore_Reflectance(cv->npt, info->cv_raw->y, info->cv_ref->y, (info->cv_dark != NULL) ? info->cv_dark->y : NULL,
+									 info->tfoc_reference, cv->y, cv->s);
 				cv->modified = TRUE;
 			}
 			rcode = TRUE; break;
@@ -810,7 +914,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				/* Read the current parameters to create a "fit stack" and generate reflectance curve */
 				SendMessage(hdlg, WMP_MAKE_SAMPLE_STACK, 0, 0);
 				info->tfoc_fit = realloc(info->tfoc_fit, info->npt * sizeof(*info->tfoc_fit));
-				TFOC_GetReflData(info->sample.tfoc, 1.0, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, info->tfoc_fit);
+				FilmFit_Refl(info->fit, info->sample.tfoc, 1.0, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, info->tfoc_fit);
 
 				/* Create the curve with the fit for display */
 				cv = info->cv_fit = ReallocReflCurve(hdlg, info, info->cv_fit, info->npt, 4, "fit", colors[4]);
@@ -833,7 +937,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				cv->visible  = GetDlgItemCheck(hdlg, IDC_SHOW_RESIDUAL);	/* By default, don't show */
 				EnableDlgItem(hdlg, IDC_SHOW_RESIDUAL, TRUE);				/* But enable being able to show */
 
-				CalcChiSqr(info->lambda, info->cv_refl->y, info->cv_refl->s, info->tfoc_fit, info->npt, info->fit_parms.lambda_min, info->fit_parms.lambda_max, &chisqr, &dof);
+				FMCore_ChiSqr(info->lambda, info->cv_refl->y, info->cv_refl->s, info->tfoc_fit, info->npt, info->fit_parms.lambda_min, info->fit_parms.lambda_max, &chisqr, &dof);
 				SetDlgItemDouble(hdlg, IDT_CHISQR, "%.3f", sqrt(chisqr));
 				SetDlgItemInt(hdlg, IDT_DOF, dof, TRUE);
 				
@@ -841,6 +945,10 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 			}
 			rcode = TRUE; break;
 
+		case WMP_SHOW_MEASUREMENT:
+			ShowMeasurement(hdlg, info, (MEASUREMENT *) lParam);
+			rcode = TRUE; break;
+
 		case WMP_DO_FIT:
 			SendMessage(hdlg, WMP_MAKE_SAMPLE_STACK, 0, 0);				/* Has all data for moment */
 			SendMessage(hdlg, WMP_RECALC_RAW_REFLECTANCE, 0, 0);		/* Raw ignores "scaling" correction (processed differently in fit) */
@@ -854,7 +962,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				if (info->sample.vary[i]) info->sample.nm[i] = info->sample.stack[ilayer].nm;
 				ilayer++; nvary++;
 			}
-			CalcChiSqr(info->lambda, info->cv_refl->y, info->cv_refl->s, info->tfoc_fit, info->npt, info->fit_parms.lambda_min, info->fit_parms.lambda_max, &chisqr, &dof);
+			FMCore_ChiSqr(info->lambda, info->cv_refl->y, info->cv_refl->s, info->tfoc_fit, info->npt, info->fit_parms.lambda_min, info->fit_parms.lambda_max, &chisqr, &dof);
 			chisqr = chisqr*dof/max(1,dof-nvary);							/* Correct for # of free parameters */
 			dof -= nvary;
 			SetDlgItemDouble(hdlg, IDT_CHISQR, "%.3f", sqrt(chisqr));
@@ -941,11 +1049,13 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				case IDB_INITIALIZE_SPEC:
 					if (BN_CLICKED == wNotifyCode) {
 						if (info->spec_ok) {
+							StopAutoMeasure();
 							Shutdown_Spec_Client();	info->spec_ok = FALSE;
 						} else {
 							SendMessage(hdlg, WMP_OPEN_SPEC, 0, 0);
 						}
 						SendMessage(hdlg, WMP_LOAD_SPEC_PARMS, 0, 0);	/* Enables/disables controls */
+						if (info->spec_ok && GetDlgItemCheck(hdlg, IDC_AUTOMEASURE)) StartAutoMeasure(hdlg, info);
 					}
 					rcode = TRUE; break;
 
@@ -987,7 +1097,9 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 							rc = Acquire_Raw_Spectrum(hdlg, info, &spectrum_info, &data);
 							npt = info->npt;
 						} else {
+							EnterCriticalSection(&spec_lock);
 							rc = Spec_Remote_Grab_Saved(SPEC_SPECTRUM_REFERENCE, &data, &npt);
+							LeaveCriticalSection(&spec_lock);
 						}
 						if (rc != 0) {
 							Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
@@ -1014,7 +1126,9 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 							rc = Acquire_Raw_Spectrum(hdlg, info, &spectrum_info, &data);
 							npt = info->npt;
 						} else {
+							EnterCriticalSection(&spec_lock);
 							rc = Spec_Remote_Grab_Saved(SPEC_SPECTRUM_DARK, &data, &npt);
+							LeaveCriticalSection(&spec_lock);
 						}
 						if (rc != 0) {
 							Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
@@ -1037,11 +1151,14 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				case IDB_MEASURE_TEST:
 					if (BN_CLICKED == wNotifyCode) {
 						if (! info->lambda_transferred) SendMessage(hdlg, WMP_LOAD_SPEC_WAVELENGTHS, 0, 0);
+						info->last_fit.valid = FALSE;								/* Until this measurement is fit */
 						if (wID == IDB_MEASURE) {
 							rc = Acquire_Raw_Spectrum(hdlg, info, &spectrum_info, &data);
 							npt = info->npt;
 						} else {
+							EnterCriticalSection(&spec_lock);
 							rc = Spec_Remote_Grab_Saved((wID == IDB_MEASURE_RAW) ? SPEC_SPECTRUM_RAW : SPEC_SPECTRUM_TEST, &data, &npt);
+							LeaveCriticalSection(&spec_lock);
 						}
 						if (rc != 0) {
 							Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
@@ -1064,73 +1181,13 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 							enable = FALSE;														/* Do we need to do a sample structure update? */
 							for (i=0; i<N_FILM_STACK; i++) {
 								if (! info->sample.vary[i]) continue;
-								rval = info->sample.nm[i];
-								lower = info->sample.tmin[i];
-								upper = info->sample.tmax[i];
-								if (upper <= lower) {											/* Might as well verify values here also */
-									lower = max(0,lower);										/* Make sure it is positive */
-									upper = max(upper, max(2.0*lower, 10.0));				/* Upper */
-									enable = TRUE;
-								}
-								delta = upper-lower;
-								if (rval-lower < 0.2*delta) {
-									info->sample.tmin[i] = max(0, rval-0.2*delta);		/* Extend downward potentially to zero */
-									enable = TRUE;
-								}
-								if (upper-rval < 0.2*delta) {
-									info->sample.tmax[i] = rval + 0.2*delta;				/* Give 20% headroom */
-									enable = TRUE;
-								}
+								if (FMCore_AdjustRange(info->sample.nm[i], &info->sample.tmin[i], &info->sample.tmax[i])) enable = TRUE;
 							}
 							if (enable) SendMessage(hdlg, WMP_SHOW_SAMPLE_STRUCTURE, 0,0);
 						}
 
-						if (info->TimeSeries_Status == S_PAUSE && info->cv_refl != NULL) {
-							if ( fopen_s(&funit, info->TimeSeries_Path, info->TimeSeries_Initialized ? "a" : "w") != 0) {
-								fprintf(stderr, "Failed to open the file\n"); fflush(stderr);
-							} else {
-								if (! info->TimeSeries_Initialized) {
-									fprintf(funit, "# Line 1 = reference, Line 2 = dark, Line 3 = reference reflectance, Line 4 = lambda, Line n... data\n");
-
-									/* Save the reference counts */
-									fprintf(funit, "%lld", time(NULL));
-									for (i=0; i<info->npt; i++) fprintf(funit, ",%.1f",info->cv_ref->y[i]);
-									fprintf(funit, "\n");
-
-									/* Save the dark (background) data */
-									fprintf(funit, "%lld", time(NULL));
-									for (i=0; i<info->npt; i++) fprintf(funit, ",%.1f",(info->cv_dark != NULL) ? info->cv_dark->y[i] : 0.0);
-									fprintf(funit, "\n");
-
-									/* Save the reference counts */
-									fprintf(funit, "%lld", time(NULL));
-									for (i=0; i<info->npt; i++) fprintf(funit, ",%.3f",info->tfoc_reference[i]);
-									fprintf(funit, "\n");
-
-									/* Save the wavelength data */
-									fprintf(funit, "%lld", time(NULL));
-									for (i=0; i<info->npt; i++) fprintf(funit, ",%.3f",info->lambda[i]);
-									fprintf(funit, "\n");
-
-									EnableDlgItem(hdlg, IDR_TIMESERIES_REFL, FALSE);		/* Don't allow it to be changed from now on */
-									EnableDlgItem(hdlg, IDR_TIMESERIES_RAW,  FALSE);
-									info->TimeSeries_Initialized = TRUE;
-								}
-
-								/* Write either raw or reflectance curve (corrected by ref/dark) */
-								fprintf(funit, "%lld", time(NULL));
-								if (GetRadioButton(hdlg, IDR_TIMESERIES_REFL, IDR_TIMESERIES_RAW) == IDR_TIMESERIES_REFL) {
-									for (i=0; i<info->npt; i++) fprintf(funit, ",%.4f",info->cv_refl->y[i]);
-								} else {
-									for (i=0; i<info->npt; i++) fprintf(funit, ",%.4f",info->cv_raw->y[i]);
-								}
-								fprintf(funit, "\n");
-								fclose(funit);
-
-								info->TimeSeries_Count++;
-								SetDlgItemInt(hdlg, IDT_TIMESERIES_COUNT, info->TimeSeries_Count, FALSE);
-							}
-						}
+						/* Time series -- header once, then one record per measurement on the open file */
+						RecordTimeSeries(hdlg, info, Sched_Clock());
 					}
 					rcode = TRUE; break;
 
@@ -1450,21 +1507,18 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 					rcode = TRUE; break;
 
 				case IDV_MEASURE_DELAY:
-					if (EN_KILLFOCUS == wNotifyCode && GetDlgItemCheck(hdlg, IDC_AUTOMEASURE)) {
-						ms = 1000*GetDlgItemIntEx(hdlg, IDV_MEASURE_DELAY);		/* Convert to ms */
-						if (ms <= 1000) { ms = 1000; SetDlgItemText(hdlg, IDV_MEASURE_DELAY, "1"); }
-						SetTimer(hdlg, TIMER_AUTO_MEASURE, ms, NULL);				/* Update spectrometer parameters seconds (if live) */
+					if (EN_KILLFOCUS == wNotifyCode) {
+						period = AutoMeasurePeriod(hdlg);									/* Also cleans up the entry */
+						if (scheduler != NULL) Sched_SetPeriod(scheduler, (pipeline != NULL) ? period : max(period, 1.0));
 					}
 					rcode = TRUE; break;
 
 				case IDC_AUTOMEASURE:
 					if (BN_CLICKED == wNotifyCode) {
-						if (GetDlgItemCheck(hdlg, wID)) {									/* Enable ... start timer */
-							ms = 1000*GetDlgItemIntEx(hdlg, IDV_MEASURE_DELAY);		/* Convert to ms */
-							if (ms <= 1000) { ms = 1000; SetDlgItemText(hdlg, IDV_MEASURE_DELAY, "1"); }
-							SetTimer(hdlg, TIMER_AUTO_MEASURE, 1000, NULL);				/* Update spectrometer parameters seconds (if live) */
+						if (GetDlgItemCheck(hdlg, wID)) {
+							StartAutoMeasure(hdlg, info);										/* Else measured in line each second */
 						} else {
-							KillTimer(hdlg, TIMER_AUTO_MEASURE);
+							StopAutoMeasure();
 						}
 					}
 					rcode = TRUE; break;
@@ -1475,6 +1529,8 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 						switch (info->TimeSeries_Status) {
 							case S_START:								/* Waiting to start */
 								info->TimeSeries_Initialized = FALSE;
+								CloseTimeSeries(info);
+								AWriter_Sync(writer);								/* Previous series fully on disk before reuse */
 								if (_stat(info->TimeSeries_Path, &statbuf) == 0) {
 									sprintf_s(szBuf, sizeof(szBuf), "\"%s\" exists.\nAre you sure you want to overwrite this file?", info->TimeSeries_Path);
 									if (MessageBox(hdlg, szBuf, "TimeSeries Overwrite", MB_OKCANCEL | MB_ICONWARNING | MB_DEFBUTTON2) != IDOK) break;
@@ -1529,6 +1585,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 							EnableDlgItem(hdlg, IDR_TIMESERIES_REFL, TRUE);
 							EnableDlgItem(hdlg, IDR_TIMESERIES_RAW,  TRUE);
 							info->TimeSeries_Initialized = FALSE;
+							CloseTimeSeries(info);
 							info->TimeSeries_Status = S_START;
 							info->TimeSeries_Count = 0;
 						}
@@ -1546,6 +1603,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 							EnableDlgItem(hdlg, IDR_TIMESERIES_REFL, TRUE);
 							EnableDlgItem(hdlg, IDR_TIMESERIES_RAW,  TRUE);
 							info->TimeSeries_Initialized = FALSE;
+							CloseTimeSeries(info);
 							info->TimeSeries_Status = S_START;
 							info->TimeSeries_Count = 0;
 						}
@@ -1555,6 +1613,7 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 				case IDB_TIMESERIES_RESET:
 					if (BN_CLICKED == wNotifyCode) {
 						info->TimeSeries_Initialized = FALSE;
+						CloseTimeSeries(info);
 						info->TimeSeries_Count = 0;
 						SetDlgItemText(hdlg, IDT_TIMESERIES_COUNT, "0");
 						EnableDlgItem(hdlg, IDR_TIMESERIES_REFL, TRUE);
@@ -1591,6 +1650,8 @@ INT_PTR CALLBACK MainDlgProc(HWND hdlg, UINT msg, WPARAM wParam, LPARAM lParam)
 					break;
 			}
 
+			/* Settings changed -- automatic measurement continues on a new snapshot */
+			if (scheduler != NULL && pipeline != NULL && PipelineStale(hdlg, info)) StartAutoMeasure(hdlg, info);
 			return rcode;
 	}
 
@@ -1789,7 +1850,10 @@ static int Acquire_Raw_Spectrum(HWND hdlg, FILM_MEASURE_INFO *info, SPEC_SPECTRU
 	char szBuf[256];
 
 	if (! info->spec_ok) return 1;				/* Must have a spectrometer */
-	if ( (rc = Spec_Remote_Acquire_Spectrum(spectrum_info, data)) != 0) {
+	EnterCriticalSection(&spec_lock);			/* Acquire, info and data exchanges as one */
+	rc = Spec_Remote_Acquire_Spectrum(spectrum_info, data);
+	LeaveCriticalSection(&spec_lock);
+	if (rc != 0) {
 		sprintf_s(szBuf, sizeof(szBuf), "Failed to acquire a spectrum from remote source [rc=%d]", rc);
 		MessageBox(hdlg, szBuf, "Spectrum acquisition failure", MB_ICONERROR | MB_OK);
 		return 2;
@@ -1820,12 +1884,12 @@ static int QueryTimeSeriesFile(HWND hdlg, char *path, int pathlen) {
 	char pathname[1024];											/* Pathname - save for multiple calls */
 
 	/* Do we have a specified filename?  If not, query via dialog box */
-	strcpy_m(pathname, sizeof(pathname), "timeseries.csv");	/* Pathname must be initialized with a value */
+	strcpy_m(pathname, sizeof(pathname), "timeseries.fmts");	/* Pathname must be initialized with a value */
 	memset(&ofn, 0, sizeof(ofn));						/* Not static, must be set to zeros */
 	ofn.lStructSize       = sizeof(OPENFILENAME);
 	ofn.hwndOwner         = hdlg;
 	ofn.lpstrTitle        = "TimeSeries Filename";
-	ofn.lpstrFilter       = "Excel csv file (*.csv)\0*.csv\0All files (*.*)\0*.*\0\0";
+	ofn.lpstrFilter       = "Binary time series (*.fmts)\0*.fmts\0Excel csv file (*.csv)\0*.csv\0All files (*.*)\0*.*\0\0";
 	ofn.lpstrCustomFilter = NULL;
 	ofn.nMaxCustFilter    = 0;
 	ofn.nFilterIndex      = 1;
@@ -1833,7 +1897,7 @@ static int QueryTimeSeriesFile(HWND hdlg, char *path, int pathlen) {
 	ofn.nMaxFile          = sizeof(pathname);
 	ofn.lpstrFileTitle    = NULL;						/* Partial path */
 	ofn.nMaxFileTitle     = 0;
-	ofn.lpstrDefExt       = "csv";
+	ofn.lpstrDefExt       = "fmts";
 	ofn.lpstrInitialDir   = (*local_dir=='\0' ? NULL : local_dir);
 	ofn.Flags = OFN_LONGNAMES | OFN_NOCHANGEDIR | OFN_HIDEREADONLY;
 
@@ -2316,6 +2380,20 @@ static int WriteProfileInfo(HWND hdlg, FILM_MEASURE_INFO *info) {
 	WritePrivateProfileStr("Fit", "Lambda_Range", szBuf, IniFile);
 	sprintf_s(szBuf, sizeof(szBuf), "%g %g", info->fit_parms.scaling_min, info->fit_parms.scaling_max);
 	WritePrivateProfileStr("Fit", "Scaling_Range", szBuf, IniFile);
+	WritePrivateProfileInt("Fit", "Analytic_Derivatives", info->fit_parms.analytic_deriv, IniFile);
+	WritePrivateProfileInt("Fit", "Variable_Projection", info->fit_parms.varpro, IniFile);
+	WritePrivateProfileInt("Fit", "Broyden", info->fit_parms.broyden, IniFile);
+	WritePrivateProfileInt("Fit", "Geodesic_Acceleration", info->fit_parms.geodesic, IniFile);
+	WritePrivateProfileInt("Fit", "Nielsen_Damping", info->fit_parms.nielsen, IniFile);
+	WritePrivateProfileInt("Fit", "Threads", info->fit_parms.threads, IniFile);
+	WritePrivateProfileInt("Fit", "Multistart", info->fit_parms.multistart, IniFile);
+	sprintf_s(szBuf, sizeof(szBuf), "%g", info->fit_parms.multistart_budget);
+	WritePrivateProfileStr("Fit", "Multistart_Budget", szBuf, IniFile);
+	WritePrivateProfileInt("Fit", "Warm_Start", info->fit_parms.warm_start, IniFile);
+	WritePrivateProfileInt("Fit", "Multires_Levels", info->fit_parms.multires, IniFile);
+	WritePrivateProfileStr("Fit", "Spectral_Library", speclib_path, IniFile);
+	WritePrivateProfileInt("Database", "Use_Compiled", use_compiled_db, IniFile);
+	WritePrivateProfileStr("Measure", "Overrun", auto_overrun == SCHED_SKIP ? "Skip" : auto_overrun == SCHED_QUEUE ? "Queue" : "Coalesce", IniFile);
 
 	/* Save the current reference film stack */
 	for (i=0; i<N_FILM_STACK; i++) {
@@ -2402,16 +2480,25 @@ static int ReadProfileInfo(HWND hdlg, FILM_MEASURE_INFO *info) {
 	GetPrivateProfileString("Graph", "Lambda_Autoscale", NULL, szBuf, sizeof(szBuf), IniFile);
 	if (*szBuf != '\0') info->lambda_autoscale = strtol(szBuf, NULL, 10) != 0;
 
-	/* Fitting parameters */
-	GetPrivateProfileString("Fit", "Lambda_Range", NULL, szBuf, sizeof(szBuf), IniFile);
-	if (*szBuf != '\0') {
-		info->fit_parms.lambda_min = strtod(szBuf, &aptr);
-		info->fit_parms.lambda_max = strtod(aptr, NULL);
+	/* Fitting parameters -- defaults and keys shared with fmfit (recipe.c) */
+	LoadFitControls(info, IniFile);
+
+	/* Spectral library for a fixed recipe (built offline by mkspeclib) */
+	SpecLib_Close(speclib);
+	speclib = NULL;
+	if (*speclib_path != '\0' && (speclib = SpecLib_Open(speclib_path)) != NULL) {
+		fprintf(stderr, "Using spectral library: \"%s\"\n", speclib_path); fflush(stderr);
 	}
-	GetPrivateProfileString("Fit", "Scaling_Range", NULL, szBuf, sizeof(szBuf), IniFile);
-	if (*szBuf != '\0') {
-		info->fit_parms.scaling_min = strtod(szBuf, &aptr);
-		info->fit_parms.scaling_max = strtod(aptr, NULL);
+	FilmFit_SetLibrary(info->fit, speclib);
+
+	/* What automatic measurement does with deadlines an acquisition overran */
+	GetPrivateProfileString("Measure", "Overrun", NULL, szBuf, sizeof(szBuf), IniFile);
+	if (_stricmp(szBuf, "Skip") == 0) {
+		auto_overrun = SCHED_SKIP;
+	} else if (_stricmp(szBuf, "Queue") == 0) {
+		auto_overrun = SCHED_QUEUE;
+	} else if (_stricmp(szBuf, "Coalesce") == 0) {
+		auto_overrun = SCHED_COALESCE;
 	}
 
 	/* Load the reference film stack */
@@ -2475,19 +2562,55 @@ static int ReadProfileInfo(HWND hdlg, FILM_MEASURE_INFO *info) {
 -- Inputs: none
 --
 -- Output: Creates the static global materials[] structure 
+--         Opens the compiled database (matdb) if present and enabled
 --
 -- Return: Number of entries, or <0 on error
+--
+-- Notes: If the directory contains a compiled database (MATDB_FILENAME,
+--        created by nkcompile) the list comes from it and the native
+--        engine takes n,k from the mapped tables.  Disable with
+--        [Database] Use_Compiled=0 in the ini file.  The compiled file
+--        must be rebuilt whenever the text database changes.
 =========================================================================== */
 static int InitMaterialsList(void) {
 	char *database;
 	char pattern[PATH_MAX+1];
 	char path[PATH_MAX+1];
+	char szBuf[256];
 	intptr_t hdir;								/* Directory handle */
 	struct _finddata_t findbuf;			/* Information from FindFirst		*/
+	size_t len;
+	int i;
 
 	database = Find_TFOC_Database(NULL, 0, NULL);
 	fprintf(stderr, "Using database: \"%s\"\n", database); fflush(stderr);
 
+	/* Try the compiled database first */
+	GetPrivateProfileString("Database", "Use_Compiled", NULL, szBuf, sizeof(szBuf), IniFile);
+	if (*szBuf != '\0') use_compiled_db = strtol(szBuf, NULL, 10) != 0;
+	if (use_compiled_db && matdb == NULL && database != NULL) {
+		len = strlen(database);
+		sprintf_s(path, sizeof(path), "%s%s%s", database, (len > 0 && strchr("/\\", database[len-1]) != NULL) ? "" : "/", MATDB_FILENAME);
+		if ( (matdb = MatDB_Open(path)) != NULL) {
+			fprintf(stderr, "Using compiled database: \"%s\" (%d materials)\n", path, MatDB_Count(matdb)); fflush(stderr);
+		}
+	}
+	if (matdb != NULL) {
+		materials_cnt = 0;
+		if (materials_dim < MatDB_Count(matdb)+1) {
+			materials_dim = MatDB_Count(matdb)+1;
+			materials = realloc(materials, materials_dim * sizeof(*materials));
+		}
+		materials[materials_cnt].id = "none"; 	materials[materials_cnt++].value = 0;		/* Always the first one */
+		for (i=0; i<MatDB_Count(matdb); i++) {
+			materials[materials_cnt].id = MatDB_Material(matdb, i)->name;					/* Mapping stays open */
+			materials[materials_cnt].value = materials_cnt;
+			materials_cnt++;
+		}
+		BuildMaterialIndex();
+		return materials_cnt;
+	}
+
 	if (_fullpath(path, database, sizeof(path)) == NULL) {
 		fprintf(stderr, "Directory does not exist\n"); fflush(stderr);
 		return -1;
@@ -2521,9 +2644,67 @@ static int InitMaterialsList(void) {
 	} while (_findnext(hdir, &findbuf) == 0);
 	_findclose(hdir);
 
+	BuildMaterialIndex();
 	return materials_cnt;
 }
 
+/* ===========================================================================
+-- Build the hash index and interned handles for the materials[] list
+--
+-- Usage: int BuildMaterialIndex(void);
+--
+-- Return: 0 if successful, !0 on memory failure (lookups then fall back to
+--         a linear scan and unresolved materials)
+=========================================================================== */
+static int BuildMaterialIndex(void) {
+	static char *rname = "BuildMaterialIndex";
+	int i;
+
+	NameHash_Free(material_index); material_index = NULL;
+	if (material_handles != NULL) free(material_handles);
+
+	if ( (material_handles = calloc(materials_cnt, sizeof(*material_handles))) == NULL ||
+		  (material_index = NameHash_Create(materials_cnt)) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate material index\n", rname); fflush(stderr);
+		if (material_handles != NULL) { free(material_handles); material_handles = NULL; }
+		return 1;
+	}
+
+	for (i=0; i<materials_cnt; i++) {
+		material_handles[i].name  = materials[i].id;
+		material_handles[i].index = i;
+		if (NameHash_Add(material_index, materials[i].id, material_handles+i) < 0) {
+			NameHash_Free(material_index); material_index = NULL;
+			return 2;
+		}
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Return the TFOC material for a name, calling TFOC_FindMaterial only the
+-- first time a given material is used
+--
+-- Usage: TFOC_MATERIAL *ResolveMaterial(char *name, char *database);
+--
+-- Inputs: name     - material name (case insensitive)
+--         database - database directory for TFOC_FindMaterial
+--
+-- Return: TFOC material, or NULL if it cannot be found
+=========================================================================== */
+static TFOC_MATERIAL *ResolveMaterial(char *name, char *database) {
+	MATERIAL_HANDLE *handle;
+
+	if ( (handle = NameHash_Find(material_index, name)) == NULL) {
+		return TFOC_FindMaterial(name, database);						/* Not listed -- let TFOC decide */
+	}
+	if (! handle->tfoc_tried) {
+		handle->tfoc = TFOC_FindMaterial(handle->name, database);
+		handle->tfoc_tried = TRUE;
+	}
+	return handle->tfoc;
+}
+
 /* ===========================================================================
 -- Routine to look up a material by name and return the index in the
 -- CB_INT_LIST so can be loaded properly
@@ -2542,6 +2723,7 @@ static int InitMaterialsList(void) {
 static int FindMaterialIndex(char *text, char **endptr) {
 	int i, cnt;
 	char *bptr, id[200];				/* For the name */
+	MATERIAL_HANDLE *handle;
 
 	/* Copy over the string, expecting that it is "enclosed" in quotes */
 	while (isspace(*text)) text++;
@@ -2564,7 +2746,10 @@ static int FindMaterialIndex(char *text, char **endptr) {
 	while (isspace(*text)) text++;
 	if (endptr != NULL) *endptr = text;
 
-	/* Scan through the list of all materials I've loaded */
+	/* Hash lookup; linear scan only if the index could not be built */
+	if (material_index != NULL) {
+		return ( (handle = NameHash_Find(material_index, id)) != NULL) ? handle->index : -1;
+	}
 	for (i=0; i<materials_cnt; i++) {
 		if (_stricmp(materials[i].id, id) == 0) return i;
 	}
@@ -2674,7 +2859,7 @@ int AddSimpleLayer(TFOC_SAMPLE **psample, char *material, double nm) {
 
 		/* Incident media is air, and second layer is EOS (nothing yet) */
 		strcpy_s(sample[0].name, sizeof(sample[0].name), "air");
-		if ( (sample[0].material = TFOC_FindMaterial("air", database)) == NULL) {
+		if ( (sample[0].material = ResolveMaterial("air", database)) == NULL) {
 			fprintf(stderr, "Didn't recognize air ... real problem\n");
 			fflush(stderr);
 		}
@@ -2695,7 +2880,7 @@ int AddSimpleLayer(TFOC_SAMPLE **psample, char *material, double nm) {
 	strcpy_s(sample[i].name, sizeof(sample[i].name), material);
 	sample[i].z = nm;
 	sample[i].type = SUBSTRATE;						/* Changed to SUBLAYER if another added */
-	if ( (sample[i].material = TFOC_FindMaterial(sample[i].name, database)) == NULL) {
+	if ( (sample[i].material = ResolveMaterial(sample[i].name, database)) == NULL) {
 		fprintf(stderr, "ERROR: Unable to locate %s in the materials database directory\n", sample[i].name); fflush(stderr);
 		if (i != 1) sample[i-1].type = SUBSTRATE;
 		sample[i].type = EOS;
@@ -2722,504 +2907,681 @@ TFOC_SAMPLE *MakeSample(int nlayers, FILM_LAYERS *films) {
 }
 
 /* ===========================================================================
--- Routine to calculate the theoretical reflectance (with possible correction for fitting work)
---
--- Usage: int TFOC_GetReflData(TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, double temperature, int npt, double *lambda, double *refl);
---
--- Inputs: sample  - pointer to TFOC_SAMPLE structure describing the film stack
---         scaling - scaling factor that ultimately will be applied to data, but here *divides* the calculated reflectance
---                   for production, this should be 1.0 giving exact values
---                   A value of 1.2 would normally scale up experimental data by a factor of 1.2
---                     but in this routine scales down the calculated reflectivity by the same 1.2
---                   This permits comparison of raw data to calculations in fit
---         theta - angle of incidence
---         polarization - obvious
---         temperature  - obvious
---         npt - number of points in the data set
---         lambda - pointer to existing wavelengths to be processed
---         refl   - pointer to array to be filled with reflectance values
---
--- Output: *refl - filled with reflectance at each of the given wavelengths
---
--- Return: 0 if successful
+-- Bring an existing sample structure up to date with a film stack, editing
+-- it in place rather than rebuilding it
+--
+-- Usage: void UpdateSample(TFOC_SAMPLE **psample, int nlayers, FILM_LAYERS *films);
+--
+-- Inputs: psample - pointer to current sample (*psample may be NULL)
+--         nlayers - number of entries in films (last is the substrate)
+--         films   - film stack as for MakeSample()
+--
+-- Output: *psample - updated (or replaced) sample structure
+--
+-- Notes: With the same number of layers, a thickness edit only stores z and
+--        a material change only re-resolves that layer.  The array, and so
+--        the material pointers seen by the n,k and transfer-matrix caches,
+--        stays the same across measurements while the recipe is unchanged.
+--        Any other change (or a material that cannot be resolved) falls
+--        back to MakeSample().
 =========================================================================== */
-int TFOC_GetReflData(TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, double temperature, int npt, double *lambda, double *refl) {
+static void UpdateSample(TFOC_SAMPLE **psample, int nlayers, FILM_LAYERS *films) {
+	static char *database = NULL;
+	TFOC_SAMPLE *sample;
+	TFOC_MATERIAL *material;
+	int i, cnt;
 
-	int i,j;
-	int nlayers;							/* Number of layers			*/
-
-	/* Fresnel calculation layers and number */
-	/* Variables that are retained after created first time */
-	static TFOC_LAYER *layers = NULL;			/* Layers for Fresnel calc	*/
-	static int dim_layers = 0;						/* How many layers are we able to handle (avoid allocating each time) */
-
-	/* On subsequent runs, if SampleFile is NULL, use last values */
-	if (sample == NULL) {
-		fprintf(stderr, "Must have a sample structure\n"); fflush(stderr);
-		return -2;
-	}
-
-	/* ----------------------------------------------------------
-	-- Pre-process sample structure - don't have temperature yet
-	-- Identify the material database information and
-	-- at the same time, figure out how big the actual layer
-	-- array will need to be given expansion of profiles, etc.
-	---------------------------------------------------------- */
-	nlayers = 0;
-	for (i=0; sample[i].type != EOS; i++) {
-		switch (sample[i].doping_profile) {
-			case NO_DOPING:
-			case CONSTANT:
-				nlayers++;
-				break;
-			case EXPONENTIAL:
-			case LINEAR_IMPLANT:
-			case LINEAR:
-				nlayers += sample[i].doping_layers;
-		}
-	}
+	sample = *psample;
 
-	/* Make sure that we have space for the needed number of layers */
-	/* But keep static so can be reused each time without multiple allocations */
-	if (nlayers > dim_layers) {
-		dim_layers = nlayers+1;
-		layers = realloc(layers, dim_layers*sizeof(*layers));				/* Allocate space (one extra for safety) for layers */
-		memset(layers, 0, dim_layers*sizeof(*layers));
+	/* Same layer count (air + nlayers) is required to edit in place */
+	cnt = 0;
+	if (sample != NULL) for (cnt=0; cnt <= nlayers && sample[cnt].type != EOS; cnt++) ;
+	if (sample == NULL || cnt != nlayers+1 || sample[cnt].type != EOS) {
+		if (sample != NULL) free(sample);
+		*psample = MakeSample(nlayers, films);
+		return;
 	}
 
-	/* ----------------------------------------------------------
-	-- Okay, run the wavelengths.  Each time need to get the NK
-	-- values for each layer in the sample.  And then generate
-   -- the layer structure for running TFOC_ReflN
-	---------------------------------------------------------- */
-	for (i=0; i<npt; i++) {
-		for (j=0; sample[j].type != EOS; j++) {
-			sample[j].n = TFOC_FindNK(sample[j].material, lambda[i]);
+	if (database == NULL) database = Find_TFOC_Database(NULL, 0, NULL);
+
+	for (i=0; i<nlayers; i++) {
+		if (_stricmp(sample[i+1].name, films[i].material) != 0) {
+			if ( (material = ResolveMaterial(films[i].material, database)) == NULL) {
+				free(sample);
+				*psample = MakeSample(nlayers, films);							/* Reports the error as before */
+				return;
+			}
+			strcpy_s(sample[i+1].name, sizeof(sample[i+1].name), films[i].material);
+			sample[i+1].material = material;
 		}
-		TFOC_MakeLayers(sample, layers, temperature, lambda[i]);
-		refl[i] = TFOC_ReflN(theta, mode, lambda[i], layers).R / scaling;
+		sample[i+1].z = films[i].nm;
 	}
-
-	return 0;
+	return;
 }
 
-
 /* ===========================================================================
--- Routine to calculate the reduced chi-square for the fit to
--- experimental reflectivity data
---
--- Usage: int CalcChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof);
+-- Record the current measurement in the time series (if one is running)
 --
--- Inputs: x    - x values (need for xmin,xmax limits)
---         y    - experimental reflectivity values 
---         s    - uncertainty estimate for the reflectivity values
---         yfit - fit value at each point
---         npt  - number of points in the data set
---         xmin,xmax - range of wavelengths to include in the calculation
---                     if xmax <= xmin, full range will be used
---         pchisqr - pointer to receive reduced chi-square value
---         pdof - number of degrees of freedom (# points used -1)
+-- Usage: void RecordTimeSeries(HWND hdlg, FILM_MEASURE_INFO *info, double when);
 --
--- Output: if not NULL, *pchisqr and *pdof set to appropriate values
+-- Inputs: when - wall clock of the measurement (Sched_Clock)
 --
--- Return: 0 if no errors
+-- Notes: The file is started (header) at the first measurement.  Records
+--        hold the raw or reflectance curve and info->last_fit if it is
+--        valid, and are queued on the background writer.
 =========================================================================== */
-static int CalcChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof) {
-	double chisqr;
-	int i, dof;
-
-	chisqr = 0;
-	dof = 0;
-	for (i=0; i<npt; i++) {
-		if (x[i] < xmin || x[i] > xmax) continue;
-		chisqr += pow(y[i]-yfit[i],2)/pow(s[i],2);
-		dof++;
-	}
-	if (dof >= 2) chisqr /= (dof-1);
-	if (pchisqr != NULL) *pchisqr = chisqr;
-	if (pdof    != NULL) *pdof    = dof;
-	return 0;
+static void RecordTimeSeries(HWND hdlg, FILM_MEASURE_INFO *info, double when) {
+	int i;
+
+	if (info->TimeSeries_Status == S_PAUSE && info->cv_refl != NULL) {
+		if (! info->TimeSeries_Initialized) {
+			char names[2*N_FILM_STACK+3][TSERIES_NAME_LENGTH], *pnames[2*N_FILM_STACK+3];
+			int nfit;
+
+			/* Name the fit values as do_fit() lays them out */
+			for (i=nfit=0; i<info->sample.layers; i++) {
+				if (! info->sample.stack[i].vary) continue;
+				sprintf_s(names[nfit++], TSERIES_NAME_LENGTH, "%.24s", info->sample.stack[i].layer_name);
+				sprintf_s(names[nfit++], TSERIES_NAME_LENGTH, "%.24s_sigma", info->sample.stack[i].layer_name);
+			}
+			strcpy_s(names[nfit++], TSERIES_NAME_LENGTH, "scaling");
+			strcpy_s(names[nfit++], TSERIES_NAME_LENGTH, "scaling_sigma");
+			strcpy_s(names[nfit++], TSERIES_NAME_LENGTH, "chisqr");
+			for (i=0; i<nfit; i++) pnames[i] = names[i];
+
+			CloseTimeSeries(info);
+			info->TimeSeries_File = TSeries_Encoder(info->TimeSeries_Path, info->npt, info->cv_ref->y, (info->cv_dark != NULL) ? info->cv_dark->y : NULL,
+																 info->tfoc_reference, info->lambda,
+																 GetRadioButton(hdlg, IDR_TIMESERIES_REFL, IDR_TIMESERIES_RAW) == IDR_TIMESERIES_RAW,
+																 nfit, pnames, sizeof(float), time(NULL));
+			if (info->TimeSeries_File != NULL && (info->TimeSeries_Stream = AWriter_Open(writer, info->TimeSeries_Path, "wb")) < 0) {
+				TSeries_Close(info->TimeSeries_File);
+				info->TimeSeries_File = NULL;
+			}
+			if (info->TimeSeries_File != NULL) {
+				void *bytes;
+				size_t len;
+				TSeries_EncodeHeader(info->TimeSeries_File, &bytes, &len);
+				AWriter_Write(writer, info->TimeSeries_Stream, bytes, len);
+				EnableDlgItem(hdlg, IDR_TIMESERIES_REFL, FALSE);		/* Don't allow it to be changed from now on */
+				EnableDlgItem(hdlg, IDR_TIMESERIES_RAW,  FALSE);
+				info->TimeSeries_NFit = nfit;
+				info->TimeSeries_Initialized = TRUE;
+			}
+		}
+
+		/* Write either raw or reflectance curve (corrected by ref/dark) */
+		if (info->TimeSeries_File == NULL) {
+			fprintf(stderr, "Failed to open the file\n"); fflush(stderr);
+		} else {
+			double *y, *fit;
+			void *bytes;
+			size_t len;
+			y   = (GetRadioButton(hdlg, IDR_TIMESERIES_REFL, IDR_TIMESERIES_RAW) == IDR_TIMESERIES_REFL) ? info->cv_refl->y : info->cv_raw->y;
+			fit = (info->last_fit.valid && info->last_fit.nvalues == info->TimeSeries_NFit) ? info->last_fit.value : NULL;
+			if (TSeries_EncodeRecord(info->TimeSeries_File, when, fit, y, &bytes, &len) != 0 ||
+				 AWriter_Write(writer, info->TimeSeries_Stream, bytes, len) != 0) {
+				fprintf(stderr, "Failed to write to the time series file\n"); fflush(stderr);
+			} else {
+				info->TimeSeries_Count++;
+				SetDlgItemInt(hdlg, IDT_TIMESERIES_COUNT, info->TimeSeries_Count, FALSE);
+			}
+		}
+	}
+	return;
 }
 
+/* ===========================================================================
+-- Close the time series being written (header and records are queued on
+-- the writer, which closes the file after the last of them)
+=========================================================================== */
+static void CloseTimeSeries(FILM_MEASURE_INFO *info) {
 
-/* ============================================================================
--- func_eval - Fill in YFIT with value of function
---
--- Usage: logical = func_eval(x,yfit,npt)
---
--- Inputs: X   - Array of X points
---         NPT - Number of points to be evaluated
---
--- Common: equation - Definition of the equation to be fit
--- Input:
---
--- Output: YFIT - Curve containing the fit
---
--- WARNING: It is assumed that yfit is already linked to $YFIT from the
---          allocation of the array.  If not, we fail terribly!  Problem with
---          relinking here is that it is first deallocated before linking. 
---          This creates a memory overwrite problem that is very bad!
-============================================================================ */
-static int nls_eval(NLS_DATA *nls) {
+	if (info->TimeSeries_File != NULL) TSeries_Close(info->TimeSeries_File);
+	if (info->TimeSeries_Stream >= 0) AWriter_Close(writer, info->TimeSeries_Stream);
+	info->TimeSeries_File = NULL;
+	info->TimeSeries_Stream = -1;
+	return;
+}
 
-	FILM_MEASURE_INFO *info;
-	info = main_info;
+/* ===========================================================================
+-- Automatic measurement
+--
+-- A scheduler thread (scheduler.c) acquires the spectra at a fixed rate --
+-- IDV_MEASURE_DELAY seconds apart, or back to back for 0 -- and stamps
+-- each with the wall clock as its acquisition starts.  Spectra go into a
+-- pipeline (pipeline.c) of
+--    acquire (scheduler) -> reflectance and fit (thread) -> show and record
+-- so the next spectrum is acquired while the last one is fitted and the
+-- one before it is displayed and recorded.  The last step runs here on the
+-- dialog thread (WMP_SHOW_MEASUREMENT) because it updates the controls,
+-- graphs, fit log and time series; its disk I/O is on the writer thread.
+-- Manual measurements and grabs may still be made during a run; every
+-- exchange with the spectrometer holds spec_lock, so an acquisition
+-- (request, info and data) is never interleaved with another.
+--
+-- The cadence never waits on the fit or the dialog.  If an acquisition
+-- overruns its period, the [Measure] Overrun policy (Skip, Queue or
+-- Coalesce) says what happens to the deadlines it missed.  If the fit
+-- falls behind, it fits only the newest spectrum waiting (except with
+-- Queue) and passes the others on to be shown and recorded unfitted; only
+-- when the queues are full anyway is a spectrum dropped.
+--
+-- A run works on a snapshot of the reference, dark, sample stack and fit
+-- settings.  Thickness, limits and scaling carry from fit to fit inside
+-- the run as they do in the dialog.  PipelineStale() compares the snapshot
+-- (and the starting values the run last put in the dialog) after each
+-- control change and the run is restarted, from the values the user
+-- entered, when any of it has been changed.  The fit in progress is then
+-- cancelled and spectra of the old run still queued or posted are
+-- dropped.  Without a reference there is nothing to fit; the scheduler
+-- then ticks once a second and the dialog measures in line.  If the run
+-- cannot be set up although there is a reference (no valid sample stack,
+-- no memory or threads), automatic measurement is turned off and the
+-- failure reported once, rather than retried on every tick; it is tried
+-- again when the user turns it back on after changing the inputs.
+=========================================================================== */
+static int StartAutoMeasure(HWND hdlg, FILM_MEASURE_INFO *info) {
+	char szBuf[256];
+	double period;
+	int rc;
 
-	TFOC_GetReflData(info->sample.tfoc, info->sample.scaling, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, nls->yfit);
+	StopAutoMeasure();
+	if ( (rc = StartPipeline(hdlg, info)) != 0 && info->spec_ok && info->cv_ref != NULL) {
+		SetDlgItemCheck(hdlg, IDC_AUTOMEASURE, FALSE);		/* Not again each tick */
+		sprintf_s(szBuf, sizeof(szBuf), "Unable to start automatic measurement with the current reference and sample stack [rc=%d]", rc);
+		MessageBox(hdlg, szBuf, "Automatic measurement failure", MB_ICONERROR | MB_OK);
+		return rc;
+	}
+	period = AutoMeasurePeriod(hdlg);
+	if (pipeline == NULL) period = max(period, 1.0);				/* In line measurements only */
+
+	InterlockedExchange(&auto_posted, 0);
+	if ( (scheduler = Sched_Start(period, auto_overrun, auto_tick, hdlg)) == NULL) {
+		StopPipeline();
+		return 4;
+	}
+	return rc;
+}
+
+/* Stop the acquisitions first -- the scheduler feeds the pipeline */
+static void StopAutoMeasure(void) {
 
+	if (scheduler != NULL) {
+		Sched_Free(scheduler);
+		scheduler = NULL;
+	}
+	StopPipeline();
+	return;
+}
+
+/* Seconds between acquisitions in IDV_MEASURE_DELAY (0 = as fast as possible) */
+static double AutoMeasurePeriod(HWND hdlg) {
+	double period;
+
+	period = GetDlgItemDouble(hdlg, IDV_MEASURE_DELAY);
+	if (period < 0.0 || period > 3600.0) {
+		period = (period < 0.0) ? 0.0 : 3600.0;
+		SetDlgItemDouble(hdlg, IDV_MEASURE_DELAY, "%g", period);
+	}
+	return period;
+}
+
+static int StartPipeline(HWND hdlg, FILM_MEASURE_INFO *info) {
+	static char *rname = "StartPipeline";
+	static PIPE_STAGE *stages[] = { pipe_fit, pipe_post };
+	static int run = 0;
+	FILMFIT_PARMS parms;
+	MEASURE_PIPE *mp;
+	int n;
+
+	StopPipeline();
+	if (! info->spec_ok || info->cv_ref == NULL) return 1;
+	if (! info->lambda_transferred) SendMessage(hdlg, WMP_LOAD_SPEC_WAVELENGTHS, 0, 0);
+	if (info->npt <= 0 || info->cv_ref->npt != info->npt) return 1;
+	SendMessage(hdlg, WMP_MAKE_SAMPLE_STACK, 0, 0);
+	if (info->sample.tfoc == NULL) return 1;
+
+	n = info->npt;
+	if ( (mp = calloc(1, sizeof(*mp))) == NULL || (mp->lambda = malloc(6*n*sizeof(double))) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		free(mp);
+		return 2;
+	}
+	mp->hdlg  = hdlg;
+	mp->run   = ++run;
+	mp->overrun = auto_overrun;
+	mp->npt   = n;
+	mp->ref   = mp->lambda + n;
+	mp->dark  = mp->lambda + 2*n;
+	mp->tref  = mp->lambda + 3*n;
+	mp->refl  = mp->lambda + 4*n;
+	mp->sigma = mp->lambda + 5*n;
+	memcpy(mp->lambda, info->lambda,   n*sizeof(double));
+	memcpy(mp->ref,    info->cv_ref->y, n*sizeof(double));
+	if (info->cv_dark != NULL) { memcpy(mp->dark, info->cv_dark->y, n*sizeof(double)); } else { mp->dark = NULL; }
+	if (info->tfoc_reference != NULL) { memcpy(mp->tref, info->tfoc_reference, n*sizeof(double)); } else { mp->tref = NULL; }
+	mp->autofit = ! GetDlgItemCheck(hdlg, IDC_DISABLE_AUTOFIT) && info->cv_dark != NULL;
+
+	/* Own fit, from a copy of the stack; the fits carry on from each other */
+	if ( (mp->core = FMCore_Create(NULL)) == NULL) {
+		free(mp->lambda); free(mp);
+		return 2;
+	}
+	FMCore_SetMaterials(mp->core, matdb, speclib);
+	MakeFitParms(hdlg, info, &parms);
+	FMCore_SetStack(mp->core, info->sample.tfoc, &parms);
+	mp->layers = info->sample.layers;
+	memcpy(mp->stack, info->sample.stack, sizeof(mp->stack));
+
+	memcpy(mp->imat, info->sample.imat, sizeof(mp->imat));
+	memcpy(mp->vary, info->sample.vary, sizeof(mp->vary));
+	mp->substrate = info->sample.substrate;
+	memcpy(&mp->fit_parms, &info->fit_parms, sizeof(mp->fit_parms));
+	memcpy(mp->shown_nm,   info->sample.nm,   sizeof(mp->shown_nm));
+	memcpy(mp->shown_tmin, info->sample.tmin, sizeof(mp->shown_tmin));
+	memcpy(mp->shown_tmax, info->sample.tmax, sizeof(mp->shown_tmax));
+	mp->shown_scaling = info->sample.scaling;
+
+	if ( (pipeline = Pipeline_Start(AUTO_MEASURE_DEPTH, 2, stages, mp)) == NULL) {
+		FMCore_Free(mp->core);
+		free(mp->lambda); free(mp);
+		return 3;
+	}
+	measure_pipe = mp;
 	return 0;
 }
 
-/* ============================================================================
--- ... Subroutine to determine the derivatives with respect to each of the
--- ... varied parameters.
---
--- Usage: LOGICAL = func_deriv(X,ipt,NPT)
---
--- Inputs: X   - List of X coordinates
---         ipt - Point # at which to evaluate derivatives
---         NPT - Number of points in X
---
--- Common: NTERMS - number of derivatives needed (1 for each varied parameter)
---         DERIVA - Function used to determine derivatives (or none)
---
--- ... If no analytic derivative is defined, we use the finite difference
--- ... method - takes twice as many calculations, but NBD.
--- ... Choose the increment size as the sqrt of the machine precision?
--- ... What to do when actually zero?
---
--- COMMON Output: deriv(i) - Value of the derivatives
--- ========================================================================== */
-static int nls_deriv(double *results, NLS_DATA *nls, int ipt) {
+/* Stop the run -- a fit in progress is abandoned and spectra still queued
+ * are dropped rather than fit with settings that no longer apply */
+static void StopPipeline(void) {
+	MEASURE_PIPE *mp;
 
-	int i,j;
-	double tmp, delta, *v;
+	if (pipeline == NULL) return;
+	if ( (mp = measure_pipe) != NULL) {
+		mp->discard = TRUE;
+		FMCore_Cancel(mp->core);
+	}
+	Pipeline_Free(pipeline);									/* Stops it first */
+	pipeline = NULL;
 
-	static double *fderiv[N_FILM_STACK+2];
-	static double *center;
-	static int ndim=-1;								/* How big are arrays ... may need to reset */
+	if ( (mp = measure_pipe) != NULL) {
+		FMCore_Free(mp->core);
+		free(mp->lambda);
+		free(mp);
+	}
+	measure_pipe = NULL;
+	return;
+}
 
-	FILM_MEASURE_INFO *info;
-	info = main_info;
+/* Has anything in the snapshot of the running pipeline been changed?  The
+ * starting values count as changed only beyond the rounding of their
+ * controls, since leaving a control reads back its displayed text */
+static BOOL PipelineStale(HWND hdlg, FILM_MEASURE_INFO *info) {
+	MEASURE_PIPE *mp = measure_pipe;
+	size_t bytes;
+	int i;
 
-	/* Initial allocation of space for the derivatives */
-	if (ndim <= 0) {
-		ndim = info->npt;
-		for (i=0; i<N_FILM_STACK+2; i++) fderiv[i] = malloc(ndim*sizeof(double));
-		center = malloc(ndim*sizeof(double));
+	if (mp == NULL) return TRUE;
+	bytes = mp->npt*sizeof(double);
+	if (info->npt != mp->npt || info->cv_ref == NULL || info->cv_ref->npt != mp->npt) return TRUE;
+	if (memcmp(info->cv_ref->y, mp->ref, bytes) != 0) return TRUE;
+	if ((info->cv_dark == NULL) != (mp->dark == NULL) || (mp->dark != NULL && memcmp(info->cv_dark->y, mp->dark, bytes) != 0)) return TRUE;
+	if ((info->tfoc_reference == NULL) != (mp->tref == NULL) || (mp->tref != NULL && memcmp(info->tfoc_reference, mp->tref, bytes) != 0)) return TRUE;
+	if (mp->autofit != (! GetDlgItemCheck(hdlg, IDC_DISABLE_AUTOFIT) && info->cv_dark != NULL)) return TRUE;
+	if (memcmp(mp->imat, info->sample.imat, sizeof(mp->imat)) != 0 || mp->substrate != info->sample.substrate) return TRUE;
+	if (memcmp(mp->vary, info->sample.vary, sizeof(mp->vary)) != 0) return TRUE;
+	if (memcmp(&mp->fit_parms, &info->fit_parms, sizeof(mp->fit_parms)) != 0) return TRUE;
+	for (i=0; i<N_FILM_STACK; i++) {
+		if (fabs(info->sample.nm[i]-mp->shown_nm[i]) > (info->sample.vary[i] ? 0.006 : 0.06)) return TRUE;
+		if (fabs(info->sample.tmin[i]-mp->shown_tmin[i]) > 0.06 || fabs(info->sample.tmax[i]-mp->shown_tmax[i]) > 0.06) return TRUE;
 	}
+	if (fabs(info->sample.scaling-mp->shown_scaling) > 0.0006) return TRUE;
+	return FALSE;
+}
 
-	/* On ipt == 0, do the full vector.  After that, simple lookup */
-	if (ipt == 0) {
-		if (ndim != info->npt) {
-			ndim = info->npt;
-			for (i=0; i<N_FILM_STACK+2; i++) fderiv[i] = realloc(fderiv[i], ndim*sizeof(double));
-			center = realloc(center, ndim*sizeof(double));		/* Center values with current parameters */
-		}
+/* Scheduler tick -- acquire one spectrum into the pipeline; a failure ends
+ * the run.  pipeline and measure_pipe do not change while the scheduler runs */
+static int auto_tick(void *arg, long n, double when) {
+	HWND hdlg = (HWND) arg;
+	MEASURE_PIPE *mp = measure_pipe;
+	SPEC_SPECTRUM_INFO spectrum_info;
+	MEASUREMENT *m;
+	double *data;
+	int rc, failed;
 
-		/* Evaluate at the center point */
-		TFOC_GetReflData(info->sample.tfoc, info->sample.scaling, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, center);
+	if (pipeline == NULL) {											/* Dialog measures in line */
+		if (InterlockedExchange(&auto_posted, 1) == 0 && ! PostMessage(hdlg, WMP_AUTO_MEASURE, 0, 0)) auto_posted = 0;
+		return 0;
+	}
 
-		for (i=0; i<nls->nvars; i++) {
-			v = nls->vars[i];
-			tmp = *v;
-			if (i != nls->nvars-1) {
-				delta = 1.0;								/* Use a 1 nm change so tfoc has a chance (always +) */
-			} else {
-				delta = 0.01;
-			}
-			*v +=   delta;
-			TFOC_GetReflData(info->sample.tfoc, info->sample.scaling, 0.0, UNPOLARIZED, 300.0, info->npt, info->lambda, fderiv[i]);
-			for (j=0; j<info->npt; j++) fderiv[i][j] = (fderiv[i][j]-center[j])/delta;
-			*v = tmp;
-		}
+	if ( (m = calloc(1, sizeof(*m))) == NULL) return 0;
+	m->run  = mp->run;
+	m->npt  = mp->npt;
+	m->time = when;
+	EnterCriticalSection(&spec_lock);								/* Manual measurements may run meanwhile */
+	if ( (m->rc = Spec_Remote_Acquire_Spectrum(&spectrum_info, &data)) == 0) m->raw = data;
+	LeaveCriticalSection(&spec_lock);
+	failed = (m->rc != 0);
+
+	/* Never wait on the fit or the dialog; a failure is reported regardless */
+	rc = Pipeline_Put(pipeline, m, FALSE);
+	if (rc != 0 && failed && PostMessage(hdlg, WMP_SHOW_MEASUREMENT, 0, (LPARAM) m)) rc = 0;
+	if (rc != 0) {													/* Fit and display fell behind */
+		free(m->raw);
+		free(m);
 	}
+	return failed;
+}
 
-	/* Now have data stored as a vector ... just return the appropriate points */
-	for (i=0; i<nls->nvars; i++) results[i] = fderiv[i][ipt];
+/* Stage 1 -- reflectance and fit, continuing from the previous fit (FMCore_Fit
+ * goes back to the starting values of the run after a failure) */
+static int pipe_fit(void *arg, void *item) {
+	MEASURE_PIPE *mp = (MEASURE_PIPE *) arg;
+	MEASUREMENT *m = (MEASUREMENT *) item;
+	FILMFIT_PARMS *fit, *next;
+	int i, j;
+
+	if (mp->discard) {
+		free(m->raw);
+		free(m);
+		return 1;
+	}
+	if (m->rc != 0 || ! mp->autofit) return 0;
+	if (mp->overrun != SCHED_QUEUE && Pipeline_Backlog(pipeline, 0) > 0) return 0;	/* Behind -- fit the newest only */
+
+	FMCore_Reflectance(mp->npt, m->raw, mp->ref, mp->dark, mp->tref, mp->refl, mp->sigma);
+	if (FMCore_SetReflectance(mp->core, mp->npt, mp->lambda, mp->refl, mp->sigma) != 0) return 0;
+	if (FMCore_Fit(mp->core) < 0 || (fit = FMCore_LastFit(mp->core)) == NULL) return 0;
+
+	next = &FMCore_Recipe(mp->core)->parms;						/* Limits of the next fit */
+	for (j=0; j<fit->nvary; j++) {
+		i = fit->layer[j]-1;											/* In tfoc structure ... 0 is air */
+		mp->stack[i].nm    = fit->sample[i+1].z;
+		mp->stack[i].sigma = fit->z_sigma[j];
+		FMCore_AdjustRange(mp->stack[i].nm, &next->lower[j], &next->upper[j]);
+		mp->stack[i].lower = next->lower[j];
+		mp->stack[i].upper = next->upper[j];
+	}
+	m->fitted  = TRUE;
+	m->layers  = mp->layers;
+	m->scaling = fit->scaling;
+	for (i=0; i<mp->layers; i++) {
+		m->nm[i]    = mp->stack[i].nm;
+		m->sigma[i] = mp->stack[i].sigma;
+		m->lower[i] = mp->stack[i].lower;
+		m->upper[i] = mp->stack[i].upper;
+	}
+	m->nvalues = FMCore_Results(mp->core, m->value, NULL);
 	return 0;
 }
 
+/* Stage 2 -- hand over to the dialog thread */
+static int pipe_post(void *arg, void *item) {
+	MEASURE_PIPE *mp = (MEASURE_PIPE *) arg;
+	MEASUREMENT *m = (MEASUREMENT *) item;
+
+	m->posted = TRUE;
+	if (mp->discard || ! PostMessage(mp->hdlg, WMP_SHOW_MEASUREMENT, 0, (LPARAM) m)) {
+		free(m->raw);
+		free(m);
+		return 1;
+	}
+	return 0;
+}
 
 /* ===========================================================================
--- Do quick estimate of normalization and sigma for a brute-force search
+-- Display and record a spectrum from the pipeline (WMP_SHOW_MEASUREMENT)
+--
+-- Usage: void ShowMeasurement(HWND hdlg, FILM_MEASURE_INFO *info, MEASUREMENT *m);
+--
+-- Notes: Same end result as IDB_MEASURE followed by an autofit; the fit
+--        results replace the thickness, limits and scaling in the dialog
+--        unless the user has changed them (or other settings) meanwhile.
+--        m is released.  A failed acquisition stops automatic measurement.
 =========================================================================== */
-double Estimate_Chisqr(int npt, double *x, double *y, double *s, double *f, double *pscaling) {
-	int i;
-	double ysum, fsum, scaling, chisqr;
+static void ShowMeasurement(HWND hdlg, FILM_MEASURE_INFO *info, MEASUREMENT *m) {
+	char szBuf[256];
+	GRAPH_CURVE *cv;
+	MEASURE_PIPE *mp;
+	int i, j, ilayer;
+	BOOL stale;
+
+	if (pipeline == NULL || (mp = measure_pipe) == NULL || m->run != mp->run) {	/* Posted before a stop or restart */
+		free(m->raw);
+		free(m);
+		return;
+	}
+	if (m->posted) Pipeline_Done(pipeline);						/* Not a failure auto_tick() posted itself */
+	stale = PipelineStale(hdlg, info);								/* Restart pending -- keep the edits */
 
-	/* Calculate a normalization factor so sum(y) = sum(f) */
-	ysum = fsum = 0;
-	for (i=0; i<npt; i++) { ysum += y[i]; fsum += f[i]; }
-	scaling = ( ysum != 0 ) ? fsum / ysum : 1.0 ;
+	if (m->rc != 0) {
+		SetDlgItemCheck(hdlg, IDC_AUTOMEASURE, FALSE);
+		StopAutoMeasure();
+		sprintf_s(szBuf, sizeof(szBuf), "Failed to acquire a spectrum from remote source [rc=%d]", m->rc);
+		MessageBox(hdlg, szBuf, "Spectrum acquisition failure", MB_ICONERROR | MB_OK);
+		free(m);
+		return;
+	}
 
-	/* Calculate simplified chisqr */
-	for (i=0,chisqr=0; i<npt; i++) {
-		chisqr += pow( (scaling*y[i]-f[i])/s[i], 2);
+	cv = info->cv_raw = ReallocRawCurve(hdlg, info, info->cv_raw, m->npt, 0, "sample", colors[0]);
+	for (i=0; i<m->npt; i++) cv->y[i] = m->raw[i];
+	cv->modified = TRUE;
+	EnableDlgItem  (hdlg, IDC_SHOW_RAW, TRUE);			/* Make sure enabled */
+	SetDlgItemCheck(hdlg, IDC_SHOW_RAW, cv->visible);	/* But leave off if had been set off */
+	SendMessage(hdlg, WMP_UPDATE_RAW_AXIS_SCALES, 0, 0);
+
+	info->last_fit.valid = FALSE;
+	if (m->fitted && m->layers == info->sample.layers && ! stale) {
+		info->sample.scaling = m->scaling;
+		for (i=ilayer=j=0; i<N_FILM_STACK; i++) {
+			SetDlgItemText(hdlg, IDT_SIGMA_0+i, "");
+			if (info->sample.imat[i] == 0) continue;				/* Not a real layer */
+			if (info->sample.vary[i]) {
+				info->sample.nm[i]   = info->sample.stack[ilayer].nm = m->nm[ilayer];
+				info->sample.stack[ilayer].sigma = m->sigma[ilayer];
+				info->sample.tmin[i] = m->lower[ilayer];
+				info->sample.tmax[i] = m->upper[ilayer];
+				SetDlgItemDouble(hdlg, IDT_SIGMA_0+i, "%.2f", m->value[2*j+1]);
+				j++;
+			}
+			ilayer++;
+		}
+		memcpy(info->last_fit.value, m->value, sizeof(info->last_fit.value));
+		info->last_fit.nvalues = m->nvalues;
+		info->last_fit.valid   = TRUE;
+		memcpy(mp->shown_nm,   info->sample.nm,   sizeof(mp->shown_nm));		/* What the user now sees */
+		memcpy(mp->shown_tmin, info->sample.tmin, sizeof(mp->shown_tmin));
+		memcpy(mp->shown_tmax, info->sample.tmax, sizeof(mp->shown_tmax));
+		mp->shown_scaling = info->sample.scaling;
+		SendMessage(hdlg, WMP_SHOW_SAMPLE_STRUCTURE, 0, 0);
 	}
+	SendMessage(hdlg, WMP_PROCESS_MEASUREMENT, 0, 0);			/* Reflectance, fit and residual curves */
 
-	/* Return values */
-	if (pscaling != NULL) *pscaling = scaling;
-	return chisqr / (npt-1);
-}		
+	LogFit(hdlg, info, m->time);
+	RecordTimeSeries(hdlg, info, m->time);
+
+	free(m->raw);
+	free(m);
+	return;
+}
 
 /* ===========================================================================
 --- Do fit
+--
+-- Builds the fit problem from the sample stack and runs it through
+-- FMCore_Fit() on info->core, the same sequence as fmfit.  Results are
+-- transferred back to the sample stack and optionally logged.
 =========================================================================== */
-#define	MAXITER	(20)							/* Max iterations to find solution */
-
 static int do_fit(HWND hdlg, FILM_MEASURE_INFO *info) {
 
 	/* Local variables */
-	int mode = 0;
-	int		i,j,k, iter;						/* Random integer constants	*/
-	char		token[256];
-	int		rcode=0;
-	double	*xy[3];								/* Array for the dependent vars */
-	char *var_names[N_FILM_STACK+2];
-
-	static NLS_DATA *nls=NULL;					/* Structure passed to NLSFIT	*/
-
-	/* Clear and set the parameter structure */
-	if (nls == NULL) nls = calloc(1, sizeof(*nls));
-
-	/* Initialize the data structure to nlsfit() now */
-	nls->yfit      = NULL;				/* Let fit routines allocate space	*/
-	nls->outchi    = NULL;				/* Let fit allocate space if needed	*/
-	nls->correlate = NULL;				/* No correlation matrix wanted		*/
-	nls->workspace = NULL;				/* Let fit allocate space if needed	*/
-	nls->magic_cookie = 0;				
-
-	nls->data = info->cv_refl->y;			/* Experimental reflectance curve */
-	nls->errorbar = info->cv_refl->s;	/* Uncertainty on measured reflectivity */
-	nls->npt = info->npt;					/* Number of points */
-	xy[0]    = info->lambda;				/* At moment, not use, but let's define them */
-	xy[1]    = info->cv_refl->y;
-	xy[2]    = info->cv_refl->s;
-	nls->xy  = xy;
-
-	nls->flamda   = 0;						/* Let CurveFit() set initial value	*/
-	nls->EpsCrit  = 1E-4;					/* CurveFit() now does completion test */
-
-	nls->evalfnc   = nls_eval;				/* Functions to evaluate function	*/
-	nls->fderiv    = nls_deriv;			/* Functions to evaluate derivative	*/
-	nls->evalchi   = NULL;					/* Use default chisqr evaluation		*/
-
-	if (nls->vars  == NULL) nls->vars  = calloc(N_FILM_STACK+2, sizeof(*nls->vars));
-	if (nls->sigma == NULL) nls->sigma = calloc(N_FILM_STACK+2, sizeof(*nls->sigma));
-	nls->correlate = NULL;
-	if (nls->lower == NULL) nls->lower = calloc(N_FILM_STACK+2, sizeof(*nls->lower));
-	if (nls->upper == NULL) nls->upper = calloc(N_FILM_STACK+2, sizeof(*nls->upper));
-
-	/* Mark only wavelengths within the given region for testing */
-	if (nls->valid == NULL) nls->valid = calloc(info->npt, sizeof(*nls->valid));
-	for (i=0; i<info->npt; i++) nls->valid[i] = (info->lambda[i] >= info->fit_parms.lambda_min) && (info->lambda[i] <= info->fit_parms.lambda_max);
+	int i,j;
+	int rcode;
+	FILMFIT_PARMS parms, *fit;
 
-	/* Include in all of the requested variations */
-	nls->nvars = 0;							/* How many are we actually going to do? */
-	for (i=0,j=0; i<info->sample.layers; i++) {
-		if (! info->sample.stack[i].vary) continue;
-		nls->vars[j] = &info->sample.tfoc[i+1].z;				/* In tfoc structure ... 0 is air */
-		nls->lower[j] = info->sample.stack[i].lower;
-		nls->upper[j] = info->sample.stack[i].upper;
-		var_names[j] = info->sample.stack[i].layer_name;
-		j++;
-	}
-	/* And then add in the scaling factor (always appropriate for small changes in illumination intensity) */
-	nls->vars[j]  = &info->sample.scaling;
-	nls->lower[j] = info->fit_parms.scaling_min;
-	nls->upper[j] = info->fit_parms.scaling_max;
-	var_names[j] = "scaling";
-	j++;
-	nls->nvars = j;
-
-	/* Initialize everything else in CurveFit routine (will use below) */
-	if ( (rcode = CurveFit(NKEY_INIT, 0, nls)) != 0) {
-		printf("ERROR: Error on initialization of routine\n"); fflush(stdout);
-		goto FitExit;
-	}
-
-/* ------------- SPECIAL CASE FOR ONLY 1 THICKNESS VARYING -------------------
--- Do a 10-pt linear search over min/max range and choose lowest chi^2 as
--- starting point.  This should at least get the right # of fringes
---------------------------------------------------------------------------- */
-	if (nls->nvars == 2) {											/* One thickness varying */
-		double guess, best, initial, chi, chi_best, scaling, scaling_best;
-		int npt;
-
-		static double *x=NULL, *y=NULL, *s=NULL, *f=NULL;	/* Compress the spectrum by 10x to make fast */
-		static int nsize=-1;											/* Avoid continuously allocating / deallocating */
-		
-		if (nsize != info->npt/10 || x == NULL) {				/* Do we need to change allocated size? */
-			nsize = info->npt / 10;
-			x = realloc(x, nsize*sizeof(*x));
-			y = realloc(y, nsize*sizeof(*y));
-			s = realloc(s, nsize*sizeof(*s));
-			f = realloc(f, nsize*sizeof(*f));
-		}
+	if (info->core == NULL) return -100;
+	MakeFitParms(hdlg, info, &parms);
+	FMCore_SetStack(info->core, info->sample.tfoc, &parms);
+	if (FMCore_SetReflectance(info->core, info->npt, info->lambda, info->cv_refl->y, info->cv_refl->s) != 0) return -100;
 
-		/* Copy the useful data (every 10th point) */
-		for (i=0,j=0; i<info->npt; i+=10) {
-			if (! nls->valid[i]) continue;
-			x[j] = info->lambda[i];
-			y[j] = nls->data[i];
-			s[j] = nls->errorbar[i];
-			j++;
-		}
-		npt = j;															/* Number of points remaining */
-
-		if (npt > 5) {													/* Don't bother if too few */
-			initial = best = *nls->vars[0];						/* Originally suggested point */ 
-			TFOC_GetReflData(info->sample.tfoc, 1.0, 0.0, UNPOLARIZED, 300.0, npt, x, f);
-			chi_best = Estimate_Chisqr(npt, x, y, s, f, NULL);
-
-			for (guess=nls->lower[0]; guess<=nls->upper[0]; guess+=10.0) {
-				*nls->vars[0] = guess;
-				TFOC_GetReflData(info->sample.tfoc, 1.0, 0.0, UNPOLARIZED, 300.0, npt, x, f);
-				chi = Estimate_Chisqr(npt, x, y, s, f, &scaling);
-//				fprintf(stderr, "%.2f %.0f\n", *nls->vars[0], chi); fflush(stderr);
-				if (chi < chi_best) {							/* Better point */
-					best = *nls->vars[0];
-					chi_best = chi;
-					scaling_best = scaling;
-				}
-			}
-			*nls->vars[0] = initial;								/* Reset now */
+	rcode = FMCore_Fit(info->core);
 
-			/* If we have a better initial guess, put it in place now */
-			if (best != initial) {
-				*nls->vars[0] = best;
-				info->sample.scaling = scaling_best;
+	/* If we are mostly successful, transfer back */
+	if (rcode >= 0 && (fit = FMCore_LastFit(info->core)) != NULL) {
 
-				/* Fake last things that NKEY_INIT would have done */
-				(*nls->evalfnc)(nls);							/* Evaluate at this point */
-				(*nls->evalchi)(nls);							/* Get the chi^2 value */
-				nls->chiold = nls->chisqr;						/* Internal cleanup to keep NLSFIT synchronized (see curfit.c) */
+		/* Transfer values from the fitted stack back into the sample stack */
+		info->sample.scaling = fit->scaling;
+		for (i=0,j=0; i<info->sample.layers; i++) {
+			if (info->sample.stack[i].vary) {
+				info->sample.tfoc[i+1].z    = fit->sample[i+1].z;		/* layer 0 is air */
+				info->sample.stack[i].nm    = fit->sample[i+1].z;
+				info->sample.stack[i].sigma = fit->z_sigma[j];
+				j++;
 			}
 		}
+
+		/* Values as they are logged, also recorded with a time series */
+		info->last_fit.nvalues = FMCore_Results(info->core, info->last_fit.value, NULL);
+		info->last_fit.valid = TRUE;
+		LogFit(hdlg, info, Sched_Clock());
 	}
 
-	/* And we are off and running */
-	fputs("------------------------------------------------------------------------------\n", stdout);
-	strcpy_s(token, sizeof(token), "    CHISQR ");
-	for (i=0; i<nls->nvars;) {
-		fputs(token, stdout);
-		for (j=0; j<6 && i<nls->nvars; j++) printf("%11s", var_names[i++]);
-		fputs("\n", stdout);
-		strcpy_s(token, sizeof(token), "           ");
-	}
-	fputs("------------------------------------------------------------------------------\n", stdout);
-
-	/* Set key to be either silent or verbose on fitting */
-	rcode = 0;
-	for (iter=0; iter<MAXITER; iter++) {			/* Number of reps allowed */
-		printf("\r%11.4g", nls->chisqr);
-		for (j=0; j<nls->nvars; ) {
-			for (k=0; k<6 && j<nls->nvars; k++) printf("%11.4g", *nls->vars[j++]);
-			fputs("\n", stdout);
-			if (j != nls->nvars) fputs("           ", stdout);
-		}
-		fflush(stdout);
-
-		if (nls->chisqr <= 0 || rcode == 1) break;		/* Basically success! */
-		if ( (rcode = CurveFit(NKEY_TRY_VERBOSE, iter, nls)) < 0) goto FitExit;		/* Run again */
-	}
-	if (rcode == 0 && iter >= MAXITER) rcode = 2;	/* Run out of time? */
-
-	/* Print results */
-	fputs( "\n"
-			 "    Variable                Value               Sigma\n"
-			 "    --------                -----               -----\n", stdout);
-	/*				"    123456789012345  12345.1234567     123456.1234567 */
-	for (i=0; i<nls->nvars; i++) {
-		printf("     %-15s  %13.7g     %14.7g\n", var_names[i], *nls->vars[i], nls->sigma[i]);
-	}
-	fputs("\n", stdout);
-
-	printf("     Degrees of Freedom: %d\n", nls->dof);
-	printf("     Root Mean Variance: %g\n", sqrt(nls->chisqr));
-	printf("     Estimated Y sigma:  %g\n", nls->sigmaest);
-	fputs( "     WARNING: Error estimates valid only if estimated Y sigma is correct\n", stdout);
-	fputs("\n", stdout);
-
-	/* ----------------------- */
-FitExit:
-	/* ----------------------- */
-	switch (rcode) {
-		case -1:
-			fputs("      GET OFF THE QUAALUDES, MAN!\n"
-					"ERROR: Too many parameters for number of data points\n", stdout);
-			break;
-		case -2:
-			fputs("ERROR: Unable to properly evaluate function (NLSFIT)\n", stdout);
-			break;
-		case -3:
-			fputs("ERROR: Unable to allocate temporary matrix space (NLSFIT)\n", stdout);
-			break;
-		case -4:
-			fputs("ERROR: Unable to allocate work spaces.  (NLSFIT)\n", stdout);
-			break;
-		case -5:
-			fputs("ERROR: *** Fit aborted by user pressing ^C (NLSFIT) ***\n", stdout);
-			break;
-		case -6:				/* Initialization errors - reported by CurveFit() */
-			break;
-		case 1:
-			break;			/* Success! */
-		case 2:
-			fputs("WARNING: Maximum iteration count reached.  A better fit may be obtained\n"
-					"         by running fit again starting from these parameters\n", stdout);
-			break;
-		default:
-			if (rcode < 0) printf("Function evaluator errors.  (NLSFIT)\n");
+	fflush(NULL);
+	return rcode;
+}
+
+/* ===========================================================================
+-- Fit problem for the current sample stack and fit settings
+--
+-- Usage: void MakeFitParms(HWND hdlg, FILM_MEASURE_INFO *info, FILMFIT_PARMS *parms);
+--
+-- Output: *parms - everything except the measured refl and sigma
+=========================================================================== */
+static void MakeFitParms(HWND hdlg, FILM_MEASURE_INFO *info, FILMFIT_PARMS *parms) {
+	int i,j;
+
+	memset(parms, 0, sizeof(*parms));
+	parms->sample  = info->sample.tfoc;
+	parms->scaling = info->sample.scaling;
+	parms->npt     = info->npt;
+	parms->lambda  = info->lambda;
+	parms->lambda_min  = info->fit_parms.lambda_min;
+	parms->lambda_max  = info->fit_parms.lambda_max;
+	parms->scaling_min = info->fit_parms.scaling_min;
+	parms->scaling_max = info->fit_parms.scaling_max;
+	parms->analytic_deriv = info->fit_parms.analytic_deriv;
+	parms->varpro  = info->fit_parms.varpro;
+	parms->broyden = info->fit_parms.broyden;
+	parms->geodesic = info->fit_parms.geodesic;
+	parms->nielsen = info->fit_parms.nielsen;
+	parms->multistart = info->fit_parms.multistart;
+	parms->multistart_budget = info->fit_parms.multistart_budget;
+	parms->multires = info->fit_parms.multires;
+	parms->verbose = TRUE;
+
+	/* Automatic measurements and time series follow a slowly changing film */
+	parms->warm_start = info->fit_parms.warm_start &&
+							 (GetDlgItemCheck(hdlg, IDC_AUTOMEASURE) || info->TimeSeries_Status == S_PAUSE);
+
+	/* Include in all of the requested variations */
+	for (i=0,j=0; i<info->sample.layers; i++) {
+		if (! info->sample.stack[i].vary) continue;
+		parms->layer[j] = i+1;										/* In tfoc structure ... 0 is air */
+		parms->lower[j] = info->sample.stack[i].lower;
+		parms->upper[j] = info->sample.stack[i].upper;
+		parms->name[j]  = info->sample.stack[i].layer_name;
+		j++;
 	}
+	parms->nvary = j;
 
-	/* Clean up workspaces and exit */
-	CurveFit(NKEY_EXIT, 0, nls);					/* Free allocated workspaces	*/
+	return;
+}
 
-	/* If we are mostly successful, transfer back */
-	if (rcode >= 0) {												/* Only in case of success */
+/* ===========================================================================
+-- Fit controls from the defaults and [Fit] keys of recipe.c
+--
+-- Usage: void LoadFitControls(FILM_MEASURE_INFO *info, char *inifile);
+--
+-- Inputs: inifile - FilmMeasure.ini (NULL for the defaults alone)
+--
+-- Output: info->fit_parms, and speclib_path from [Fit] Spectral_Library
+--
+-- Notes: One copy of the defaults and parsing for the dialog and for fmfit
+--        and fmrefit.  WriteProfileInfo() writes the same keys back.
+=========================================================================== */
+static void LoadFitControls(FILM_MEASURE_INFO *info, char *inifile) {
+	RECIPE recipe;
+
+	memset(&recipe, 0, sizeof(recipe));
+	Recipe_Options(inifile, &recipe);
+	info->fit_parms.lambda_min        = recipe.parms.lambda_min;
+	info->fit_parms.lambda_max        = recipe.parms.lambda_max;
+	info->fit_parms.scaling_min       = recipe.parms.scaling_min;
+	info->fit_parms.scaling_max       = recipe.parms.scaling_max;
+	info->fit_parms.analytic_deriv    = recipe.parms.analytic_deriv != 0;
+	info->fit_parms.varpro            = recipe.parms.varpro != 0;
+	info->fit_parms.broyden           = recipe.parms.broyden != 0;
+	info->fit_parms.geodesic          = recipe.parms.geodesic != 0;
+	info->fit_parms.nielsen           = recipe.parms.nielsen != 0;
+	info->fit_parms.threads           = recipe.threads;
+	info->fit_parms.multistart        = recipe.parms.multistart;
+	info->fit_parms.multistart_budget = recipe.parms.multistart_budget;
+	info->fit_parms.warm_start        = recipe.parms.warm_start != 0;
+	info->fit_parms.multires          = recipe.parms.multires;
+	strcpy_s(speclib_path, sizeof(speclib_path), recipe.speclib);
+	return;
+}
 
-		/* Transfer values from tfoc structure back into the sample stack */
-		for (i=0,j=0; i<info->sample.layers; i++) {
-			if (info->sample.stack[i].vary) {
-				info->sample.stack[i].nm    = info->sample.tfoc[i+1].z;		/* layer 0 is air */
-				info->sample.stack[i].sigma = nls->sigma[j];
-				j++;
-			}
-		}
+/* ===========================================================================
+-- Append info->last_fit to the fit log (if enabled) as time,elapsed,values
+--
+-- Usage: void LogFit(HWND hdlg, FILM_MEASURE_INFO *info, double when);
+--
+-- Inputs: when - wall clock of the measurement (Sched_Clock)
+--
+-- Notes: The line is queued on the background writer; the file stays open
+--        until the logfile name changes.  The time is logged in whole
+--        seconds as time() and the elapsed time to the millisecond.
+=========================================================================== */
+static void LogFit(HWND hdlg, FILM_MEASURE_INFO *info, double when) {
+	char pathname[PATH_MAX], line[1024];
+	static double time_0=0;
+	size_t len;
+	int i;
 
-		/* Do we want to log these results? */
-		if (GetDlgItemCheck(hdlg, IDC_LOG_FITS)) {
-			FILE *funit;
-			char pathname[PATH_MAX];
-			static time_t time_0=0;
-			
-			if (time_0 == 0) time_0 = time(NULL);
+	if (! GetDlgItemCheck(hdlg, IDC_LOG_FITS) || ! info->last_fit.valid) return;
+	if (time_0 == 0) time_0 = when;
 
-			GetDlgItemText(hdlg, IDV_LOGFILE, pathname, sizeof(pathname));
-			if (*pathname == '\0') {
-				Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
-				strcpy_s(pathname, sizeof(pathname), "logfile.csv");
-				SetDlgItemText(hdlg, IDV_LOGFILE, pathname);
-			}
-			if (fopen_s(&funit, pathname, "a") != 0) {
-				Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
-			} else {
-				fprintf(funit, "%lld,%lld", time(NULL),time(NULL)-time_0);
-				for (i=0; i<nls->nvars; i++) {
-					fprintf(funit, ",%g,%g", *nls->vars[i], nls->sigma[i]*sqrt(nls->chisqr));
-				}
-				fprintf(funit, "\n");
-				fclose(funit);
-			}
-		}
+	GetDlgItemText(hdlg, IDV_LOGFILE, pathname, sizeof(pathname));
+	if (*pathname == '\0') {
+		Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
+		strcpy_s(pathname, sizeof(pathname), "logfile.csv");
+		SetDlgItemText(hdlg, IDV_LOGFILE, pathname);
+	}
+	if (log_stream >= 0 && _stricmp(pathname, log_path) != 0) {		/* Logfile changed */
+		AWriter_Close(writer, log_stream);
+		log_stream = -1;
+	}
+	if (log_stream < 0 && (log_stream = AWriter_Open(writer, pathname, "a")) >= 0) {
+		strcpy_s(log_path, sizeof(log_path), pathname);
+	}
+	if (log_stream < 0) {
+		Beep(ERROR_BEEP_FREQ, ERROR_BEEP_MS);
+		return;
 	}
 
-	fflush(NULL);
-	return rcode;
+	/* Every value but the trailing chisqr, in pairs */
+	len = sprintf_s(line, sizeof(line), "%lld,%.3f", (long long) when, when-time_0);
+	for (i=0; i<info->last_fit.nvalues-1; i+=2) {
+		len += sprintf_s(line+len, sizeof(line)-len, ",%g,%g", info->last_fit.value[i], info->last_fit.value[i+1]);
+	}
+	len += sprintf_s(line+len, sizeof(line)-len, "\n");
+	AWriter_Write(writer, log_stream, line, len);
+	return;
 }
 
+
 /* ===========================================================================
 -- Simple routines to handle server requests with minimal internal information
 --
@@ -37,6 +37,8 @@ typedef struct _FILM_MEASURE_INFO {
 					*cv_residual;					/* Residual error */
 	double *tfoc_reference;						/* TFOC of reference structure */
 	double *tfoc_fit;								/* TFOC of sample structure */
+	FILMFIT *fit;									/* Evaluation / fit context (owns workspaces) */
+	FMCORE *core;									/* Fits, through FMCore_Fit() as in fmfit */
 
 	struct {
 		BOOL mirror;								/* Is it a perfect mirror? */
@@ -59,15 +61,34 @@ typedef struct _FILM_MEASURE_INFO {
 		int layers;									/* # of layers (including substrate) in stack */
 	} sample;
 
-	struct {
+	struct _FIT_CONTROLS {
 		double lambda_min, lambda_max;		/* X range (wavelength) for fitting */
 		double scaling_min, scaling_max;		/* Scaling min/max (multiplicative) */
+		BOOL analytic_deriv;						/* Use analytic Jacobian from TMM engine */
+		BOOL varpro;								/* Eliminate scaling by variable projection */
+		BOOL broyden;								/* Secant Jacobian updates (pays with finite differences) */
+		BOOL geodesic;								/* Geodesic acceleration of LM steps */
+		BOOL nielsen;								/* Nielsen damping schedule */
+		int threads;								/* Threads for spectrum evaluation (0 = all processors) */
+		int multistart;							/* Extra starting points for multi-layer fits (0 = off) */
+		double multistart_budget;				/* Time limit (s) for the multi-start search */
+		BOOL warm_start;							/* Continue from the last fit while automeasuring */
+		int multires;								/* Binned coarse-to-fine levels (0 = off) */
 	} fit_parms;
 
+	struct {
+		BOOL valid;									/* Fit of the current measurement succeeded */
+		int nvalues;								/* Entries in value[] */
+		double value[2*N_FILM_STACK+3];		/* z, sigma of each varied layer, scaling, sigma, chisqr (as logged) */
+	} last_fit;
+
 	enum {S_START, S_PAUSE, S_CONTINUE} TimeSeries_Status;
 	BOOL TimeSeries_Initialized;
-	char TimeSeries_Path[PATH_MAX];			/* Time series pathname */
+	char TimeSeries_Path[PATH_MAX];			/* Time series pathname (*.csv for the text layout) */
 	int TimeSeries_Count;
+	TSERIES *TimeSeries_File;					/* Encoder while the series is running */
+	int TimeSeries_Stream;						/* Its file on the background writer */
+	int TimeSeries_NFit;							/* Fit values per record (fixed at the first record) */
 
 } FILM_MEASURE_INFO;
 
@@ -92,5 +113,8 @@ typedef struct _FILM_MEASURE_INFO {
 #define	WMP_SHOW_REFERENCE_STRUCTURE	(WM_APP+15)
 #define	WMP_MAKE_REFERENCE_STACK		(WM_APP+16)
 
+#define	WMP_SHOW_MEASUREMENT				(WM_APP+17)
+#define	WMP_AUTO_MEASURE					(WM_APP+18)
+
 #define	ID_NULL			(-1)
 
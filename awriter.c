@@ -0,0 +1,512 @@
+/* awriter.c - Background thread writing queued data to open files */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+#ifdef __linux__
+	#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+	#define STRICT						/* define before including windows.h for stricter type checking */
+	#include <windows.h>				/* master include file for Windows applications */
+	#undef _POSIX_
+		#include <process.h>			/* for process control fuctions (e.g. threads, programs) */
+	#define _POSIX_
+#elif __linux__
+	#include <pthread.h>
+	#include <time.h>
+#else
+	#error "Unsupported OS"
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tpool.h"							/* TPool_Timer() */
+#include "awriter.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION	AW_MUTEX;
+	typedef CONDITION_VARIABLE	AW_COND;
+	typedef HANDLE					AW_THREAD;
+	typedef volatile LONG64		AW_ATOMIC;
+	#define	AW_THREAD_FNC		static unsigned __stdcall
+	#define	AW_MUTEX_INIT(m)	(InitializeCriticalSection(m), 0)
+	#define	AW_MUTEX_FREE(m)	DeleteCriticalSection(m)
+	#define	AW_LOCK(m)			EnterCriticalSection(m)
+	#define	AW_UNLOCK(m)		LeaveCriticalSection(m)
+	#define	AW_COND_INIT(c)	(InitializeConditionVariable(c), 0)
+	#define	AW_COND_FREE(c)
+	#define	AW_WAIT(c,m)		SleepConditionVariableCS((c), (m), INFINITE)
+	#define	AW_BROADCAST(c)	WakeAllConditionVariable(c)
+	#define	AW_SIGNAL(c)		WakeConditionVariable(c)
+	#define	AW_SLEEP_MS(ms)	Sleep(ms)
+	#define	AW_LOAD(p)			InterlockedCompareExchange64((p), 0, 0)
+	#define	AW_STORE(p,v)		InterlockedExchange64((p), (v))
+	#define	AW_CAS(p,o,n)		(InterlockedCompareExchange64((p), (n), (o)) == (o))
+	#define	AW_INCREMENT(p)	InterlockedIncrement64(p)
+#else
+	typedef pthread_mutex_t		AW_MUTEX;
+	typedef pthread_cond_t		AW_COND;
+	typedef pthread_t				AW_THREAD;
+	typedef volatile int64_t	AW_ATOMIC;
+	#define	AW_THREAD_FNC		static void *
+	#define	AW_MUTEX_INIT(m)	pthread_mutex_init((m), NULL)
+	#define	AW_MUTEX_FREE(m)	pthread_mutex_destroy(m)
+	#define	AW_LOCK(m)			pthread_mutex_lock(m)
+	#define	AW_UNLOCK(m)		pthread_mutex_unlock(m)
+	#define	AW_COND_INIT(c)	pthread_cond_init((c), NULL)
+	#define	AW_COND_FREE(c)	pthread_cond_destroy(c)
+	#define	AW_WAIT(c,m)		pthread_cond_wait((c), (m))
+	#define	AW_BROADCAST(c)	pthread_cond_broadcast(c)
+	#define	AW_SIGNAL(c)		pthread_cond_signal(c)
+	#define	AW_SLEEP_MS(ms)	do { struct timespec _t = {0, (ms)*1000000L}; nanosleep(&_t, NULL); } while (0)
+	#define	AW_LOAD(p)			__atomic_load_n((p), __ATOMIC_SEQ_CST)
+	#define	AW_STORE(p,v)		__atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+	#define	AW_CAS(p,o,n)		__sync_bool_compare_and_swap((p), (o), (n))
+	#define	AW_INCREMENT(p)	__atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#endif
+
+#define	AW_FILE_BUFFER	(65536)						/* stdio buffer of each stream */
+
+typedef enum {AW_OPEN, AW_WRITE, AW_CLOSE, AW_SYNC} AW_OP;
+
+typedef struct _AW_ENTRY {
+	AW_OP op;
+	int stream;
+	char *data;									/* Bytes (AW_WRITE), "mode\0path" (AW_OPEN) */
+	size_t len;
+	volatile int *done;						/* AW_SYNC: set when reached */
+} AW_ENTRY;
+
+/* Slot of the bounded queue.  seq == position when free for that position,
+ * position+1 when filled (multi-producer / single-consumer ring) */
+typedef struct _AW_SLOT {
+	AW_ATOMIC seq;
+	AW_ENTRY entry;
+} AW_SLOT;
+
+typedef struct _AW_STREAM {
+	int in_use;									/* Allocated (changed under the mutex) */
+	FILE *funit;								/* Writer thread only from here down */
+	int failed;									/* Open or write failed -- discard data */
+	size_t pending;							/* Bytes written since the last flush */
+	double last_flush;
+} AW_STREAM;
+
+struct _AWRITER {
+	int depth;									/* Power of 2 */
+	AW_SLOT *slot;								/* [depth] */
+	AW_ATOMIC tail;							/* Next position to fill (producers) */
+	int64_t head;								/* Next position to take (writer) */
+
+	double flush_interval;
+	size_t flush_bytes;
+	AW_STREAM stream[AWRITER_MAX_STREAMS];
+
+	int threaded;								/* Writer thread running */
+	AW_THREAD thread;
+	AW_MUTEX mutex;							/* Stream allocation, sleeping writer, sync */
+	AW_COND wake;								/* Writer waits here when idle */
+	AW_COND synced;							/* Signalled as AW_SYNC entries are reached */
+	AW_ATOMIC sleeping;						/* Writer is (about to be) waiting on wake */
+	int shutdown;
+
+	AW_ATOMIC stalls, errors;
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+AW_THREAD_FNC writer_thread(void *parm);
+static int post(AWRITER *aw, AW_ENTRY *entry);
+static int take(AWRITER *aw, AW_ENTRY *entry);
+static void process(AWRITER *aw, AW_ENTRY *entry);
+static void flush_streams(AWRITER *aw, int force);
+static void wait_idle(AWRITER *aw);
+
+/* ===========================================================================
+-- Create or destroy a writer
+=========================================================================== */
+AWRITER *AWriter_Create(int depth, double flush_interval, size_t flush_bytes) {
+	static char *rname = "AWriter_Create";
+	AWRITER *aw;
+	int i;
+
+	if (depth <= 0) depth = AWRITER_DFLT_DEPTH;
+	for (i=2; i<depth; i*=2);
+	depth = i;
+	if (flush_interval <= 0) flush_interval = AWRITER_DFLT_INTERVAL;
+	if (flush_bytes == 0) flush_bytes = AWRITER_DFLT_BYTES;
+
+	if ( (aw = calloc(1, sizeof(*aw))) == NULL) return NULL;
+	if ( (aw->slot = calloc(depth, sizeof(*aw->slot))) == NULL) {
+		free(aw);
+		return NULL;
+	}
+	for (i=0; i<depth; i++) aw->slot[i].seq = i;
+	aw->depth = depth;
+	aw->flush_interval = flush_interval;
+	aw->flush_bytes = flush_bytes;
+
+	if (AW_MUTEX_INIT(&aw->mutex) != 0 || AW_COND_INIT(&aw->wake) != 0 || AW_COND_INIT(&aw->synced) != 0) {
+		fprintf(stderr, "ERROR: %s: unable to create synchronization objects\n", rname); fflush(stderr);
+		free(aw->slot); free(aw);
+		return NULL;
+	}
+
+#ifdef _WIN32
+	aw->thread = (HANDLE) _beginthreadex(NULL, 0, writer_thread, aw, 0, NULL);
+	aw->threaded = (aw->thread != 0);
+#else
+	aw->threaded = (pthread_create(&aw->thread, NULL, writer_thread, aw) == 0);
+#endif
+	if (! aw->threaded) {
+		fprintf(stderr, "WARNING: %s: unable to start the writer thread; writing synchronously\n", rname); fflush(stderr);
+	}
+	return aw;
+}
+
+void AWriter_Free(AWRITER *aw) {
+	int i;
+
+	if (aw == NULL) return;
+
+	if (aw->threaded) {
+		AW_LOCK(&aw->mutex);
+		aw->shutdown = TRUE;
+		AW_SIGNAL(&aw->wake);
+		AW_UNLOCK(&aw->mutex);
+#ifdef _WIN32
+		WaitForSingleObject(aw->thread, INFINITE);
+		CloseHandle(aw->thread);
+#else
+		pthread_join(aw->thread, NULL);
+#endif
+	}
+	for (i=0; i<AWRITER_MAX_STREAMS; i++) {			/* Thread has finished with them */
+		if (aw->stream[i].funit != NULL) fclose(aw->stream[i].funit);
+	}
+
+	AW_COND_FREE(&aw->synced);
+	AW_COND_FREE(&aw->wake);
+	AW_MUTEX_FREE(&aw->mutex);
+	free(aw->slot);
+	free(aw);
+	return;
+}
+
+/* ===========================================================================
+-- Streams
+=========================================================================== */
+int AWriter_Open(AWRITER *aw, char *path, char *mode) {
+	static char *rname = "AWriter_Open";
+	AW_ENTRY entry;
+	size_t lmode, lpath;
+	int i;
+
+	if (aw == NULL || path == NULL || mode == NULL) return -1;
+
+	AW_LOCK(&aw->mutex);
+	for (i=0; i<AWRITER_MAX_STREAMS; i++) if (! aw->stream[i].in_use) break;
+	if (i < AWRITER_MAX_STREAMS) aw->stream[i].in_use = TRUE;
+	AW_UNLOCK(&aw->mutex);
+	if (i >= AWRITER_MAX_STREAMS) {
+		fprintf(stderr, "ERROR: %s: all %d streams are in use\n", rname, AWRITER_MAX_STREAMS); fflush(stderr);
+		return -1;
+	}
+
+	lmode = strlen(mode); lpath = strlen(path);
+	memset(&entry, 0, sizeof(entry));
+	entry.op = AW_OPEN;
+	entry.stream = i;
+	if ( (entry.data = malloc(lmode+lpath+2)) == NULL) {
+		AW_LOCK(&aw->mutex); aw->stream[i].in_use = FALSE; AW_UNLOCK(&aw->mutex);
+		return -1;
+	}
+	memcpy(entry.data, mode, lmode+1);
+	memcpy(entry.data+lmode+1, path, lpath+1);
+	post(aw, &entry);
+	return i;
+}
+
+int AWriter_Close(AWRITER *aw, int stream) {
+	AW_ENTRY entry;
+
+	if (aw == NULL || stream < 0 || stream >= AWRITER_MAX_STREAMS) return 1;
+	memset(&entry, 0, sizeof(entry));
+	entry.op = AW_CLOSE;
+	entry.stream = stream;
+	post(aw, &entry);
+	return 0;
+}
+
+/* ===========================================================================
+-- Queue bytes (copied) for a stream
+=========================================================================== */
+int AWriter_Write(AWRITER *aw, int stream, void *data, size_t len) {
+	AW_ENTRY entry;
+
+	if (aw == NULL || stream < 0 || stream >= AWRITER_MAX_STREAMS) return 1;
+	if (len == 0) return 0;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.op = AW_WRITE;
+	entry.stream = stream;
+	entry.len = len;
+	if ( (entry.data = malloc(len)) == NULL) return 2;
+	memcpy(entry.data, data, len);
+	post(aw, &entry);
+	return 0;
+}
+
+int AWriter_Printf(AWRITER *aw, int stream, char *fmt, ...) {
+	AW_ENTRY entry;
+	va_list args;
+	int n;
+
+	if (aw == NULL || stream < 0 || stream >= AWRITER_MAX_STREAMS) return 1;
+
+	va_start(args, fmt);
+	n = vsnprintf(NULL, 0, fmt, args);
+	va_end(args);
+	if (n <= 0) return (n < 0) ? 2 : 0;
+
+	memset(&entry, 0, sizeof(entry));
+	entry.op = AW_WRITE;
+	entry.stream = stream;
+	entry.len = n;
+	if ( (entry.data = malloc(n+1)) == NULL) return 2;
+	va_start(args, fmt);
+	vsnprintf(entry.data, n+1, fmt, args);
+	va_end(args);
+	post(aw, &entry);
+	return 0;
+}
+
+/* ===========================================================================
+-- Wait for everything queued so far
+=========================================================================== */
+int AWriter_Sync(AWRITER *aw) {
+	AW_ENTRY entry;
+	volatile int done = FALSE;
+
+	if (aw == NULL) return 0;
+	memset(&entry, 0, sizeof(entry));
+	entry.op = AW_SYNC;
+	entry.done = &done;
+	post(aw, &entry);
+
+	AW_LOCK(&aw->mutex);
+	while (! done) AW_WAIT(&aw->synced, &aw->mutex);
+	AW_UNLOCK(&aw->mutex);
+	return 0;
+}
+
+int AWriter_Stats(AWRITER *aw, long *stalls, long *errors) {
+	if (stalls != NULL) *stalls = (aw == NULL) ? 0 : (long) AW_LOAD(&aw->stalls);
+	if (errors != NULL) *errors = (aw == NULL) ? 0 : (long) AW_LOAD(&aw->errors);
+	return 0;
+}
+
+/* ===========================================================================
+-- Writer thread -- drain the queue, flush on the policy, sleep when idle
+=========================================================================== */
+AW_THREAD_FNC writer_thread(void *parm) {
+	AWRITER *aw = (AWRITER *) parm;
+	AW_ENTRY entry;
+	int done;
+
+	done = FALSE;
+	while (! done) {
+		while (take(aw, &entry)) process(aw, &entry);
+		flush_streams(aw, FALSE);
+
+		AW_LOCK(&aw->mutex);
+		done = aw->shutdown;
+		AW_UNLOCK(&aw->mutex);
+		if (! done) wait_idle(aw);
+	}
+
+	while (take(aw, &entry)) process(aw, &entry);			/* Anything posted during shutdown */
+	flush_streams(aw, TRUE);
+	return 0;
+}
+
+/* ===========================================================================
+-- Sleep until an entry is posted, shutdown, or the flush interval passes
+--
+-- Notes: sleeping is set before the queue is checked, and producers check
+--        it after posting, so one of the two always sees the other
+=========================================================================== */
+static void wait_idle(AWRITER *aw) {
+	AW_SLOT *slot;
+
+	AW_LOCK(&aw->mutex);
+	AW_STORE(&aw->sleeping, 1);
+	slot = &aw->slot[aw->head & (aw->depth-1)];
+	if (! aw->shutdown && AW_LOAD(&slot->seq) != aw->head+1) {
+#ifdef _WIN32
+		SleepConditionVariableCS(&aw->wake, &aw->mutex, (DWORD) (1000*aw->flush_interval));
+#else
+		struct timespec abstime;
+		clock_gettime(CLOCK_REALTIME, &abstime);
+		abstime.tv_sec  += (time_t) aw->flush_interval;
+		abstime.tv_nsec += (long) (1E9*(aw->flush_interval - (time_t) aw->flush_interval));
+		if (abstime.tv_nsec >= 1000000000L) { abstime.tv_sec++; abstime.tv_nsec -= 1000000000L; }
+		pthread_cond_timedwait(&aw->wake, &aw->mutex, &abstime);
+#endif
+	}
+	AW_STORE(&aw->sleeping, 0);
+	AW_UNLOCK(&aw->mutex);
+	return;
+}
+
+/* ===========================================================================
+-- Bounded queue -- any number of producers, the writer thread consumes
+=========================================================================== */
+static int post(AWRITER *aw, AW_ENTRY *entry) {
+	AW_SLOT *slot;
+	int64_t pos, seq;
+
+	/* No thread -- do it here, one caller at a time */
+	if (! aw->threaded) {
+		AW_LOCK(&aw->mutex);
+		process(aw, entry);
+		flush_streams(aw, FALSE);
+		AW_UNLOCK(&aw->mutex);
+		return 0;
+	}
+
+	while (TRUE) {
+		pos  = AW_LOAD(&aw->tail);
+		slot = &aw->slot[pos & (aw->depth-1)];
+		seq  = AW_LOAD(&slot->seq);
+		if (seq == pos) {
+			if (AW_CAS(&aw->tail, pos, pos+1)) break;	/* Slot is ours */
+		} else if (seq < pos) {									/* Full -- wait for the writer */
+			AW_INCREMENT(&aw->stalls);
+			AW_LOCK(&aw->mutex); AW_SIGNAL(&aw->wake); AW_UNLOCK(&aw->mutex);
+			AW_SLEEP_MS(1);
+		}
+	}
+	slot->entry = *entry;
+	AW_STORE(&slot->seq, pos+1);								/* Publish */
+
+	if (AW_LOAD(&aw->sleeping)) {
+		AW_LOCK(&aw->mutex); AW_SIGNAL(&aw->wake); AW_UNLOCK(&aw->mutex);
+	}
+	return 0;
+}
+
+static int take(AWRITER *aw, AW_ENTRY *entry) {
+	AW_SLOT *slot;
+
+	slot = &aw->slot[aw->head & (aw->depth-1)];
+	if (AW_LOAD(&slot->seq) != aw->head+1) return FALSE;	/* Empty (or not yet published) */
+	*entry = slot->entry;
+	AW_STORE(&slot->seq, aw->head+aw->depth);				/* Free for the next lap */
+	aw->head++;
+	return TRUE;
+}
+
+/* ===========================================================================
+-- Carry out one entry (writer thread, or caller when synchronous)
+=========================================================================== */
+static void process(AWRITER *aw, AW_ENTRY *entry) {
+	static char *rname = "AWriter";
+	AW_STREAM *s;
+	char *mode, *path;
+
+	s = &aw->stream[entry->stream];
+	switch (entry->op) {
+		case AW_OPEN:
+			mode = entry->data;
+			path = entry->data+strlen(mode)+1;
+			s->pending = 0;
+			s->last_flush = TPool_Timer();
+			s->failed = ( (s->funit = fopen(path, mode)) == NULL);
+			if (s->failed) {
+				AW_INCREMENT(&aw->errors);
+				fprintf(stderr, "ERROR: %s: unable to open \"%s\" (mode %s)\n", rname, path, mode); fflush(stderr);
+			} else {
+				setvbuf(s->funit, NULL, _IOFBF, AW_FILE_BUFFER);		/* Batch small writes */
+			}
+			break;
+
+		case AW_WRITE:
+			if (s->funit == NULL || s->failed) break;
+			if (fwrite(entry->data, 1, entry->len, s->funit) != entry->len) {
+				AW_INCREMENT(&aw->errors);
+				fprintf(stderr, "ERROR: %s: write to stream %d failed; further data discarded\n", rname, entry->stream); fflush(stderr);
+				s->failed = TRUE;
+			}
+			s->pending += entry->len;
+			break;
+
+		case AW_CLOSE:
+			if (s->funit != NULL && fclose(s->funit) != 0) AW_INCREMENT(&aw->errors);
+			s->funit = NULL;
+			s->failed = FALSE;
+			s->pending = 0;
+			if (aw->threaded) AW_LOCK(&aw->mutex);				/* Else already held */
+			s->in_use = FALSE;
+			if (aw->threaded) AW_UNLOCK(&aw->mutex);
+			break;
+
+		case AW_SYNC:
+			flush_streams(aw, TRUE);
+			if (aw->threaded) AW_LOCK(&aw->mutex);
+			*entry->done = TRUE;
+			AW_BROADCAST(&aw->synced);
+			if (aw->threaded) AW_UNLOCK(&aw->mutex);
+			break;
+	}
+	if (entry->data != NULL) free(entry->data);
+	return;
+}
+
+/* ===========================================================================
+-- Flush streams with enough pending data, or pending for long enough
+=========================================================================== */
+static void flush_streams(AWRITER *aw, int force) {
+	AW_STREAM *s;
+	double now;
+	int i;
+
+	now = TPool_Timer();
+	for (i=0; i<AWRITER_MAX_STREAMS; i++) {
+		s = &aw->stream[i];
+		if (s->funit == NULL || s->pending == 0) continue;
+		if (force || s->pending >= aw->flush_bytes || now-s->last_flush >= aw->flush_interval) {
+			if (fflush(s->funit) != 0 && ! s->failed) {
+				AW_INCREMENT(&aw->errors);
+				s->failed = TRUE;
+			}
+			s->pending = 0;
+			s->last_flush = now;
+		}
+	}
+	return;
+}
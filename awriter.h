@@ -0,0 +1,104 @@
+#ifndef _AWRITER_H_LOADED
+#define _AWRITER_H_LOADED
+
+/* ===========================================================================
+-- Asynchronous file writer.
+--
+-- One background thread owns a set of open files (streams) and does all
+-- of the disk I/O for them.  Callers hand it copies of the bytes through a
+-- bounded lock-free queue and return immediately, so a slow disk or network
+-- share never stalls acquisition or fitting.  Entries are processed in the
+-- order they were queued, so writes, opens and closes of a stream keep
+-- their order.
+--
+-- Streams stay open until closed.  The writer batches whatever has queued
+-- up and flushes a stream when flush_bytes have accumulated or
+-- flush_interval seconds have passed since its last flush, and always when
+-- it is closed or at AWriter_Sync().
+--
+-- If the queue is full the caller waits (in 1 ms steps) for room rather
+-- than lose data; these waits are counted by AWriter_Stats().  If the
+-- thread cannot be started the writer works synchronously in the caller.
+=========================================================================== */
+
+#include <stddef.h>
+
+typedef struct _AWRITER AWRITER;				/* Opaque */
+
+#define	AWRITER_MAX_STREAMS		(32)			/* Streams open at one time */
+#define	AWRITER_DFLT_DEPTH		(1024)		/* Queued entries */
+#define	AWRITER_DFLT_INTERVAL	(1.0)			/* Seconds between flushes */
+#define	AWRITER_DFLT_BYTES		(1<<20)		/* Bytes that force a flush */
+
+/* ===========================================================================
+-- Create or destroy a writer
+--
+-- Usage: AWRITER *AWriter_Create(int depth, double flush_interval, size_t flush_bytes);
+--        void AWriter_Free(AWRITER *aw);
+--
+-- Inputs: depth          - queue entries (rounded up to a power of 2, <= 0 for default)
+--         flush_interval - max seconds data may sit unflushed (<= 0 for default)
+--         flush_bytes    - unflushed bytes that force a flush (0 for default)
+--
+-- Return: AWriter_Create returns NULL only if memory cannot be allocated
+--
+-- Notes: AWriter_Free() writes everything still queued, closes all streams
+--        and stops the thread.
+=========================================================================== */
+AWRITER *AWriter_Create(int depth, double flush_interval, size_t flush_bytes);
+void AWriter_Free(AWRITER *aw);
+
+/* ===========================================================================
+-- Open or close a stream
+--
+-- Usage: int AWriter_Open(AWRITER *aw, char *path, char *mode);
+--        int AWriter_Close(AWRITER *aw, int stream);
+--
+-- Inputs: path, mode - as for fopen() ("a", "wb", ...)
+--         stream     - value returned by AWriter_Open()
+--
+-- Return: AWriter_Open returns the stream (>= 0) or -1 if all are in use.
+--         AWriter_Close returns 0, or 1 for an invalid stream.
+--
+-- Notes: The file is opened by the writer thread; a failure is reported
+--        on stderr there and later writes to the stream are discarded
+=========================================================================== */
+int AWriter_Open(AWRITER *aw, char *path, char *mode);
+int AWriter_Close(AWRITER *aw, int stream);
+
+/* ===========================================================================
+-- Queue bytes for a stream
+--
+-- Usage: int AWriter_Write(AWRITER *aw, int stream, void *data, size_t len);
+--        int AWriter_Printf(AWRITER *aw, int stream, char *fmt, ...);
+--
+-- Return: 0 if queued, 1 for an invalid stream, 2 if out of memory
+--
+-- Notes: The data is copied; the caller's buffer may be reused at once
+=========================================================================== */
+int AWriter_Write(AWRITER *aw, int stream, void *data, size_t len);
+int AWriter_Printf(AWRITER *aw, int stream, char *fmt, ...);
+
+/* ===========================================================================
+-- Wait until everything queued so far is written and flushed
+--
+-- Usage: int AWriter_Sync(AWRITER *aw);
+--
+-- Return: 0
+--
+-- Notes: Needed before the caller itself touches a file the writer has
+--        been writing (e.g. to truncate or reopen it)
+=========================================================================== */
+int AWriter_Sync(AWRITER *aw);
+
+/* ===========================================================================
+-- Counters since creation
+--
+-- Usage: int AWriter_Stats(AWRITER *aw, long *stalls, long *errors);
+--
+-- Output: *stalls - times a caller waited for room in the queue
+--         *errors - failed opens or writes
+=========================================================================== */
+int AWriter_Stats(AWRITER *aw, long *stalls, long *errors);
+
+#endif		/* _AWRITER_H_LOADED */
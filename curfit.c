@@ -43,6 +43,12 @@ typedef int BOOL;
 
 #define	MY_MAGIC_COOKIE	0x31415926
 
+#define	BROYDEN_STALL	(0.01)		/* Secant step improving chisqr less than this fraction gets a true Jacobian */
+#define	JAC_BLOCK		(256)			/* Points per block of the curvature matrix kernel */
+#define	GEO_H				(0.1)			/* Finite difference step (fraction of the step) for geodesic acceleration */
+#define	GEO_ALPHA		(0.75)		/* Largest acceleration relative to velocity (2|a|/|v|) */
+#define	NIELSEN_FLAMDA_MIN	(1E-6)	/* Floor on flamda with Nielsen damping (legacy limit is 1E-7) */
+
 typedef struct _CURFIT_DATA {
 	double **alpha;				/* [PARMS][PARMS] Curvature matrix row ptrs	*/
 	double *alpha_v;				/* [PARMS][PARMS] Actual data for alpha		*/
@@ -51,6 +57,13 @@ typedef struct _CURFIT_DATA {
 	double *beta;					/* [PARMS] result vector							*/
 	double *da;						/* [PARMS] change in A elements					*/
 	double   *deriv;					/* Vector for d/da functions						*/
+	double *jac;					/* [PARMS][npt] whole Jacobian (fjacobian or secant updates) */
+	double *yold;					/* [npt] yfit before the step (secant updates)	*/
+	BOOL jac_ok;					/* jac may be used in place of new derivatives	*/
+	int *run;						/* [2*nrun] first, last+1 of runs of used points	*/
+	int nrun;
+	double *work;					/* [4][PARMS] right hand side, velocity, acceleration, start */
+	double nu;						/* Nielsen growth factor for flamda					*/
 } CURFIT_DATA;
 
 /* ------------------------------- */
@@ -61,6 +74,14 @@ typedef struct _CURFIT_DATA {
 /* My internal function prototypes */
 /* ------------------------------- */
 static int matinv(double **matrix, int order);
+static void jac_curvature(CURFIT_DATA *lv, NLS_DATA *nls, double **alpha, double *beta);
+static void jac_project(CURFIT_DATA *lv, NLS_DATA *nls, double *vec, double *out);
+static void damped_matrix(double **alpha, double **array, int nvars, double flamda, BOOL normalize);
+static int cholesky(double **a, int order);
+static void cholsolve(double **l, int order, double *b);
+static int geodesic(CURFIT_DATA *lv, NLS_DATA *nls, double *da, double *rhs, double *vel, double *acc, double *xold,
+						  double **alpha, double **chol, BOOL normalize);
+static double wdot(int n, double *a, double *w, double *b);
 static void ERRprintf(const char *format, ...);
 static void TTYprintf(const char *format, ...);
 
@@ -99,6 +120,10 @@ static void TTYprintf(const char *format, ...);
 --   double *sigma;		   If not NULL, ptr to vector to receive sigma estimate
 --   double chisqr;		   Chi-square value from the fit
 --   double flamda;		   Size of change parameter (if 0 on key=0, set to reasonable value)
+--   BOOL broyden;       If TRUE, keep the Jacobian between iterations and
+--                      update it from the observed change in yfit (Broyden
+--                      rank-1 secant update) instead of calling fderiv().
+--                      See the notes below.
 --   double *yfit;			Array ptr receiving fits (if NULL, alloc on key=0)
 --   void *workspace;	Ptr to workspace (should be NULL on key=0)
 --   BOOL (*evalfnc)(struct _NLS_DATA *nls);
@@ -108,6 +133,13 @@ static void TTYprintf(const char *format, ...);
 --                      Ptr to function which evaluates derivations of the
 --                      function at the <ipt> point with respect to each of the
 --                      varying parameters.  Fills in the vector <deriv>.
+--   int (*fjacobian)(double *jac, struct _NLS_DATA *nls);
+--                      If not NULL, used instead of fderiv().  Fills in the
+--                      whole Jacobian at the current parameters in one call:
+--                      jac[k*npt+i] is the derivative at point i with respect
+--                      to parameter k (each parameter's vector contiguous).
+--                      Points that are not valid or have zero error may be
+--                      left unset.  Returns 0 if successful.
 --	  void    (*evalchi)(struct _NLS_DATA *nls);
 --                      If not NULL, routine which estimates the chi-square
 --                      fit value and sets nls->chisqr.  CurveFit() will 
@@ -132,6 +164,31 @@ static void TTYprintf(const char *format, ...);
 --       array in the workspace.  This ends up proportional to the error
 --       correlation, but is not normalized.
 --
+-- Notes on nls->broyden:
+--   The true Jacobian (fderiv) is evaluated on the first iteration, again
+--   whenever a step with the updated Jacobian increases chisqr or improves
+--   it by less than 1%, and always on the iteration that reports completion
+--   (+1), so the returned sigmas are from true derivatives.  The update is
+--   weighted by the diagonal of the curvature matrix so that it does not
+--   depend on the units of the parameters.  Costs npt*nvars doubles.
+--
+-- Notes on the step:
+--   Each trial step solves the damped (normalized) normal equations by a
+--   Cholesky factorization; matinv() is only used if the matrix is not
+--   positive definite, and for the final sigma / correlation estimates.
+--   nls->geodesic adds the geodesic acceleration correction (one more
+--   function evaluation per trial; needs the whole Jacobian, which is then
+--   kept even without fjacobian).  nls->nielsen replaces the x10 / /10
+--   flamda schedule by Nielsen's: on a rejected step flamda *= nu, nu *= 2;
+--   on an accepted one flamda *= max(1/3, 1-(2 rho-1)^3), nu = 2, with rho
+--   the ratio of actual to predicted decrease of chi^2.
+--
+-- Notes on nls->fjacobian:
+--   With a whole Jacobian (or secant updates) the curvature matrix and
+--   gradient are formed by blocked dot products over the runs of used
+--   points (valid and non-zero error, found once on NKEY_INIT), without a
+--   callback per point or strided access.
+--
 -- Documentation:
 --  (1) Basic concept and code formulation based on Bevington, Statistical
 --      Treatment of Experimental Data, 1986.   Section 11.5.
@@ -145,6 +202,11 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 	int		i,j,k, rcode;
 	int		nvars, npt, nfree;
 	BOOL     verbose, debug;
+	BOOL		fresh, accepted;				/* True Jacobian this iteration / step taken */
+	BOOL		factored;						/* Damped matrix has a Cholesky factor */
+	double	ss, r, pred, rho;
+	double	*rhs, *vel, *acc, *xold;
+	int		irun;
 	BOOL		use_valid, use_errorbar;	/* Do we have entries to use */
 	BOOL     NormalizeMatrix;				/* Should we normalize prior to inversion */
 	CURFIT_DATA *lv;							/* Local variables pointer */
@@ -225,9 +287,38 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 		lv->beta    = calloc(nvars, sizeof(*beta));				/* rslt vector	*/
 		lv->da      = calloc(nvars, sizeof(*da));					/* dv vector	*/
 		lv->deriv   = calloc(nvars, sizeof(*deriv));				/* d/da vector	*/
+		lv->work    = calloc(4*nvars, sizeof(*lv->work));			/* Step solves	*/
+		lv->nu      = 2.0;
+		lv->jac     = NULL;
+		lv->yold    = NULL;
+		lv->jac_ok  = FALSE;
+		lv->run     = NULL;
+		lv->nrun    = 0;
+		if (nls->broyden || nls->fjacobian != NULL || nls->geodesic) {
+			lv->jac  = calloc(npt*nvars, sizeof(*lv->jac));		/* Whole Jacobian	*/
+			lv->yold = calloc(npt, sizeof(*lv->yold));
+			lv->run  = calloc(npt+1, sizeof(*lv->run));			/* At most (npt+1)/2 runs */
+			if (lv->jac == NULL || lv->yold == NULL || lv->run == NULL) {
+				free(lv->jac); free(lv->yold); free(lv->run);
+				lv->jac = lv->yold = NULL; lv->run = NULL;
+				nls->broyden = FALSE;									/* Work without them */
+				nls->fjacobian = NULL;
+				nls->geodesic = FALSE;
+			} else {
+				for (i=0; i<npt; ) {										/* Runs of used points */
+					while (i < npt && ( (use_errorbar && nls->errorbar[i] == 0) || (use_valid && ! nls->valid[i])) ) i++;
+					if (i >= npt) break;
+					lv->run[2*lv->nrun] = i;
+					while (i < npt && ! ( (use_errorbar && nls->errorbar[i] == 0) || (use_valid && ! nls->valid[i])) ) i++;
+					lv->run[2*lv->nrun+1] = i;
+					lv->nrun++;
+				}
+			}
+		}
 
 		nls->workspace    = (void *) lv;				/* So I get back each time	*/
 		nls->magic_cookie = MY_MAGIC_COOKIE;		/* And I know it is there	*/
+		if (lv->work == NULL) return(-3);			/* (freed by NKEY_EXIT)		*/
 
 /* Evaluate function and return error level if user requests simple trial */
 		if ( (*nls->evalfnc)(nls) != 0) return(-2);
@@ -247,6 +338,10 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 				free(lv->beta);
 				free(lv->da);
 				free(lv->deriv);
+				if (lv->jac  != NULL) free(lv->jac);
+				if (lv->yold != NULL) free(lv->yold);
+				if (lv->run  != NULL) free(lv->run);
+				free(lv->work);
 				free(nls->workspace);		/* And the workspace itself */
 			}
 			nls->workspace = NULL;
@@ -280,6 +375,10 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 	for (i=0; i<nvars; i++) alpha[i] = &lv->alpha_v[i*nvars];
 	for (i=0; i<nvars; i++) array[i] = &lv->array_v[i*nvars];
 
+	fresh = ! (nls->broyden && lv->jac_ok);		/* Evaluate true derivatives? */
+	if (lv->jac != NULL) memcpy(lv->yold, nls->yfit, npt*sizeof(*lv->yold));
+
+Curvature:
 	for (i=0; i<nvars; i++) {							/* Clear out everything */
 		beta[i] = 0.0f;
 		for (j=0; j<=i; j++) alpha[j][i] = 0.0f;
@@ -295,23 +394,40 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 --
 -- Note: nls->fderiv is guarenteed to be called for first point of data set
 --       but will only be called on subsequent points if errorbar is non-zero.
+--       With nls->broyden, it is not called at all when the kept (secant
+--       updated) Jacobian is used, and with nls->fjacobian never.
 ------------------------------------------------------------------------- */
 /*	if (verbose) CONputs("Curvature matrix ... "); */
-	for (i=0; i<npt; i++) {
-		xtmp = use_errorbar ? nls->errorbar[i] : 1.0f;
-		if (xtmp != 0 && xtmp != 1) xtmp = 1/(xtmp*xtmp);	/* Weighting factor */
-		if (xtmp == 0 || (use_valid && ! nls->valid[i]) ) {
-			if (i == 0) {
-				rcode = (*nls->fderiv)(deriv, nls, i);			/* Get df/da|x(i)	  */
-				if (rcode != 0) return(rcode);					/* Error condition  */	
+	if (lv->jac != NULL) {								/* Whole Jacobian in the workspace */
+		if (fresh && nls->fjacobian != NULL) {
+			if ( (rcode = (*nls->fjacobian)(lv->jac, nls)) != 0) return(rcode);
+		} else if (fresh) {									/* Collect from fderiv() for secant updates */
+			if ( (lv->nrun == 0 || lv->run[0] != 0) && (rcode = (*nls->fderiv)(deriv, nls, 0)) != 0) return(rcode);
+			for (irun=0; irun<lv->nrun; irun++) {
+				for (i=lv->run[2*irun]; i<lv->run[2*irun+1]; i++) {
+					if ( (rcode = (*nls->fderiv)(deriv, nls, i)) != 0) return(rcode);
+					for (k=0; k<nvars; k++) lv->jac[k*npt+i] = deriv[k];
+				}
 			}
-			continue;
 		}
-		rcode = (*nls->fderiv)(deriv, nls, i);					/* Get df/da|x(i)	  */
-		if (rcode != 0) return(rcode);							/* Error condition  */	
-		for (j=0; j<nvars; j++) {
-			beta[j] += (nls->data[i]-nls->yfit[i])*deriv[j]*xtmp;
-			for (k=0; k<=j; k++) alpha[k][j] += deriv[j]*deriv[k]*xtmp;
+		jac_curvature(lv, nls, alpha, beta);
+	} else {
+		for (i=0; i<npt; i++) {
+			xtmp = use_errorbar ? nls->errorbar[i] : 1.0f;
+			if (xtmp != 0 && xtmp != 1) xtmp = 1/(xtmp*xtmp);	/* Weighting factor */
+			if (xtmp == 0 || (use_valid && ! nls->valid[i]) ) {
+				if (i == 0) {
+					rcode = (*nls->fderiv)(deriv, nls, i);			/* Get df/da|x(i)	  */
+					if (rcode != 0) return(rcode);					/* Error condition  */	
+				}
+				continue;
+			}
+			rcode = (*nls->fderiv)(deriv, nls, i);					/* Get df/da|x(i)	  */
+			if (rcode != 0) return(rcode);							/* Error condition  */	
+			for (j=0; j<nvars; j++) {
+				beta[j] += (nls->data[i]-nls->yfit[i])*deriv[j]*xtmp;
+				for (k=0; k<=j; k++) alpha[k][j] += deriv[j]*deriv[k]*xtmp;
+			}
 		}
 	}
 	for (j=0; j<nvars; j++) {							/* Create symmetric matrix */
@@ -341,28 +457,32 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 		}
 	}
 					
+	accepted = FALSE;
+	rhs = lv->work;  vel = lv->work+nvars;  acc = lv->work+2*nvars;  xold = lv->work+3*nvars;
 	while (TRUE) {
-		for (j=0; j<nvars; j++) {
-			if (NormalizeMatrix) {
-				for (k=0; k<nvars; k++) array[k][j] = alpha[k][j] / sqrt(alpha[k][k]*alpha[j][j]);
-				array[j][j]  = 1.0f + nls->flamda;
-			} else {
-				for (k=0; k<nvars; k++) array[k][j] = alpha[k][j];
-				array[j][j] *= 1.0f + nls->flamda;
-			}
-		}
-		matinv(array, nvars);							/* Invert it */
-		for (j=0; j<nvars; j++) {
-			da[j] = 0.0f;
-			if (NormalizeMatrix) {
-				for (k=0; k<nvars; k++) da[j] += beta[k] * array[k][j]/sqrt(alpha[k][k]*alpha[j][j]);
-			} else {
-				for (k=0; k<nvars; k++) da[j] += beta[k] * array[k][j];
+		damped_matrix(alpha, array, nvars, nls->flamda, NormalizeMatrix);
+
+/* ... Solve by Cholesky factorization; invert only if not positive definite */
+		for (j=0; j<nvars; j++) rhs[j] = NormalizeMatrix ? beta[j]/sqrt(alpha[j][j]) : beta[j];
+		factored = (cholesky(array, nvars) == 0);
+		if (factored) {
+			cholsolve(array, nvars, rhs);
+			for (j=0; j<nvars; j++) da[j] = NormalizeMatrix ? rhs[j]/sqrt(alpha[j][j]) : rhs[j];
+		} else {
+			damped_matrix(alpha, array, nvars, nls->flamda, NormalizeMatrix);
+			matinv(array, nvars);							/* Invert it */
+			for (j=0; j<nvars; j++) {
+				da[j] = 0.0f;
+				if (NormalizeMatrix) {
+					for (k=0; k<nvars; k++) da[j] += beta[k] * array[k][j]/sqrt(alpha[k][k]*alpha[j][j]);
+				} else {
+					for (k=0; k<nvars; k++) da[j] += beta[k] * array[k][j];
+				}
 			}
 		}
 
 		if (debug) {
-			TTYprintf("Matrix inverted with flamda: %f\n",nls->flamda);
+			TTYprintf("Matrix %s with flamda: %f\n", factored ? "factored" : "inverted", nls->flamda);
 			for (i=0; i<nvars; i++) TTYprintf("   da[%d] = %f\n", i, da[i]);
 		}
 
@@ -371,9 +491,26 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 			if (verbose) TTYprintf(
 				"WARNING: Internal parameter out of range (%g).  Strange function indicated.\n"
 				"          Additional iterations may/may not improve the fit.\n", nls->flamda);
+			if (lv->jac != NULL) memcpy(nls->yfit, lv->yold, npt*sizeof(*nls->yfit));
 			nls->chisqr = nls->chiold;
 			break;
 		}
+
+/* ... Geodesic acceleration -- second order correction along the step */
+		if (nls->geodesic && factored && lv->jac != NULL) {
+			rcode = geodesic(lv, nls, da, rhs, vel, acc, xold, alpha, array, NormalizeMatrix);
+			if (rcode < 0) return(rcode);
+			if (rcode == 1) {											/* Acceleration too large: trust less */
+				if (debug) TTYprintf(" Geodesic acceleration too large, increasing flamda\n");
+				if (nls->nielsen) {
+					nls->flamda *= lv->nu; lv->nu *= 2;
+				} else {
+					nls->flamda *= 10;
+				}
+				continue;
+			}
+		}
+
 		for (i=0; i<nvars; i++) {						/* Modify the parms			*/
 			tmp   = *nls->vars[i] + da[i];			/* New value					*/
 			if (nls->lower != NULL && tmp < nls->lower[i]) tmp = nls->lower[i];
@@ -394,14 +531,74 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 
 		if ( (nls->chisqr - nls->chiold)/nls->chiold > 1E-7f) {
 			for (i=0; i<nvars; i++) *nls->vars[i] = (double) da[i];	/* Change back */
-			nls->flamda *= 10;										/* Scale up		*/
+			if (! fresh) {											/* Secant Jacobian misled us */
+				if (debug) TTYprintf(" Step with updated Jacobian failed, evaluating true derivatives\n");
+				memcpy(nls->yfit, lv->yold, npt*sizeof(*nls->yfit));
+				nls->chisqr = nls->chiold;
+				fresh = TRUE;
+				goto Curvature;
+			}
+			if (nls->nielsen) {
+				nls->flamda *= lv->nu;								/* Scale up, faster each time */
+				lv->nu *= 2;
+			} else {
+				nls->flamda *= 10;									/* Scale up		*/
+			}
 			if (debug) TTYprintf(" Change in chisqr too small, trying large flambda perturbation (%g)\n", nls->flamda);
 			continue;
 		} else {
+			accepted = TRUE;
 			break;
 		}
 	}
 
+/* -------------------------------------------------------------------------------
+-- ... Nielsen damping update from the gain ratio of the accepted step
+--
+-- rho = (actual decrease of chi^2) / (decrease predicted by the quadratic
+-- model, 2 s.beta - s.alpha.s, with s the step taken).  A step that did as
+-- well as predicted reduces flamda by up to 3x; a poor one barely changes it.
+------------------------------------------------------------------------------- */
+	if (nls->nielsen && accepted) {
+		pred = 0.0;
+		for (j=0; j<nvars; j++) {
+			tmp = *nls->vars[j] - da[j];
+			pred += 2*tmp*beta[j];
+			for (k=0; k<nvars; k++) pred -= tmp*alpha[j][k]*(*nls->vars[k] - da[k]);
+		}
+		rho = (pred > 0) ? (nls->chiold-nls->chisqr)*nls->dof / pred : 1.0;
+		tmp = 1.0 - pow(2*rho-1, 3);
+		nls->flamda *= (tmp > 1.0/3.0) ? tmp : 1.0/3.0;
+		if (nls->flamda < NIELSEN_FLAMDA_MIN) nls->flamda = NIELSEN_FLAMDA_MIN;
+		lv->nu = 2.0;
+	}
+
+/* -------------------------------------------------------------------------------
+-- ... Broyden update of the kept Jacobian for the step just taken
+--
+-- J += r (D s)^T / (s^T D s) with s the step, r = dy - J s the part of the
+-- change in yfit the Jacobian failed to predict, and D = diag(alpha).
+-- A secant step that barely helped means the update has gone stale, so the
+-- next iteration evaluates the true derivatives instead.
+------------------------------------------------------------------------------- */
+	if (nls->broyden) {
+		lv->jac_ok = accepted && (fresh || nls->chiold-nls->chisqr >= BROYDEN_STALL*nls->chiold);
+		ss = 0.0;
+		for (k=0; k<nvars && lv->jac_ok; k++) {
+			da[k] = *nls->vars[k] - da[k];						/* Step actually taken */
+			ss += alpha[k][k]*da[k]*da[k];
+		}
+		if (ss <= 0) lv->jac_ok = FALSE;
+		for (irun=0; irun<lv->nrun && lv->jac_ok; irun++) {
+			for (i=lv->run[2*irun]; i<lv->run[2*irun+1]; i++) {
+				r = nls->yfit[i] - lv->yold[i];
+				for (k=0; k<nvars; k++) r -= lv->jac[k*npt+i]*da[k];
+				r /= ss;
+				for (k=0; k<nvars; k++) lv->jac[k*npt+i] += r*alpha[k][k]*da[k];
+			}
+		}
+	}
+
 /* -------------------------------------------------------------------------------
 -- ... Return with estimate of the sigma elements and/or error correlation matrix
 --
@@ -456,12 +653,12 @@ int CurveFit(int key, int iter, NLS_DATA *nls) {
 		}
 	}
 
-	nls->flamda /= 10;
+	if (! nls->nielsen) nls->flamda /= 10;
 
 /* -----------------------------------------------
 -- ... Check for completion
 ----------------------------------------------- */
-	if (fabs(nls->chisqr-nls->chiold) < nls->EpsCrit*nls->chiold) return(1);
+	if (fabs(nls->chisqr-nls->chiold) < nls->EpsCrit*nls->chiold) return(fresh ? 1 : 0);	/* Confirm with true derivatives */
 	return(0);
 }
 
@@ -624,6 +821,243 @@ int EvalChiPoisson( NLS_DATA *nls ) {
    return(nbad);
 }
 
+/* ============================================================================
+-- Curvature matrix and gradient from the whole Jacobian in the workspace
+--
+-- Usage: void jac_curvature(CURFIT_DATA *lv, NLS_DATA *nls, double **alpha, double *beta);
+--
+-- Inputs: lv    - workspace with lv->jac [nvars][npt] and the runs of used points
+--         nls   - fit (data, yfit, errorbar)
+--         alpha - cleared upper triangle receives SUM w*J_j*J_k
+--         beta  - cleared vector receives SUM w*(y-yfit)*J_j
+--
+-- Note: Points are taken in blocks of JAC_BLOCK so that the weights, the
+--       weighted residuals and each Jacobian block stay in cache while all
+--       nvars*(nvars+1)/2 products are formed.  Every inner loop runs over
+--       contiguous memory.
+============================================================================ */
+static void jac_curvature(CURFIT_DATA *lv, NLS_DATA *nls, double **alpha, double *beta) {
+
+	double w[JAC_BLOCK], res[JAC_BLOCK], *jj;
+	int irun, i0, i1, i, j, k, n, npt, nvars;
+
+	npt   = nls->npt;
+	nvars = nls->nvars;
+	for (irun=0; irun<lv->nrun; irun++) {
+		for (i0=lv->run[2*irun]; i0<lv->run[2*irun+1]; i0=i1) {
+			i1 = i0+JAC_BLOCK;
+			if (i1 > lv->run[2*irun+1]) i1 = lv->run[2*irun+1];
+			n = i1-i0;
+			for (i=0; i<n; i++) {
+				w[i] = (nls->errorbar != NULL) ? nls->errorbar[i0+i] : 1.0;
+				if (w[i] != 1) w[i] = 1/(w[i]*w[i]);						/* Weighting factor */
+				res[i] = nls->data[i0+i] - nls->yfit[i0+i];
+			}
+			for (j=0; j<nvars; j++) {
+				jj = &lv->jac[j*npt+i0];
+				beta[j] += wdot(n, jj, w, res);
+				for (k=0; k<=j; k++) alpha[k][j] += wdot(n, jj, w, &lv->jac[k*npt+i0]);
+			}
+		}
+	}
+	return;
+}
+
+/* ============================================================================
+-- Weighted dot product SUM a[i]*w[i]*b[i] (four partial sums so the loop
+-- pipelines and vectorizes without reassociation by the compiler)
+============================================================================ */
+static double wdot(int n, double *a, double *w, double *b) {
+
+	double s0=0, s1=0, s2=0, s3=0;
+	int i;
+
+	for (i=0; i+3<n; i+=4) {
+		s0 += a[i]  *w[i]  *b[i];
+		s1 += a[i+1]*w[i+1]*b[i+1];
+		s2 += a[i+2]*w[i+2]*b[i+2];
+		s3 += a[i+3]*w[i+3]*b[i+3];
+	}
+	for ( ; i<n; i++) s0 += a[i]*w[i]*b[i];
+	return (s0+s1) + (s2+s3);
+}
+
+/* ============================================================================
+-- SUM w*J_k*vec over the used points for each parameter k (out[nvars])
+============================================================================ */
+static void jac_project(CURFIT_DATA *lv, NLS_DATA *nls, double *vec, double *out) {
+
+	double w[JAC_BLOCK];
+	int irun, i0, i1, i, k, n;
+
+	for (k=0; k<nls->nvars; k++) out[k] = 0.0;
+	for (irun=0; irun<lv->nrun; irun++) {
+		for (i0=lv->run[2*irun]; i0<lv->run[2*irun+1]; i0=i1) {
+			i1 = i0+JAC_BLOCK;
+			if (i1 > lv->run[2*irun+1]) i1 = lv->run[2*irun+1];
+			n = i1-i0;
+			for (i=0; i<n; i++) {
+				w[i] = (nls->errorbar != NULL) ? nls->errorbar[i0+i] : 1.0;
+				if (w[i] != 1) w[i] = 1/(w[i]*w[i]);
+			}
+			for (k=0; k<nls->nvars; k++) out[k] += wdot(n, &lv->jac[k*nls->npt+i0], w, &vec[i0]);
+		}
+	}
+	return;
+}
+
+/* ============================================================================
+-- Damped curvature matrix for a trial step
+--
+-- Usage: void damped_matrix(double **alpha, double **array, int nvars, double flamda, BOOL normalize);
+--
+-- Output: array - alpha with its diagonal scaled by (1+flamda), normalized to
+--                 unit diagonal before damping if normalize is TRUE
+============================================================================ */
+static void damped_matrix(double **alpha, double **array, int nvars, double flamda, BOOL normalize) {
+
+	int j, k;
+
+	for (j=0; j<nvars; j++) {
+		if (normalize) {
+			for (k=0; k<nvars; k++) array[k][j] = alpha[k][j] / sqrt(alpha[k][k]*alpha[j][j]);
+			array[j][j]  = 1.0f + flamda;
+		} else {
+			for (k=0; k<nvars; k++) array[k][j] = alpha[k][j];
+			array[j][j] *= 1.0f + flamda;
+		}
+	}
+	return;
+}
+
+/* ============================================================================
+-- Cholesky factorization of a symmetric positive definite matrix
+--
+-- Usage: int cholesky(double **a, int order);
+--        void cholsolve(double **l, int order, double *b);
+--
+-- Inputs: a     - row pointers to the full symmetric matrix
+--         order - size of the matrix
+--         b     - right hand side, replaced by the solution of A x = b
+--
+-- Output: lower triangle of a replaced by L with A = L L^T
+--
+-- Return: cholesky returns 0 if successful, 1 if not positive definite
+--
+-- Note: Half the work of matinv() and no pivoting; the factor is reused
+--       for the geodesic acceleration solve.
+============================================================================ */
+static int cholesky(double **a, int order) {
+
+	int i, j, k;
+	double sum;
+
+	for (j=0; j<order; j++) {
+		sum = a[j][j];
+		for (k=0; k<j; k++) sum -= a[j][k]*a[j][k];
+		if (sum <= 0) return(1);
+		a[j][j] = sqrt(sum);
+		for (i=j+1; i<order; i++) {
+			sum = a[i][j];
+			for (k=0; k<j; k++) sum -= a[i][k]*a[j][k];
+			a[i][j] = sum / a[j][j];
+		}
+	}
+	return(0);
+}
+
+static void cholsolve(double **l, int order, double *b) {
+
+	int i, k;
+
+	for (i=0; i<order; i++) {							/* L y = b */
+		for (k=0; k<i; k++) b[i] -= l[i][k]*b[k];
+		b[i] /= l[i][i];
+	}
+	for (i=order-1; i>=0; i--) {						/* L^T x = y */
+		for (k=i+1; k<order; k++) b[i] -= l[k][i]*b[k];
+		b[i] /= l[i][i];
+	}
+	return;
+}
+
+/* ============================================================================
+-- Geodesic acceleration of a Levenberg-Marquardt step
+--
+-- Usage: int geodesic(CURFIT_DATA *lv, NLS_DATA *nls, double *da, double *rhs, double *vel, double *acc, double *xold,
+--                     double **alpha, double **chol, BOOL normalize);
+--
+-- Inputs: lv    - workspace with the whole Jacobian and yold = yfit at the parameters
+--         nls   - fit structure (parameters at the start of the step)
+--         da    - [nvars] step (velocity v) from the damped normal equations
+--         rhs, vel, acc, xold - [nvars] scratch vectors
+--         alpha - curvature matrix
+--         chol  - Cholesky factor of the damped (normalized) matrix
+--         normalize - TRUE if chol is of the normalized matrix
+--
+-- Output: da    - v + a/2 if the acceleration is accepted
+--
+-- Return: 0 if da is ready (accelerated, or unchanged if the probe hit a limit)
+--         1 if 2|a| > GEO_ALPHA |v| -- the step should be damped more
+--        -2 if the function could not be evaluated
+--
+-- Notes: The second directional derivative f_vv = (2/h) [ (f(x+hv)-f(x))/h - J v ]
+--        costs one function evaluation.  The acceleration solves the same
+--        damped system with right hand side -J^T W f_vv, so the factor is
+--        reused.  Norms are weighted by diag(alpha).  (Transtrum & Sethna,
+--        arXiv:1201.5885.)  yfit is restored to yold on return.
+============================================================================ */
+static int geodesic(CURFIT_DATA *lv, NLS_DATA *nls, double *da, double *rhs, double *vel, double *acc, double *xold,
+						  double **alpha, double **chol, BOOL normalize) {
+
+	int i, k, irun, nvars, npt;
+	double tmp, jv, vv, aa;
+	BOOL clamped;
+
+	nvars = nls->nvars;
+	npt   = nls->npt;
+	clamped = FALSE;
+	for (k=0; k<nvars; k++) {
+		vel[k]  = da[k];
+		xold[k] = *nls->vars[k];
+		tmp = xold[k] + GEO_H*vel[k];
+		if (nls->lower != NULL && tmp < nls->lower[k]) clamped = TRUE;
+		if (nls->upper != NULL && tmp > nls->upper[k]) clamped = TRUE;
+		*nls->vars[k] = tmp;
+	}
+	if (clamped) {												/* Probe would leave the limits */
+		for (k=0; k<nvars; k++) *nls->vars[k] = xold[k];
+		return(0);
+	}
+	if ( (*nls->evalfnc)(nls) != 0) {
+		for (k=0; k<nvars; k++) *nls->vars[k] = xold[k];
+		return(-2);
+	}
+	for (k=0; k<nvars; k++) *nls->vars[k] = xold[k];
+
+	/* f_vv over the used points, in place of yfit */
+	for (irun=0; irun<lv->nrun; irun++) {
+		for (i=lv->run[2*irun]; i<lv->run[2*irun+1]; i++) {
+			for (jv=0,k=0; k<nvars; k++) jv += lv->jac[k*npt+i]*vel[k];
+			nls->yfit[i] = (2/GEO_H) * ((nls->yfit[i]-lv->yold[i])/GEO_H - jv);
+		}
+	}
+	jac_project(lv, nls, nls->yfit, rhs);
+	memcpy(nls->yfit, lv->yold, npt*sizeof(*nls->yfit));
+
+	for (k=0; k<nvars; k++) rhs[k] = normalize ? -rhs[k]/sqrt(alpha[k][k]) : -rhs[k];
+	cholsolve(chol, nvars, rhs);
+	vv = aa = 0.0;
+	for (k=0; k<nvars; k++) {
+		acc[k] = normalize ? rhs[k]/sqrt(alpha[k][k]) : rhs[k];
+		vv += alpha[k][k]*vel[k]*vel[k];
+		aa += alpha[k][k]*acc[k]*acc[k];
+	}
+	if (vv > 0 && 2*sqrt(aa) > GEO_ALPHA*sqrt(vv)) return(1);
+	for (k=0; k<nvars; k++) da[k] = vel[k] + 0.5*acc[k];
+	return(0);
+}
+
 /* ============================================================================
 -- Subroutine to invert a matrix of arbitrary order
 --
@@ -725,7 +1159,7 @@ void ERRprintf(const char *format, ...) {
 	char szBuf[256];
 
 	va_start(var1, format);
-	vsprintf_s(szBuf, sizeof(szBuf), format, var1);
+	vsnprintf(szBuf, sizeof(szBuf), format, var1);
 	va_end(var1);
 	printf("%s", szBuf); fflush(stdout);
 	return;
@@ -736,7 +1170,7 @@ void TTYprintf(const char *format, ...) {
 	char szBuf[256];
 
 	va_start(var1, format);
-	vsprintf_s(szBuf, sizeof(szBuf), format, var1);
+	vsnprintf(szBuf, sizeof(szBuf), format, var1);
 	va_end(var1);
 	printf("%s", szBuf); fflush(stdout);
 	return;
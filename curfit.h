@@ -30,10 +30,16 @@ typedef struct _NLS_DATA {
 	double EpsCrit;		/* epsilon criteria for quitting					(input)	*/
 	int  dof;				/* Degrees of freedom (npt-nvars-unused pts)	(output)	*/
 	double flamda;			/* Lamda parameter									(in/out) */
+	BOOL broyden;			/* If TRUE, secant (Broyden) Jacobian updates	(input)	*/
+								/* between true derivative evaluations					*/
+	BOOL geodesic;			/* If TRUE, geodesic acceleration of each step	(input)	*/
+	BOOL nielsen;			/* If TRUE, Nielsen update of flamda				(input)	*/
 
 	int  (*evalfnc)(struct _NLS_DATA *nls);
 	int  (*fderiv) (double *deriv, struct _NLS_DATA *nls, int ipt);
+	int  (*fjacobian)(double *jac, struct _NLS_DATA *nls);	/* If !NULL, used instead of fderiv */
 	int  (*evalchi)(struct _NLS_DATA *nls);
+	void *user;				/* Unused by fit(), available to evalfnc() and fderiv()	*/
 
 /* Space will be allocated if NULL initially.  User responsibility to free  */
 	double *yfit;			/* Best fit (allocated on init if NULL)		(in/out)	*/
@@ -0,0 +1,1770 @@
+/* filmfit.c - Reentrant reflectance evaluation and fitting of film stacks */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+typedef int BOOL;
+#ifndef	TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef	FALSE
+	#define	FALSE	(0)
+#endif
+
+#include "tfoc.h"
+#include "curfit.h"
+#include "tpool.h"
+#include "tmm.h"
+#include "nkcache.h"
+#include "matdb.h"
+#include "fringe.h"
+#include "speclib.h"
+#include "filmfit.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#define	MAXITER	(20)							/* Max iterations to find solution */
+#define	MS_ITER	(6)							/* Iterations of each multi-start fit */
+#define	SCAN_STEP	(10.0)					/* Step (nm) of the single thickness scan */
+#define	COARSE_POINTS	(150)				/* Points in the scan and coarsest multi-resolution level */
+#define	FRINGE_SCAN	(50)						/* Scans longer than this try the fringe period first */
+#define	WARM_RESTART	(10.0)				/* Chi-square jump that abandons a warm start */
+#define	WARM_FLAMDA_MIN	(1E-4)			/* Limits on flamda carried into a warm start */
+#define	WARM_FLAMDA_MAX	(1E-3)			/* (the CurveFit() default) */
+
+struct _FILMFIT {
+	/* Reflectance evaluation */
+	TPOOL *pool;								/* Pool for wavelength-parallel evaluation */
+	TMM_WORK *tmm;								/* Native engine workspace					*/
+	NKCACHE *nk;								/* Cached n,k tables (structure of arrays)	*/
+	MATDB *matdb;								/* Compiled n,k database (NULL ==> TFOC)	*/
+	SPECLIB *speclib;							/* Spectral library (NULL if none)		*/
+	unsigned long nk_serial;				/* Detect discarded tables (pointer reuse)	*/
+	TFOC_LAYER *layers;						/* Layers for legacy Fresnel calc (doped)	*/
+	int dim_layers;
+
+	/* Fitting */
+	FILMFIT_PARMS *parms;					/* Problem currently being fit				*/
+	NLS_DATA nls;								/* Structure passed to CurveFit				*/
+	double *vars[FILMFIT_MAX_VARS];
+	double sigma[FILMFIT_MAX_VARS], lower[FILMFIT_MAX_VARS], upper[FILMFIT_MAX_VARS];
+	int npt;										/* Points within the fit range				*/
+	double *lambda;							/* [npt] their wavelengths, compacted		*/
+	double *data;								/* [npt] measured reflectance					*/
+	double *errorbar;							/* [npt] uncertainty								*/
+	double *yfit;								/* [npt] current fit							*/
+	double *fderiv[FILMFIT_MAX_VARS];		/* [npt] derivative vectors					*/
+	double *center;							/* [npt] values at current parameters		*/
+	int ndim;									/* Allocated size of arrays above			*/
+	volatile int cancel;						/* FilmFit_Cancel() -- fits end at once	*/
+	double correlate[FILMFIT_MAX_VARS*FILMFIT_MAX_VARS];	/* From CurveFit (varpro scaling_sigma) */
+
+	/* Coarse scan for single thickness fits (about COARSE_POINTS points) */
+	double *sx, *sy, *ss, *sf;
+	int nscan;
+
+	/* Binned spectra of the multi-resolution levels */
+	double *mr_lambda, *mr_data, *mr_errorbar;
+	int mr_dim;
+	BOOL polish;								/* Next fit only refines the given start	*/
+
+	/* Multi-start search -- one serial context per pool thread */
+	FILMFIT **child;
+	int nchild;
+	TFOC_SAMPLE **ms_sample;				/* [nchild] private copies of the stack	*/
+	int ms_layers;								/* Size of each copy							*/
+
+	/* Continuation of a series of fits (warm start) */
+	double eval_x[FILMFIT_MAX_VARS];		/* Parameters of the model in nls.yfit		*/
+	double jac_x[FILMFIT_MAX_VARS];		/* Parameters where fderiv[] was evaluated	*/
+	double *jac_y;								/* [npt] model at jac_x							*/
+	BOOL jac_ok;								/* fderiv[], jac_x and jac_y consistent	*/
+	BOOL jac_reuse;							/* Next nls_deriv() keeps fderiv[]			*/
+	double *jac_live;							/* CurveFit() workspace holding fderiv[]	*/
+	BOOL warm_ok;								/* Values below describe the last fit		*/
+	FILMFIT_PARMS warm_parms;				/* Problem of the last fit (no pointers)	*/
+	TFOC_SAMPLE *warm_sample;				/* Copy of the stack of the last fit		*/
+	int warm_layers, warm_dim;
+	int warm_npt;								/* Points in the fit range						*/
+	double *warm_lambda;						/* [warm_npt] their wavelengths, compacted	*/
+	double warm_x[FILMFIT_MAX_VARS];		/* Final parameters								*/
+	double warm_flamda, warm_chisqr;
+};
+
+/* Shared description of a multi-start search (read only in tasks) */
+typedef struct _MS_JOB {
+	FILMFIT *fit;								/* Parent context								*/
+	FILMFIT_PARMS *parms;					/* Problem being fit							*/
+	int nstart, ntask;
+	int nlayers;								/* Layers of parms->sample (with EOS)		*/
+	double *start;								/* [nstart][nvary] starting thicknesses	*/
+	double *result;							/* [nstart][nvary+1] thicknesses, scaling	*/
+	double *chisqr;							/* [nstart] result (<0 if not run)		*/
+	double deadline;							/* TPool_Timer() limit (0 if none)		*/
+} MS_JOB;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int NK_Lookup(void *parm, void *material, int npt, double *lambda, double *n, double *k);
+static int check_arrays(FILMFIT *fit, int npt);
+static void compact_range(FILMFIT *fit, FILMFIT_PARMS *parms);
+static int bin_range(FILMFIT *fit, FILMFIT_PARMS *parms, int nbin);
+static int multires(FILMFIT *fit, FILMFIT_PARMS *parms);
+static int nls_eval(NLS_DATA *nls);
+static int nls_deriv(double *results, NLS_DATA *nls, int ipt);
+static int nls_jacobian(double *jac, NLS_DATA *nls);
+static void jac_mark(FILMFIT *fit, NLS_DATA *nls);
+static void jac_keep(FILMFIT *fit, NLS_DATA *nls);
+static void deriv_columns(FILMFIT *fit, NLS_DATA *nls, double **col);
+static BOOL project_scaling(FILMFIT *fit, double *R, double *pa, double *pwrr);
+static int projected_refl(FILMFIT *fit, double *refl);
+static int projected_stats(FILMFIT *fit, FILMFIT_PARMS *parms);
+static double Estimate_Chisqr(int npt, double *x, double *y, double *s, double *f, double *pscaling);
+static void scan_single_thickness(FILMFIT *fit);
+static int fringe_window(FILMFIT *fit, double *lo, double *hi);
+static int library_start(FILMFIT *fit, FILMFIT_PARMS *parms);
+static int multistart(FILMFIT *fit, FILMFIT_PARMS *parms);
+static void ms_task(void *arg, int itask);
+static BOOL warm_compatible(FILMFIT *fit, FILMFIT_PARMS *parms);
+static void warm_save(FILMFIT *fit, FILMFIT_PARMS *parms, int rcode);
+static double warm_clamp(FILMFIT *fit, double x, double lower, double upper);
+
+/* ===========================================================================
+-- Create or release an evaluation / fit context
+--
+-- Usage: FILMFIT *FilmFit_Create(TPOOL *pool);
+--        void FilmFit_Free(FILMFIT *fit);
+--
+-- Inputs: pool - thread pool used to split wavelengths (NULL for serial)
+--
+-- Return: FilmFit_Create returns NULL on memory failure
+=========================================================================== */
+FILMFIT *FilmFit_Create(TPOOL *pool) {
+	FILMFIT *fit;
+
+	if ( (fit = calloc(1, sizeof(*fit))) == NULL) return NULL;
+	if ( (fit->tmm = TMM_CreateWork()) == NULL ||
+		  (fit->nk  = NKCache_Create(NK_Lookup, fit)) == NULL) {
+		FilmFit_Free(fit);
+		return NULL;
+	}
+	FilmFit_SetThreadPool(fit, pool);
+	return fit;
+}
+
+void FilmFit_Free(FILMFIT *fit) {
+	int i;
+
+	if (fit == NULL) return;
+	TMM_FreeWork(fit->tmm);
+	NKCache_Free(fit->nk);
+	if (fit->layers != NULL) free(fit->layers);
+	for (i=0; i<FILMFIT_MAX_VARS; i++) if (fit->fderiv[i] != NULL) free(fit->fderiv[i]);
+	if (fit->center != NULL) free(fit->center);
+	if (fit->yfit   != NULL) free(fit->yfit);
+	if (fit->lambda != NULL) free(fit->lambda);
+	if (fit->data   != NULL) free(fit->data);
+	if (fit->errorbar != NULL) free(fit->errorbar);
+	if (fit->sx != NULL) free(fit->sx);
+	if (fit->sy != NULL) free(fit->sy);
+	if (fit->ss != NULL) free(fit->ss);
+	if (fit->sf != NULL) free(fit->sf);
+	if (fit->mr_lambda   != NULL) free(fit->mr_lambda);
+	if (fit->mr_data     != NULL) free(fit->mr_data);
+	if (fit->mr_errorbar != NULL) free(fit->mr_errorbar);
+	if (fit->jac_y != NULL) free(fit->jac_y);
+	if (fit->warm_sample != NULL) free(fit->warm_sample);
+	if (fit->warm_lambda != NULL) free(fit->warm_lambda);
+	for (i=0; i<fit->nchild; i++) {
+		FilmFit_Free(fit->child[i]);
+		free(fit->ms_sample[i]);
+	}
+	if (fit->child     != NULL) free(fit->child);
+	if (fit->ms_sample != NULL) free(fit->ms_sample);
+	free(fit);
+	return;
+}
+
+/* ===========================================================================
+-- Change the thread pool used by a context
+--
+-- Usage: void FilmFit_SetThreadPool(FILMFIT *fit, TPOOL *pool);
+=========================================================================== */
+void FilmFit_SetThreadPool(FILMFIT *fit, TPOOL *pool) {
+	if (fit == NULL) return;
+	fit->pool = pool;
+	TMM_SetThreadPool(fit->tmm, pool);
+	return;
+}
+
+/* ===========================================================================
+-- Discard the cached n,k tables
+--
+-- Usage: void FilmFit_ClearCache(FILMFIT *fit);
+=========================================================================== */
+void FilmFit_ClearCache(FILMFIT *fit) {
+	int i;
+
+	if (fit == NULL) return;
+	NKCache_Clear(fit->nk);
+	TMM_ClearCache(fit->tmm);
+	fit->nk_serial = NKCache_Serial(fit->nk);
+	fit->warm_ok = fit->jac_ok = FALSE;			/* Materials may have changed */
+	for (i=0; i<fit->nchild; i++) FilmFit_ClearCache(fit->child[i]);
+	return;
+}
+
+/* ===========================================================================
+-- Use a compiled n,k database for the native engine
+--
+-- Usage: void FilmFit_SetMaterialDB(FILMFIT *fit, MATDB *db);
+=========================================================================== */
+void FilmFit_SetMaterialDB(FILMFIT *fit, MATDB *db) {
+	int i;
+
+	if (fit == NULL) return;
+	fit->matdb = db;
+	for (i=0; i<fit->nchild; i++) fit->child[i]->matdb = db;
+	FilmFit_ClearCache(fit);						/* Material identities change */
+	return;
+}
+
+/* ===========================================================================
+-- Take starting points from a precomputed spectral library
+--
+-- Usage: void FilmFit_SetLibrary(FILMFIT *fit, SPECLIB *lib);
+=========================================================================== */
+void FilmFit_SetLibrary(FILMFIT *fit, SPECLIB *lib) {
+	if (fit == NULL) return;
+	fit->speclib = lib;
+	return;
+}
+
+/* ===========================================================================
+-- Abandon the fit running in a context (from another thread)
+--
+-- Usage: void FilmFit_Cancel(FILMFIT *fit);
+=========================================================================== */
+void FilmFit_Cancel(FILMFIT *fit) {
+	if (fit == NULL) return;
+	fit->cancel = TRUE;
+	return;
+}
+
+/* ===========================================================================
+-- Evaluate n,k of a material over a wavelength grid (NKCACHE lookup routine)
+--
+-- Usage: int NK_Lookup(void *parm, void *material, int npt, double *lambda, double *n, double *k);
+--
+-- Inputs: parm     - FILMFIT context
+--         material - entry in the context's compiled database, or
+--                    TFOC_MATERIAL * from TFOC_FindMaterial
+--         npt      - number of wavelengths
+--         lambda   - wavelengths (nm)
+--         n, k     - arrays [npt] to receive optical constants
+--
+-- Return: 0 if successful, 1 if material is NULL
+=========================================================================== */
+static int NK_Lookup(void *parm, void *material, int npt, double *lambda, double *n, double *k) {
+	FILMFIT *fit = (FILMFIT *) parm;
+	int i;
+	COMPLEX nk;
+
+	if (material == NULL) return 1;
+	if (MatDB_Owns(fit->matdb, material)) return MatDB_NK(fit->matdb, material, npt, lambda, n, k);
+	for (i=0; i<npt; i++) {
+		nk = TFOC_FindNK((TFOC_MATERIAL *) material, lambda[i]);
+		n[i] = nk.x;
+		k[i] = nk.y;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Reflectance and analytic thickness derivatives using the native engine
+--
+-- Usage: int FilmFit_ReflDeriv(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode,
+--                              int npt, double *lambda, double *refl, double **dRdz);
+--
+-- Inputs: fit     - context from FilmFit_Create()
+--         sample  - pointer to TFOC_SAMPLE structure describing the film stack
+--         scaling - divides the calculated reflectance (see FilmFit_Refl)
+--         theta   - angle of incidence (radians)
+--         mode    - polarization
+--         npt     - number of points in the data set
+--         lambda  - pointer to existing wavelengths to be processed
+--         refl    - pointer to array to be filled with reflectance values
+--         dRdz    - NULL, or array indexed like sample[] of pointers to
+--                   arrays [npt] for d(refl)/dz of that layer (NULL entries
+--                   are not calculated)
+--
+-- Output: *refl - filled with reflectance / scaling
+--         dRdz[j][i] - derivative of refl[i] with respect to sample[j].z (per nm)
+--
+-- Return: 0 if successful
+--         1 if the sample cannot be handled by the native engine (doping profiles)
+--        <0 on errors
+=========================================================================== */
+int FilmFit_ReflDeriv(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, int npt, double *lambda, double *refl, double **dRdz) {
+
+	int i,j;
+	int nlayers;							/* Number of layers			*/
+
+	NKCACHE_GRID *grid;
+	void *material;
+	double *n_tmm[TMM_MAX_LAYERS], *k_tmm[TMM_MAX_LAYERS], zval[TMM_MAX_LAYERS], *d_tmm[TMM_MAX_LAYERS];
+	TMM_STACK stack;
+
+	if (fit == NULL || sample == NULL) return -2;
+
+	/* Only simple layers (no doping profiles) */
+	nlayers = 0;
+	for (i=0; sample[i].type != EOS; i++) {
+		if (sample[i].type == IGNORE_LAYER) continue;
+		if (sample[i].doping_profile != NO_DOPING) return 1;
+		nlayers++;
+	}
+	if (nlayers < 2 || nlayers > TMM_MAX_LAYERS) return 1;
+
+	if ( (grid = NKCache_Grid(fit->nk, npt, lambda)) == NULL) return 1;
+	if (NKCache_Serial(fit->nk) != fit->nk_serial) {				/* Table pointers may be reused */
+		fit->nk_serial = NKCache_Serial(fit->nk);
+		TMM_ClearCache(fit->tmm);
+	}
+
+	for (j=nlayers=0; sample[j].type != EOS; j++) {
+		if (dRdz != NULL && dRdz[j] != NULL && sample[j].type == IGNORE_LAYER) {
+			for (i=0; i<npt; i++) dRdz[j][i] = 0.0;
+		}
+		if (sample[j].type == IGNORE_LAYER) continue;
+		if (fit->matdb == NULL || (material = MatDB_Find(fit->matdb, sample[j].name)) == NULL) material = sample[j].material;
+		if (NKCache_Lookup(fit->nk, grid, material, &n_tmm[nlayers], &k_tmm[nlayers]) != 0) return -3;
+		zval[nlayers]  = sample[j].z;
+		d_tmm[nlayers] = (dRdz != NULL) ? dRdz[j] : NULL;
+		nlayers++;
+	}
+	stack.npt = npt;			stack.lambda = lambda;
+	stack.nlayers = nlayers;	stack.z = zval;
+	stack.n = n_tmm;			stack.k = k_tmm;
+
+	if (TMM_ReflectanceDeriv(fit->tmm, &stack, theta, mode, refl, (dRdz != NULL) ? d_tmm : NULL) != 0) return -3;
+
+	if (scaling != 1.0) {
+		for (i=0; i<npt; i++) refl[i] /= scaling;
+		for (j=0; dRdz != NULL && j<nlayers; j++) {
+			if (d_tmm[j] != NULL) for (i=0; i<npt; i++) d_tmm[j][i] /= scaling;
+		}
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Routine to calculate the theoretical reflectance (with possible correction for fitting work)
+--
+-- Usage: int FilmFit_Refl(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, double temperature, int npt, double *lambda, double *refl);
+--
+-- Inputs: fit     - context from FilmFit_Create()
+--         sample  - pointer to TFOC_SAMPLE structure describing the film stack
+--         scaling - scaling factor that ultimately will be applied to data, but here *divides* the calculated reflectance
+--                   for production, this should be 1.0 giving exact values
+--                   A value of 1.2 would normally scale up experimental data by a factor of 1.2
+--                     but in this routine scales down the calculated reflectivity by the same 1.2
+--                   This permits comparison of raw data to calculations in fit
+--         theta - angle of incidence (radians)
+--         polarization - obvious
+--         temperature  - obvious (only used for doping profiles)
+--         npt - number of points in the data set
+--         lambda - pointer to existing wavelengths to be processed
+--         refl   - pointer to array to be filled with reflectance values
+--
+-- Output: *refl - filled with reflectance at each of the given wavelengths
+--
+-- Return: 0 if successful
+--
+-- Notes: Stacks without doping profiles (everything FilmMeasure builds) are
+--        calculated with the native vectorized engine in tmm.c over the full
+--        wavelength array in one call.  Samples with doping profiles still go
+--        wavelength by wavelength through TFOC_MakeLayers / TFOC_ReflN.
+--
+--        The n,k tables for each material are kept in an NKCACHE keyed by
+--        material and wavelength grid, so the database is only interpolated
+--        the first time a material is seen on a given grid.
+--
+--        When successive calls change only one layer thickness (the usual
+--        single-layer fit, or the brute force scan) the engine reuses the
+--        partial matrix products above and below that layer.
+=========================================================================== */
+int FilmFit_Refl(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, double temperature, int npt, double *lambda, double *refl) {
+	static char *rname = "FilmFit_Refl";
+
+	int i,j;
+	int nlayers;							/* Number of layers			*/
+	int rc;
+	TFOC_LAYER *layers;
+
+	/* Must have both a context and a sample */
+	if (fit == NULL || sample == NULL) {
+		fprintf(stderr, "ERROR: %s: Must have a context and sample structure\n", rname); fflush(stderr);
+		return -2;
+	}
+
+	/* Native path handles everything without doping profiles */
+	if ( (rc = FilmFit_ReflDeriv(fit, sample, scaling, theta, mode, npt, lambda, refl, NULL)) <= 0) return rc;
+
+	/* ----------------------------------------------------------
+	-- Pre-process sample structure - don't have temperature yet
+	-- Identify the material database information and
+	-- at the same time, figure out how big the actual layer
+	-- array will need to be given expansion of profiles, etc.
+	---------------------------------------------------------- */
+	nlayers = 0;
+	for (i=0; sample[i].type != EOS; i++) {
+		switch (sample[i].doping_profile) {
+			case NO_DOPING:
+			case CONSTANT:
+				nlayers++;
+				break;
+			case EXPONENTIAL:
+			case LINEAR_IMPLANT:
+			case LINEAR:
+				nlayers += sample[i].doping_layers;
+		}
+	}
+
+	/* Make sure that we have space for the needed number of layers */
+	/* Kept in the context so can be reused each time without multiple allocations */
+	if (nlayers >= fit->dim_layers) {
+		if ( (layers = realloc(fit->layers, (nlayers+1)*sizeof(*layers))) == NULL) return -3;
+		fit->layers = layers;
+		fit->dim_layers = nlayers+1;											/* One extra for safety */
+		memset(fit->layers, 0, fit->dim_layers*sizeof(*fit->layers));
+	}
+	layers = fit->layers;
+
+	/* ----------------------------------------------------------
+	-- Okay, run the wavelengths.  Each time need to get the NK
+	-- values for each layer in the sample.  And then generate
+	-- the layer structure for running TFOC_ReflN
+	---------------------------------------------------------- */
+	for (i=0; i<npt; i++) {
+		for (j=0; sample[j].type != EOS; j++) {
+			sample[j].n = TFOC_FindNK(sample[j].material, lambda[i]);
+		}
+		TFOC_MakeLayers(sample, layers, temperature, lambda[i]);
+		refl[i] = TFOC_ReflN(theta, mode, lambda[i], layers).R / scaling;
+	}
+
+	return 0;
+}
+
+/* ===========================================================================
+-- Make sure the per-point arrays of the context hold npt values
+--
+-- Return: 0 if successful, -3 on memory failure
+=========================================================================== */
+static int check_arrays(FILMFIT *fit, int npt) {
+	static char *rname = "FilmFit_Fit";
+	int i;
+	BOOL ok;
+
+	if (npt <= fit->ndim) return 0;
+
+	ok = (fit->center = realloc(fit->center, npt*sizeof(double))) != NULL;
+	ok = ok && (fit->yfit  = realloc(fit->yfit,  npt*sizeof(double))) != NULL;
+	ok = ok && (fit->lambda = realloc(fit->lambda, npt*sizeof(double))) != NULL;
+	ok = ok && (fit->data   = realloc(fit->data,   npt*sizeof(double))) != NULL;
+	ok = ok && (fit->errorbar = realloc(fit->errorbar, npt*sizeof(double))) != NULL;
+	ok = ok && (fit->jac_y = realloc(fit->jac_y, npt*sizeof(double))) != NULL;
+	ok = ok && (fit->warm_lambda = realloc(fit->warm_lambda, npt*sizeof(double))) != NULL;
+	for (i=0; ok && i<FILMFIT_MAX_VARS; i++) ok = (fit->fderiv[i] = realloc(fit->fderiv[i], npt*sizeof(double))) != NULL;
+	if (! ok) {
+		fprintf(stderr, "ERROR: %s: unable to allocate fit workspace\n", rname); fflush(stderr);
+		fit->ndim = 0;
+		fit->warm_ok = FALSE;
+		return -3;
+	}
+	fit->ndim = npt;
+	return 0;
+}
+
+/* ===========================================================================
+-- Copy the points within lambda_min/max (and with nonzero sigma) to the
+-- compact arrays of the context; the model is only evaluated at these
+=========================================================================== */
+static void compact_range(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	int i, j;
+
+	for (i=j=0; i<parms->npt; i++) {
+		if (parms->lambda[i] < parms->lambda_min || parms->lambda[i] > parms->lambda_max || parms->sigma[i] == 0) continue;
+		fit->lambda[j]   = parms->lambda[i];
+		fit->data[j]     = parms->refl[i];
+		fit->errorbar[j] = parms->sigma[i];
+		j++;
+	}
+	fit->npt = j;
+	return;
+}
+
+/* ===========================================================================
+-- Bin the points within the fit range for a multi-resolution level
+--
+-- Usage: int bin_range(FILMFIT *fit, FILMFIT_PARMS *parms, int nbin);
+--
+-- Inputs: nbin - consecutive points (as in compact_range) per bin
+--
+-- Output: fit->mr_lambda, mr_data, mr_errorbar - the binned spectrum
+--
+-- Return: number of bins, or -3 on memory failure
+--
+-- Notes: Data are averaged with weights 1/sigma^2 and the error bar of a
+--        bin is 1/sqrt(sum 1/sigma^2), so chi-square keeps its meaning.  The
+--        wavelength is the plain mean of the bin.  A short last bin is kept.
+=========================================================================== */
+static int bin_range(FILMFIT *fit, FILMFIT_PARMS *parms, int nbin) {
+	static char *rname = "FilmFit_Fit";
+	double w, sw, swx, swy;
+	int i, j, k, n;
+
+	n = parms->npt/nbin + 1;
+	if (n > fit->mr_dim) {
+		fit->mr_lambda   = realloc(fit->mr_lambda,   n*sizeof(double));
+		fit->mr_data     = realloc(fit->mr_data,     n*sizeof(double));
+		fit->mr_errorbar = realloc(fit->mr_errorbar, n*sizeof(double));
+		if (fit->mr_lambda == NULL || fit->mr_data == NULL || fit->mr_errorbar == NULL) {
+			fprintf(stderr, "ERROR: %s: unable to allocate multi-resolution workspace\n", rname); fflush(stderr);
+			fit->mr_dim = 0;
+			return -3;
+		}
+		fit->mr_dim = n;
+	}
+
+	sw = swx = swy = 0; k = j = 0;
+	for (i=0; i<parms->npt; i++) {
+		if (parms->lambda[i] < parms->lambda_min || parms->lambda[i] > parms->lambda_max || parms->sigma[i] == 0) continue;
+		w = 1.0 / (parms->sigma[i]*parms->sigma[i]);
+		sw  += w;
+		swx += parms->lambda[i];
+		swy += w * parms->refl[i];
+		if (++k == nbin) {
+			fit->mr_lambda[j]   = swx / k;
+			fit->mr_data[j]     = swy / sw;
+			fit->mr_errorbar[j] = 1.0 / sqrt(sw);
+			j++;
+			sw = swx = swy = 0; k = 0;
+		}
+	}
+	if (k > 0) {
+		fit->mr_lambda[j]   = swx / k;
+		fit->mr_data[j]     = swy / sw;
+		fit->mr_errorbar[j] = 1.0 / sqrt(sw);
+		j++;
+	}
+	return j;
+}
+
+/* ============================================================================
+-- func_eval - Fill in YFIT with value of function
+--
+-- Usage: logical = func_eval(nls)
+--
+-- Inputs: nls->user - FILMFIT context, with fit->parms the current problem
+--
+-- Output: nls->yfit - Curve containing the fit
+--
+-- Return: 0 if successful, !0 on evaluation failure
+============================================================================ */
+static int nls_eval(NLS_DATA *nls) {
+	int i;
+	FILMFIT *fit;
+	FILMFIT_PARMS *parms;
+
+	fit = (FILMFIT *) nls->user;
+	parms = fit->parms;
+
+	for (i=0; i<nls->nvars; i++) fit->eval_x[i] = *nls->vars[i];		/* Model in yfit is at these */
+	if (parms->varpro) return projected_refl(fit, nls->yfit);
+	return FilmFit_Refl(fit, parms->sample, parms->scaling, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, nls->yfit) != 0;
+}
+
+/* ===========================================================================
+-- Closed-form scaling for variable projection
+--
+-- Usage: BOOL project_scaling(FILMFIT *fit, double *R, double *pa, double *pwrr);
+--
+-- Inputs: fit - context (fit->parms and fit->nls describe the problem)
+--         R   - [npt] unscaled model reflectance
+--
+-- Output: *pa   - a = 1/scaling minimizing sum w (y - a R)^2 over the valid
+--                 points (w = 1/sigma^2), limited to the scaling range
+--         *pwrr - if not NULL, sum w R^2 (curvature in a)
+--
+-- Return: TRUE if a was limited by the scaling range (then da/dz = 0)
+=========================================================================== */
+static BOOL project_scaling(FILMFIT *fit, double *R, double *pa, double *pwrr) {
+	FILMFIT_PARMS *parms;
+	NLS_DATA *nls;
+	double w, wyr, wrr, a, amin, amax;
+	int i;
+	BOOL clamped;
+
+	parms = fit->parms;
+	nls = &fit->nls;
+
+	wyr = wrr = 0.0;
+	for (i=0; i<fit->npt; i++) {
+		if (nls->errorbar[i] == 0) continue;
+		w = 1.0 / (nls->errorbar[i]*nls->errorbar[i]);
+		wyr += w * nls->data[i] * R[i];
+		wrr += w * R[i] * R[i];
+	}
+	a = (wrr > 0 && wyr > 0) ? wyr / wrr : 1.0 / parms->scaling;		/* Degenerate -- keep current */
+
+	clamped = FALSE;
+	if (parms->scaling_min > 0 && parms->scaling_max > parms->scaling_min) {
+		amin = 1.0 / parms->scaling_max;
+		amax = 1.0 / parms->scaling_min;
+		if (a < amin) { a = amin; clamped = TRUE; }
+		if (a > amax) { a = amax; clamped = TRUE; }
+	}
+
+	*pa = a;
+	if (pwrr != NULL) *pwrr = wrr;
+	return clamped;
+}
+
+/* ===========================================================================
+-- Reflectance with the scaling eliminated (variable projection model)
+--
+-- Usage: int projected_refl(FILMFIT *fit, double *refl);
+--
+-- Output: refl[npt]      - a*R with a from project_scaling()
+--         parms->scaling - 1/a, so the current scaling is always available
+--
+-- Return: 0 if successful, !0 on evaluation failure
+=========================================================================== */
+static int projected_refl(FILMFIT *fit, double *refl) {
+	FILMFIT_PARMS *parms;
+	double a;
+	int i;
+
+	parms = fit->parms;
+	if (FilmFit_Refl(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, refl) != 0) return 1;
+	project_scaling(fit, refl, &a, NULL);
+	parms->scaling = 1.0 / a;
+	for (i=0; i<fit->npt; i++) refl[i] *= a;
+	return 0;
+}
+
+/* ===========================================================================
+-- Statistics of a variable projection fit
+--
+-- Usage: int projected_stats(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Inputs: fit   - context, with fit->nls (sigma, correlate, chisqr, dof) as
+--                 left by CurveFit() for the thicknesses alone
+--         parms - problem just fit, thicknesses at their best values
+--
+-- Output: parms->dof, chisqr, sigmaest - with the eliminated scaling counted
+--                 as a parameter, as it is without varpro
+--         parms->scaling, scaling_sigma - projected value and its marginal
+--                 uncertainty
+--
+-- Return: 0 if successful, !0 if the model could not be evaluated (then
+--         scaling_sigma is 0)
+--
+-- Notes: With a = 1/scaling the full information matrix has F_aa = sum w R^2
+--        and F_az = sum w R (a dR/dz).  The projected Jacobian already gives
+--        the marginal thickness covariance C, so
+--           var(a) = 1/F_aa + g^T C g,  g = -F_az/F_aa
+--        Without the second term it would be the uncertainty with the
+--        thicknesses held fixed, which is too small.  A scaling at its
+--        limit has no first order dependence on z and keeps 1/F_aa.
+=========================================================================== */
+static int projected_stats(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	NLS_DATA *nls = &fit->nls;
+	double *dRdz[TMM_MAX_LAYERS], *deriv, g[FILMFIT_MAX_VARS];
+	double a, wrr, w, var, *v, tmp;
+	int i, j, nvary, rc;
+	BOOL clamped;
+
+	/* One more parameter than CurveFit saw */
+	if (nls->dof > 1) {
+		parms->dof      = nls->dof - 1;
+		parms->chisqr   = nls->chisqr * nls->dof / parms->dof;
+		parms->sigmaest = sqrt(parms->chisqr);
+	}
+
+	parms->scaling_sigma = 0.0;
+	nvary = parms->nvary;
+	if ( (deriv = malloc((nvary > 0 ? nvary : 1)*fit->npt*sizeof(*deriv))) == NULL) return 1;		/* fderiv[] is kept for a warm start */
+
+	/* Unscaled model and its thickness derivatives -- analytic or by difference */
+	for (j=0; parms->sample[j].type != EOS; j++) ;
+	rc = 1;
+	if (parms->analytic_deriv && j <= TMM_MAX_LAYERS) {
+		for (j=0; j<TMM_MAX_LAYERS; j++) dRdz[j] = NULL;
+		for (i=0; i<nvary; i++) dRdz[parms->layer[i]] = deriv + i*fit->npt;
+		rc = FilmFit_ReflDeriv(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, fit->npt, fit->lambda, fit->center, dRdz);
+	}
+	if (rc != 0) {
+		if ( (rc = FilmFit_Refl(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, fit->center)) == 0) {
+			for (i=0; i<nvary; i++) {
+				v = &parms->sample[parms->layer[i]].z;
+				tmp = *v;
+				*v += 1.0;
+				FilmFit_Refl(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, deriv + i*fit->npt);
+				*v = tmp;
+				for (j=0; j<fit->npt; j++) deriv[i*fit->npt+j] -= fit->center[j];
+			}
+		}
+	}
+	if (rc != 0) { free(deriv); return rc; }
+
+	clamped = project_scaling(fit, fit->center, &a, &wrr);
+	parms->scaling = 1.0 / a;
+	if (wrr <= 0) { free(deriv); return 0; }
+
+	var = 1.0 / wrr;
+	for (i=0; i<nvary; i++) {
+		g[i] = 0.0;
+		for (j=0; ! clamped && j<fit->npt; j++) {
+			if (nls->errorbar[j] == 0) continue;
+			w = 1.0 / (nls->errorbar[j]*nls->errorbar[j]);
+			g[i] -= w * fit->center[j] * a*deriv[i*fit->npt+j];
+		}
+		g[i] /= wrr;
+	}
+	for (i=0; i<nvary; i++) {
+		for (j=0; j<nvary; j++) var += g[i]*g[j] * fit->correlate[i*nvary+j]*nls->sigma[i]*nls->sigma[j];
+	}
+	if (! (var >= 1.0/wrr)) var = 1.0/wrr;							/* Singular C (NaN) -- conditional only */
+	parms->scaling_sigma = sqrt(var) / (a*a);						/* sigma_s = sigma_a / a^2 */
+
+	free(deriv);
+	return 0;
+}
+
+/* ============================================================================
+-- ... Subroutine to determine the derivatives with respect to each of the
+-- ... varied parameters.
+--
+-- Usage: LOGICAL = func_deriv(results, nls, ipt)
+--
+-- Inputs: nls - fit structure (nls->user is the FILMFIT context)
+--         ipt - Point # at which to evaluate derivatives
+--
+-- ... On ipt == 0 the whole derivative vectors are built by deriv_columns()
+-- ... into fit->fderiv[]; other points are a simple lookup.
+--
+-- Output: results[i] - Value of the derivatives
+-- ========================================================================== */
+static int nls_deriv(double *results, NLS_DATA *nls, int ipt) {
+
+	int i;
+	FILMFIT *fit;
+
+	fit = (FILMFIT *) nls->user;
+
+	/* On ipt == 0, do the full vector (unless a warm start carries over the
+	 * Jacobian from the end of the last fit).  After that, simple lookup */
+	if (ipt == 0) {
+		jac_mark(fit, nls);
+		if (fit->jac_reuse) {
+			fit->jac_reuse = FALSE;
+		} else {
+			deriv_columns(fit, nls, fit->fderiv);
+		}
+	}
+
+	/* Now have data stored as a vector ... just return the appropriate points */
+	for (i=0; i<nls->nvars; i++) results[i] = fit->fderiv[i][ipt];
+	return 0;
+}
+
+/* ===========================================================================
+-- Whole Jacobian for CurveFit() in one call
+--
+-- Usage: int nls_jacobian(double *jac, NLS_DATA *nls);
+--
+-- Output: jac[k*npt+i] - derivative of point i with respect to variable k
+--
+-- Notes: The columns are built in place in jac.  fit->fderiv[] (kept for a
+--        warm start of the next fit) is filled from it once, just before
+--        CurveFit() releases its workspace; with nls->broyden the secant
+--        updates rewrite jac, so the copy is taken here instead.
+=========================================================================== */
+static int nls_jacobian(double *jac, NLS_DATA *nls) {
+	FILMFIT *fit;
+	double *col[FILMFIT_MAX_VARS];
+	int k;
+
+	fit = (FILMFIT *) nls->user;
+	jac_mark(fit, nls);
+	if (fit->jac_reuse) {										/* Carried from the last fit of the series */
+		fit->jac_reuse = FALSE;
+		for (k=0; k<nls->nvars; k++) memcpy(&jac[k*nls->npt], fit->fderiv[k], nls->npt*sizeof(*jac));
+		return 0;
+	}
+
+	for (k=0; k<nls->nvars; k++) col[k] = &jac[k*nls->npt];
+	deriv_columns(fit, nls, col);
+	fit->jac_live = jac;
+	if (nls->broyden) jac_keep(fit, nls);
+	return 0;
+}
+
+/* ===========================================================================
+-- Copy the Jacobian built in CurveFit()'s workspace to fit->fderiv[]
+=========================================================================== */
+static void jac_keep(FILMFIT *fit, NLS_DATA *nls) {
+	int k;
+
+	if (fit->jac_live == NULL) return;
+	for (k=0; k<nls->nvars; k++) memcpy(fit->fderiv[k], &fit->jac_live[k*nls->npt], nls->npt*sizeof(*fit->jac_live));
+	fit->jac_live = NULL;
+	return;
+}
+
+/* ===========================================================================
+-- Remember where the Jacobian is taken (secant update at the end of the fit)
+=========================================================================== */
+static void jac_mark(FILMFIT *fit, NLS_DATA *nls) {
+	int i;
+
+	fit->jac_ok = TRUE;
+	for (i=0; i<nls->nvars; i++) {
+		fit->jac_x[i] = *nls->vars[i];
+		if (fit->jac_x[i] != fit->eval_x[i]) fit->jac_ok = FALSE;
+	}
+	memcpy(fit->jac_y, nls->yfit, fit->npt*sizeof(*fit->jac_y));
+	return;
+}
+
+/* ============================================================================
+-- Derivative vectors with respect to each of the varied parameters
+--
+-- Usage: void deriv_columns(FILMFIT *fit, NLS_DATA *nls, double **col);
+--
+-- Inputs: fit - context, with fit->parms the current problem
+--         nls - fit structure (variables at their current values)
+--         col - [nvars] pointers to [npt] output vectors
+--
+-- Output: col[i][j] - derivative of point j with respect to variable i
+--
+-- ... With parms->analytic_deriv set (default), thickness derivatives
+-- ... come from the transfer-matrix engine in the same pass as the
+-- ... reflectance, written straight into col[], and the scaling
+-- ... derivative is closed form since the model is R/s, d/ds = -R/s^2.
+-- ... Otherwise (or for doped samples) we use the finite difference
+-- ... method - takes twice as many calculations, but NBD.
+-- ...
+-- ... With parms->varpro the model is a(z)*R(z) with a = 1/scaling solved
+-- ... in closed form, and only thicknesses are variables.  The derivative
+-- ... is the full one including da/dz:
+-- ...    d(aR)/dz = a R' + R (sum w y R' - 2a sum w R R') / sum w R^2
+-- ========================================================================== */
+static void deriv_columns(FILMFIT *fit, NLS_DATA *nls, double **col) {
+
+	int i,j;
+	double tmp, delta, *v;
+	double *dRdz[TMM_MAX_LAYERS];					/* Analytic derivatives indexed by tfoc layer */
+	int iscale;
+	double a, wrr, w, wyd, wrd, dadz;
+	BOOL clamped;
+
+	FILMFIT_PARMS *parms;
+
+	parms = fit->parms;
+
+	/* Analytic derivatives -- variables are the thicknesses in order, then the scaling */
+	if (parms->analytic_deriv) {
+		for (j=0; parms->sample[j].type != EOS; j++) ;
+		if (j <= TMM_MAX_LAYERS) {
+			for (j=0; j<TMM_MAX_LAYERS; j++) dRdz[j] = NULL;
+			for (i=0; i<parms->nvary; i++) dRdz[parms->layer[i]] = col[i];
+			iscale = parms->nvary;
+			if (parms->varpro && FilmFit_ReflDeriv(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, fit->npt, fit->lambda, fit->center, dRdz) == 0) {
+				clamped = project_scaling(fit, fit->center, &a, &wrr);
+				parms->scaling = 1.0 / a;
+				for (i=0; i<parms->nvary; i++) {
+					wyd = wrd = 0.0;
+					for (j=0; ! clamped && j<fit->npt; j++) {
+						if (nls->errorbar[j] == 0) continue;
+						w = 1.0 / (nls->errorbar[j]*nls->errorbar[j]);
+						wyd += w * nls->data[j]   * col[i][j];
+						wrd += w * fit->center[j] * col[i][j];
+					}
+					dadz = (! clamped && wrr > 0) ? (wyd - 2*a*wrd) / wrr : 0.0;
+					for (j=0; j<fit->npt; j++) col[i][j] = a*col[i][j] + dadz*fit->center[j];
+				}
+				return;
+			}
+			if (! parms->varpro && FilmFit_ReflDeriv(fit, parms->sample, parms->scaling, 0.0, UNPOLARIZED, fit->npt, fit->lambda, fit->center, dRdz) == 0) {
+				for (j=0; j<fit->npt; j++) col[iscale][j] = -fit->center[j] / parms->scaling;
+				return;
+			}
+		}
+	}
+
+	/* Evaluate at the center point */
+	if (parms->varpro) {
+		projected_refl(fit, fit->center);
+		tmp = parms->scaling;								/* Projected scaling at the center */
+		for (i=0; i<nls->nvars; i++) {					/* Projected model -- da/dz included by differencing */
+			v = nls->vars[i];
+			*v += 1.0;
+			projected_refl(fit, col[i]);
+			for (j=0; j<fit->npt; j++) col[i][j] = col[i][j]-fit->center[j];
+			*v -= 1.0;
+		}
+		parms->scaling = tmp;
+		return;
+	}
+	FilmFit_Refl(fit, parms->sample, parms->scaling, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, fit->center);
+
+	for (i=0; i<nls->nvars; i++) {
+		v = nls->vars[i];
+		tmp = *v;
+		if (i != nls->nvars-1) {
+			delta = 1.0;								/* Use a 1 nm change so tfoc has a chance (always +) */
+		} else {
+			delta = 0.01;
+		}
+		*v +=   delta;
+		FilmFit_Refl(fit, parms->sample, parms->scaling, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, col[i]);
+		for (j=0; j<fit->npt; j++) col[i][j] = (col[i][j]-fit->center[j])/delta;
+		*v = tmp;
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Do quick estimate of normalization and sigma for a brute-force search
+=========================================================================== */
+static double Estimate_Chisqr(int npt, double *x, double *y, double *s, double *f, double *pscaling) {
+	int i;
+	double ysum, fsum, scaling, chisqr;
+
+	/* Calculate a normalization factor so sum(y) = sum(f) */
+	ysum = fsum = 0;
+	for (i=0; i<npt; i++) { ysum += y[i]; fsum += f[i]; }
+	scaling = ( ysum != 0 ) ? fsum / ysum : 1.0 ;
+
+	/* Calculate simplified chisqr */
+	for (i=0,chisqr=0; i<npt; i++) {
+		chisqr += pow( (scaling*y[i]-f[i])/s[i], 2);
+	}
+
+	/* Return values */
+	if (pscaling != NULL) *pscaling = scaling;
+	return chisqr / (npt-1);
+}
+
+/* ===========================================================================
+-- Thickness window for a thick film from the period of its fringes
+--
+-- Usage: int fringe_window(FILMFIT *fit, double *lo, double *hi);
+--
+-- Inputs: fit - context with fit->parms and fit->nls set up for one thickness
+--
+-- Output: *lo, *hi - thickness range (within lower/upper) to scan
+--
+-- Return: 0 if successful, nonzero if the fringes give no usable estimate
+--
+-- Notes: The optical thickness from the FFT is divided by the mean group
+--        index n - lambda dn/dlambda of the layer over the fit range, which
+--        sets the fringe period.  The window is +/- one Fourier bin (about
+--        one fringe) plus a scan step.
+=========================================================================== */
+static int fringe_window(FILMFIT *fit, double *lo, double *hi) {
+	FILMFIT_PARMS *parms;
+	NKCACHE_GRID *grid;
+	TFOC_SAMPLE *layer;
+	void *material;
+	double nd, resolution, ng, *n, *k, z, dz;
+	int i, count;
+
+	parms = fit->parms;
+	if (Fringe_OpticalThickness(fit->npt, fit->lambda, fit->data, NULL, &nd, &resolution) != 0) return 1;
+
+	/* Mean group index of the layer over the fit range */
+	layer = &parms->sample[parms->layer[0]];
+	if (fit->matdb == NULL || (material = MatDB_Find(fit->matdb, layer->name)) == NULL) material = layer->material;
+	if ( (grid = NKCache_Grid(fit->nk, fit->npt, fit->lambda)) == NULL) return 2;
+	if (NKCache_Lookup(fit->nk, grid, material, &n, &k) != 0) return 2;
+	ng = 0; count = 0;
+	for (i=1; i<fit->npt-1; i++) {
+		if (fit->lambda[i+1] == fit->lambda[i-1]) continue;
+		ng += n[i] - fit->lambda[i]*(n[i+1]-n[i-1])/(fit->lambda[i+1]-fit->lambda[i-1]);
+		count++;
+	}
+	if (count == 0 || ng <= 0) return 2;
+	ng /= count;
+
+	z  = nd/ng;
+	dz = resolution/ng + SCAN_STEP;
+	if (z+dz < fit->nls.lower[0] || z-dz > fit->nls.upper[0]) return 3;
+	*lo = (z-dz > fit->nls.lower[0]) ? z-dz : fit->nls.lower[0];
+	*hi = (z+dz < fit->nls.upper[0]) ? z+dz : fit->nls.upper[0];
+	if (parms->verbose) { printf("Fringe estimate: n*d = %.1f nm, n_g = %.3f, d = %.1f nm\n", nd, ng, z); fflush(stdout); }
+	return 0;
+}
+
+/* ------------- SPECIAL CASE FOR ONLY 1 THICKNESS VARYING -------------------
+-- Do a 10 nm linear search over min/max range and choose lowest chi^2 as
+-- starting point.  This should at least get the right # of fringes.  For
+-- thick films the search is narrowed to the window implied by the fringe
+-- period (FFT) instead of stepping the whole range.
+--------------------------------------------------------------------------- */
+static void scan_single_thickness(FILMFIT *fit) {
+	double guess, best, initial, chi, chi_best, scaling, scaling_best, lo, hi;
+	int i, j, npt, nsize, stride;
+	NLS_DATA *nls;
+	FILMFIT_PARMS *parms;
+
+	nls = &fit->nls;
+	parms = fit->parms;
+
+	/* Decimate the spectrum to about COARSE_POINTS to make fast (arrays kept in context) */
+	stride = fit->npt / COARSE_POINTS;
+	if (stride < 1) stride = 1;
+	nsize = (fit->npt+stride-1) / stride;
+	if (nsize > fit->nscan) {
+		fit->sx = realloc(fit->sx, nsize*sizeof(double));
+		fit->sy = realloc(fit->sy, nsize*sizeof(double));
+		fit->ss = realloc(fit->ss, nsize*sizeof(double));
+		fit->sf = realloc(fit->sf, nsize*sizeof(double));
+		if (fit->sx == NULL || fit->sy == NULL || fit->ss == NULL || fit->sf == NULL) {
+			fit->nscan = 0;
+			return;
+		}
+		fit->nscan = nsize;
+	}
+
+	/* Copy the useful data (every stride'th point) */
+	for (i=0,j=0; i<fit->npt; i+=stride,j++) {
+		fit->sx[j] = fit->lambda[i];
+		fit->sy[j] = fit->data[i];
+		fit->ss[j] = fit->errorbar[i];
+	}
+	npt = j;															/* Number of points remaining */
+	if (npt <= 5) return;										/* Don't bother if too few */
+
+	initial = best = *nls->vars[0];							/* Originally suggested point */
+	FilmFit_Refl(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, 300.0, npt, fit->sx, fit->sf);
+	chi_best = Estimate_Chisqr(npt, fit->sx, fit->sy, fit->ss, fit->sf, NULL);
+	scaling_best = parms->scaling;
+
+	lo = nls->lower[0]; hi = nls->upper[0];
+	if ((hi-lo)/SCAN_STEP > FRINGE_SCAN) fringe_window(fit, &lo, &hi);
+	for (guess=lo; guess<=hi; guess+=SCAN_STEP) {
+		*nls->vars[0] = guess;
+		FilmFit_Refl(fit, parms->sample, 1.0, 0.0, UNPOLARIZED, 300.0, npt, fit->sx, fit->sf);
+		chi = Estimate_Chisqr(npt, fit->sx, fit->sy, fit->ss, fit->sf, &scaling);
+		if (chi < chi_best) {									/* Better point */
+			best = *nls->vars[0];
+			chi_best = chi;
+			scaling_best = scaling;
+		}
+	}
+	*nls->vars[0] = initial;									/* Reset now */
+
+	/* If we have a better initial guess, put it in place now */
+	if (best != initial) {
+		*nls->vars[0] = best;
+		parms->scaling = scaling_best;
+
+		/* Fake last things that NKEY_INIT would have done */
+		(*nls->evalfnc)(nls);									/* Evaluate at this point */
+		(*nls->evalchi)(nls);									/* Get the chi^2 value */
+		nls->chiold = nls->chisqr;								/* Internal cleanup to keep NLSFIT synchronized (see curfit.c) */
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Starting point from the spectral library
+--
+-- Usage: int library_start(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Output: varied thicknesses and scaling set to the nearest library entry
+--         (limited to lower/upper and scaling_min/max)
+--
+-- Return: 0 if the library was used, nonzero if it does not apply
+=========================================================================== */
+static int library_start(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	SPECLIB_RECIPE recipe;
+	double z[SPECLIB_MAX_VARS], scaling;
+	int i;
+
+	if (fit->speclib == NULL || parms->nvary < 1 || parms->nvary > SPECLIB_MAX_VARS) return 1;
+
+	memset(&recipe, 0, sizeof(recipe));
+	for (i=0; parms->sample[i].type != EOS; i++) {
+		if (i >= SPECLIB_MAX_LAYERS) return 1;
+		strncpy(recipe.name[i], parms->sample[i].name, SPECLIB_NAME_LENGTH-1);
+		recipe.z[i] = parms->sample[i].z;
+	}
+	recipe.nlayers = i;
+	recipe.nvary   = parms->nvary;
+	for (i=0; i<parms->nvary; i++) recipe.layer[i] = parms->layer[i];
+	if (! SpecLib_Matches(fit->speclib, &recipe)) return 2;
+
+	if (SpecLib_Lookup(fit->speclib, parms->npt, parms->lambda, parms->refl, z, &scaling) != 0) return 3;
+	for (i=0; i<parms->nvary; i++) {
+		if (z[i] < parms->lower[i]) z[i] = parms->lower[i];
+		if (z[i] > parms->upper[i]) z[i] = parms->upper[i];
+		parms->sample[parms->layer[i]].z = z[i];
+	}
+	if (scaling < parms->scaling_min) scaling = parms->scaling_min;
+	if (scaling > parms->scaling_max) scaling = parms->scaling_max;
+	parms->scaling = scaling;
+	return 0;
+}
+
+/* ===========================================================================
+-- One multi-start task -- runs starts itask, itask+ntask, ... in the
+-- private context fit->child[itask] so the result of each start depends
+-- only on its index, not on which thread ran it
+=========================================================================== */
+static void ms_task(void *arg, int itask) {
+	MS_JOB *job = (MS_JOB *) arg;
+	FILMFIT_PARMS *parms, cp;
+	TFOC_SAMPLE *sample;
+	int i, istart, nvary;
+
+	parms  = job->parms;
+	nvary  = parms->nvary;
+	sample = job->fit->ms_sample[itask];
+
+	for (istart=itask; istart<job->nstart; istart+=job->ntask) {
+		if (istart >= job->ntask && job->deadline > 0 && TPool_Timer() > job->deadline) break;
+		if (job->fit->cancel) break;
+
+		memcpy(sample, parms->sample, job->nlayers*sizeof(*sample));
+		for (i=0; i<nvary; i++) sample[parms->layer[i]].z = job->start[istart*nvary+i];
+
+		cp = *parms;
+		cp.sample     = sample;
+		cp.max_iter   = MS_ITER;
+		cp.multistart = 0;
+		cp.multires   = 0;							/* Never nest a binned search */
+		cp.warm_start = FALSE;						/* Each start from its own point */
+		cp.verbose    = FALSE;
+		if (FilmFit_Fit(job->fit->child[itask], &cp) < 0) continue;
+
+		job->chisqr[istart] = cp.chisqr;
+		for (i=0; i<nvary; i++) job->result[istart*(nvary+1)+i] = sample[parms->layer[i]].z;
+		job->result[istart*(nvary+1)+nvary] = cp.scaling;
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Multi-start search for the starting point of a multi-thickness fit
+--
+-- Usage: int multistart(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Inputs: fit   - parent context (its pool is used for the starts)
+--         parms - problem; varied thicknesses and scaling are the initial
+--                 values (start 0)
+--
+-- Output: varied thicknesses and scaling replaced by the best start
+--         parms->multistart_run - number of starts completed
+--
+-- Return: 0 if successful (or nothing better found), -3 on memory failure
+--
+-- Notes: Starting points are a Latin hypercube over lower/upper with a
+--        fixed seed, so the search is reproducible when it is not cut
+--        short by the time budget.  Each child context evaluates serially;
+--        the parallelism is across starts.  n,k tables are loaded into
+--        every child before the tasks start so the material database is
+--        only touched from this thread.
+=========================================================================== */
+static int multistart(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	static char *rname = "FilmFit_Fit";
+	MS_JOB job;
+	int i, j, k, nvary, nstart, ntask, nlayers, best, *perm;
+	unsigned long seed;
+	double t0, lo, hi;
+	FILMFIT **child;
+	TFOC_SAMPLE **ms_sample;
+
+	nvary  = parms->nvary;
+	nstart = parms->multistart+1;							/* Plus the given starting point */
+	ntask  = TPool_Threads(fit->pool);
+	if (ntask > nstart) ntask = nstart;
+	for (nlayers=0; parms->sample[nlayers].type != EOS; nlayers++) ;
+	nlayers++;													/* Include the EOS */
+
+	/* Contexts and private stack copies, kept for the next fit */
+	if (ntask > fit->nchild) {
+		if ( (child = realloc(fit->child, ntask*sizeof(*child))) == NULL) return -3;
+		fit->child = child;
+		if ( (ms_sample = realloc(fit->ms_sample, ntask*sizeof(*ms_sample))) == NULL) return -3;
+		fit->ms_sample = ms_sample;
+		for (i=fit->nchild; i<ntask; i++) {
+			fit->ms_sample[i] = NULL;
+			if ( (fit->child[i] = FilmFit_Create(NULL)) == NULL) break;
+			fit->child[i]->matdb = fit->matdb;
+			fit->nchild = i+1;
+		}
+		if (fit->nchild < ntask) return -3;
+		fit->ms_layers = 0;									/* Force copies to be resized */
+	}
+	if (nlayers > fit->ms_layers) {
+		for (i=0; i<fit->nchild; i++) {
+			free(fit->ms_sample[i]);
+			if ( (fit->ms_sample[i] = calloc(nlayers, sizeof(TFOC_SAMPLE))) == NULL) { fit->ms_layers = 0; return -3; }
+		}
+		fit->ms_layers = nlayers;
+	}
+
+	memset(&job, 0, sizeof(job));
+	job.start  = calloc(nstart*nvary, sizeof(double));
+	job.result = calloc(nstart*(nvary+1), sizeof(double));
+	job.chisqr = calloc(nstart, sizeof(double));
+	perm = calloc(nstart, sizeof(int));
+	if (job.start == NULL || job.result == NULL || job.chisqr == NULL || perm == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate multi-start workspace\n", rname); fflush(stderr);
+		free(job.start); free(job.result); free(job.chisqr); free(perm);
+		return -3;
+	}
+
+	/* Start 0 is the given point; the rest a Latin hypercube (fixed seed) */
+	seed = 2463534242UL;
+	for (i=0; i<nvary; i++) {
+		lo = parms->lower[i]; hi = parms->upper[i];
+		job.start[i] = parms->sample[parms->layer[i]].z;
+		for (j=0; j<nstart-1; j++) perm[j] = j;
+		for (j=nstart-2; j>0; j--) {							/* Fisher-Yates shuffle of the strata */
+			seed ^= (seed << 13) & 0xFFFFFFFFUL; seed ^= seed >> 17; seed ^= (seed << 5) & 0xFFFFFFFFUL;
+			k = seed % (j+1);
+			if (k != j) { int t = perm[j]; perm[j] = perm[k]; perm[k] = t; }
+		}
+		for (j=1; j<nstart; j++) {
+			seed ^= (seed << 13) & 0xFFFFFFFFUL; seed ^= seed >> 17; seed ^= (seed << 5) & 0xFFFFFFFFUL;
+			job.start[j*nvary+i] = (hi > lo) ? lo + (hi-lo)*(perm[j-1] + (seed & 0xFFFF)/65536.0)/(nstart-1) : job.start[i];
+		}
+	}
+	for (j=0; j<nstart; j++) job.chisqr[j] = -1.0;
+
+	/* Load n,k into each child (serially) -- tasks then never miss the cache */
+	for (i=0; i<ntask; i++) FilmFit_Refl(fit->child[i], parms->sample, 1.0, 0.0, UNPOLARIZED, 300.0, fit->npt, fit->lambda, fit->center);
+
+	t0 = TPool_Timer();
+	job.fit      = fit;
+	job.parms    = parms;
+	job.nstart   = nstart;
+	job.ntask    = ntask;
+	job.nlayers  = nlayers;
+	job.deadline = (parms->multistart_budget > 0) ? t0 + parms->multistart_budget : 0;
+	TPool_Run(fit->pool, ntask, ms_task, &job);
+
+	/* Choose the best (lowest index on ties, so deterministic) */
+	best = -1;
+	parms->multistart_run = 0;
+	for (j=0; j<nstart; j++) {
+		if (job.chisqr[j] < 0) continue;
+		parms->multistart_run++;
+		if (best < 0 || job.chisqr[j] < job.chisqr[best]) best = j;
+	}
+	if (best >= 0) {
+		for (i=0; i<nvary; i++) parms->sample[parms->layer[i]].z = job.result[best*(nvary+1)+i];
+		parms->scaling = job.result[best*(nvary+1)+nvary];
+	}
+	if (parms->verbose) {
+		printf("Multi-start: %d of %d starts in %.3f s", parms->multistart_run, nstart, TPool_Timer()-t0);
+		if (best >= 0) printf(", best #%d chisqr %g", best, job.chisqr[best]);
+		printf("\n"); fflush(stdout);
+	}
+
+	free(job.start); free(job.result); free(job.chisqr); free(perm);
+	return 0;
+}
+
+/* ===========================================================================
+-- Coarse-to-fine starting point -- fits on binned copies of the spectrum
+--
+-- Usage: int multires(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Inputs: fit   - context
+--         parms - problem; varied thicknesses and scaling are the start
+--
+-- Output: varied thicknesses and scaling from the finest binned level
+--         parms->multires_run, multires_time[] - levels run and their times
+--         parms->multistart_run - from the coarsest level
+--
+-- Return: 0 if successful, 1 if the spectrum is too short to bin (nothing
+--         done), <0 on errors (start restored)
+--
+-- Notes: The coarsest level bins the fit range down to about COARSE_POINTS
+--        points and does the global search (multi-start or thickness
+--        scan).  Each further level has bins 4x smaller, up to
+--        parms->multires levels while bins hold at least 2 points, and
+--        only polishes the previous result.  The context's compacted
+--        arrays are overwritten and must be rebuilt afterwards.
+=========================================================================== */
+static int multires(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	FILMFIT_PARMS cp;
+	double z0[FILMFIT_MAX_VARS], scaling0, t0;
+	int i, level, nbin, n, rc = 0;
+
+	nbin = fit->npt / COARSE_POINTS;
+	if (nbin < 2) return 1;
+
+	for (i=0; i<parms->nvary; i++) z0[i] = parms->sample[parms->layer[i]].z;
+	scaling0 = parms->scaling;
+
+	for (level=0; level<parms->multires && level<FILMFIT_MAX_LEVELS && nbin>=2; level++, nbin/=4) {
+		t0 = TPool_Timer();
+		if ( (n = bin_range(fit, parms, nbin)) < 0) { rc = n; break; }
+
+		cp = *parms;
+		cp.npt      = n;
+		cp.lambda   = fit->mr_lambda;
+		cp.refl     = fit->mr_data;
+		cp.sigma    = fit->mr_errorbar;
+		cp.multires = 0;
+		cp.warm_start = FALSE;
+		cp.verbose  = FALSE;
+		if (level > 0) {
+			cp.multistart = 0;
+			fit->polish = TRUE;								/* Start is already in the right valley */
+		}
+		if ( (rc = FilmFit_Fit(fit, &cp)) < 0) break;
+		parms->scaling = cp.scaling;
+		if (level == 0) parms->multistart_run = cp.multistart_run;
+
+		parms->multires_time[level] = TPool_Timer()-t0;
+		if (parms->verbose) {
+			printf("Multi-resolution level %d: %d points (bins of %d), chisqr %g, %.2f ms\n", level, n, nbin, cp.chisqr, 1000*parms->multires_time[level]);
+			fflush(stdout);
+		}
+	}
+	parms->multires_run = level;
+
+	if (rc < 0) {													/* Give up -- back to the caller's start */
+		for (i=0; i<parms->nvary; i++) parms->sample[parms->layer[i]].z = z0[i];
+		parms->scaling = scaling0;
+		parms->multires_run = 0;
+		return rc;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Fit layer thicknesses and scaling to a measured reflectance spectrum
+--
+-- Usage: int FilmFit_Fit(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Inputs: fit   - context from FilmFit_Create()
+--         parms - problem description
+--
+-- Output: varied thicknesses and scaling updated in place, plus uncertainties
+--         and chi-square in parms
+--
+-- Return: 1 on success, 2 if iterations exhausted, <0 on errors
+=========================================================================== */
+int FilmFit_Fit(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	static char *rname = "FilmFit_Fit";
+
+	int		i,j,k, iter, maxiter;			/* Random integer constants	*/
+	char		token[256];
+	int		rcode=0;
+	double	z0[FILMFIT_MAX_VARS], scaling0;	/* Caller's start (if warm start abandoned) */
+	double	t0;
+	BOOL		warm, reused, polish;
+	double	*xy[3];								/* Array for the dependent vars */
+	char		*var_names[FILMFIT_MAX_VARS];
+	NLS_DATA *nls;
+
+	if (fit == NULL || parms == NULL || parms->sample == NULL || parms->lambda == NULL || parms->refl == NULL || parms->sigma == NULL) {
+		fprintf(stderr, "ERROR: %s called with NULL pointer\n", rname); fflush(stderr);
+		return -6;
+	}
+	if (parms->nvary < 0 || parms->nvary >= FILMFIT_MAX_VARS) {
+		fprintf(stderr, "ERROR: %s called with invalid number of variables (%d)\n", rname, parms->nvary); fflush(stderr);
+		return -6;
+	}
+	for (i=0; i<parms->nvary; i++) {
+		for (j=0; j<=parms->layer[i] && parms->sample[j].type != EOS; j++) ;
+		if (parms->layer[i] < 0 || j <= parms->layer[i]) {
+			fprintf(stderr, "ERROR: %s: varied layer %d not in sample\n", rname, parms->layer[i]); fflush(stderr);
+			return -6;
+		}
+	}
+	if (fit->cancel) return -5;
+	if ( (rcode = check_arrays(fit, parms->npt)) != 0) return rcode;
+	compact_range(fit, parms);						/* Points actually fit, once */
+	polish = fit->polish;							/* Set by multires() for its later levels */
+	fit->polish = FALSE;
+
+	/* Continuing a series -- start from the last solution of the same problem */
+	parms->multistart_run = 0;
+	parms->multires_run = 0;
+	parms->library_used = FALSE;
+	parms->warm_used = FALSE;
+	warm = parms->warm_start && warm_compatible(fit, parms);
+	scaling0 = parms->scaling;
+	if (warm) {
+		for (i=0; i<parms->nvary; i++) {
+			z0[i] = parms->sample[parms->layer[i]].z;
+			parms->sample[parms->layer[i]].z = warm_clamp(fit, fit->warm_x[i], parms->lower[i], parms->upper[i]);
+		}
+		if (! parms->varpro) parms->scaling = warm_clamp(fit, fit->warm_x[parms->nvary], parms->scaling_min, parms->scaling_max);
+	}
+
+WarmRestart:
+	/* Known recipe -- start from the library; otherwise a global search
+	 * for the starting point with several thicknesses */
+	if (! warm && ! polish) {
+		parms->library_used = (library_start(fit, parms) == 0);
+		if (parms->verbose && parms->library_used) { printf("Starting from the spectral library\n"); fflush(stdout); }
+		if (! parms->library_used && parms->multires > 0) {		/* Search and approach on binned spectra */
+			if ( (rcode = multires(fit, parms)) < 0) return rcode;
+			if (rcode == 0) polish = TRUE;
+			compact_range(fit, parms);								/* Levels reused the arrays */
+		}
+		if (! parms->library_used && ! polish && parms->multistart > 0 && parms->nvary >= 2) {
+			if ( (rcode = multistart(fit, parms)) != 0) return rcode;
+		}
+	}
+	fit->parms = parms;
+	t0 = TPool_Timer();
+
+	/* Clear and set the parameter structure */
+	nls = &fit->nls;
+	memset(nls, 0, sizeof(*nls));
+	nls->user      = fit;					/* Callbacks find the context here	*/
+	nls->yfit      = fit->yfit;			/* Space owned by the context			*/
+	nls->outchi    = NULL;				/* Let fit allocate space if needed	*/
+	nls->correlate = parms->varpro ? fit->correlate : NULL;	/* For the marginal scaling sigma */
+	nls->workspace = NULL;				/* Let fit allocate space if needed	*/
+	nls->magic_cookie = 0;
+
+	nls->data = fit->data;					/* Experimental reflectance curve (fit range) */
+	nls->errorbar = fit->errorbar;		/* Uncertainty on measured reflectivity */
+	nls->npt = fit->npt;						/* Number of points */
+	nls->valid = NULL;						/* All within the range already */
+	xy[0]    = fit->lambda;				/* At moment, not use, but let's define them */
+	xy[1]    = fit->data;
+	xy[2]    = fit->errorbar;
+	nls->xy  = xy;
+
+	nls->flamda   = 0;						/* Let CurveFit() set initial value	*/
+	if (warm) {									/* Or carry over the last damping	*/
+		nls->flamda = fit->warm_flamda;
+		if (nls->flamda < WARM_FLAMDA_MIN) nls->flamda = WARM_FLAMDA_MIN;
+		if (nls->flamda > WARM_FLAMDA_MAX) nls->flamda = WARM_FLAMDA_MAX;
+	}
+	nls->EpsCrit  = 1E-4;					/* CurveFit() now does completion test */
+	nls->broyden  = parms->broyden;		/* Derivatives only when secant updates fail */
+	nls->geodesic = parms->geodesic;		/* Second order step correction			*/
+	nls->nielsen  = parms->nielsen;		/* Damping from the gain ratio			*/
+
+	nls->evalfnc   = nls_eval;				/* Functions to evaluate function	*/
+	nls->fderiv    = nls_deriv;			/* Functions to evaluate derivative	*/
+	nls->fjacobian = nls_jacobian;		/* ... all points in one call			*/
+	nls->evalchi   = NULL;					/* Use default chisqr evaluation		*/
+
+	nls->vars  = fit->vars;
+	nls->sigma = fit->sigma;
+	nls->lower = fit->lower;
+	nls->upper = fit->upper;
+
+	/* Include in all of the requested variations */
+	for (j=0; j<parms->nvary; j++) {
+		nls->vars[j]  = &parms->sample[parms->layer[j]].z;
+		nls->lower[j] = parms->lower[j];
+		nls->upper[j] = parms->upper[j];
+		var_names[j]  = (parms->name[j] != NULL) ? parms->name[j] : "thickness";
+	}
+	/* And then add in the scaling factor (always appropriate for small changes in illumination intensity) */
+	/* With variable projection it is solved in closed form at every evaluation instead */
+	if (! parms->varpro) {
+		nls->vars[j]  = &parms->scaling;
+		nls->lower[j] = parms->scaling_min;
+		nls->upper[j] = parms->scaling_max;
+		var_names[j]  = "scaling";
+		j++;
+	}
+	nls->nvars = j;
+
+	/* Initialize everything else in CurveFit routine (will use below) */
+	if ( (rcode = CurveFit(NKEY_INIT, 0, nls)) != 0) {
+		if (parms->verbose) { printf("ERROR: Error on initialization of routine\n"); fflush(stdout); }
+		goto FitExit;
+	}
+
+	/* A jump in chi-square means the series moved too far -- start over */
+	if (warm && nls->chisqr > WARM_RESTART*fit->warm_chisqr) {
+		if (parms->verbose) { printf("Chi-square jumped from %g to %g: warm start abandoned\n", fit->warm_chisqr, nls->chisqr); fflush(stdout); }
+		fit->jac_live = NULL;
+		CurveFit(NKEY_EXIT, 0, nls);
+		for (i=0; i<parms->nvary; i++) parms->sample[parms->layer[i]].z = z0[i];
+		parms->scaling = scaling0;
+		warm = FALSE;
+		goto WarmRestart;
+	}
+	parms->warm_used = warm;
+	fit->jac_reuse = warm && fit->jac_ok;
+	if (parms->verbose && warm) { printf("Continuing from the previous fit\n"); fflush(stdout); }
+
+	/* Brute force scan for the right number of fringes if only one thickness */
+	if (parms->nvary == 1 && ! parms->library_used && ! warm && ! polish) scan_single_thickness(fit);
+
+	/* And we are off and running */
+	if (parms->verbose) {
+		fputs("------------------------------------------------------------------------------\n", stdout);
+		strcpy(token, "    CHISQR ");
+		for (i=0; i<nls->nvars;) {
+			fputs(token, stdout);
+			for (j=0; j<6 && i<nls->nvars; j++) printf("%11s", var_names[i++]);
+			fputs("\n", stdout);
+			strcpy(token, "           ");
+		}
+		fputs("------------------------------------------------------------------------------\n", stdout);
+	}
+
+	/* Set key to be either silent or verbose on fitting */
+	rcode = 0;
+	maxiter = (parms->max_iter > 0) ? parms->max_iter : MAXITER;
+	for (iter=0; iter<maxiter; iter++) {			/* Number of reps allowed */
+		if (parms->verbose) {
+			printf("\r%11.4g", nls->chisqr);
+			for (j=0; j<nls->nvars; ) {
+				for (k=0; k<6 && j<nls->nvars; k++) printf("%11.4g", *nls->vars[j++]);
+				fputs("\n", stdout);
+				if (j != nls->nvars) fputs("           ", stdout);
+			}
+			fflush(stdout);
+		}
+
+		if (nls->chisqr <= 0 || rcode == 1) break;		/* Basically success! */
+		if (fit->cancel) { rcode = -5; goto FitExit; }
+		reused = fit->jac_reuse;
+		if ( (rcode = CurveFit(parms->verbose ? NKEY_TRY_VERBOSE : NKEY_TRY_SILENT, iter, nls)) < 0) goto FitExit;		/* Run again */
+		if (reused && rcode == 1) rcode = 0;		/* Carried Jacobian -- confirm with a true one */
+	}
+	if (rcode == 0 && iter >= maxiter) rcode = 2;	/* Run out of time? */
+
+	/* Print results */
+	if (parms->verbose) {
+		fputs( "\n"
+				 "    Variable                Value               Sigma\n"
+				 "    --------                -----               -----\n", stdout);
+		/*				"    123456789012345  12345.1234567     123456.1234567 */
+		for (i=0; i<nls->nvars; i++) {
+			printf("     %-15s  %13.7g     %14.7g\n", var_names[i], *nls->vars[i], nls->sigma[i]);
+		}
+		if (parms->varpro) printf("     %-15s  %13.7g     (projected)\n", "scaling", parms->scaling);
+		fputs("\n", stdout);
+
+		printf("     Degrees of Freedom: %d\n", nls->dof);
+		printf("     Root Mean Variance: %g\n", sqrt(nls->chisqr));
+		printf("     Estimated Y sigma:  %g\n", nls->sigmaest);
+		fputs( "     WARNING: Error estimates valid only if estimated Y sigma is correct\n", stdout);
+		fputs("\n", stdout);
+	}
+
+	/* ----------------------- */
+FitExit:
+	/* ----------------------- */
+	if (parms->verbose) {
+		switch (rcode) {
+			case -1:
+				fputs("      GET OFF THE QUAALUDES, MAN!\n"
+						"ERROR: Too many parameters for number of data points\n", stdout);
+				break;
+			case -2:
+				fputs("ERROR: Unable to properly evaluate function (NLSFIT)\n", stdout);
+				break;
+			case -3:
+				fputs("ERROR: Unable to allocate temporary matrix space (NLSFIT)\n", stdout);
+				break;
+			case -4:
+				fputs("ERROR: Unable to allocate work spaces.  (NLSFIT)\n", stdout);
+				break;
+			case -5:
+				fputs("ERROR: *** Fit aborted by user pressing ^C (NLSFIT) ***\n", stdout);
+				break;
+			case -6:				/* Initialization errors - reported by CurveFit() */
+				break;
+			case 1:
+				break;			/* Success! */
+			case 2:
+				fputs("WARNING: Maximum iteration count reached.  A better fit may be obtained\n"
+						"         by running fit again starting from these parameters\n", stdout);
+				break;
+			default:
+				if (rcode < 0) printf("Function evaluator errors.  (NLSFIT)\n");
+		}
+		fflush(stdout);
+	}
+
+	/* Clean up workspaces and exit */
+	jac_keep(fit, nls);								/* Last Jacobian before the workspace goes */
+	CurveFit(NKEY_EXIT, 0, nls);					/* Free allocated workspaces	*/
+	fit->jac_reuse = FALSE;
+	warm_save(fit, parms, rcode);				/* Starting point for the next of a series */
+
+	/* Transfer statistics (thickness and scaling already updated in place) */
+	if (rcode >= 0) {
+		for (i=0; i<parms->nvary; i++) parms->z_sigma[i] = nls->sigma[i];
+		parms->chisqr   = nls->chisqr;
+		parms->sigmaest = nls->sigmaest;
+		parms->dof      = nls->dof;
+		if (! parms->varpro) {
+			parms->scaling_sigma = nls->sigma[parms->nvary];
+		} else {
+			projected_stats(fit, parms);
+		}
+	}
+	if (parms->multires_run > 0) {
+		parms->multires_time[parms->multires_run] = TPool_Timer()-t0;
+		if (parms->verbose) { printf("Full resolution: %d points, %.2f ms\n", fit->npt, 1000*parms->multires_time[parms->multires_run]); fflush(stdout); }
+	}
+
+	fit->parms = NULL;
+	return rcode;
+}
+
+/* ===========================================================================
+-- Determine whether a fit continues the last fit of this context
+--
+-- Usage: BOOL warm_compatible(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Return: TRUE if the last fit succeeded and had the same stack (materials
+--         and fixed thicknesses), varied layers, wavelengths and fit options
+--
+-- Notes: Every compacted wavelength is compared, so a point dropped for
+--        zero sigma also starts over.  The solver options (varpro,
+--        analytic_deriv, broyden, geodesic, nielsen, multires) must match
+--        since the saved Jacobian and damping belong to that setup.  The
+--        limits are not compared (callers move them with the solution);
+--        warm_clamp() brings the saved solution within them instead.
+=========================================================================== */
+static BOOL warm_compatible(FILMFIT *fit, FILMFIT_PARMS *parms) {
+	FILMFIT_PARMS *last = &fit->warm_parms;
+	TFOC_SAMPLE *a, *b;
+	int i, j;
+
+	if (! fit->warm_ok) return FALSE;
+	if (parms->nvary != last->nvary || parms->varpro != last->varpro || parms->analytic_deriv != last->analytic_deriv) return FALSE;
+	if (parms->broyden != last->broyden || parms->geodesic != last->geodesic || parms->nielsen != last->nielsen) return FALSE;
+	if (parms->multires != last->multires) return FALSE;
+	if (parms->npt != last->npt || parms->lambda_min != last->lambda_min || parms->lambda_max != last->lambda_max) return FALSE;
+	if (fit->npt <= 0 || fit->npt != fit->warm_npt) return FALSE;
+	if (memcmp(fit->lambda, fit->warm_lambda, fit->npt*sizeof(*fit->lambda)) != 0) return FALSE;
+	for (i=0; i<parms->nvary; i++) if (parms->layer[i] != last->layer[i]) return FALSE;
+
+	for (i=0; parms->sample[i].type != EOS; i++) {
+		if (i >= fit->warm_layers) return FALSE;
+		a = &parms->sample[i];
+		b = &fit->warm_sample[i];
+		if (a->type != b->type || a->material != b->material || a->doping_profile != b->doping_profile) return FALSE;
+		if (strcmp(a->name, b->name) != 0) return FALSE;
+		for (j=0; j<parms->nvary && parms->layer[j] != i; j++) ;
+		if (j == parms->nvary && a->z != b->z) return FALSE;				/* Fixed layer changed */
+	}
+	return i == fit->warm_layers;
+}
+
+/* ===========================================================================
+-- Bring one value of the saved solution within the limits of the new fit
+--
+-- Usage: double warm_clamp(FILMFIT *fit, double x, double lower, double upper);
+--
+-- Return: x limited to [lower,upper] (either order, as CurveFit)
+--
+-- Notes: A value that had to be moved leaves the saved Jacobian at another
+--        point, so the fit then evaluates fresh derivatives (jac_ok FALSE)
+=========================================================================== */
+static double warm_clamp(FILMFIT *fit, double x, double lower, double upper) {
+	double lo, hi;
+
+	lo = (lower < upper) ? lower : upper;
+	hi = (lower < upper) ? upper : lower;
+	if (x < lo) { x = lo; fit->jac_ok = FALSE; }
+	if (x > hi) { x = hi; fit->jac_ok = FALSE; }
+	return x;
+}
+
+/* ===========================================================================
+-- Keep the result of a fit as the starting point for the next of a series
+--
+-- Usage: void warm_save(FILMFIT *fit, FILMFIT_PARMS *parms, int rcode);
+--
+-- Inputs: fit   - context, with fit->nls as left by CurveFit()
+--         parms - problem just fit
+--         rcode - result of the fit (<0 discards any saved state)
+--
+-- Notes: fderiv[] holds the Jacobian from the start of the last iteration.
+--        A Broyden (secant) rank-1 update moves it to the final parameters
+--        using the model values already in hand, so the next fit of the
+--        series can take its first step without evaluating derivatives.
+=========================================================================== */
+static void warm_save(FILMFIT *fit, FILMFIT_PARMS *parms, int rcode) {
+	NLS_DATA *nls = &fit->nls;
+	TFOC_SAMPLE *sample;
+	double s[FILMFIT_MAX_VARS], ss, r;
+	int i, j, nlayers;
+
+	fit->warm_ok = FALSE;
+	if (rcode < 0) { fit->jac_ok = FALSE; return; }
+
+	/* Jacobian to the final point -- only if yfit is the model there */
+	for (i=0; i<nls->nvars; i++) if (*nls->vars[i] != fit->eval_x[i]) fit->jac_ok = FALSE;
+	if (fit->jac_ok) {
+		ss = 0;
+		for (i=0; i<nls->nvars; i++) {
+			s[i] = *nls->vars[i] - fit->jac_x[i];
+			ss += s[i]*s[i];
+		}
+		if (ss > 0) {
+			for (j=0; j<fit->npt; j++) {
+				r = nls->yfit[j] - fit->jac_y[j];
+				for (i=0; i<nls->nvars; i++) r -= fit->fderiv[i][j]*s[i];
+				r /= ss;
+				for (i=0; i<nls->nvars; i++) fit->fderiv[i][j] += r*s[i];
+			}
+		}
+		for (i=0; i<nls->nvars; i++) fit->jac_x[i] = *nls->vars[i];
+		memcpy(fit->jac_y, nls->yfit, fit->npt*sizeof(*fit->jac_y));
+	}
+
+	/* Copy of the stack for comparison with the next problem */
+	for (nlayers=0; parms->sample[nlayers].type != EOS; nlayers++) ;
+	if (nlayers > fit->warm_dim) {
+		if ( (sample = realloc(fit->warm_sample, nlayers*sizeof(*sample))) == NULL) return;
+		fit->warm_sample = sample;
+		fit->warm_dim = nlayers;
+	}
+	memcpy(fit->warm_sample, parms->sample, nlayers*sizeof(*fit->warm_sample));
+	fit->warm_layers = nlayers;
+
+	fit->warm_parms = *parms;
+	fit->warm_npt = fit->npt;
+	memcpy(fit->warm_lambda, fit->lambda, fit->npt*sizeof(*fit->warm_lambda));
+	for (i=0; i<nls->nvars; i++) fit->warm_x[i] = *nls->vars[i];
+	fit->warm_flamda = nls->flamda;
+	fit->warm_chisqr = nls->chisqr;
+	fit->warm_ok = TRUE;
+	return;
+}
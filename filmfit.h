@@ -0,0 +1,241 @@
+#ifndef _FILMFIT_H_LOADED
+#define _FILMFIT_H_LOADED
+
+/* ===========================================================================
+-- Reentrant reflectance evaluation and thickness fitting of a film stack.
+--
+-- All workspaces (transfer-matrix workspace, cached n,k tables, legacy
+-- TFOC layer buffer, fit matrices and derivative vectors) belong to a
+-- FILMFIT context.  Nothing is held in static or global variables, so
+-- separate contexts may be used concurrently from different threads --
+-- for example several fits at once, one per channel, or a batch refit.
+-- A single context must only be used by one thread at a time.
+--
+-- Requires tfoc.h to be included first (TFOC_SAMPLE, POLARIZATION).
+=========================================================================== */
+
+/* Make sure we have enough #includes to run */
+#include "tpool.h"
+#include "matdb.h"
+#include "speclib.h"
+
+#define	FILMFIT_MAX_VARS	(32)			/* Max varied thicknesses + scaling */
+#define	FILMFIT_MAX_LEVELS	(4)		/* Max binned multi-resolution levels */
+
+typedef struct _FILMFIT FILMFIT;			/* Opaque context */
+
+/* Description of one fit (inputs) and its results (outputs) */
+typedef struct _FILMFIT_PARMS {
+	/* Inputs */
+	TFOC_SAMPLE *sample;						/* Film stack (EOS terminated).  Varied z updated in place */
+	double scaling;							/* Scaling of measured data (initial guess / result) */
+	int npt;										/* Number of points in spectrum */
+	double *lambda;							/* [npt] wavelengths (nm) */
+	double *refl;								/* [npt] measured reflectance (unscaled) */
+	double *sigma;								/* [npt] uncertainty of reflectance */
+	double lambda_min, lambda_max;		/* Wavelength range used in the fit */
+	int nvary;									/* Number of layer thicknesses varied */
+	int layer[FILMFIT_MAX_VARS];			/* Index in sample[] of each varied layer */
+	double lower[FILMFIT_MAX_VARS];		/* Limits on each varied thickness */
+	double upper[FILMFIT_MAX_VARS];
+	char *name[FILMFIT_MAX_VARS];			/* Labels for verbose output (NULL ok) */
+	double scaling_min, scaling_max;		/* Limits on the scaling */
+	int analytic_deriv;						/* Use analytic Jacobian from TMM engine */
+	int varpro;									/* Solve scaling in closed form (variable projection) */
+	int broyden;								/* Secant Jacobian updates between true derivatives */
+	int geodesic;								/* Geodesic acceleration of each step */
+	int nielsen;								/* Nielsen damping schedule (gain ratio) */
+	int max_iter;								/* Iteration limit (0 for default of 20) */
+	int multistart;							/* Extra starting points for 2+ thicknesses (0 = off) */
+	double multistart_budget;				/* Wall-clock limit on the multi-start search (s, 0 = none) */
+	int warm_start;							/* Continue from the last fit of this context (series) */
+	int multires;								/* Binned coarse-to-fine levels before the full fit (0 = off) */
+	int verbose;								/* Print progress and results to stdout */
+
+	/* Outputs */
+	double z_sigma[FILMFIT_MAX_VARS];	/* Fit uncertainty of each varied thickness */
+	double scaling_sigma;					/* Fit uncertainty of the scaling */
+	double chisqr;								/* Final chi-square (per degree of freedom) */
+	double sigmaest;							/* Estimated Y sigma */
+	int dof;										/* Degrees of freedom */
+	int multistart_run;						/* Starting points actually tried */
+	int library_used;							/* Started from the spectral library */
+	int warm_used;								/* Continued from the last fit (warm start) */
+	int multires_run;							/* Binned levels actually fit */
+	double multires_time[FILMFIT_MAX_LEVELS+1];	/* Time (s) of each level, then the full fit */
+} FILMFIT_PARMS;
+
+/* ===========================================================================
+-- Create or release an evaluation / fit context
+--
+-- Usage: FILMFIT *FilmFit_Create(TPOOL *pool);
+--        void FilmFit_Free(FILMFIT *fit);
+--
+-- Inputs: pool - thread pool used to split wavelengths (NULL for serial)
+--
+-- Return: FilmFit_Create returns NULL on memory failure
+=========================================================================== */
+FILMFIT *FilmFit_Create(TPOOL *pool);
+void FilmFit_Free(FILMFIT *fit);
+
+/* ===========================================================================
+-- Change the thread pool used by a context
+--
+-- Usage: void FilmFit_SetThreadPool(FILMFIT *fit, TPOOL *pool);
+=========================================================================== */
+void FilmFit_SetThreadPool(FILMFIT *fit, TPOOL *pool);
+
+/* ===========================================================================
+-- Discard the cached n,k tables (needed if material data is reloaded)
+--
+-- Usage: void FilmFit_ClearCache(FILMFIT *fit);
+=========================================================================== */
+void FilmFit_ClearCache(FILMFIT *fit);
+
+/* ===========================================================================
+-- Take n,k for the native engine from a compiled (memory mapped) database
+--
+-- Usage: void FilmFit_SetMaterialDB(FILMFIT *fit, MATDB *db);
+--
+-- Inputs: fit - context from FilmFit_Create()
+--         db  - database from MatDB_Open(), or NULL to use TFOC_FindNK only
+--
+-- Notes: Layers are matched to the database by sample[].name; layers not in
+--        the database, and the legacy doping-profile path, still use the
+--        TFOC material.  The database may be shared by several contexts and
+--        must stay open while any of them use it.
+=========================================================================== */
+void FilmFit_SetMaterialDB(FILMFIT *fit, MATDB *db);
+
+/* ===========================================================================
+-- Take starting points from a precomputed spectral library
+--
+-- Usage: void FilmFit_SetLibrary(FILMFIT *fit, SPECLIB *lib);
+--
+-- Inputs: fit - context from FilmFit_Create()
+--         lib - library from SpecLib_Open(), or NULL to stop using one
+--
+-- Notes: A fit whose stack and varied layers match the library's recipe
+--        starts from the nearest library spectrum and skips the thickness
+--        scan and multi-start search.  Other fits are unaffected.  The
+--        library may be shared by several contexts and must stay open
+--        while any of them use it.
+=========================================================================== */
+void FilmFit_SetLibrary(FILMFIT *fit, SPECLIB *lib);
+
+/* ===========================================================================
+-- Abandon the fit running in a context
+--
+-- Usage: void FilmFit_Cancel(FILMFIT *fit);
+--
+-- Notes: May be called from any thread.  The fit in progress returns -5
+--        within one iteration (or one multi-start refinement), and so does
+--        every later fit in the context; it is meant to be freed next.
+=========================================================================== */
+void FilmFit_Cancel(FILMFIT *fit);
+
+/* ===========================================================================
+-- Calculate the theoretical reflectance of a stack
+--
+-- Usage: int FilmFit_Refl(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode,
+--                         double temperature, int npt, double *lambda, double *refl);
+--
+-- Inputs: fit         - context from FilmFit_Create()
+--         sample      - TFOC_SAMPLE structure describing the film stack
+--         scaling     - *divides* the calculated reflectance (1.0 for true values)
+--         theta       - angle of incidence (radians)
+--         mode        - polarization
+--         temperature - only used for doping profiles
+--         npt         - number of points
+--         lambda      - [npt] wavelengths
+--         refl        - [npt] array to receive reflectance
+--
+-- Return: 0 if successful, <0 on errors
+=========================================================================== */
+int FilmFit_Refl(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, double temperature, int npt, double *lambda, double *refl);
+
+/* ===========================================================================
+-- Reflectance and analytic thickness derivatives using the native engine
+--
+-- Usage: int FilmFit_ReflDeriv(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode,
+--                              int npt, double *lambda, double *refl, double **dRdz);
+--
+-- Inputs: as FilmFit_Refl(), plus
+--         dRdz - NULL, or array indexed like sample[] of pointers to [npt]
+--                arrays for d(refl)/dz of that layer (NULL entries skipped)
+--
+-- Return: 0 if successful
+--         1 if the sample cannot be handled by the native engine (doping profiles)
+--        <0 on errors
+=========================================================================== */
+int FilmFit_ReflDeriv(FILMFIT *fit, TFOC_SAMPLE *sample, double scaling, double theta, POLARIZATION mode, int npt, double *lambda, double *refl, double **dRdz);
+
+/* ===========================================================================
+-- Fit layer thicknesses and scaling to a measured reflectance spectrum
+--
+-- Usage: int FilmFit_Fit(FILMFIT *fit, FILMFIT_PARMS *parms);
+--
+-- Inputs: fit   - context from FilmFit_Create()
+--         parms - problem description (see FILMFIT_PARMS)
+--
+-- Output: parms->sample[layer[i]].z, parms->scaling - best fit values
+--         parms->z_sigma, scaling_sigma, chisqr, sigmaest, dof
+--
+-- Notes: Only the points within lambda_min/max with nonzero sigma are fit.
+--        They are copied to compact arrays once per fit and the model is
+--        evaluated at those wavelengths only; a display curve over the
+--        whole spectrum is the caller's (FilmFit_Refl) after the fit.
+--
+--        With parms->varpro the model R(z)/scaling is linear in 1/scaling,
+--        so the scaling is solved in closed form (weighted least squares,
+--        limited to scaling_min/max) at every evaluation and only the
+--        thicknesses are fit parameters.  The scaling still counts as a
+--        parameter in dof and chisqr, and scaling_sigma is its marginal
+--        uncertainty (thickness correlations included), as without varpro.
+--
+--        With parms->multistart > 0 and two or more thicknesses varied, a
+--        Latin hypercube of starting points within lower/upper (plus the
+--        given values) is first refined by short fits spread across the
+--        context's thread pool, and the full fit continues from the best.
+--        Starts not begun within multistart_budget seconds are skipped.
+--
+--        With a single thickness, a 10 nm scan over lower/upper on about
+--        150 decimated points picks the starting point.  When the range is
+--        large the fringe period (FFT, see fringe.h) first narrows the scan
+--        to about one fringe around the estimated thickness; thin films
+--        fall back to the full scan.
+--
+--        With parms->warm_start (successive spectra of a time series), a
+--        fit of the same problem as the last successful fit in this context
+--        -- same stack, fixed thicknesses, varied layers, wavelengths and
+--        options -- starts from that solution with its final damping and
+--        its Jacobian (moved to the solution by a secant update), and skips
+--        the library, multi-start and scan.  If the starting chi-square is
+--        more than 10x the last final value the warm start is abandoned and
+--        the fit starts over from the given values.
+--
+--        With parms->multires > 0 (and no library start or warm start) the
+--        fit first runs on the spectrum binned to about 150 points -- where
+--        the multi-start search or thickness scan is done -- then on up to
+--        multires-1 levels with 4x finer bins, and ends with a short polish
+--        at full resolution.  Bins average with weights 1/sigma^2 and carry
+--        error bars 1/sqrt(sum 1/sigma^2).  multires_time[] reports each
+--        level and the full fit.  Bins span part of a fringe for very thick
+--        films; the coarse levels then only serve to find the start.
+--
+--        parms->broyden replaces most Jacobian evaluations by secant
+--        updates (see CurveFit()).  It pays with finite differences
+--        (analytic_deriv off or doping profiles); analytic derivatives cost
+--        little more than one spectrum and are better evaluated every time.
+--        parms->geodesic and parms->nielsen select geodesic acceleration
+--        and Nielsen damping in CurveFit(); both widen the range of
+--        starting points that converge at the cost of more evaluations.
+--
+-- Return: 1 on success
+--         2 if the maximum number of iterations was reached
+--         0 if no convergence decision was made
+--        <0 on errors (codes as CurveFit; -5 if cancelled)
+=========================================================================== */
+int FilmFit_Fit(FILMFIT *fit, FILMFIT_PARMS *parms);
+
+#endif		/* _FILMFIT_H_LOADED */
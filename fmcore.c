@@ -0,0 +1,544 @@
+/* fmcore.c - FilmMeasure measurement core without the dialog */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tfoc.h"
+#include "tpool.h"
+#include "matdb.h"
+#include "speclib.h"
+#include "filmfit.h"
+#include "recipe.h"
+#include "fmcore.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#ifndef max
+	#define	max(a,b)	(((a) > (b)) ? (a) : (b))
+#endif
+#ifndef min
+	#define	min(a,b)	(((a) < (b)) ? (a) : (b))
+#endif
+
+struct _FMCORE {
+	char database[RECIPE_PATH_LENGTH];
+	MATDB *db;												/* Compiled database (may be NULL) */
+	SPECLIB *lib;											/* Library of the recipe (may be NULL) */
+	int shared;												/* db and lib belong to the caller */
+	FILMFIT *fit;
+
+	int have_recipe;
+	RECIPE recipe;											/* Sample stack as loaded and fit options */
+	TFOC_SAMPLE sample[RECIPE_MAX_FILM+3];			/* Stack being fit (follows the fits) */
+	double scaling;
+	int warm;												/* Last fit succeeded -- continue from it */
+
+	RECIPE_FILM reffilm;									/* Reference stack */
+	TFOC_SAMPLE reference[RECIPE_MAX_FILM+3];
+
+	int npt;
+	double *lambda, *ref, *dark, *tref;				/* [npt] each, one allocation */
+	double *refl, *sigma, *model;
+	int have_ref, have_dark, have_tref, have_refl, have_model;
+
+	int nvalues;											/* Last successful fit */
+	FILMFIT_PARMS last;
+	double value[FMCORE_MAX_VALUES];
+	char name[FMCORE_MAX_VALUES][FMCORE_NAME_LENGTH];
+	char *pname[FMCORE_MAX_VALUES];
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int set_recipe(FMCORE *core, int rc);
+
+/* ===========================================================================
+-- Create a core
+--
+-- Usage: FMCORE *FMCore_Create(char *database);
+--
+-- Return: pointer to the core, or NULL if out of memory
+=========================================================================== */
+FMCORE *FMCore_Create(char *database) {
+	FMCORE *core;
+	char path[RECIPE_PATH_LENGTH+64];
+	int i;
+
+	if ( (core = calloc(1, sizeof(*core))) == NULL) return NULL;
+	if ( (core->fit = FilmFit_Create(TPool_Default())) == NULL) {
+		free(core);
+		return NULL;
+	}
+	if (database != NULL) {
+		strncpy(core->database, database, sizeof(core->database)-1);
+		sprintf(path, "%.1000s/%s", database, MATDB_FILENAME);
+		core->db = MatDB_Open(path);
+		FilmFit_SetMaterialDB(core->fit, core->db);
+	}
+	for (i=0; i<FMCORE_MAX_VALUES; i++) core->pname[i] = core->name[i];
+	Recipe_Options(NULL, &core->recipe);						/* FilmMeasure defaults */
+
+	/* Bare substrate until a recipe says otherwise */
+	strcpy(core->reffilm.substrate, "Si");
+	return core;
+}
+
+/* ===========================================================================
+-- Destroy a core (NULL ok)
+=========================================================================== */
+void FMCore_Free(FMCORE *core) {
+	if (core == NULL) return;
+	FilmFit_Free(core->fit);
+	if (! core->shared) {
+		SpecLib_Close(core->lib);
+		MatDB_Close(core->db);
+	}
+	if (core->lambda != NULL) free(core->lambda);
+	free(core);
+	return;
+}
+
+/* ===========================================================================
+-- Load the stacks and fit options from an ini file
+--
+-- Usage: int FMCore_LoadRecipe(FMCORE *core, char *inifile);
+--
+-- Return: 0 if successful, 1 if a material is missing, 2 if nothing varies
+=========================================================================== */
+int FMCore_LoadRecipe(FMCORE *core, char *inifile) {
+	RECIPE_FILM film;
+	int rc;
+
+	rc = Recipe_Read(inifile, core->database, core->db, &core->recipe);
+	if (rc == 1) {
+		core->have_recipe = FALSE;
+		return 1;
+	}
+
+	if (! core->shared) {
+		SpecLib_Close(core->lib);
+		core->lib = (*core->recipe.speclib != '\0') ? SpecLib_Open(core->recipe.speclib) : NULL;
+		FilmFit_SetLibrary(core->fit, core->lib);
+	}
+
+	Recipe_ReadFilm(inifile, "Reference", &film);
+	if (FMCore_SetReferenceStack(core, &film) != 0) rc = 1;
+	set_recipe(core, rc);
+	return rc;
+}
+
+/* ===========================================================================
+-- Replace the sample stack, keeping the fit options
+--
+-- Usage: int FMCore_SetSample(FMCORE *core, RECIPE_FILM *film);
+--
+-- Return: 0 if successful, 1 if a material is missing, 2 if nothing varies
+=========================================================================== */
+int FMCore_SetSample(FMCORE *core, RECIPE_FILM *film) {
+	int rc;
+
+	if ( (rc = Recipe_SetFilm(&core->recipe, film, core->database, core->db)) == 1) {
+		core->have_recipe = FALSE;
+		return 1;
+	}
+	return set_recipe(core, rc);
+}
+
+/* ===========================================================================
+-- Replace the reference stack
+--
+-- Usage: int FMCore_SetReferenceStack(FMCORE *core, RECIPE_FILM *film);
+--
+-- Return: 0 if successful, 1 if a material is missing
+=========================================================================== */
+int FMCore_SetReferenceStack(FMCORE *core, RECIPE_FILM *film) {
+	int tfoc_needed = FALSE;
+
+	core->reffilm = *film;
+	core->have_tref = core->have_refl = FALSE;
+	if (! film->mirror && Recipe_Stack(film, core->database, core->db, core->reference, &tfoc_needed) < 0) {
+		core->reffilm.mirror = TRUE;							/* Something usable, but report failure */
+		return 1;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Recipe in use
+=========================================================================== */
+RECIPE *FMCore_Recipe(FMCORE *core) {
+	return &core->recipe;
+}
+
+/* ===========================================================================
+-- Set the wavelengths, discarding spectra that went with the old ones
+--
+-- Usage: int FMCore_SetWavelengths(FMCORE *core, int npt, double *lambda);
+--
+-- Return: 0 if successful, 2 if out of memory
+=========================================================================== */
+int FMCore_SetWavelengths(FMCORE *core, int npt, double *lambda) {
+	double *work;
+
+	if (npt == core->npt && core->lambda != NULL && memcmp(lambda, core->lambda, npt*sizeof(double)) == 0) return 0;
+	if (npt != core->npt || core->lambda == NULL) {
+		if ( (work = realloc(core->lambda, 7*npt*sizeof(double))) == NULL) return 2;
+		core->npt    = npt;
+		core->lambda = work;
+		core->ref    = work +   npt;
+		core->dark   = work + 2*npt;
+		core->tref   = work + 3*npt;
+		core->refl   = work + 4*npt;
+		core->sigma  = work + 5*npt;
+		core->model  = work + 6*npt;
+	}
+	memcpy(core->lambda, lambda, npt*sizeof(double));
+	core->have_ref = core->have_dark = core->have_tref = core->have_refl = core->have_model = FALSE;
+	core->nvalues = 0;
+	FMCore_Restart(core);
+	return 0;
+}
+
+/* ===========================================================================
+-- Set the reference or dark spectrum
+--
+-- Return: 0 if successful, 1 if the wavelengths are not set
+=========================================================================== */
+int FMCore_SetReference(FMCORE *core, double *ref) {
+	if (core->lambda == NULL) return 1;
+	memcpy(core->ref, ref, core->npt*sizeof(double));
+	core->have_ref = TRUE;
+	core->have_refl = FALSE;
+	return 0;
+}
+
+int FMCore_SetDark(FMCORE *core, double *dark) {
+	if (core->lambda == NULL) return 1;
+	if (dark != NULL) memcpy(core->dark, dark, core->npt*sizeof(double));
+	core->have_dark = (dark != NULL);
+	core->have_refl = FALSE;
+	return 0;
+}
+
+/* ===========================================================================
+-- Use the caller's compiled database and spectral library
+--
+-- Usage: int FMCore_SetMaterials(FMCORE *core, MATDB *db, SPECLIB *lib);
+--
+-- Return: 0
+=========================================================================== */
+int FMCore_SetMaterials(FMCORE *core, MATDB *db, SPECLIB *lib) {
+	if (! core->shared) {
+		SpecLib_Close(core->lib);
+		MatDB_Close(core->db);
+	}
+	core->shared = TRUE;
+	core->db  = db;
+	core->lib = lib;
+	FilmFit_SetMaterialDB(core->fit, db);
+	FilmFit_SetLibrary(core->fit, lib);
+	return 0;
+}
+
+/* ===========================================================================
+-- Replace the recipe by a stack and fit problem built by the caller
+--
+-- Usage: int FMCore_SetStack(FMCORE *core, TFOC_SAMPLE *sample, FILMFIT_PARMS *parms);
+--
+-- Return: 0 if successful, 1 if the stack is too long, 2 if nothing varies
+=========================================================================== */
+int FMCore_SetStack(FMCORE *core, TFOC_SAMPLE *sample, FILMFIT_PARMS *parms) {
+	FILMFIT_PARMS *p;
+	int i, n, warm;
+
+	for (n=0; sample[n].type != EOS; n++) {
+		if (n >= RECIPE_MAX_FILM+2) return 1;					/* Incident, films, substrate */
+	}
+	memcpy(core->recipe.sample, sample, (n+1)*sizeof(*sample));
+	core->recipe.nlayers = n;
+	core->recipe.tfoc_needed = FALSE;
+
+	p = &core->recipe.parms;
+	*p = *parms;
+	p->sample = core->recipe.sample;
+	for (i=0; i<p->nvary; i++) p->name[i] = core->recipe.sample[p->layer[i]].name;
+	p->npt    = 0;
+	p->lambda = p->refl = p->sigma = NULL;
+
+	warm = core->warm;												/* The fit context decides */
+	set_recipe(core, 0);
+	core->warm = warm;
+	return (p->nvary == 0) ? 2 : 0;
+}
+
+/* ===========================================================================
+-- Take a reflectance normalized by the caller
+--
+-- Usage: int FMCore_SetReflectance(FMCORE *core, int npt, double *lambda, double *refl, double *sigma);
+--
+-- Return: 0 if successful, 2 if out of memory
+=========================================================================== */
+int FMCore_SetReflectance(FMCORE *core, int npt, double *lambda, double *refl, double *sigma) {
+	int rc;
+
+	if ( (rc = FMCore_SetWavelengths(core, npt, lambda)) != 0) return rc;
+	memcpy(core->refl,  refl,  npt*sizeof(double));
+	memcpy(core->sigma, sigma, npt*sizeof(double));
+	core->have_refl  = TRUE;
+	core->have_model = FALSE;
+	return 0;
+}
+
+/* ===========================================================================
+-- Normalize a raw sample spectrum
+--
+-- Usage: int FMCore_Process(FMCORE *core, double *raw);
+--
+-- Return: 0 if successful, 1 if there is no reference spectrum
+--
+-- Notes: The reflectance of the reference stack is computed the first time
+--        after the wavelengths or the reference stack change
+=========================================================================== */
+int FMCore_Process(FMCORE *core, double *raw) {
+	int i;
+
+	if (! core->have_ref) return 1;
+	if (! core->have_tref) {
+		if (! core->reffilm.mirror) {
+			FilmFit_Refl(core->fit, core->reference, 1.0, 0.0, UNPOLARIZED, 300.0, core->npt, core->lambda, core->tref);
+		} else {
+			for (i=0; i<core->npt; i++) core->tref[i] = 1.0;
+		}
+		core->have_tref = TRUE;
+	}
+	FMCore_Reflectance(core->npt, raw, core->ref, core->have_dark ? core->dark : NULL, core->tref, core->refl, core->sigma);
+	core->have_refl = TRUE;
+	core->have_model = FALSE;
+	return 0;
+}
+
+/* ===========================================================================
+-- Fit the processed spectrum
+--
+-- Usage: int FMCore_Fit(FMCORE *core);
+--
+-- Return: FilmFit_Fit() code, or -100 if there is nothing to fit
+=========================================================================== */
+int FMCore_Fit(FMCORE *core) {
+	FILMFIT_PARMS parms;
+	int i, rc;
+
+	if (! core->have_recipe || ! core->have_refl || core->recipe.parms.nvary <= 0) return -100;
+
+	parms = core->recipe.parms;
+	parms.sample  = core->sample;
+	for (i=0; i<parms.nvary; i++) parms.name[i] = core->sample[parms.layer[i]].name;
+	parms.scaling = core->scaling;
+	parms.npt     = core->npt;
+	parms.lambda  = core->lambda;
+	parms.refl    = core->refl;
+	parms.sigma   = core->sigma;
+	parms.warm_start = parms.warm_start && core->warm;
+
+	rc = FilmFit_Fit(core->fit, &parms);
+	if (rc < 0) {
+		FMCore_Restart(core);
+		return rc;
+	}
+	core->scaling = parms.scaling;
+	core->warm    = TRUE;
+	core->last    = parms;
+	core->nvalues = FMCore_FitValues(&parms, core->value);
+	FilmFit_Refl(core->fit, core->sample, 1.0, 0.0, UNPOLARIZED, 300.0, core->npt, core->lambda, core->model);
+	core->have_model = TRUE;
+	return rc;
+}
+
+/* ===========================================================================
+-- Go back to the recipe thicknesses and scaling for the next fit
+=========================================================================== */
+int FMCore_Restart(FMCORE *core) {
+	memcpy(core->sample, core->recipe.sample, sizeof(core->sample));
+	core->scaling = (core->recipe.parms.scaling > 0) ? core->recipe.parms.scaling : 1.0;
+	core->warm = FALSE;
+	return 0;
+}
+
+/* ===========================================================================
+-- End a fit in progress early (from another thread)
+=========================================================================== */
+void FMCore_Cancel(FMCORE *core) {
+	if (core != NULL) FilmFit_Cancel(core->fit);
+	return;
+}
+
+/* ===========================================================================
+-- Results of the last successful fit
+--
+-- Return: number of values (0 if none)
+=========================================================================== */
+int FMCore_Results(FMCORE *core, double *value, char ***names) {
+	if (value != NULL) memcpy(value, core->value, core->nvalues*sizeof(double));
+	if (names != NULL) *names = core->pname;
+	return core->nvalues;
+}
+
+/* ===========================================================================
+-- Curves of the last processed spectrum and fit
+--
+-- Return: npt, or 0 if nothing has been processed
+=========================================================================== */
+int FMCore_Curves(FMCORE *core, double **refl, double **sigma, double **fit) {
+	if (refl  != NULL) *refl  = core->have_refl  ? core->refl  : NULL;
+	if (sigma != NULL) *sigma = core->have_refl  ? core->sigma : NULL;
+	if (fit   != NULL) *fit   = core->have_model ? core->model : NULL;
+	return core->have_refl ? core->npt : 0;
+}
+
+/* ===========================================================================
+-- Parameters of the last successful fit (NULL if none)
+=========================================================================== */
+FILMFIT_PARMS *FMCore_LastFit(FMCORE *core) {
+	return (core->nvalues > 0) ? &core->last : NULL;
+}
+
+/* ===========================================================================
+-- Common end of loading a recipe -- name the values and restart the fits
+=========================================================================== */
+static int set_recipe(FMCORE *core, int rc) {
+	FILMFIT_PARMS *parms;
+	int i, j;
+
+	parms = &core->recipe.parms;
+	for (i=j=0; i<parms->nvary; i++) {
+		sprintf(core->name[j++], "%.24s", core->recipe.sample[parms->layer[i]].name);
+		sprintf(core->name[j++], "%.24s_sigma", core->recipe.sample[parms->layer[i]].name);
+	}
+	strcpy(core->name[j++], "scaling");
+	strcpy(core->name[j++], "scaling_sigma");
+	strcpy(core->name[j++], "chisqr");
+
+	core->have_recipe = TRUE;
+	core->have_model  = FALSE;
+	core->nvalues     = 0;
+	FMCore_Restart(core);
+	return rc;
+}
+
+/* ===========================================================================
+-- Normalized reflectance of a raw spectrum and its uncertainty
+--
+-- Usage: void FMCore_Reflectance(int npt, double *raw, double *ref, double *dark, double *tref, double *refl, double *sigma);
+=========================================================================== */
+void FMCore_Reflectance(int npt, double *raw, double *ref, double *dark, double *tref, double *refl, double *sigma) {
+	int i;
+
+	for (i=0; i<npt; i++) {										/* Calculate the normalized reflectance */
+		if (dark != NULL) {
+			refl[i] = (raw[i]-dark[i]) / max(1.0,ref[i]-dark[i]) ;
+			sigma[i]  = pow(1.0/max(1.0,fabs(ref[i]-dark[i])),2) * fabs(raw[i]);								/* First term in sigma^2 */
+			sigma[i] += pow((raw[i]-dark[i])/pow(max(1.0,fabs(ref[i]-dark[i])),2),2) * fabs(ref[i]);	/* Second term in sigma^2 */
+			sigma[i] += pow(-1.0/max(1.0,fabs(ref[i]-dark[i])) + (raw[i]-dark[i])/pow(max(1.0,fabs(ref[i]-dark[i])),2),2) * fabs(dark[i]);
+			sigma[i] = sqrt(sigma[i]);
+		} else {
+			refl[i] = raw[i] / max(1.0,ref[i]) ;
+			sigma[i] = refl[i] * sqrt(1.0/max(1.0,raw[i]) + 1.0/max(1.0,ref[i]));	/* Fractional uncertainty ... no dark */
+		}
+		if (tref != NULL) {											/* Scale by known reflectance of given sample */
+			refl[i]  *= tref[i];										/* Now absolute ... */
+			sigma[i] *= tref[i];										/* Also scale the uncertainty */
+		}
+		refl[i] = max(-1.0, min(2.0, refl[i]));				/* Limit so graphing clean */
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Reduced chi-square of a fit curve against measured reflectance
+--
+-- Usage: int FMCore_ChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof);
+=========================================================================== */
+int FMCore_ChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof) {
+	double chisqr;
+	int i, dof;
+
+	chisqr = 0;
+	dof = 0;
+	for (i=0; i<npt; i++) {
+		if (x[i] < xmin || x[i] > xmax) continue;
+		chisqr += pow(y[i]-yfit[i],2)/pow(s[i],2);
+		dof++;
+	}
+	if (dof >= 2) chisqr /= (dof-1);
+	if (pchisqr != NULL) *pchisqr = chisqr;
+	if (pdof    != NULL) *pdof    = dof;
+	return 0;
+}
+
+/* ===========================================================================
+-- Fit results as they are logged and recorded with a time series
+--
+-- Usage: int FMCore_FitValues(FILMFIT_PARMS *parms, double *value);
+=========================================================================== */
+int FMCore_FitValues(FILMFIT_PARMS *parms, double *value) {
+	int i,j;
+
+	for (i=j=0; i<parms->nvary; i++) {
+		value[j++] = parms->sample[parms->layer[i]].z;
+		value[j++] = parms->z_sigma[i]*sqrt(parms->chisqr);
+	}
+	value[j++] = parms->scaling;
+	value[j++] = parms->scaling_sigma*sqrt(parms->chisqr);
+	value[j++] = parms->chisqr;
+	return j;
+}
+
+/* ===========================================================================
+-- Keep 20% headroom on each side of a fitted thickness
+--
+-- Usage: int FMCore_AdjustRange(double z, double *lower, double *upper);
+=========================================================================== */
+int FMCore_AdjustRange(double z, double *lower, double *upper) {
+	double lo, hi, delta;
+	int changed = FALSE;
+
+	lo = *lower;
+	hi = *upper;
+	if (hi <= lo) {													/* Might as well verify values here also */
+		lo = max(0,lo);												/* Make sure it is positive */
+		hi = max(hi, max(2.0*lo, 10.0));							/* Upper */
+		changed = TRUE;
+	}
+	delta = hi-lo;
+	if (z-lo < 0.2*delta) {
+		*lower = max(0, z-0.2*delta);								/* Extend downward potentially to zero */
+		changed = TRUE;
+	}
+	if (hi-z < 0.2*delta) {
+		*upper = z + 0.2*delta;										/* Give 20% headroom */
+		changed = TRUE;
+	}
+	return changed;
+}
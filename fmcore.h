@@ -0,0 +1,258 @@
+#ifndef _FMCORE_H_LOADED
+#define _FMCORE_H_LOADED
+
+/* ===========================================================================
+-- FilmMeasure measurement core without the dialog.
+--
+-- An FMCORE holds what the dialog keeps for one measurement: the sample
+-- and reference stacks, the fit options, the wavelengths, the reference
+-- and dark spectra, and the last fit.  A raw sample spectrum is normalized
+-- to absolute reflectance exactly as the dialog does it (counting
+-- statistics of sample, reference and dark, scaled by the computed
+-- reflectance of the reference stack) and fit with filmfit.c.  Successive
+-- fits continue from the previous result, as automatic measurement does.
+--
+-- The helpers at the end are the arithmetic the dialog itself uses, so
+-- FilmMeasure, fmfit and other front ends give the same numbers.
+-- FilmMeasure builds its own stacks and reflectance from the dialog and
+-- hands them over with FMCore_SetStack() and FMCore_SetReflectance(), so
+-- its fits also run through FMCore_Fit().
+--
+-- Typical use:
+--    core = FMCore_Create(database);
+--    FMCore_LoadRecipe(core, "FilmMeasure.ini");
+--    FMCore_SetWavelengths(core, npt, lambda);
+--    FMCore_SetReference(core, ref);    FMCore_SetDark(core, dark);
+--    for each spectrum:
+--       FMCore_Process(core, raw);      FMCore_Fit(core);
+--       n = FMCore_Results(core, value, &names);
+--    FMCore_Free(core);
+--
+-- Requires tfoc.h, filmfit.h and recipe.h to be included first.
+=========================================================================== */
+
+typedef struct _FMCORE FMCORE;					/* Opaque */
+
+#define	FMCORE_MAX_VALUES		(2*FILMFIT_MAX_VARS+3)	/* Results of one fit */
+#define	FMCORE_NAME_LENGTH	(32)
+
+/* ===========================================================================
+-- Create or destroy a core
+--
+-- Usage: FMCORE *FMCore_Create(char *database);
+--        void FMCore_Free(FMCORE *core);
+--
+-- Inputs: database - directory of the TFOC text database; its compiled
+--                    database (MATDB_FILENAME) is used if present (NULL
+--                    if stacks come only from FMCore_SetStack)
+--
+-- Return: FMCore_Create returns NULL if memory cannot be allocated
+--
+-- Notes: Fits run on the default thread pool (TPool_Default), so set its
+--        size with TPool_SetDefaultThreads() before the first create.
+--        Until a recipe is loaded the reference stack is a bare Si
+--        substrate and there is nothing to fit.
+=========================================================================== */
+FMCORE *FMCore_Create(char *database);
+void FMCore_Free(FMCORE *core);
+
+/* ===========================================================================
+-- Load the stacks and fit options
+--
+-- Usage: int FMCore_LoadRecipe(FMCORE *core, char *inifile);
+--        int FMCore_SetSample(FMCORE *core, RECIPE_FILM *film);
+--        int FMCore_SetReferenceStack(FMCORE *core, RECIPE_FILM *film);
+--
+-- Inputs: inifile - FilmMeasure.ini style file ([Film], [Fit], [Reference])
+--         film    - stack description (see recipe.h); for the reference
+--                   only materials, thicknesses, substrate and mirror count
+--
+-- Return: 0 if successful
+--         1 if a material cannot be found (reported on stderr)
+--         2 if no layer is marked to vary (stacks are still loaded)
+--
+-- Notes: FMCore_SetSample keeps the fit options.  Any of these starts the
+--        next fit over from the thicknesses given.
+=========================================================================== */
+int FMCore_LoadRecipe(FMCORE *core, char *inifile);
+int FMCore_SetSample(FMCORE *core, RECIPE_FILM *film);
+int FMCore_SetReferenceStack(FMCORE *core, RECIPE_FILM *film);
+
+/* ===========================================================================
+-- Access to the recipe (stack and fit options) in use
+--
+-- Usage: RECIPE *FMCore_Recipe(FMCORE *core);
+--
+-- Return: the recipe owned by core
+--
+-- Notes: Fit options in parms may be changed between fits; the stacks
+--        should be changed only through FMCore_SetSample()
+=========================================================================== */
+RECIPE *FMCore_Recipe(FMCORE *core);
+
+/* ===========================================================================
+-- Set the spectrometer data
+--
+-- Usage: int FMCore_SetWavelengths(FMCORE *core, int npt, double *lambda);
+--        int FMCore_SetReference(FMCORE *core, double *ref);
+--        int FMCore_SetDark(FMCORE *core, double *dark);
+--
+-- Inputs: npt    - points per spectrum
+--         lambda - [npt] wavelengths (nm)
+--         ref    - [npt] raw counts of the reference sample
+--         dark   - [npt] dark counts (NULL for none)
+--
+-- Return: 0 if successful, 1 if the wavelengths are not set, 2 if out of
+--         memory
+--
+-- Notes: New wavelengths discard the reference, dark and any fit and
+--        restart the fits; setting the same wavelengths again does nothing
+=========================================================================== */
+int FMCore_SetWavelengths(FMCORE *core, int npt, double *lambda);
+int FMCore_SetReference(FMCORE *core, double *ref);
+int FMCore_SetDark(FMCORE *core, double *dark);
+
+/* ===========================================================================
+-- Fit a stack and reflectance prepared by the caller
+--
+-- Usage: int FMCore_SetMaterials(FMCORE *core, MATDB *db, SPECLIB *lib);
+--        int FMCore_SetStack(FMCORE *core, TFOC_SAMPLE *sample, FILMFIT_PARMS *parms);
+--        int FMCore_SetReflectance(FMCORE *core, int npt, double *lambda, double *refl, double *sigma);
+--
+-- Inputs: db, lib - compiled database and spectral library (NULL ok) that
+--                   the caller's stacks were built with
+--         sample  - EOS terminated stack (at most RECIPE_MAX_FILM films)
+--         parms   - fit options, scaling, varied layers and limits; the
+--                   spectrum fields are not used
+--         refl, sigma - [npt] normalized reflectance and its uncertainty
+--
+-- Return: FMCore_SetMaterials returns 0.  FMCore_SetStack returns 0, 1 if
+--         the stack is too long, 2 if no layer varies.
+--         FMCore_SetReflectance returns 0, or 2 if out of memory.
+--
+-- Notes: db and lib stay owned by the caller and are kept by later
+--        FMCore_LoadRecipe() calls.  FMCore_SetStack replaces the recipe:
+--        the next fit starts from the thicknesses and scaling given, and
+--        (unlike FMCore_SetSample) the warm start of the fit context is
+--        kept, as the dialog hands over its current values before every
+--        fit.  The stack may be changed in the recipe between fits, such
+--        as the limits by FMCore_AdjustRange().
+=========================================================================== */
+int FMCore_SetMaterials(FMCORE *core, MATDB *db, SPECLIB *lib);
+int FMCore_SetStack(FMCORE *core, TFOC_SAMPLE *sample, FILMFIT_PARMS *parms);
+int FMCore_SetReflectance(FMCORE *core, int npt, double *lambda, double *refl, double *sigma);
+
+/* ===========================================================================
+-- Process and fit a sample spectrum
+--
+-- Usage: int FMCore_Process(FMCORE *core, double *raw);
+--        int FMCore_Fit(FMCORE *core);
+--        int FMCore_Restart(FMCORE *core);
+--        void FMCore_Cancel(FMCORE *core);
+--
+-- Inputs: raw - [npt] raw counts of the sample
+--
+-- Return: FMCore_Process returns 0, or 1 if there is no reference.
+--         FMCore_Fit returns the FilmFit_Fit() code (>= 0 on success), or
+--         -100 if there is no processed spectrum or recipe.
+--         FMCore_Restart returns 0.
+--
+-- Notes: A successful fit leaves its thicknesses and scaling in the stack
+--        and (with the recipe's warm_start) the next fit starts from them.
+--        A failed fit, or FMCore_Restart, goes back to the recipe values.
+--        FMCore_Cancel() may be called from another thread to end a fit
+--        in progress early (see FilmFit_Cancel).
+=========================================================================== */
+int FMCore_Process(FMCORE *core, double *raw);
+int FMCore_Fit(FMCORE *core);
+int FMCore_Restart(FMCORE *core);
+void FMCore_Cancel(FMCORE *core);
+
+/* ===========================================================================
+-- Results of the last successful fit
+--
+-- Usage: int FMCore_Results(FMCORE *core, double *value, char ***names);
+--        int FMCore_Curves(FMCORE *core, double **refl, double **sigma, double **fit);
+--        FILMFIT_PARMS *FMCore_LastFit(FMCORE *core);
+--
+-- Output: value[] - z and sigma of each varied layer, scaling and its sigma,
+--                   then chisqr, as FMCore_FitValues() (NULL ok)
+--         *names  - [n] names of the values, owned by core (NULL ok)
+--         *refl, *sigma - [npt] processed reflectance and uncertainty
+--         *fit    - [npt] reflectance of the fitted stack over the whole
+--                   spectrum; compare with refl*scaling as the dialog does
+--
+-- Return: FMCore_Results returns the number of values (0 if no fit has
+--         succeeded).  FMCore_Curves returns npt (0 if nothing processed);
+--         the arrays are owned by core and *fit is NULL without a fit.
+--         FMCore_LastFit returns the parameters of the fit as FilmFit_Fit()
+--         left them (z_sigma, scaling, chisqr, thicknesses in sample[]),
+--         or NULL; they are owned by core and valid until the next fit.
+=========================================================================== */
+int FMCore_Results(FMCORE *core, double *value, char ***names);
+int FMCore_Curves(FMCORE *core, double **refl, double **sigma, double **fit);
+FILMFIT_PARMS *FMCore_LastFit(FMCORE *core);
+
+/* ===========================================================================
+-- Normalized reflectance of a raw spectrum and its uncertainty
+--
+-- Usage: void FMCore_Reflectance(int npt, double *raw, double *ref, double *dark, double *tref, double *refl, double *sigma);
+--
+-- Inputs: npt   - number of points
+--         raw   - raw counts of the sample
+--         ref   - raw counts of the reference
+--         dark  - dark counts (NULL if none)
+--         tref  - known reflectance of the reference (NULL if unknown)
+--         refl  - array to receive the reflectance
+--         sigma - array to receive its uncertainty (counting statistics)
+--
+-- Notes: No scaling correction is applied.  Values are limited to -1 ... 2
+--        so graphing stays clean.
+=========================================================================== */
+void FMCore_Reflectance(int npt, double *raw, double *ref, double *dark, double *tref, double *refl, double *sigma);
+
+/* ===========================================================================
+-- Reduced chi-square of a fit curve against measured reflectance
+--
+-- Usage: int FMCore_ChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof);
+--
+-- Inputs: x         - wavelengths (for the xmin,xmax limits)
+--         y, s      - measured reflectance and its uncertainty
+--         yfit      - fit value at each point
+--         npt       - number of points
+--         xmin,xmax - range of wavelengths to include
+--
+-- Output: if not NULL, *pchisqr and *pdof (points used)
+--
+-- Return: 0
+=========================================================================== */
+int FMCore_ChiSqr(double *x, double *y, double *s, double *yfit, int npt, double xmin, double xmax, double *pchisqr, int *pdof);
+
+/* ===========================================================================
+-- Fit results as they are logged and recorded with a time series
+--
+-- Usage: int FMCore_FitValues(FILMFIT_PARMS *parms, double *value);
+--
+-- Output: value[] - z and sigma of each varied layer, scaling and its
+--                   sigma (sigmas scaled by sqrt(chisqr)), then chisqr
+--
+-- Return: number of values (2*nvary+3)
+=========================================================================== */
+int FMCore_FitValues(FILMFIT_PARMS *parms, double *value);
+
+/* ===========================================================================
+-- Keep 20% headroom on each side of a fitted thickness
+--
+-- Usage: int FMCore_AdjustRange(double z, double *lower, double *upper);
+--
+-- Inputs: z            - fitted thickness
+--         lower, upper - current fit limits (modified)
+--
+-- Return: TRUE if the limits were changed (or found inconsistent)
+--
+-- Notes: Used after automatic fits so a drifting film never runs into a
+--        limit; the lower limit never goes below zero
+=========================================================================== */
+int FMCore_AdjustRange(double z, double *lower, double *upper);
+
+#endif		/* _FMCORE_H_LOADED */
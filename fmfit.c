@@ -0,0 +1,367 @@
+/* fmfit.c - Fit FilmMeasure spectra from the command line */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tfoc.h"
+#include "tpool.h"
+#include "matdb.h"
+#include "filmfit.h"
+#include "recipe.h"
+#include "fmcore.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	DFLT_INIFILE	"./FilmMeasure.ini"
+#define	DFLT_DATABASE	"./database.nk"
+#define	MAX_NPT			(65536)						/* As FilmMeasure LoadData() */
+
+/* One saved spectrum (FilmMeasure "Save data" file) */
+typedef struct _SPECTRUM {
+	int npt;
+	double *lambda, *raw, *dark, *ref;				/* [npt] each, one allocation */
+	int have_dark;										/* Dark not all zero */
+	RECIPE_FILM sample, reference;					/* Stacks as saved */
+	int have_sample, have_reference;
+} SPECTRUM;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void usage(void);
+static int read_spectrum(char *path, SPECTRUM *spec);
+static char *read_material(char *aptr, char *name, size_t len);
+
+/* ===========================================================================
+-- Usage: fmfit [-q] [-ini file] [-threads n] [-stack] [-cold] [-repeat n] [-curve file] [-o output] spectrum ...
+--
+-- Fits spectra saved by FilmMeasure ("Save data" files with the raw,
+-- dark and reference counts) with the same normalization and fit as the
+-- dialog, using the [Film], [Reference] and [Fit] sections of the ini
+-- file (or, with -stack, the stacks saved in each spectrum).  One results
+-- row per spectrum:
+--     file,rc,z_1,sigma_1,...,scaling,scaling_sigma,chisqr
+-- with the sigmas scaled by sqrt(chisqr) as in the FilmMeasure fit log.
+--
+-- Spectra are taken in order and each fit continues from the previous
+-- one, as automatic measurement does; -cold starts every fit from the
+-- stack thicknesses.  -repeat n fits each spectrum n times from the
+-- stack thicknesses and reports the time per fit, for benchmarks.
+-- -curve writes lambda,reflectance,sigma,fit for the last spectrum.
+=========================================================================== */
+int main(int argc, char *argv[]) {
+
+	char *inifile, *outfile, *curvefile, *database, *env, **names;
+	int i, j, k, rc, verbose, nthreads, use_stack, cold, repeat, nfile, nvalues, nfit, nfail, nstack, header;
+	double t0, tfit, value[FMCORE_MAX_VALUES], *refl, *sigma, *fit;
+	FILE *funit;
+	SPECTRUM spec;
+	RECIPE_FILM last_sample, last_reference;
+	FMCORE *core;
+
+	inifile   = DFLT_INIFILE;
+	outfile   = NULL;
+	curvefile = NULL;
+	nthreads  = 0;
+	use_stack = FALSE;
+	cold      = FALSE;
+	repeat    = 1;
+	verbose   = TRUE;
+	for (i=1; i<argc && *argv[i] == '-'; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			verbose = FALSE;
+		} else if (strcmp(argv[i], "-ini") == 0 && i+1 < argc) {
+			inifile = argv[++i];
+		} else if (strcmp(argv[i], "-threads") == 0 && i+1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-stack") == 0) {
+			use_stack = TRUE;
+		} else if (strcmp(argv[i], "-cold") == 0) {
+			cold = TRUE;
+		} else if (strcmp(argv[i], "-repeat") == 0 && i+1 < argc) {
+			repeat = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-curve") == 0 && i+1 < argc) {
+			curvefile = argv[++i];
+		} else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+			outfile = argv[++i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	if (i >= argc || repeat < 1) {
+		usage();
+		return 1;
+	}
+	nfile = argc-i;
+	argv += i;
+
+	/* Materials -- compiled database if present, otherwise the text files */
+	database = ( (env = getenv("tfocDatabase")) != NULL && *env != '\0') ? env : DFLT_DATABASE;
+	TPool_SetDefaultThreads(nthreads);
+	if ( (core = FMCore_Create(database)) == NULL) {
+		fprintf(stderr, "ERROR: unable to allocate memory\n"); fflush(stderr);
+		return 4;
+	}
+	if ( (rc = FMCore_LoadRecipe(core, inifile)) == 1 && ! use_stack) {
+		FMCore_Free(core);
+		return 2;
+	} else if (rc == 2 && ! use_stack) {
+		fprintf(stderr, "ERROR: no layers are marked to vary in [Film] of \"%s\"\n", inifile); fflush(stderr);
+		FMCore_Free(core);
+		return 2;
+	}
+
+	if (outfile == NULL) {
+		funit = stdout;
+	} else if ( (funit = fopen(outfile, "w")) == NULL) {
+		fprintf(stderr, "ERROR: unable to create \"%s\"\n", outfile); fflush(stderr);
+		FMCore_Free(core);
+		return 3;
+	}
+	if (verbose) {
+		fprintf(stderr, "Fitting %d spectr%s with the %s on %d thread%s\n", nfile, (nfile == 1) ? "um" : "a",
+				  use_stack ? "stacks saved with each" : "recipe in the ini file", TPool_Threads(TPool_Default()), (TPool_Threads(TPool_Default()) == 1) ? "" : "s");
+		fflush(stderr);
+	}
+
+	memset(&spec, 0, sizeof(spec));
+	nfit = nfail = nstack = 0;
+	header = TRUE;
+	tfit = 0.0;
+	rc = 0;
+	for (i=0; i<nfile; i++) {
+		if (read_spectrum(argv[i], &spec) != 0) {
+			rc = 3;
+			continue;
+		}
+
+		/* Stacks from the file only when they differ from those in use */
+		if (use_stack && spec.have_reference && (nstack == 0 || memcmp(&spec.reference, &last_reference, sizeof(last_reference)) != 0)) {
+			FMCore_SetReferenceStack(core, &spec.reference);
+			last_reference = spec.reference;
+		}
+		if (use_stack && spec.have_sample && (nstack == 0 || memcmp(&spec.sample, &last_sample, sizeof(last_sample)) != 0)) {
+			last_sample = spec.sample;
+			if (FMCore_SetSample(core, &spec.sample) != 0) {
+				fprintf(stderr, "ERROR: \"%s\" has no usable sample stack\n", argv[i]); fflush(stderr);
+				memset(&last_sample, 0, sizeof(last_sample));
+				rc = 2;
+				continue;
+			}
+			nstack++;
+			header = TRUE;
+		}
+
+		/* Same wavelengths keep following the film; new ones restart */
+		FMCore_SetWavelengths(core, spec.npt, spec.lambda);
+		FMCore_SetReference(core, spec.ref);
+		FMCore_SetDark(core, spec.have_dark ? spec.dark : NULL);
+		FMCore_Process(core, spec.raw);
+
+		/* Fit, repeatedly from the stack thicknesses when benchmarking */
+		for (k=0; k<repeat; k++) {
+			if (cold || repeat > 1) FMCore_Restart(core);
+			t0 = TPool_Timer();
+			j = FMCore_Fit(core);
+			tfit += TPool_Timer()-t0;
+			nfit++;
+		}
+		if (j < 0) nfail++;
+
+		nvalues = 2*FMCore_Recipe(core)->parms.nvary+3;
+		if (header) {														/* Again whenever the stack changes */
+			FMCore_Results(core, NULL, &names);
+			fprintf(funit, "# file,rc");
+			for (k=0; k<nvalues; k++) fprintf(funit, ",%s", names[k]);
+			fprintf(funit, "\n");
+			header = FALSE;
+		}
+		if (j < 0 || FMCore_Results(core, value, NULL) != nvalues) {
+			for (k=0; k<nvalues; k++) value[k] = 0.0;
+		}
+		fprintf(funit, "%s,%d", argv[i], j);
+		for (k=0; k<nvalues; k++) fprintf(funit, ",%g", value[k]);
+		fprintf(funit, "\n");
+	}
+	if (funit != stdout) fclose(funit);
+
+	/* Curves of the last spectrum */
+	if (curvefile != NULL && (j = FMCore_Curves(core, &refl, &sigma, &fit)) > 0) {
+		if ( (funit = fopen(curvefile, "w")) == NULL) {
+			fprintf(stderr, "ERROR: unable to create \"%s\"\n", curvefile); fflush(stderr);
+			rc = 3;
+		} else {
+			fprintf(funit, "# lambda,reflectance,uncertainty,fit\n");
+			for (k=0; k<j; k++) fprintf(funit, "%f,%f,%f,%f\n", spec.lambda[k], refl[k], sigma[k], (fit != NULL) ? fit[k] : 0.0);
+			fclose(funit);
+		}
+	}
+
+	if (verbose && nfit > 0) {
+		fprintf(stderr, "%d fit%s (%d failed) in %.3f s, %.2f ms per fit\n", nfit, (nfit == 1) ? "" : "s", nfail*repeat, tfit, 1000.0*tfit/nfit);
+		fflush(stderr);
+	}
+	if (spec.lambda != NULL) free(spec.lambda);
+	FMCore_Free(core);
+	return rc;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: fmfit [-q] [-ini file] [-threads n] [-stack] [-cold] [-repeat n] [-curve file] [-o output] spectrum ...\n"
+						 "   -ini      recipe file (default " DFLT_INIFILE ")\n"
+						 "   -threads  threads to use (default all processors)\n"
+						 "   -stack    use the sample and reference stacks saved with each spectrum\n"
+						 "   -cold     start every fit from the stack thicknesses\n"
+						 "   -repeat   fit each spectrum n times and report the time per fit\n"
+						 "   -curve    write reflectance and fit of the last spectrum\n"
+						 "   -o        results file (default stdout)\n");
+	fflush(stderr);
+	return;
+}
+
+/* ===========================================================================
+-- Read a spectrum saved by FilmMeasure (SaveData)
+--
+-- Usage: int read_spectrum(char *path, SPECTRUM *spec);
+--
+-- Output: *spec - arrays (reallocated as needed) and the stacks if saved
+--
+-- Return: 0 if successful, !0 on errors (reported on stderr)
+=========================================================================== */
+static int read_spectrum(char *path, SPECTRUM *spec) {
+	static char *rname = "read_spectrum";
+
+	enum {NORMAL, REFERENCE, SAMPLE} mode;
+	RECIPE_FILM *film;
+	char szBuf[1024], *aptr;
+	int valid, npt, ipt, index;
+	double *work;
+	FILE *funit;
+
+	if ( (funit = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "ERROR[%s]: unable to open \"%s\"\n", rname, path); fflush(stderr);
+		return 1;
+	}
+
+	valid = FALSE;
+	npt = ipt = 0;
+	mode = NORMAL;
+	film = NULL;
+	spec->have_sample = spec->have_reference = spec->have_dark = FALSE;
+	while (fgets(szBuf, sizeof(szBuf), funit) != NULL) {
+		if ( (aptr = strchr(szBuf, '\n')) != NULL) *aptr = '\0';
+
+		if (strncmp(szBuf, "# FilmMeasure spectrum v1.0", 27) == 0) {	/* Version identifier */
+			valid = TRUE;
+
+		} else if (strncmp(szBuf, "# NPT: ", 7) == 0) {						/* Spectrum size */
+			npt = atol(szBuf+7);
+			if (! valid || npt <= 0 || npt > MAX_NPT) break;
+			if (npt > spec->npt || spec->lambda == NULL) {
+				if ( (work = realloc(spec->lambda, 4*npt*sizeof(double))) == NULL) break;
+				spec->lambda = work;
+			}
+			spec->npt  = npt;
+			spec->raw  = spec->lambda +   npt;
+			spec->dark = spec->lambda + 2*npt;
+			spec->ref  = spec->lambda + 3*npt;
+
+		} else if (strncmp(szBuf, "# REFERENCE STACK", 17) == 0 || strncmp(szBuf, "# SAMPLE STACK", 14) == 0) {
+			mode = (szBuf[2] == 'R') ? REFERENCE : SAMPLE;
+			film = (mode == REFERENCE) ? &spec->reference : &spec->sample;
+			memset(film, 0, sizeof(*film));
+			if (mode == REFERENCE) spec->have_reference = TRUE; else spec->have_sample = TRUE;
+
+		} else if (strncmp(szBuf, "# END", 5) == 0) {
+			mode = NORMAL;
+
+		} else if (mode != NORMAL && film != NULL) {						/* Layer or substrate of a stack */
+			aptr = szBuf+1;
+			while (isspace(*aptr)) aptr++;
+			if (isdigit(*aptr)) {
+				index = strtol(aptr, &aptr, 10);
+				if (index < 0 || index >= RECIPE_MAX_FILM) continue;
+				aptr = read_material(aptr, film->layer[index].material, sizeof(film->layer[index].material));
+				film->layer[index].nm = strtod(aptr, &aptr);
+				if (mode == SAMPLE) {
+					film->layer[index].lower = strtod(aptr, &aptr);
+					film->layer[index].upper = strtod(aptr, &aptr);
+					while (isspace(*aptr)) aptr++;
+					film->layer[index].vary = strchr("yY1", *aptr) != NULL && *aptr != '\0';
+				}
+			} else if (strncmp(aptr, "substrate ", 10) == 0) {
+				read_material(aptr+10, film->substrate, sizeof(film->substrate));
+			}
+
+		} else if (*szBuf == '#' || *szBuf == '\0') {					/* Other comment line */
+			continue;
+
+		} else if (npt <= 0) {
+			break;
+
+		} else {
+			if (ipt < npt) {
+				aptr = szBuf;
+				spec->lambda[ipt] = strtod(aptr, &aptr); while (isspace(*aptr) || *aptr == ',') aptr++;
+				strtod(aptr, &aptr);                     while (isspace(*aptr) || *aptr == ',') aptr++;	/* Reflectance */
+				strtod(aptr, &aptr);                     while (isspace(*aptr) || *aptr == ',') aptr++;	/* Uncertainty */
+				spec->raw[ipt]    = strtod(aptr, &aptr); while (isspace(*aptr) || *aptr == ',') aptr++;
+				spec->dark[ipt]   = strtod(aptr, &aptr); while (isspace(*aptr) || *aptr == ',') aptr++;
+				spec->ref[ipt]    = strtod(aptr, &aptr);
+				if (spec->dark[ipt] != 0.0) spec->have_dark = TRUE;
+			}
+			ipt++;
+		}
+	}
+	fclose(funit);
+
+	if (! valid || npt <= 0 || ipt != npt) {
+		fprintf(stderr, "ERROR[%s]: \"%s\" is not a complete FilmMeasure spectrum (v1.0) file\n", rname, path); fflush(stderr);
+		return 2;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Material name, in quotes as SaveData writes it (or up to white space)
+--
+-- Return: pointer to the character following the name
+=========================================================================== */
+static char *read_material(char *aptr, char *name, size_t len) {
+	char *end;
+
+	while (isspace(*aptr)) aptr++;
+	if (*aptr == '"') {
+		aptr++;
+		if ( (end = strchr(aptr, '"')) == NULL) end = aptr+strlen(aptr);
+	} else {
+		for (end=aptr; *end != '\0' && ! isspace(*end); end++) ;
+	}
+	if ((size_t) (end-aptr) >= len) end = aptr+len-1;
+	memcpy(name, aptr, end-aptr);
+	name[end-aptr] = '\0';
+	return (*end == '"') ? end+1 : end;
+}
@@ -0,0 +1,316 @@
+/* fmrefit.c - Refit a FilmMeasure time series with the recipe in FilmMeasure.ini */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tfoc.h"
+#include "tpool.h"
+#include "matdb.h"
+#include "speclib.h"
+#include "filmfit.h"
+#include "recipe.h"
+#include "tseries.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	DFLT_INIFILE	"./FilmMeasure.ini"
+#define	DFLT_DATABASE	"./database.nk"
+#define	DFLT_BLOCK		(4096)						/* Spectra read and fit per pass */
+
+typedef enum {ROWS_AUTO, ROWS_RAW, ROWS_REFL} ROW_TYPE;
+
+/* Result of fitting one spectrum */
+typedef struct _REFIT_RESULT {
+	int rc;												/* FilmFit_Fit() return code */
+	double z[FILMFIT_MAX_VARS], z_sigma[FILMFIT_MAX_VARS];
+	double scaling, scaling_sigma, chisqr;
+} REFIT_RESULT;
+
+/* One block of spectra, split across the tasks in contiguous runs */
+typedef struct _REFIT_JOB {
+	RECIPE *recipe;
+	TSERIES *ts;
+	int raw;												/* Rows hold raw counts */
+	int npt;
+	double *lambda;
+	int nrow, ntask;
+	double *rows;										/* [nrow][npt] values as read */
+	REFIT_RESULT *result;							/* [nrow] */
+	FILMFIT **fit;										/* [ntask] serial contexts */
+	TFOC_SAMPLE **sample;							/* [ntask] private stacks */
+	double **refl, **sigma;							/* [ntask][npt] workspace */
+} REFIT_JOB;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void usage(void);
+static void refit_task(void *arg, int itask);
+
+/* ===========================================================================
+-- Usage: fmrefit [-q] [-ini file] [-threads n] [-raw | -refl] [-o output] timeseries
+--
+-- Streams a time series written by FilmMeasure (text or binary layout, see
+-- tseries.h), fits every spectrum with the [Film] stack and [Fit] options
+-- of the ini file (as FilmMeasure would after a recipe change) and writes
+-- one results row per spectrum:
+--     time,index,rc,z_1,sigma_1,...,scaling,scaling_sigma,chisqr
+-- with the sigmas scaled by sqrt(chisqr) as in the FilmMeasure fit log.
+--
+-- Spectra are read DFLT_BLOCK at a time and each block is split into one
+-- contiguous run per thread.  Within a run each fit continues from the
+-- previous one (warm start, if enabled in the recipe); the first of each
+-- run starts from the recipe thicknesses.  Materials not in the compiled
+-- database go through TFOC, which is not reentrant, and force one thread.
+=========================================================================== */
+int main(int argc, char *argv[]) {
+
+	char *inifile, *infile, *outfile, *database, *env, path[1024];
+	int i, j, rc, verbose, nthreads, nrow, ntask, nlayers, nvary, total;
+	double *times;
+	ROW_TYPE rows;
+	double t0, chi;
+	FILE *funit;
+	RECIPE recipe;
+	REFIT_JOB job;
+	TPOOL *pool;
+	MATDB *db;
+	SPECLIB *lib;
+	TSERIES *ts;
+
+	inifile  = DFLT_INIFILE;
+	infile   = NULL;
+	outfile  = NULL;
+	nthreads = 0;
+	rows     = ROWS_AUTO;
+	verbose  = TRUE;
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			verbose = FALSE;
+		} else if (strcmp(argv[i], "-ini") == 0 && i+1 < argc) {
+			inifile = argv[++i];
+		} else if (strcmp(argv[i], "-threads") == 0 && i+1 < argc) {
+			nthreads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+			outfile = argv[++i];
+		} else if (strcmp(argv[i], "-raw") == 0) {
+			rows = ROWS_RAW;
+		} else if (strcmp(argv[i], "-refl") == 0) {
+			rows = ROWS_REFL;
+		} else if (*argv[i] == '-' || i != argc-1) {
+			usage();
+			return 1;
+		} else {
+			infile = argv[i];
+		}
+	}
+	if (infile == NULL) {
+		usage();
+		return 1;
+	}
+
+	/* Materials -- compiled database if present, otherwise the text files */
+	database = ( (env = getenv("tfocDatabase")) != NULL && *env != '\0') ? env : DFLT_DATABASE;
+	sprintf(path, "%.1000s/%s", database, MATDB_FILENAME);
+	db = MatDB_Open(path);
+
+	if ( (rc = Recipe_Read(inifile, database, db, &recipe)) != 0) {
+		if (rc == 2) { fprintf(stderr, "ERROR: no layers are marked to vary in [Film] of \"%s\"\n", inifile); fflush(stderr); }
+		MatDB_Close(db);
+		return 2;
+	}
+	lib = (*recipe.speclib != '\0') ? SpecLib_Open(recipe.speclib) : NULL;
+
+	if ( (ts = TSeries_Open(infile)) == NULL) {
+		SpecLib_Close(lib); MatDB_Close(db);
+		return 3;
+	}
+	if (outfile == NULL) {
+		funit = stdout;
+	} else if ( (funit = fopen(outfile, "w")) == NULL) {
+		fprintf(stderr, "ERROR: unable to create \"%s\"\n", outfile); fflush(stderr);
+		TSeries_Close(ts); SpecLib_Close(lib); MatDB_Close(db);
+		return 3;
+	}
+
+	/* Threads -- one serial fit context and stack per task */
+	if (recipe.tfoc_needed && nthreads != 1) {
+		fprintf(stderr, "WARNING: materials not in the compiled database; fitting on one thread\n"); fflush(stderr);
+		nthreads = 1;
+	}
+	TPool_SetDefaultThreads(nthreads);
+	pool  = TPool_Default();
+	ntask = TPool_Threads(pool);
+	nlayers = recipe.nlayers+1;								/* Include the EOS */
+	nvary   = recipe.parms.nvary;
+
+	memset(&job, 0, sizeof(job));
+	job.recipe = &recipe;
+	job.ts     = ts;
+	job.npt    = TSeries_Points(ts);
+	job.lambda = TSeries_Lambda(ts);
+	job.ntask  = ntask;
+	job.rows   = malloc((size_t) DFLT_BLOCK*job.npt*sizeof(double));
+	job.result = calloc(DFLT_BLOCK, sizeof(REFIT_RESULT));
+	job.fit    = calloc(ntask, sizeof(FILMFIT *));
+	job.sample = calloc(ntask, sizeof(TFOC_SAMPLE *));
+	job.refl   = calloc(ntask, sizeof(double *));
+	job.sigma  = calloc(ntask, sizeof(double *));
+	times      = calloc(DFLT_BLOCK, sizeof(double));
+	rc = (job.rows == NULL || job.result == NULL || job.fit == NULL || job.sample == NULL ||
+			job.refl == NULL || job.sigma == NULL || times == NULL);
+	for (i=0; ! rc && i<ntask; i++) {
+		job.fit[i]    = FilmFit_Create(NULL);
+		job.sample[i] = malloc(nlayers*sizeof(TFOC_SAMPLE));
+		job.refl[i]   = malloc(job.npt*sizeof(double));
+		job.sigma[i]  = malloc(job.npt*sizeof(double));
+		rc = (job.fit[i] == NULL || job.sample[i] == NULL || job.refl[i] == NULL || job.sigma[i] == NULL);
+		if (! rc) {
+			FilmFit_SetMaterialDB(job.fit[i], db);
+			FilmFit_SetLibrary(job.fit[i], lib);
+		}
+	}
+	if (rc) {
+		fprintf(stderr, "ERROR: unable to allocate memory\n"); fflush(stderr);
+		rc = 4;
+		goto Exit;
+	}
+
+	if (verbose) {
+		fprintf(stderr, "Refitting \"%s\" (%d points) with the recipe in \"%s\" on %d thread%s\n", infile, job.npt, inifile, ntask, (ntask == 1) ? "" : "s");
+		fflush(stderr);
+	}
+
+	/* Results header */
+	fprintf(funit, "# time,index,rc");
+	for (j=0; j<nvary; j++) fprintf(funit, ",%s,%s_sigma", recipe.parms.name[j], recipe.parms.name[j]);
+	fprintf(funit, ",scaling,scaling_sigma,chisqr\n");
+
+	/* Stream the file a block at a time */
+	t0 = TPool_Timer();
+	total = 0;
+	while (TRUE) {
+		for (nrow=0; nrow<DFLT_BLOCK; nrow++) {
+			if ( (rc = TSeries_Read(ts, &times[nrow], &job.rows[(size_t) nrow*job.npt])) == 1) break;
+			if (rc < 0) { rc = 4; goto Exit; }
+			if (rc == 2) { fprintf(stderr, "WARNING: spectrum %d is short; missing values set to 0\n", total+nrow); fflush(stderr); }
+		}
+		if (nrow == 0) break;
+		if (total == 0) {
+			if (rows != ROWS_AUTO) {
+				job.raw = (rows == ROWS_RAW);
+			} else {
+				job.raw = (TSeries_Raw(ts) >= 0) ? TSeries_Raw(ts) : TSeries_IsRaw(ts, job.rows);
+			}
+			if (verbose) { fprintf(stderr, "Spectra hold %s\n", job.raw ? "raw counts" : "reflectance"); fflush(stderr); }
+		}
+
+		job.nrow = nrow;
+		TPool_Run(pool, (nrow < ntask) ? nrow : ntask, refit_task, &job);
+
+		for (i=0; i<nrow; i++) {
+			REFIT_RESULT *r = &job.result[i];
+			chi = (r->rc >= 0 && r->chisqr > 0) ? sqrt(r->chisqr) : 0.0;
+			fprintf(funit, "%.3f,%d,%d", times[i], total+i, r->rc);
+			for (j=0; j<nvary; j++) fprintf(funit, ",%g,%g", r->z[j], r->z_sigma[j]*chi);
+			fprintf(funit, ",%g,%g,%g\n", r->scaling, r->scaling_sigma*chi, r->chisqr);
+		}
+		total += nrow;
+		if (verbose) { fprintf(stderr, "\r%d spectra, %.1f per second", total, total/(TPool_Timer()-t0)); fflush(stderr); }
+		if (nrow < DFLT_BLOCK) break;
+	}
+	if (verbose) { fprintf(stderr, "\n%d spectra refit in %.2f s\n", total, TPool_Timer()-t0); fflush(stderr); }
+	rc = 0;
+
+Exit:
+	if (funit != stdout) fclose(funit);
+	for (i=0; job.fit != NULL && job.sample != NULL && job.refl != NULL && job.sigma != NULL && i<ntask; i++) {
+		FilmFit_Free(job.fit[i]);
+		if (job.sample[i] != NULL) free(job.sample[i]);
+		if (job.refl[i]   != NULL) free(job.refl[i]);
+		if (job.sigma[i]  != NULL) free(job.sigma[i]);
+	}
+	free(job.fit); free(job.sample); free(job.refl); free(job.sigma);
+	free(job.rows); free(job.result); free(times);
+	TSeries_Close(ts);
+	SpecLib_Close(lib);
+	MatDB_Close(db);
+	return rc;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: fmrefit [-q] [-ini file] [-threads n] [-raw | -refl] [-o output] timeseries\n"
+						 "   -ini      recipe file (default " DFLT_INIFILE ")\n"
+						 "   -threads  threads to use (default all processors)\n"
+						 "   -raw      spectra are raw counts (default: from the file, or decided from the first)\n"
+						 "   -refl     spectra are reflectance\n"
+						 "   -o        results file (default stdout)\n");
+	fflush(stderr);
+	return;
+}
+
+/* ===========================================================================
+-- Fit one contiguous run of a block -- rows nrow*itask/ntask up to the next
+-- run, in the private context job->fit[itask]
+=========================================================================== */
+static void refit_task(void *arg, int itask) {
+	REFIT_JOB *job = (REFIT_JOB *) arg;
+	FILMFIT_PARMS parms;
+	REFIT_RESULT *r;
+	TFOC_SAMPLE *sample;
+	int i, j, ntask, first, last;
+
+	ntask = (job->nrow < job->ntask) ? job->nrow : job->ntask;
+	first = (int) ((long long) job->nrow*itask/ntask);
+	last  = (int) ((long long) job->nrow*(itask+1)/ntask);
+	sample = job->sample[itask];
+	memcpy(sample, job->recipe->sample, (job->recipe->nlayers+1)*sizeof(*sample));
+
+	for (i=first; i<last; i++) {
+		TSeries_Reflectance(job->ts, &job->rows[(size_t) i*job->npt], job->raw, job->refl[itask], job->sigma[itask]);
+
+		parms = job->recipe->parms;
+		parms.sample  = sample;
+		parms.npt     = job->npt;
+		parms.lambda  = job->lambda;
+		parms.refl    = job->refl[itask];
+		parms.sigma   = job->sigma[itask];
+		parms.verbose = FALSE;
+		if (i == first) parms.warm_start = FALSE;			/* Context last saw another part of the file */
+		if (i > first) parms.scaling = job->result[i-1].scaling;
+
+		r = &job->result[i];
+		memset(r, 0, sizeof(*r));
+		r->rc = FilmFit_Fit(job->fit[itask], &parms);
+		for (j=0; j<parms.nvary; j++) {
+			r->z[j] = sample[parms.layer[j]].z;
+			r->z_sigma[j] = parms.z_sigma[j];
+		}
+		r->scaling       = parms.scaling;
+		r->scaling_sigma = parms.scaling_sigma;
+		r->chisqr        = parms.chisqr;
+		if (r->rc < 0) memcpy(sample, job->recipe->sample, (job->recipe->nlayers+1)*sizeof(*sample));
+	}
+	return;
+}
@@ -0,0 +1,202 @@
+/* fringe.c - Optical thickness from the fringe period of a reflectance spectrum */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+#define _USE_MATH_DEFINES
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "fringe.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef M_PI
+	#define	M_PI	(3.14159265358979323846)
+#endif
+
+#define	MIN_POINTS		(16)				/* Fewest valid points worth transforming */
+#define	MIN_GRID			(256)				/* Size of the uniform wavenumber grid ... */
+#define	MAX_GRID			(8192)			/* ... power of 2 between these limits */
+#define	PAD_FACTOR		(4)				/* Zero padding for a finer peak position */
+#define	MIN_CONTRAST	(10.0)			/* Peak power relative to mean of the band */
+
+typedef struct _FRINGE_POINT {
+	double sigma;								/* Wavenumber (1/nm) */
+	double refl;
+} FRINGE_POINT;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int cmp_sigma(const void *a, const void *b);
+static void fft(int n, double *re, double *im);
+
+/* ===========================================================================
+-- qsort comparison -- ascending wavenumber
+=========================================================================== */
+static int cmp_sigma(const void *a, const void *b) {
+	double sa = ((FRINGE_POINT *) a)->sigma, sb = ((FRINGE_POINT *) b)->sigma;
+	return (sa < sb) ? -1 : (sa > sb) ? 1 : 0;
+}
+
+/* ===========================================================================
+-- In-place radix-2 complex FFT (forward, unnormalized)
+--
+-- Usage: void fft(int n, double *re, double *im);
+--
+-- Inputs: n      - length, a power of 2
+--         re, im - [n] real and imaginary parts, replaced by the transform
+=========================================================================== */
+static void fft(int n, double *re, double *im) {
+	int i, j, k, len;
+	double t, wr, wi, cr, ci, ur, ui, vr, vi;
+
+	/* Bit reversal permutation */
+	for (i=1,j=0; i<n; i++) {
+		for (k=n>>1; j & k; k>>=1) j ^= k;
+		j |= k;
+		if (i < j) {
+			t = re[i]; re[i] = re[j]; re[j] = t;
+			t = im[i]; im[i] = im[j]; im[j] = t;
+		}
+	}
+
+	/* Butterflies */
+	for (len=2; len<=n; len<<=1) {
+		wr = cos(-2*M_PI/len); wi = sin(-2*M_PI/len);
+		for (i=0; i<n; i+=len) {
+			cr = 1.0; ci = 0.0;
+			for (j=0; j<len/2; j++) {
+				ur = re[i+j];            ui = im[i+j];
+				vr = re[i+j+len/2]*cr - im[i+j+len/2]*ci;
+				vi = re[i+j+len/2]*ci + im[i+j+len/2]*cr;
+				re[i+j] = ur+vr;         im[i+j] = ui+vi;
+				re[i+j+len/2] = ur-vr;   im[i+j+len/2] = ui-vi;
+				t  = cr*wr - ci*wi;
+				ci = cr*wi + ci*wr;
+				cr = t;
+			}
+		}
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Estimate the optical thickness from a reflectance spectrum
+--
+-- Usage: int Fringe_OpticalThickness(int npt, double *lambda, double *refl, int *valid,
+--                                    double *nd, double *resolution);
+--
+-- Inputs: npt    - number of points in the spectrum
+--         lambda - [npt] wavelengths (nm), any order
+--         refl   - [npt] measured reflectance
+--         valid  - [npt] nonzero for points to use, or NULL to use all
+--         nd     - pointer to receive the optical thickness n*d (nm)
+--         resolution - if not NULL, receives the width in n*d of one bin
+--
+-- Return: 0 if successful, 1 too few points, 2 no clear fringe period,
+--         <0 on memory failure
+=========================================================================== */
+int Fringe_OpticalThickness(int npt, double *lambda, double *refl, int *valid, double *nd, double *resolution) {
+	static char *rname = "Fringe_OpticalThickness";
+	FRINGE_POINT *pt;
+	double *re, *im, *power;
+	double span, dsigma, sigma, f, sx, sy, sxx, sxy, slope, offset, mean, y0, y1, y2, shift;
+	int i, j, nvalid, ngrid, nfft, klow, kmin, kmax, kpeak, rc;
+
+	if (npt <= 0 || lambda == NULL || refl == NULL || nd == NULL) return 1;
+
+	/* Valid points as (wavenumber, reflectance) sorted by wavenumber */
+	if ( (pt = malloc(npt*sizeof(*pt))) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		return -1;
+	}
+	for (i=nvalid=0; i<npt; i++) {
+		if (valid != NULL && ! valid[i]) continue;
+		if (lambda[i] <= 0) continue;
+		pt[nvalid].sigma = 1.0/lambda[i];
+		pt[nvalid].refl  = refl[i];
+		nvalid++;
+	}
+	if (nvalid < MIN_POINTS) { free(pt); return 1; }
+	qsort(pt, nvalid, sizeof(*pt), cmp_sigma);
+	span = pt[nvalid-1].sigma - pt[0].sigma;
+	if (span <= 0) { free(pt); return 1; }
+
+	for (ngrid=MIN_GRID; ngrid<nvalid && ngrid<MAX_GRID; ngrid*=2) ;
+	nfft = PAD_FACTOR*ngrid;
+	re    = calloc(nfft, sizeof(*re));
+	im    = calloc(nfft, sizeof(*im));
+	power = calloc(nfft/2, sizeof(*power));
+	if (re == NULL || im == NULL || power == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		free(pt); free(re); free(im); free(power);
+		return -1;
+	}
+
+	/* Linear interpolation onto the uniform grid */
+	dsigma = span / (ngrid-1);
+	for (i=0,j=0; i<ngrid; i++) {
+		sigma = pt[0].sigma + i*dsigma;
+		while (j < nvalid-2 && pt[j+1].sigma < sigma) j++;
+		f = (pt[j+1].sigma > pt[j].sigma) ? (sigma-pt[j].sigma)/(pt[j+1].sigma-pt[j].sigma) : 0.0;
+		if (f < 0) f = 0;
+		if (f > 1) f = 1;
+		re[i] = pt[j].refl + f*(pt[j+1].refl-pt[j].refl);
+	}
+
+	/* Remove the linear trend (envelope) and apply a Hann window */
+	sx = sy = sxx = sxy = 0;
+	for (i=0; i<ngrid; i++) { sx += i; sy += re[i]; sxx += (double) i*i; sxy += i*re[i]; }
+	slope  = (ngrid*sxy - sx*sy) / (ngrid*sxx - sx*sx);
+	offset = (sy - slope*sx) / ngrid;
+	for (i=0; i<ngrid; i++) re[i] = (re[i] - offset - slope*i) * 0.5*(1.0-cos(2*M_PI*i/(ngrid-1)));
+
+	fft(nfft, re, im);
+
+	/* Dominant peak (bin k is k*(ngrid-1)/nfft cycles).  It is looked for
+	 * from one cycle up so that a thin film's fundamental, below
+	 * FRINGE_MIN_CYCLES, is not mistaken for one of its harmonics */
+	klow = (int) ceil(1.0 * nfft / (ngrid-1));
+	kmin = (int) ceil(FRINGE_MIN_CYCLES * nfft / (ngrid-1));
+	kmax = nfft/2 - 1;
+	rc = 2;
+	if (kmin < kmax-2) {
+		mean = 0;
+		kpeak = klow;
+		for (i=klow; i<=kmax; i++) {
+			power[i] = re[i]*re[i] + im[i]*im[i];
+			if (i >= kmin) mean += power[i];
+			if (power[i] > power[kpeak]) kpeak = i;
+		}
+		mean /= (kmax-kmin+1);
+
+		if (kpeak > kmin && kpeak < kmax && power[kpeak] > MIN_CONTRAST*mean) {
+			/* Parabolic interpolation of log power (Gaussian-like Hann lobe) */
+			y0 = log(power[kpeak-1]+1E-300); y1 = log(power[kpeak]); y2 = log(power[kpeak+1]+1E-300);
+			shift = (y0 - 2*y1 + y2 != 0) ? 0.5*(y0-y2)/(y0-2*y1+y2) : 0.0;
+			if (shift < -0.5) shift = -0.5;
+			if (shift >  0.5) shift =  0.5;
+
+			/* Frequency (cycles per unit wavenumber) is 2 n d */
+			*nd = 0.5 * (kpeak+shift) / (nfft*dsigma);
+			if (resolution != NULL) *resolution = 0.5 / span;
+			rc = 0;
+		}
+	}
+
+	free(pt); free(re); free(im); free(power);
+	return rc;
+}
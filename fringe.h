@@ -0,0 +1,49 @@
+#ifndef _FRINGE_H_LOADED
+#define _FRINGE_H_LOADED
+
+/* ===========================================================================
+-- Optical thickness of a film from the period of its interference fringes.
+--
+-- For a transparent film the reflectance oscillates as cos(4 pi n d / lambda),
+-- i.e. with a constant period in wavenumber (1/lambda) whose frequency is
+-- 2 n d.  The spectrum is resampled onto a uniform wavenumber grid, detrended,
+-- windowed and Fourier transformed; the dominant peak (refined by parabolic
+-- interpolation) gives n d directly.  One transform replaces stepping the
+-- thickness of a micron-thick film through its whole range.
+--
+-- The estimate is only as good as the fringes: it needs several periods
+-- across the wavelength range (FRINGE_MIN_CYCLES) and a peak that stands out
+-- from the rest of the spectrum.  It resolves n d to about a fringe, so it is
+-- a seed for the fit, not a result.
+=========================================================================== */
+
+#define	FRINGE_MIN_CYCLES		(3.0)		/* Fewest fringes across the range for an estimate */
+
+/* ===========================================================================
+-- Estimate the optical thickness from a reflectance spectrum
+--
+-- Usage: int Fringe_OpticalThickness(int npt, double *lambda, double *refl, int *valid,
+--                                    double *nd, double *resolution);
+--
+-- Inputs: npt    - number of points in the spectrum
+--         lambda - [npt] wavelengths (nm), any order
+--         refl   - [npt] measured reflectance
+--         valid  - [npt] nonzero for points to use, or NULL to use all
+--         nd     - pointer to receive the optical thickness n*d (nm)
+--         resolution - if not NULL, receives the width in n*d of one
+--                  Fourier bin (1/(2 delta(1/lambda)) of the valid range)
+--
+-- Output: *nd, *resolution as above (unchanged on failure)
+--
+-- Return: 0 if successful
+--         1 if there are too few valid points
+--         2 if no clear fringe period (fewer than FRINGE_MIN_CYCLES or a
+--           peak not distinguished from the background)
+--        <0 on memory failure
+--
+-- Notes: n is the group index of the film over the range; dispersion makes
+--        it a few percent larger than the phase index for most materials.
+=========================================================================== */
+int Fringe_OpticalThickness(int npt, double *lambda, double *refl, int *valid, double *nd, double *resolution);
+
+#endif		/* _FRINGE_H_LOADED */
@@ -0,0 +1,163 @@
+/* inifile.c - Read-only access to FilmMeasure.ini style files without Win32 */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "inifile.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+typedef struct _INI_ENTRY {
+	char *section, *key, *value;					/* Point into INIFILE.text */
+} INI_ENTRY;
+
+struct _INIFILE {
+	char *text;											/* File contents, edited in place */
+	int nentry;
+	INI_ENTRY *entry;
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static char *trim(char *str);
+static int fold_cmp(char *s1, char *s2);
+
+/* ===========================================================================
+-- Open an ini file
+--
+-- Usage: INIFILE *IniFile_Open(char *path);
+--
+-- Return: pointer to the parsed file, or NULL if it cannot be read
+=========================================================================== */
+INIFILE *IniFile_Open(char *path) {
+	INIFILE *ini;
+	FILE *funit;
+	char *line, *next, *aptr, *section;
+	long len;
+	int n;
+
+	if (path == NULL || (funit = fopen(path, "rb")) == NULL) return NULL;
+	fseek(funit, 0, SEEK_END);
+	len = ftell(funit);
+	fseek(funit, 0, SEEK_SET);
+
+	if ( (ini = calloc(1, sizeof(*ini))) == NULL ||
+		  (ini->text = malloc(len+1)) == NULL) {
+		fclose(funit);
+		if (ini != NULL) free(ini);
+		return NULL;
+	}
+	len = (long) fread(ini->text, 1, len, funit);
+	ini->text[len] = '\0';
+	fclose(funit);
+
+	/* Upper bound on entries is the number of lines */
+	for (n=1,aptr=ini->text; *aptr; aptr++) if (*aptr == '\n') n++;
+	if ( (ini->entry = calloc(n, sizeof(*ini->entry))) == NULL) {
+		IniFile_Close(ini);
+		return NULL;
+	}
+
+	section = "";
+	for (line=ini->text; line != NULL; line=next) {
+		if ( (next = strchr(line, '\n')) != NULL) *(next++) = '\0';
+		line = trim(line);
+		if (*line == '\0' || *line == ';') continue;
+		if (*line == '[') {
+			if ( (aptr = strchr(line, ']')) != NULL) *aptr = '\0';
+			section = trim(line+1);
+		} else if ( (aptr = strchr(line, '=')) != NULL) {
+			*(aptr++) = '\0';
+			ini->entry[ini->nentry].section = section;
+			ini->entry[ini->nentry].key     = trim(line);
+			ini->entry[ini->nentry].value   = trim(aptr);
+			ini->nentry++;
+		}
+	}
+	return ini;
+}
+
+/* ===========================================================================
+-- Close an ini file (NULL ok)
+=========================================================================== */
+void IniFile_Close(INIFILE *ini) {
+	if (ini == NULL) return;
+	if (ini->entry != NULL) free(ini->entry);
+	if (ini->text  != NULL) free(ini->text);
+	free(ini);
+	return;
+}
+
+/* ===========================================================================
+-- Look up a value
+--
+-- Usage: int IniFile_GetString(INIFILE *ini, char *section, char *key, char *dflt, char *buf, size_t len);
+--
+-- Return: length of the string copied to buf
+=========================================================================== */
+int IniFile_GetString(INIFILE *ini, char *section, char *key, char *dflt, char *buf, size_t len) {
+	char *value;
+	size_t n;
+	int i;
+
+	value = (dflt != NULL) ? dflt : "";
+	for (i=0; ini != NULL && i<ini->nentry; i++) {
+		if (fold_cmp(ini->entry[i].section, section) == 0 && fold_cmp(ini->entry[i].key, key) == 0) {
+			value = ini->entry[i].value;
+			break;
+		}
+	}
+
+	/* Matching quotes are dropped, as GetPrivateProfileString() does */
+	n = strlen(value);
+	if (n >= 2 && (*value == '"' || *value == '\'') && value[n-1] == *value) {
+		value++;
+		n -= 2;
+	}
+	if (len == 0) return 0;
+	if (n > len-1) n = len-1;
+	memcpy(buf, value, n);
+	buf[n] = '\0';
+	return (int) n;
+}
+
+/* ===========================================================================
+-- Strip leading and trailing white space (in place)
+=========================================================================== */
+static char *trim(char *str) {
+	char *end;
+
+	while (isspace((unsigned char) *str)) str++;
+	end = str+strlen(str);
+	while (end > str && isspace((unsigned char) end[-1])) end--;
+	*end = '\0';
+	return str;
+}
+
+/* ===========================================================================
+-- Case insensitive compare (ASCII)
+=========================================================================== */
+static int fold_cmp(char *s1, char *s2) {
+	int c1, c2;
+
+	do {
+		c1 = tolower((unsigned char) *(s1++));
+		c2 = tolower((unsigned char) *(s2++));
+	} while (c1 == c2 && c1 != '\0');
+	return c1-c2;
+}
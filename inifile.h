@@ -0,0 +1,45 @@
+#ifndef _INIFILE_H_LOADED
+#define _INIFILE_H_LOADED
+
+/* ===========================================================================
+-- Read-only access to FilmMeasure.ini style files without Win32.
+--
+-- The whole file is read once by IniFile_Open() and lookups follow
+-- GetPrivateProfileString(): section and key names are case insensitive,
+-- white space around names and values is dropped, a value enclosed in
+-- matching quotes loses them, lines starting with ';' are comments, and
+-- the first occurrence of a key in a section wins.
+=========================================================================== */
+
+#include <stddef.h>
+
+typedef struct _INIFILE INIFILE;					/* Opaque */
+
+/* ===========================================================================
+-- Open or close an ini file
+--
+-- Usage: INIFILE *IniFile_Open(char *path);
+--        void IniFile_Close(INIFILE *ini);
+--
+-- Return: IniFile_Open returns NULL if the file cannot be read
+--
+-- Notes: A NULL ini is valid everywhere and behaves as an empty file, so
+--        a missing file simply gives the defaults
+=========================================================================== */
+INIFILE *IniFile_Open(char *path);
+void IniFile_Close(INIFILE *ini);
+
+/* ===========================================================================
+-- Look up a value
+--
+-- Usage: int IniFile_GetString(INIFILE *ini, char *section, char *key, char *dflt, char *buf, size_t len);
+--
+-- Inputs: section, key - names to find
+--         dflt         - value if the key is not present (NULL for "")
+--         buf, len     - buffer to receive the value (truncated to len-1)
+--
+-- Return: length of the string copied to buf
+=========================================================================== */
+int IniFile_GetString(INIFILE *ini, char *section, char *key, char *dflt, char *buf, size_t len);
+
+#endif		/* _INIFILE_H_LOADED */
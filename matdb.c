@@ -0,0 +1,620 @@
+/* matdb.c - Compiled (binary, memory mapped) n,k materials database */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+#ifdef __linux__
+	#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#ifdef _WIN32
+	#define STRICT						/* define before including windows.h for stricter type checking */
+	#include <windows.h>				/* master include file for Windows applications */
+	#include <io.h>						/* Contains _findfirst */
+#elif __linux__
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <dirent.h>
+#else
+	#error "Unsupported OS"
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "matdb.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	HC_EV_NM		(1239.84193)			/* hc in eV*nm -- E(eV) = HC_EV_NM / lambda(nm) */
+#define	NBLOCKS		(6)						/* lambda, energy, n, k, n2, k2 */
+
+struct _MATDB {
+	char *base;									/* Start of mapped file					*/
+	size_t size;								/* Size of mapping						*/
+	MATDB_HEADER *hdr;
+	MATDB_ENTRY *entry;						/* [nmat] directory						*/
+	int nmat;
+};
+
+/* Material read from the text database while compiling */
+typedef struct _TEXT_MAT {
+	MATDB_ENTRY entry;
+	int npt, dim;
+	double *lambda, *energy, *n, *k, *n2, *k2;
+} TEXT_MAT;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int fold_cmp(const char *a, const char *b);
+static int entry_cmp(const void *a, const void *b);
+static int node_cmp(const void *a, const void *b);
+static int validate(MATDB *db);
+static int read_text_material(char *directory, char *name, TEXT_MAT *mat);
+static void spline_coefficients(int npt, double *x, double *y, double *y2);
+static int add_name(char ***pnames, int *pcnt, int *pdim, char *name);
+static char **list_directory(char *directory, int *pcount);
+
+/* ===========================================================================
+-- Case-folded comparison of two names (ASCII only, locale independent)
+=========================================================================== */
+static int fold_cmp(const char *a, const char *b) {
+	int ca, cb;
+
+	do {
+		ca = tolower((unsigned char) *a++);
+		cb = tolower((unsigned char) *b++);
+	} while (ca == cb && ca != '\0');
+	return ca - cb;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+	return fold_cmp(((MATDB_ENTRY *) a)->name, ((MATDB_ENTRY *) b)->name);
+}
+
+/* ===========================================================================
+-- Open (map) or close a compiled database
+--
+-- Usage: MATDB *MatDB_Open(char *path);
+--        void MatDB_Close(MATDB *db);
+--
+-- Inputs: path - compiled database file
+--
+-- Return: MatDB_Open returns NULL if the file is missing or not valid
+=========================================================================== */
+MATDB *MatDB_Open(char *path) {
+	static char *rname = "MatDB_Open";
+	MATDB *db;
+
+#ifdef _WIN32
+	HANDLE hfile, hmap;
+	LARGE_INTEGER size;
+#else
+	int fd;
+	struct stat info;
+	void *map;
+#endif
+
+	if (path == NULL) return NULL;
+	if ( (db = calloc(1, sizeof(*db))) == NULL) return NULL;
+
+#ifdef _WIN32
+	hfile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hfile == INVALID_HANDLE_VALUE) { free(db); return NULL; }
+	if (! GetFileSizeEx(hfile, &size) || size.QuadPart < (LONGLONG) sizeof(MATDB_HEADER)) {
+		CloseHandle(hfile); free(db); return NULL;
+	}
+	hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(hfile);
+	if (hmap == NULL) { free(db); return NULL; }
+	db->base = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(hmap);													/* View keeps the mapping alive */
+	if (db->base == NULL) { free(db); return NULL; }
+	db->size = (size_t) size.QuadPart;
+#else
+	if ( (fd = open(path, O_RDONLY)) < 0) { free(db); return NULL; }
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(MATDB_HEADER)) {
+		close(fd); free(db); return NULL;
+	}
+	map = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);																/* Mapping stays valid */
+	if (map == MAP_FAILED) { free(db); return NULL; }
+	db->base = map;
+	db->size = (size_t) info.st_size;
+#endif
+
+	if (validate(db) != 0) {
+		fprintf(stderr, "ERROR: %s: \"%s\" is not a valid compiled database (version %d expected)\n", rname, path, MATDB_VERSION); fflush(stderr);
+		MatDB_Close(db);
+		return NULL;
+	}
+	return db;
+}
+
+void MatDB_Close(MATDB *db) {
+	if (db == NULL) return;
+	if (db->base != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(db->base);
+#else
+		munmap(db->base, db->size);
+#endif
+	}
+	free(db);
+	return;
+}
+
+/* ===========================================================================
+-- Check the header and every directory entry against the mapped size so
+-- later lookups never need to range check
+--
+-- Return: 0 if valid, 1 otherwise
+=========================================================================== */
+static int validate(MATDB *db) {
+	MATDB_HEADER *hdr;
+	MATDB_ENTRY *entry;
+	uint32_t i;
+
+	hdr = (MATDB_HEADER *) db->base;
+	if (memcmp(hdr->magic, MATDB_MAGIC, sizeof(hdr->magic)) != 0) return 1;
+	if (hdr->version != MATDB_VERSION) return 1;
+	if (hdr->header_size != sizeof(MATDB_HEADER) || hdr->entry_size != sizeof(MATDB_ENTRY)) return 1;
+	if (hdr->file_size != db->size) return 1;
+	if (hdr->dir_offset % 8 != 0 || hdr->dir_offset > db->size) return 1;
+	if (hdr->nmat > (db->size - hdr->dir_offset) / sizeof(MATDB_ENTRY)) return 1;
+
+	entry = (MATDB_ENTRY *) (db->base + hdr->dir_offset);
+	for (i=0; i<hdr->nmat; i++) {
+		if (memchr(entry[i].name, '\0', sizeof(entry[i].name)) == NULL) return 1;
+		if (entry[i].npt < 1 || entry[i].offset % 8 != 0 || entry[i].offset > db->size) return 1;
+		if (entry[i].npt > (db->size - entry[i].offset) / (NBLOCKS*sizeof(double))) return 1;
+	}
+
+	db->hdr   = hdr;
+	db->entry = entry;
+	db->nmat  = hdr->nmat;
+	return 0;
+}
+
+/* ===========================================================================
+-- Enumerate the materials in a database
+--
+-- Usage: int MatDB_Count(MATDB *db);
+--        MATDB_MATERIAL *MatDB_Material(MATDB *db, int i);
+=========================================================================== */
+int MatDB_Count(MATDB *db) {
+	return (db == NULL) ? 0 : db->nmat;
+}
+
+MATDB_MATERIAL *MatDB_Material(MATDB *db, int i) {
+	if (db == NULL || i < 0 || i >= db->nmat) return NULL;
+	return db->entry+i;
+}
+
+/* ===========================================================================
+-- Look up a material by name (case insensitive binary search)
+--
+-- Usage: MATDB_MATERIAL *MatDB_Find(MATDB *db, char *name);
+--
+-- Return: Pointer to the material, or NULL if not in the database
+=========================================================================== */
+MATDB_MATERIAL *MatDB_Find(MATDB *db, char *name) {
+	int lo, hi, mid, cmp;
+
+	if (db == NULL || name == NULL) return NULL;
+	lo = 0; hi = db->nmat-1;
+	while (lo <= hi) {
+		mid = (lo+hi)/2;
+		if ( (cmp = fold_cmp(name, db->entry[mid].name)) == 0) return db->entry+mid;
+		if (cmp < 0) { hi = mid-1; } else { lo = mid+1; }
+	}
+	return NULL;
+}
+
+/* ===========================================================================
+-- Determine whether a pointer refers to a material in this database
+--
+-- Usage: int MatDB_Owns(MATDB *db, void *ptr);
+=========================================================================== */
+int MatDB_Owns(MATDB *db, void *ptr) {
+	if (db == NULL || ptr == NULL) return FALSE;
+	return (char *) ptr >= (char *) db->entry && (char *) ptr < (char *) (db->entry+db->nmat);
+}
+
+/* ===========================================================================
+-- Evaluate n,k of a material over a set of wavelengths
+--
+-- Usage: int MatDB_NK(MATDB *db, MATDB_MATERIAL *mat, int npt, double *lambda, double *n, double *k);
+--
+-- Inputs: db     - database containing the material
+--         mat    - material from MatDB_Find() or MatDB_Material()
+--         npt    - number of wavelengths
+--         lambda - [npt] wavelengths (nm), any order
+--         n, k   - [npt] arrays to receive the optical constants
+--
+-- Return: 0 if successful, 1 on invalid parameters
+--
+-- Notes: Spectrometer grids are ascending, so the bracketing interval is
+--        searched starting from the previous one before falling back to
+--        bisection.
+=========================================================================== */
+int MatDB_NK(MATDB *db, MATDB_MATERIAL *mat, int npt, double *lambda, double *n, double *k) {
+	int i, j, lo, hi, mid, nnode;
+	double *lam, *en, *tn, *tk, *n2, *k2;
+	double E, h, A, B, C, D;
+	int spline;
+
+	if (db == NULL || mat == NULL || lambda == NULL || n == NULL || k == NULL) return 1;
+	if (! MatDB_Owns(db, mat)) return 1;
+
+	nnode = mat->npt;
+	lam = (double *) (db->base + mat->offset);
+	en  = lam + nnode;
+	tn  = en  + nnode;
+	tk  = tn  + nnode;
+	n2  = tk  + nnode;
+	k2  = n2  + nnode;
+	spline = (mat->flags & MATDB_SPLINE) != 0;
+
+	j = 0;
+	for (i=0; i<npt; i++) {
+		if (nnode == 1 || lambda[i] <= lam[0]) {
+			n[i] = tn[0]; k[i] = tk[0];
+			continue;
+		} else if (lambda[i] >= lam[nnode-1]) {
+			n[i] = tn[nnode-1]; k[i] = tk[nnode-1];
+			continue;
+		}
+
+		/* Find j with lam[j] <= lambda < lam[j+1] */
+		if (! (lam[j] <= lambda[i] && lambda[i] < lam[j+1])) {
+			if (j+2 < nnode && lam[j+1] <= lambda[i] && lambda[i] < lam[j+2]) {
+				j++;
+			} else {
+				lo = 0; hi = nnode-1;
+				while (hi-lo > 1) {
+					mid = (lo+hi)/2;
+					if (lam[mid] <= lambda[i]) { lo = mid; } else { hi = mid; }
+				}
+				j = lo;
+			}
+		}
+
+		/* Interpolate in photon energy */
+		E = HC_EV_NM / lambda[i];
+		h = en[j+1]-en[j];
+		A = (en[j+1]-E)/h;
+		B = 1.0-A;
+		n[i] = A*tn[j] + B*tn[j+1];
+		k[i] = A*tk[j] + B*tk[j+1];
+		if (spline) {
+			C = (A*A*A-A)*h*h/6.0;
+			D = (B*B*B-B)*h*h/6.0;
+			n[i] += C*n2[j] + D*n2[j+1];
+			k[i] += C*k2[j] + D*k2[j+1];
+		}
+	}
+	return 0;
+}
+
+/*
+ * ===========================================================================
+ * Offline compiler (used by nkcompile)
+ * ===========================================================================
+ */
+
+/* ===========================================================================
+-- Sort nodes by ascending wavelength (descending energy)
+=========================================================================== */
+static int node_cmp(const void *a, const void *b) {
+	double ea = ((double *) a)[0], eb = ((double *) b)[0];
+	return (ea > eb) ? -1 : (ea < eb) ? 1 : 0;
+}
+
+/* ===========================================================================
+-- Natural cubic spline second derivatives of y(x) at the nodes
+--
+-- Usage: void spline_coefficients(int npt, double *x, double *y, double *y2);
+--
+-- Notes: x must be monotonic (either direction).  Second derivatives are
+--        unchanged by reversing x, so the descending energies of a
+--        wavelength sorted table can be used directly.
+=========================================================================== */
+static void spline_coefficients(int npt, double *x, double *y, double *y2) {
+	int i;
+	double p, sig, *u;
+
+	for (i=0; i<npt; i++) y2[i] = 0.0;
+	if (npt < 3 || (u = calloc(npt, sizeof(*u))) == NULL) return;
+
+	for (i=1; i<npt-1; i++) {
+		sig = (x[i]-x[i-1])/(x[i+1]-x[i-1]);
+		p = sig*y2[i-1]+2.0;
+		y2[i] = (sig-1.0)/p;
+		u[i] = (y[i+1]-y[i])/(x[i+1]-x[i]) - (y[i]-y[i-1])/(x[i]-x[i-1]);
+		u[i] = (6.0*u[i]/(x[i+1]-x[i-1]) - sig*u[i-1])/p;
+	}
+	y2[npt-1] = 0.0;
+	for (i=npt-2; i>=0; i--) y2[i] = y2[i]*y2[i+1]+u[i];
+
+	free(u);
+	return;
+}
+
+/* ===========================================================================
+-- Read one material from the text database
+--
+-- Usage: int read_text_material(char *directory, char *name, TEXT_MAT *mat);
+--
+-- Inputs: directory - database directory
+--         name      - material (file) name
+--         mat       - structure to fill (all zero on entry)
+--
+-- Return: 0 if successful, !0 if the file cannot be used
+--
+-- Notes: Each line is "energy(eV) n k".  Text following / * or # is a
+--        comment.  A line with the keyword SPLINE selects spline rather
+--        than linear interpolation; other words are ignored.
+=========================================================================== */
+static int read_text_material(char *directory, char *name, TEXT_MAT *mat) {
+	static char *rname = "MatDB_Compile";
+	FILE *funit;
+	char path[1024], line[1024], *aptr;
+	double E, nval, kval, *nodes, *tmp;
+	int i, j, cnt;
+
+	sprintf(path, "%.900s/%.100s", directory, name);
+	if ( (funit = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to open %s\n", rname, path); fflush(stderr);
+		return 1;
+	}
+
+	nodes = NULL;
+	while (fgets(line, sizeof(line), funit) != NULL) {
+		if ( (aptr = strstr(line, "/*")) != NULL) *aptr = '\0';
+		if ( (aptr = strchr(line, '#')) != NULL) *aptr = '\0';
+		aptr = line;
+		while (isspace((unsigned char) *aptr)) aptr++;
+		if (*aptr == '\0') continue;
+
+		if (isalpha((unsigned char) *aptr)) {
+			if (strncmp(aptr, "SPLINE", 6) == 0) mat->entry.flags |= MATDB_SPLINE;
+			continue;
+		}
+
+		if ( (cnt = sscanf(aptr, "%lf %lf %lf", &E, &nval, &kval)) < 2 || E <= 0.0) continue;
+		if (cnt < 3) kval = 0.0;
+		if (mat->npt >= mat->dim) {
+			mat->dim += 256;
+			if ( (tmp = realloc(nodes, 3*mat->dim*sizeof(*nodes))) == NULL) { free(nodes); fclose(funit); return 2; }
+			nodes = tmp;
+		}
+		nodes[3*mat->npt+0] = E;
+		nodes[3*mat->npt+1] = nval;
+		nodes[3*mat->npt+2] = kval;
+		mat->npt++;
+	}
+	fclose(funit);
+
+	if (mat->npt < 1) {
+		fprintf(stderr, "WARNING: %s: no n,k data in %s -- skipped\n", rname, path); fflush(stderr);
+		free(nodes);
+		return 3;
+	}
+
+	/* Sort by wavelength and drop repeated energies (first one wins) */
+	qsort(nodes, mat->npt, 3*sizeof(*nodes), node_cmp);
+	for (i=j=1; i<mat->npt; i++) {
+		if (nodes[3*i] == nodes[3*(j-1)]) continue;
+		if (i != j) memcpy(nodes+3*j, nodes+3*i, 3*sizeof(*nodes));
+		j++;
+	}
+	mat->npt = j;
+
+	if ( (mat->lambda = calloc(NBLOCKS*mat->npt, sizeof(double))) == NULL) { free(nodes); return 2; }
+	mat->energy = mat->lambda + mat->npt;
+	mat->n  = mat->energy + mat->npt;
+	mat->k  = mat->n  + mat->npt;
+	mat->n2 = mat->k  + mat->npt;
+	mat->k2 = mat->n2 + mat->npt;
+	for (i=0; i<mat->npt; i++) {
+		mat->energy[i] = nodes[3*i];
+		mat->lambda[i] = HC_EV_NM / nodes[3*i];
+		mat->n[i] = nodes[3*i+1];
+		mat->k[i] = nodes[3*i+2];
+	}
+	free(nodes);
+
+	if (mat->entry.flags & MATDB_SPLINE) {
+		spline_coefficients(mat->npt, mat->energy, mat->n, mat->n2);
+		spline_coefficients(mat->npt, mat->energy, mat->k, mat->k2);
+	}
+
+	strcpy(mat->entry.name, name);
+	mat->entry.npt = mat->npt;
+	mat->entry.lambda_min = mat->lambda[0];
+	mat->entry.lambda_max = mat->lambda[mat->npt-1];
+	return 0;
+}
+
+/* ===========================================================================
+-- Append a directory entry to the list if it looks like a material file
+--
+-- Return: 0 if ok (added or ignored), 1 on memory failure
+=========================================================================== */
+static int add_name(char ***pnames, int *pcnt, int *pdim, char *name) {
+	char **tmp;
+
+	if (strchr(name, '.') != NULL) return 0;							/* Ignore anything with an extension */
+	if (strlen(name) >= MATDB_NAME_LENGTH) {
+		fprintf(stderr, "WARNING: MatDB_Compile: material name \"%s\" too long -- skipped\n", name); fflush(stderr);
+		return 0;
+	}
+	if (*pcnt >= *pdim) {
+		if ( (tmp = realloc(*pnames, (*pdim+64)*sizeof(*tmp))) == NULL) return 1;
+		*pnames = tmp;
+		*pdim += 64;
+	}
+	if ( ((*pnames)[*pcnt] = malloc(strlen(name)+1)) == NULL) return 1;
+	strcpy((*pnames)[(*pcnt)++], name);
+	return 0;
+}
+
+/* ===========================================================================
+-- List the material files in a database directory (names without an
+-- extension, same rule as the program's materials list)
+--
+-- Usage: char **list_directory(char *directory, int *pcount);
+--
+-- Return: Allocated array of allocated names (NULL on error or if empty)
+=========================================================================== */
+static char **list_directory(char *directory, int *pcount) {
+	char **names;
+	int cnt, dim;
+
+#ifdef _WIN32
+	char pattern[1024];
+	intptr_t hdir;
+	struct _finddata_t findbuf;
+
+	names = NULL; cnt = dim = 0;
+	sprintf(pattern, "%.1000s/*", directory);
+	if ( (hdir = _findfirst(pattern, &findbuf)) < 0) return NULL;
+	do {
+		if (findbuf.attrib & _A_SUBDIR) continue;					/* Ignore directories */
+		if (add_name(&names, &cnt, &dim, findbuf.name) != 0) break;
+	} while (_findnext(hdir, &findbuf) == 0);
+	_findclose(hdir);
+#else
+	DIR *dir;
+	struct dirent *ent;
+	struct stat info;
+	char path[1024];
+
+	names = NULL; cnt = dim = 0;
+	if ( (dir = opendir(directory)) == NULL) return NULL;
+	while ( (ent = readdir(dir)) != NULL) {
+		sprintf(path, "%.900s/%.100s", directory, ent->d_name);
+		if (stat(path, &info) != 0 || ! S_ISREG(info.st_mode)) continue;
+		if (add_name(&names, &cnt, &dim, ent->d_name) != 0) break;
+	}
+	closedir(dir);
+#endif
+
+	*pcount = cnt;
+	return names;
+}
+
+/* ===========================================================================
+-- Compile a text database directory into a binary database file
+--
+-- Usage: int MatDB_Compile(char *directory, char *outfile, int verbose);
+--
+-- Inputs: directory - text database (e.g. "./database.nk")
+--         outfile   - file to create (e.g. "./database.nk/materials.nkdb")
+--         verbose   - if TRUE, list each material as it is compiled
+--
+-- Return: Number of materials written, or <0 on error
+--           -1 ==> directory empty or unreadable
+--           -2 ==> memory allocation failure
+--           -3 ==> unable to write the output file
+=========================================================================== */
+int MatDB_Compile(char *directory, char *outfile, int verbose) {
+	static char *rname = "MatDB_Compile";
+	char **names;
+	int i, nnames, nmat, rc;
+	TEXT_MAT *mats;
+	MATDB_HEADER hdr;
+	MATDB_ENTRY *entry;
+	uint64_t offset;
+	FILE *funit;
+
+	if (directory == NULL || outfile == NULL) return -1;
+	if ( (names = list_directory(directory, &nnames)) == NULL || nnames <= 0) {
+		fprintf(stderr, "ERROR: %s: no materials found in \"%s\"\n", rname, directory); fflush(stderr);
+		free(names);
+		return -1;
+	}
+
+	rc = 0;
+	nmat = 0;
+	entry = NULL;
+	if ( (mats = calloc(nnames, sizeof(*mats))) == NULL) { rc = -2; goto cleanup; }
+	for (i=0; i<nnames; i++) {
+		if (read_text_material(directory, names[i], mats+nmat) != 0) continue;
+		if (verbose) {
+			printf("  %-20s %4d points  %8.2f - %9.2f nm  %s\n", mats[nmat].entry.name, mats[nmat].npt,
+					 mats[nmat].entry.lambda_min, mats[nmat].entry.lambda_max,
+					 (mats[nmat].entry.flags & MATDB_SPLINE) ? "spline" : "linear");
+		}
+		nmat++;
+	}
+	if (nmat <= 0) { rc = -1; goto cleanup; }
+
+	/* Directory sorted by case-folded name; each material keeps its data pointer */
+	qsort(mats, nmat, sizeof(*mats), entry_cmp);						/* entry is first member */
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MATDB_MAGIC, sizeof(hdr.magic));
+	hdr.version     = MATDB_VERSION;
+	hdr.header_size = sizeof(MATDB_HEADER);
+	hdr.entry_size  = sizeof(MATDB_ENTRY);
+	hdr.nmat        = nmat;
+	hdr.dir_offset  = sizeof(MATDB_HEADER);
+	hdr.compiled    = (int64_t) time(NULL);
+
+	if ( (entry = calloc(nmat, sizeof(*entry))) == NULL) { rc = -2; goto cleanup; }
+	offset = hdr.dir_offset + nmat*sizeof(MATDB_ENTRY);
+	for (i=0; i<nmat; i++) {
+		entry[i] = mats[i].entry;
+		entry[i].offset = offset;
+		offset += NBLOCKS*mats[i].npt*sizeof(double);
+	}
+	hdr.file_size = offset;
+
+	if ( (funit = fopen(outfile, "wb")) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to create \"%s\"\n", rname, outfile); fflush(stderr);
+		rc = -3; goto cleanup;
+	}
+	rc = fwrite(&hdr, sizeof(hdr), 1, funit) == 1 && fwrite(entry, sizeof(*entry), nmat, funit) == (size_t) nmat;
+	for (i=0; rc && i<nmat; i++) {
+		rc = fwrite(mats[i].lambda, sizeof(double), NBLOCKS*mats[i].npt, funit) == (size_t) (NBLOCKS*mats[i].npt);
+	}
+	if (fclose(funit) != 0) rc = FALSE;
+	if (! rc) {
+		fprintf(stderr, "ERROR: %s: failed writing \"%s\"\n", rname, outfile); fflush(stderr);
+		remove(outfile);
+		rc = -3; goto cleanup;
+	}
+	rc = nmat;
+
+cleanup:
+	if (mats != NULL) for (i=0; i<nnames; i++) free(mats[i].lambda);
+	for (i=0; i<nnames; i++) free(names[i]);
+	free(names);
+	free(mats);
+	free(entry);
+	return rc;
+}
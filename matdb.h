@@ -0,0 +1,130 @@
+#ifndef _MATDB_H_LOADED
+#define _MATDB_H_LOADED
+
+/* ===========================================================================
+-- Compiled (binary) n,k materials database.
+--
+-- The text database (database.nk directory, one file per material with
+-- lines of "energy(eV) n k") is compiled offline by nkcompile into a single
+-- versioned file, normally database.nk/materials.nkdb.  Each material is
+-- stored with its table sorted by wavelength, the photon energies of the
+-- nodes, and the precomputed spline coefficients, so nothing needs to be
+-- parsed or sorted at run time.  The file is memory mapped read only; a
+-- MATDB and its materials may be shared by any number of threads.
+--
+-- Interpolation is in photon energy, the variable the tables are written
+-- in: piecewise linear, or a natural cubic spline for files that contain
+-- the SPLINE keyword.  Outside the table the end values are used.
+--
+-- File layout (little endian, every block 8 byte aligned):
+--     MATDB_HEADER
+--     MATDB_ENTRY[nmat]          sorted by case-folded name
+--     per material: lambda[npt]  ascending wavelength (nm)
+--                   energy[npt]  photon energy of each node (eV)
+--                   n[npt], k[npt]
+--                   n2[npt], k2[npt]  d2/dE2 spline coefficients (0 if linear)
+=========================================================================== */
+
+#include <stdint.h>
+
+#define	MATDB_MAGIC			"FMNKDB\032"	/* 8 bytes including terminating NUL */
+#define	MATDB_VERSION		(1)
+#define	MATDB_FILENAME		"materials.nkdb"
+#define	MATDB_NAME_LENGTH	(64)
+
+#define	MATDB_SPLINE		(0x01)			/* Cubic spline rather than linear */
+
+typedef struct _MATDB_HEADER {
+	char magic[8];								/* MATDB_MAGIC								*/
+	uint32_t version;							/* MATDB_VERSION							*/
+	uint32_t header_size;					/* sizeof(MATDB_HEADER)					*/
+	uint32_t entry_size;						/* sizeof(MATDB_ENTRY)					*/
+	uint32_t nmat;								/* Number of materials					*/
+	uint64_t dir_offset;						/* Offset of MATDB_ENTRY[nmat]		*/
+	uint64_t file_size;						/* Total size of the file				*/
+	int64_t compiled;							/* time() when compiled					*/
+	char reserved[16];
+} MATDB_HEADER;
+
+typedef struct _MATDB_ENTRY {
+	char name[MATDB_NAME_LENGTH];			/* Material name (file name in database) */
+	uint32_t flags;							/* MATDB_SPLINE							*/
+	uint32_t npt;								/* Number of nodes in the table		*/
+	uint64_t offset;							/* Offset of lambda[npt] (data start)	*/
+	double lambda_min, lambda_max;		/* Range of the table (nm)				*/
+} MATDB_ENTRY;
+
+typedef struct _MATDB MATDB;					/* Opaque -- an open (mapped) database */
+typedef MATDB_ENTRY MATDB_MATERIAL;			/* Pointer into the mapped file */
+
+/* ===========================================================================
+-- Open (map) or close a compiled database
+--
+-- Usage: MATDB *MatDB_Open(char *path);
+--        void MatDB_Close(MATDB *db);
+--
+-- Inputs: path - compiled database file
+--
+-- Return: MatDB_Open returns NULL if the file is missing or not valid
+=========================================================================== */
+MATDB *MatDB_Open(char *path);
+void MatDB_Close(MATDB *db);
+
+/* ===========================================================================
+-- Enumerate the materials in a database (sorted by case-folded name)
+--
+-- Usage: int MatDB_Count(MATDB *db);
+--        MATDB_MATERIAL *MatDB_Material(MATDB *db, int i);
+--
+-- Return: MatDB_Material returns NULL if i is out of range
+=========================================================================== */
+int MatDB_Count(MATDB *db);
+MATDB_MATERIAL *MatDB_Material(MATDB *db, int i);
+
+/* ===========================================================================
+-- Look up a material by name (case insensitive)
+--
+-- Usage: MATDB_MATERIAL *MatDB_Find(MATDB *db, char *name);
+--
+-- Return: Pointer to the material, or NULL if not in the database
+=========================================================================== */
+MATDB_MATERIAL *MatDB_Find(MATDB *db, char *name);
+
+/* ===========================================================================
+-- Determine whether a pointer refers to a material in this database
+--
+-- Usage: int MatDB_Owns(MATDB *db, void *ptr);
+--
+-- Return: TRUE if ptr lies within the mapped file
+=========================================================================== */
+int MatDB_Owns(MATDB *db, void *ptr);
+
+/* ===========================================================================
+-- Evaluate n,k of a material over a set of wavelengths
+--
+-- Usage: int MatDB_NK(MATDB *db, MATDB_MATERIAL *mat, int npt, double *lambda, double *n, double *k);
+--
+-- Inputs: db     - database containing the material
+--         mat    - material from MatDB_Find() or MatDB_Material()
+--         npt    - number of wavelengths
+--         lambda - [npt] wavelengths (nm), any order
+--         n, k   - [npt] arrays to receive the optical constants (N = n - ik)
+--
+-- Return: 0 if successful, 1 on invalid parameters
+=========================================================================== */
+int MatDB_NK(MATDB *db, MATDB_MATERIAL *mat, int npt, double *lambda, double *n, double *k);
+
+/* ===========================================================================
+-- Compile a text database directory into a binary database file
+--
+-- Usage: int MatDB_Compile(char *directory, char *outfile, int verbose);
+--
+-- Inputs: directory - text database (e.g. "./database.nk")
+--         outfile   - file to create (e.g. "./database.nk/materials.nkdb")
+--         verbose   - if TRUE, list each material as it is compiled
+--
+-- Return: Number of materials written, or <0 on error
+=========================================================================== */
+int MatDB_Compile(char *directory, char *outfile, int verbose);
+
+#endif		/* _MATDB_H_LOADED */
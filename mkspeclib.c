@@ -0,0 +1,175 @@
+/* mkspeclib.c - Build the spectral library for the recipe in FilmMeasure.ini */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tfoc.h"
+#include "tpool.h"
+#include "matdb.h"
+#include "speclib.h"
+#include "filmfit.h"
+#include "recipe.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	DFLT_INIFILE	"./FilmMeasure.ini"
+#define	DFLT_DATABASE	"./database.nk"
+#define	DFLT_STEP		(5.0)							/* Thickness step of the grid (nm) */
+#define	DFLT_NWAVE		(256)
+
+/* Evaluation of the recipe for SpecLib_Build() */
+typedef struct _MODEL_PARM {
+	FILMFIT *fit;
+	TFOC_SAMPLE *sample;
+	SPECLIB_RECIPE *recipe;
+} MODEL_PARM;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void usage(void);
+static int model(void *parm, double *z, int nwave, double *lambda, double *refl);
+
+/* ===========================================================================
+-- Usage: mkspeclib [-q] [-ini file] [-step nm] [-nwave n] [-ncomp n] [output_file]
+--
+-- Reads the [Film] stack (Layer_N_Material, _Thickness, _Vary, _Limits and
+-- Substrate) and the [Fit] Lambda_Range from the ini file and tabulates the
+-- varied layers over their limits.  The output defaults to SPECLIB_FILENAME,
+-- the file FilmMeasure opens at startup.  Rebuild whenever the recipe changes;
+-- FilmMeasure ignores a library that does not match the current stack.
+=========================================================================== */
+int main(int argc, char *argv[]) {
+
+	char *inifile, *outfile, *database, *env, path[1024];
+	int i, rc, verbose, nwave, ncomp;
+	double lambda_min, lambda_max, step;
+	SPECLIB_RECIPE recipe;
+	RECIPE film;
+	MODEL_PARM parm;
+	MATDB *db;
+
+	inifile = DFLT_INIFILE;
+	outfile = SPECLIB_FILENAME;
+	step    = DFLT_STEP;
+	nwave   = DFLT_NWAVE;
+	ncomp   = 0;
+	verbose = TRUE;
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			verbose = FALSE;
+		} else if (strcmp(argv[i], "-ini") == 0 && i+1 < argc) {
+			inifile = argv[++i];
+		} else if (strcmp(argv[i], "-step") == 0 && i+1 < argc) {
+			step = atof(argv[++i]);
+		} else if (strcmp(argv[i], "-nwave") == 0 && i+1 < argc) {
+			nwave = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-ncomp") == 0 && i+1 < argc) {
+			ncomp = atoi(argv[++i]);
+		} else if (*argv[i] == '-' || i != argc-1) {
+			usage();
+			return 1;
+		} else {
+			outfile = argv[i];
+		}
+	}
+	if (step <= 0 || nwave < 2 || nwave > SPECLIB_MAX_WAVE || ncomp < 0 || ncomp > SPECLIB_MAX_COMP) {
+		usage();
+		return 1;
+	}
+
+	/* Materials -- compiled database if present, otherwise the text files */
+	database = ( (env = getenv("tfocDatabase")) != NULL && *env != '\0') ? env : DFLT_DATABASE;
+	sprintf(path, "%.1000s/%s", database, MATDB_FILENAME);
+	db = MatDB_Open(path);
+
+	/* Recipe from the [Film] and [Fit] sections, as FilmMeasure builds its sample stack */
+	if ( (rc = Recipe_Read(inifile, database, db, &film)) == 2) {
+		fprintf(stderr, "ERROR: no layers are marked to vary in [Film] of \"%s\"\n", inifile); fflush(stderr);
+	} else if (rc == 0 && film.parms.nvary > SPECLIB_MAX_VARS) {
+		fprintf(stderr, "ERROR: at most %d varied layers can be tabulated\n", SPECLIB_MAX_VARS); fflush(stderr);
+		rc = 1;
+	}
+	if (rc != 0) { MatDB_Close(db); return 2; }
+
+	memset(&recipe, 0, sizeof(recipe));
+	recipe.nlayers = film.nlayers;
+	for (i=0; i<film.nlayers; i++) {
+		strncpy(recipe.name[i], film.sample[i].name, SPECLIB_NAME_LENGTH-1);
+		recipe.z[i] = film.sample[i].z;
+	}
+	recipe.nvary = film.parms.nvary;
+	for (i=0; i<film.parms.nvary; i++) {
+		recipe.layer[i] = film.parms.layer[i];
+		recipe.lower[i] = film.parms.lower[i];
+		recipe.upper[i] = film.parms.upper[i];
+		recipe.step[i]  = step;
+	}
+	lambda_min = film.parms.lambda_min;
+	lambda_max = film.parms.lambda_max;
+
+	if (verbose) {
+		printf("Recipe from \"%s\", %.0f - %.0f nm, %d wavelengths\n", inifile, lambda_min, lambda_max, nwave);
+		for (i=0; i<recipe.nvary; i++) {
+			printf("  vary %-12s %8.1f - %8.1f nm by %g\n", recipe.name[recipe.layer[i]], recipe.lower[i], recipe.upper[i], recipe.step[i]);
+		}
+		fflush(stdout);
+	}
+
+	parm.fit    = FilmFit_Create(TPool_Default());
+	parm.sample = film.sample;
+	parm.recipe = &recipe;
+	FilmFit_SetMaterialDB(parm.fit, db);
+	rc = SpecLib_Build(&recipe, lambda_min, lambda_max, nwave, ncomp, model, &parm, outfile, verbose);
+	FilmFit_Free(parm.fit);
+	MatDB_Close(db);
+	if (rc < 0) {
+		fprintf(stderr, "ERROR: library build failed (rc=%d)\n", rc); fflush(stderr);
+		return 3;
+	}
+	if (verbose) { printf("%d spectra written to \"%s\"\n", rc, outfile); fflush(stdout); }
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: mkspeclib [-q] [-ini file] [-step nm] [-nwave n] [-ncomp n] [output_file]\n"
+						 "   -ini    recipe file (default " DFLT_INIFILE ")\n"
+						 "   -step   thickness grid step in nm (default 5)\n"
+						 "   -nwave  wavelengths tabulated (default 256, max 512)\n"
+						 "   -ncomp  principal components (default automatic, max 32)\n"
+						 "   output_file defaults to " SPECLIB_FILENAME "\n");
+	fflush(stderr);
+	return;
+}
+
+/* ===========================================================================
+-- Model reflectance for SpecLib_Build() -- varied thicknesses set to z[]
+=========================================================================== */
+static int model(void *parm, double *z, int nwave, double *lambda, double *refl) {
+	MODEL_PARM *p = (MODEL_PARM *) parm;
+	int v;
+
+	for (v=0; v<p->recipe->nvary; v++) p->sample[p->recipe->layer[v]].z = z[v];
+	return FilmFit_Refl(p->fit, p->sample, 1.0, 0.0, UNPOLARIZED, 300.0, nwave, lambda, refl);
+}
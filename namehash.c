@@ -0,0 +1,157 @@
+/* namehash.c - Case-insensitive hash index from names to pointers */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "namehash.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#define	MIN_SLOTS	(64)
+
+typedef struct _NAMEHASH_SLOT {
+	char *name;								/* NULL ==> empty slot				*/
+	unsigned long hash;					/* Full hash (fast reject)			*/
+	void *value;
+} NAMEHASH_SLOT;
+
+struct _NAMEHASH {
+	int nslot;								/* Power of 2							*/
+	int count;								/* Names in the table				*/
+	NAMEHASH_SLOT *slot;
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static unsigned long fold_hash(const char *name);
+static int fold_equal(const char *a, const char *b);
+static int grow(NAMEHASH *hash);
+
+/* ===========================================================================
+-- FNV-1a hash of the lower-cased name
+=========================================================================== */
+static unsigned long fold_hash(const char *name) {
+	unsigned long h = 2166136261UL;
+
+	while (*name) {
+		h ^= (unsigned long) tolower((unsigned char) *name++);
+		h = (h * 16777619UL) & 0xFFFFFFFFUL;
+	}
+	return h;
+}
+
+static int fold_equal(const char *a, const char *b) {
+	while (*a && tolower((unsigned char) *a) == tolower((unsigned char) *b)) { a++; b++; }
+	return tolower((unsigned char) *a) == tolower((unsigned char) *b);
+}
+
+/* ===========================================================================
+-- Create or release an index
+--
+-- Usage: NAMEHASH *NameHash_Create(int size_hint);
+--        void NameHash_Free(NAMEHASH *hash);
+=========================================================================== */
+NAMEHASH *NameHash_Create(int size_hint) {
+	NAMEHASH *hash;
+	int nslot;
+
+	for (nslot=MIN_SLOTS; nslot < 2*size_hint; nslot *= 2) ;		/* Keep load below 1/2 */
+
+	if ( (hash = calloc(1, sizeof(*hash))) == NULL) return NULL;
+	if ( (hash->slot = calloc(nslot, sizeof(*hash->slot))) == NULL) { free(hash); return NULL; }
+	hash->nslot = nslot;
+	return hash;
+}
+
+void NameHash_Free(NAMEHASH *hash) {
+	if (hash == NULL) return;
+	free(hash->slot);
+	free(hash);
+	return;
+}
+
+/* ===========================================================================
+-- Double the table size and reinsert every name
+--
+-- Return: 0 if successful, 1 on memory failure (table unchanged)
+=========================================================================== */
+static int grow(NAMEHASH *hash) {
+	NAMEHASH_SLOT *old, *slot;
+	int i, j, nold;
+
+	nold = hash->nslot;
+	if ( (slot = calloc(2*nold, sizeof(*slot))) == NULL) return 1;
+	old = hash->slot;
+	hash->slot  = slot;
+	hash->nslot = 2*nold;
+	for (i=0; i<nold; i++) {
+		if (old[i].name == NULL) continue;
+		for (j=old[i].hash & (hash->nslot-1); slot[j].name != NULL; j=(j+1) & (hash->nslot-1)) ;
+		slot[j] = old[i];
+	}
+	free(old);
+	return 0;
+}
+
+/* ===========================================================================
+-- Add a name to the index
+--
+-- Usage: int NameHash_Add(NAMEHASH *hash, char *name, void *value);
+--
+-- Return: 0 if added, 1 if already present, <0 on error
+=========================================================================== */
+int NameHash_Add(NAMEHASH *hash, char *name, void *value) {
+	static char *rname = "NameHash_Add";
+	unsigned long h;
+	int j;
+
+	if (hash == NULL || name == NULL) return -1;
+	if (2*(hash->count+1) > hash->nslot && grow(hash) != 0) {
+		fprintf(stderr, "ERROR: %s: unable to grow hash table\n", rname); fflush(stderr);
+		return -2;
+	}
+
+	h = fold_hash(name);
+	for (j=h & (hash->nslot-1); hash->slot[j].name != NULL; j=(j+1) & (hash->nslot-1)) {
+		if (hash->slot[j].hash == h && fold_equal(hash->slot[j].name, name)) return 1;
+	}
+	hash->slot[j].name  = name;
+	hash->slot[j].hash  = h;
+	hash->slot[j].value = value;
+	hash->count++;
+	return 0;
+}
+
+/* ===========================================================================
+-- Find a name in the index (case insensitive)
+--
+-- Usage: void *NameHash_Find(NAMEHASH *hash, char *name);
+--
+-- Return: value given to NameHash_Add(), or NULL if not present
+=========================================================================== */
+void *NameHash_Find(NAMEHASH *hash, char *name) {
+	unsigned long h;
+	int j;
+
+	if (hash == NULL || name == NULL) return NULL;
+	h = fold_hash(name);
+	for (j=h & (hash->nslot-1); hash->slot[j].name != NULL; j=(j+1) & (hash->nslot-1)) {
+		if (hash->slot[j].hash == h && fold_equal(hash->slot[j].name, name)) return hash->slot[j].value;
+	}
+	return NULL;
+}
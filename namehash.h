@@ -0,0 +1,56 @@
+#ifndef _NAMEHASH_H_LOADED
+#define _NAMEHASH_H_LOADED
+
+/* ===========================================================================
+-- Case-insensitive hash index from names to opaque pointers.
+--
+-- Used for the materials list so that looking up a material by name is a
+-- single probe, independent of the size of the database.  Names are folded
+-- to lower case (ASCII) for both hashing and comparison, matching the
+-- _stricmp() semantics previously used.  Keys are not copied -- the strings
+-- must remain valid for the life of the index.
+--
+-- An index is not thread safe for modification; lookups from several
+-- threads are fine once it is built.
+=========================================================================== */
+
+typedef struct _NAMEHASH NAMEHASH;			/* Opaque */
+
+/* ===========================================================================
+-- Create or release an index
+--
+-- Usage: NAMEHASH *NameHash_Create(int size_hint);
+--        void NameHash_Free(NAMEHASH *hash);
+--
+-- Inputs: size_hint - expected number of names (table grows as needed)
+--
+-- Return: NameHash_Create returns NULL on memory failure
+=========================================================================== */
+NAMEHASH *NameHash_Create(int size_hint);
+void NameHash_Free(NAMEHASH *hash);
+
+/* ===========================================================================
+-- Add a name to the index
+--
+-- Usage: int NameHash_Add(NAMEHASH *hash, char *name, void *value);
+--
+-- Inputs: hash  - index from NameHash_Create()
+--         name  - key (not copied; must stay valid)
+--         value - pointer returned by NameHash_Find()
+--
+-- Return: 0 if added
+--         1 if the name (case folded) was already present -- value unchanged
+--        <0 on invalid parameters or memory failure
+=========================================================================== */
+int NameHash_Add(NAMEHASH *hash, char *name, void *value);
+
+/* ===========================================================================
+-- Find a name in the index (case insensitive)
+--
+-- Usage: void *NameHash_Find(NAMEHASH *hash, char *name);
+--
+-- Return: value given to NameHash_Add(), or NULL if not present
+=========================================================================== */
+void *NameHash_Find(NAMEHASH *hash, char *name);
+
+#endif		/* _NAMEHASH_H_LOADED */
@@ -0,0 +1,203 @@
+/* nkcache.c - Cache of n,k tables evaluated on a wavelength grid */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "nkcache.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+typedef struct _NKCACHE_ENTRY {
+	void *material;						/* Identity of the material		*/
+	double *n, *k;							/* [npt] tables (single block)	*/
+} NKCACHE_ENTRY;
+
+struct _NKCACHE_GRID {
+	int npt;									/* 0 ==> slot unused				*/
+	double *lambda;						/* Copy of the wavelengths			*/
+	unsigned long last_use;				/* For least-recently-used discard */
+	int nentry, dim_entry;
+	NKCACHE_ENTRY *entry;
+};
+
+struct _NKCACHE {
+	NKCACHE_LOOKUP *lookup;
+	void *parm;								/* Passed to lookup					*/
+	unsigned long use_count;
+	unsigned long serial;				/* Incremented when tables are discarded */
+	NKCACHE_GRID grid[NKCACHE_MAX_GRIDS];
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void FreeGrid(NKCACHE_GRID *grid);
+
+/* ===========================================================================
+-- Release everything held by a grid slot and mark it unused
+=========================================================================== */
+static void FreeGrid(NKCACHE_GRID *grid) {
+	int i;
+
+	for (i=0; i<grid->nentry; i++) free(grid->entry[i].n);
+	free(grid->entry);
+	free(grid->lambda);
+	memset(grid, 0, sizeof(*grid));
+	return;
+}
+
+/* ===========================================================================
+-- Create or release an n,k cache
+--
+-- Usage: NKCACHE *NKCache_Create(NKCACHE_LOOKUP *lookup, void *parm);
+--        void NKCache_Free(NKCACHE *cache);
+--
+-- Return: NKCache_Create returns NULL on error
+=========================================================================== */
+NKCACHE *NKCache_Create(NKCACHE_LOOKUP *lookup, void *parm) {
+	NKCACHE *cache;
+
+	if (lookup == NULL) return NULL;
+	if ( (cache = calloc(1, sizeof(*cache))) == NULL) return NULL;
+	cache->lookup = lookup;
+	cache->parm   = parm;
+	return cache;
+}
+
+void NKCache_Free(NKCACHE *cache) {
+	if (cache == NULL) return;
+	NKCache_Clear(cache);
+	free(cache);
+	return;
+}
+
+/* ===========================================================================
+-- Discard all cached tables
+--
+-- Usage: void NKCache_Clear(NKCACHE *cache);
+=========================================================================== */
+void NKCache_Clear(NKCACHE *cache) {
+	int i;
+
+	if (cache == NULL) return;
+	for (i=0; i<NKCACHE_MAX_GRIDS; i++) FreeGrid(&cache->grid[i]);
+	cache->serial++;
+	return;
+}
+
+/* ===========================================================================
+-- Serial number incremented whenever cached tables are discarded
+--
+-- Usage: unsigned long NKCache_Serial(NKCACHE *cache);
+=========================================================================== */
+unsigned long NKCache_Serial(NKCACHE *cache) {
+	return (cache == NULL) ? 0 : cache->serial;
+}
+
+/* ===========================================================================
+-- Find (or create) the cache entry for a wavelength grid
+--
+-- Usage: NKCACHE_GRID *NKCache_Grid(NKCACHE *cache, int npt, double *lambda);
+--
+-- Inputs: cache  - cache from NKCache_Create()
+--         npt    - number of wavelengths
+--         lambda - wavelengths (values are copied)
+--
+-- Return: Handle for use with NKCache_Lookup, or NULL on error
+=========================================================================== */
+NKCACHE_GRID *NKCache_Grid(NKCACHE *cache, int npt, double *lambda) {
+	int i;
+	NKCACHE_GRID *grid, *oldest;
+
+	if (cache == NULL || npt <= 0 || lambda == NULL) return NULL;
+
+	/* Look for an existing grid with identical wavelengths */
+	oldest = NULL;
+	for (i=0; i<NKCACHE_MAX_GRIDS; i++) {
+		grid = &cache->grid[i];
+		if (grid->npt == npt && memcmp(grid->lambda, lambda, npt*sizeof(*lambda)) == 0) {
+			grid->last_use = ++cache->use_count;
+			return grid;
+		}
+		if (oldest == NULL || grid->npt == 0 || (oldest->npt != 0 && grid->last_use < oldest->last_use)) oldest = grid;
+	}
+
+	/* New grid -- replace least recently used (or an empty slot) */
+	if (oldest->npt != 0) cache->serial++;
+	FreeGrid(oldest);
+	if ( (oldest->lambda = malloc(npt*sizeof(*lambda))) == NULL) return NULL;
+	memcpy(oldest->lambda, lambda, npt*sizeof(*lambda));
+	oldest->npt = npt;
+	oldest->last_use = ++cache->use_count;
+	return oldest;
+}
+
+/* ===========================================================================
+-- Return the n,k tables for a material on a grid
+--
+-- Usage: int NKCache_Lookup(NKCACHE *cache, NKCACHE_GRID *grid, void *material, double **n, double **k);
+--
+-- Inputs: cache    - cache from NKCache_Create()
+--         grid     - handle from NKCache_Grid()
+--         material - material identity passed to the lookup routine
+--         n, k     - pointers to receive the [npt] tables
+--
+-- Output: *n, *k - tables owned by the cache
+--
+-- Return: 0 if successful
+--         1 ==> invalid parameters
+--         2 ==> memory allocation failure
+--         3 ==> lookup routine failed
+=========================================================================== */
+int NKCache_Lookup(NKCACHE *cache, NKCACHE_GRID *grid, void *material, double **n, double **k) {
+	static char *rname = "NKCache_Lookup";
+	int i;
+	NKCACHE_ENTRY *entry;
+
+	if (n != NULL) *n = NULL;
+	if (k != NULL) *k = NULL;
+	if (cache == NULL || grid == NULL || grid->npt <= 0 || n == NULL || k == NULL) return 1;
+
+	for (i=0; i<grid->nentry; i++) {
+		if (grid->entry[i].material == material) {
+			*n = grid->entry[i].n;
+			*k = grid->entry[i].k;
+			return 0;
+		}
+	}
+
+	/* Miss -- evaluate the material over the full grid */
+	if (grid->nentry >= grid->dim_entry) {
+		entry = realloc(grid->entry, (grid->dim_entry+8)*sizeof(*entry));
+		if (entry == NULL) return 2;
+		grid->entry = entry;
+		grid->dim_entry += 8;
+	}
+	entry = &grid->entry[grid->nentry];
+	if ( (entry->n = malloc(2*grid->npt*sizeof(double))) == NULL) return 2;
+	entry->k = entry->n + grid->npt;
+	entry->material = material;
+	if (cache->lookup(cache->parm, material, grid->npt, grid->lambda, entry->n, entry->k) != 0) {
+		fprintf(stderr, "ERROR: %s: n,k lookup failed for material\n", rname); fflush(stderr);
+		free(entry->n);
+		return 3;
+	}
+	grid->nentry++;
+
+	*n = entry->n;
+	*k = entry->k;
+	return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef _NKCACHE_H_LOADED
+#define _NKCACHE_H_LOADED
+
+/* ===========================================================================
+-- Cache of n,k tables evaluated on a wavelength grid.
+--
+-- The optical constants of a material only need to be interpolated from the
+-- database once for a given set of wavelengths.  The cache holds the [npt]
+-- n and k arrays for each (material, grid) pair so the fit inner loop never
+-- touches the database or spline code.
+--
+-- Grids are identified by content (npt and the wavelength values), so a grid
+-- that is reloaded with different values is automatically a new grid.
+-- Materials are identified by an opaque pointer (TFOC_MATERIAL * or a
+-- compiled database entry in FilmMeasure).  A small number of grids are
+-- kept, least recently used discarded first.
+--
+-- A cache is not thread safe; use one per thread or evaluation context.
+=========================================================================== */
+
+#define	NKCACHE_MAX_GRIDS	(8)
+
+/* Routine to evaluate n,k for a material on a grid.  parm is the pointer
+ * given to NKCache_Create().  Fills n[npt] and k[npt] (N = n - ik) and
+ * returns 0 if successful */
+typedef int NKCACHE_LOOKUP(void *parm, void *material, int npt, double *lambda, double *n, double *k);
+
+typedef struct _NKCACHE NKCACHE;					/* Opaque */
+typedef struct _NKCACHE_GRID NKCACHE_GRID;		/* Opaque */
+
+/* ===========================================================================
+-- Create or release an n,k cache
+--
+-- Usage: NKCACHE *NKCache_Create(NKCACHE_LOOKUP *lookup, void *parm);
+--        void NKCache_Free(NKCACHE *cache);
+--
+-- Inputs: lookup - routine used to fill tables on a cache miss
+--         parm   - passed unchanged to the lookup routine
+--
+-- Return: NKCache_Create returns NULL on error
+=========================================================================== */
+NKCACHE *NKCache_Create(NKCACHE_LOOKUP *lookup, void *parm);
+void NKCache_Free(NKCACHE *cache);
+
+/* ===========================================================================
+-- Discard all cached tables (for example when the material database reloads)
+--
+-- Usage: void NKCache_Clear(NKCACHE *cache);
+=========================================================================== */
+void NKCache_Clear(NKCACHE *cache);
+
+/* ===========================================================================
+-- Serial number incremented whenever cached tables are discarded
+--
+-- Usage: unsigned long NKCache_Serial(NKCACHE *cache);
+--
+-- Return: Current serial.  If unchanged since an earlier call, every table
+--         pointer returned in between is still valid and unchanged, so
+--         pointer identity can be used as a key by later stages.
+=========================================================================== */
+unsigned long NKCache_Serial(NKCACHE *cache);
+
+/* ===========================================================================
+-- Find (or create) the cache entry for a wavelength grid
+--
+-- Usage: NKCACHE_GRID *NKCache_Grid(NKCACHE *cache, int npt, double *lambda);
+--
+-- Inputs: cache  - cache from NKCache_Create()
+--         npt    - number of wavelengths
+--         lambda - wavelengths (values are copied, pointer not retained)
+--
+-- Return: Handle for use with NKCache_Lookup, or NULL on error.  The handle
+--         remains valid until another call to NKCache_Grid() or
+--         NKCache_Clear() on the same cache.
+--
+-- Notes: Comparison is by value.  Calling once per evaluation and then
+--        looking up each layer keeps the cost of the comparison negligible.
+=========================================================================== */
+NKCACHE_GRID *NKCache_Grid(NKCACHE *cache, int npt, double *lambda);
+
+/* ===========================================================================
+-- Return the n,k tables for a material on a grid
+--
+-- Usage: int NKCache_Lookup(NKCACHE *cache, NKCACHE_GRID *grid, void *material, double **n, double **k);
+--
+-- Inputs: cache    - cache from NKCache_Create()
+--         grid     - handle from NKCache_Grid()
+--         material - material identity passed to the lookup routine
+--         n, k     - pointers to receive the [npt] tables
+--
+-- Output: *n, *k - tables owned by the cache.  Valid until the grid is
+--                  discarded or NKCache_Clear() is called.
+--
+-- Return: 0 if successful, !0 on failure (lookup routine or memory)
+=========================================================================== */
+int NKCache_Lookup(NKCACHE *cache, NKCACHE_GRID *grid, void *material, double **n, double **k);
+
+#endif		/* _NKCACHE_H_LOADED */
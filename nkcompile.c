@@ -0,0 +1,159 @@
+/* nkcompile.c - Compile the text n,k database into a memory mappable file */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "matdb.h"
+
+#ifdef NKCOMPILE_TFOC						/* Built with tfoc.lib -- can verify against TFOC_FindNK */
+	#include "tfoc.h"
+#endif
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	DFLT_DATABASE	"./database.nk"
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void usage(void);
+#ifdef NKCOMPILE_TFOC
+	static int verify(MATDB *db, char *directory);
+#endif
+
+/* ===========================================================================
+-- Usage: nkcompile [-q] [-verify] [database_directory [output_file]]
+--
+-- Reads every material file (no extension) in the text database and writes
+-- the compiled file, by default database_directory/materials.nkdb, which
+-- FilmMeasure maps at startup.  Rerun whenever the text database changes.
+=========================================================================== */
+int main(int argc, char *argv[]) {
+
+	char *directory, *outfile, *env, path[1024];
+	int i, nmat, verbose, check;
+	MATDB *db;
+
+	directory = outfile = NULL;
+	verbose = TRUE;
+	check = FALSE;
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			verbose = FALSE;
+		} else if (strcmp(argv[i], "-verify") == 0) {
+			check = TRUE;
+		} else if (*argv[i] == '-') {
+			usage();
+			return 1;
+		} else if (directory == NULL) {
+			directory = argv[i];
+		} else if (outfile == NULL) {
+			outfile = argv[i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (directory == NULL) directory = ( (env = getenv("tfocDatabase")) != NULL && *env != '\0') ? env : DFLT_DATABASE;
+	if (outfile == NULL) {
+		sprintf(path, "%.1000s/%s", directory, MATDB_FILENAME);
+		outfile = path;
+	}
+
+	if (verbose) { printf("Compiling \"%s\" -> \"%s\"\n", directory, outfile); fflush(stdout); }
+	if ( (nmat = MatDB_Compile(directory, outfile, verbose)) < 0) {
+		fprintf(stderr, "ERROR: compilation failed (rc=%d)\n", nmat); fflush(stderr);
+		return 2;
+	}
+
+	/* Make sure it maps back cleanly */
+	if ( (db = MatDB_Open(outfile)) == NULL || MatDB_Count(db) != nmat) {
+		fprintf(stderr, "ERROR: unable to reopen \"%s\" after writing\n", outfile); fflush(stderr);
+		MatDB_Close(db);
+		return 3;
+	}
+	if (verbose) { printf("%d materials written\n", nmat); fflush(stdout); }
+
+	if (check) {
+#ifdef NKCOMPILE_TFOC
+		verify(db, directory);
+#else
+		fprintf(stderr, "WARNING: -verify requires a build linked with tfoc.lib (NKCOMPILE_TFOC)\n"); fflush(stderr);
+#endif
+	}
+
+	MatDB_Close(db);
+	return 0;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: nkcompile [-q] [-verify] [database_directory [output_file]]\n"
+						 "   database_directory defaults to $tfocDatabase or " DFLT_DATABASE "\n"
+						 "   output_file defaults to database_directory/" MATDB_FILENAME "\n");
+	fflush(stderr);
+	return;
+}
+
+#ifdef NKCOMPILE_TFOC
+/* ===========================================================================
+-- Compare the compiled tables with TFOC_FindNK over each material's range
+--
+-- Usage: int verify(MATDB *db, char *directory);
+--
+-- Return: Number of materials whose n or k differ by more than 1E-6
+=========================================================================== */
+static int verify(MATDB *db, char *directory) {
+	int i, j, nbad;
+	double lambda, n, k, dn, dk;
+	MATDB_MATERIAL *mat;
+	TFOC_MATERIAL *tfoc;
+	COMPLEX nk;
+	char dir[1024];
+
+	sprintf(dir, "%.1000s/", directory);
+	nbad = 0;
+	printf("\nVerification against TFOC_FindNK (max |dn|, |dk| over 250-2000 nm):\n");
+	for (i=0; i<MatDB_Count(db); i++) {
+		mat = MatDB_Material(db, i);
+		if ( (tfoc = TFOC_FindMaterial(mat->name, dir)) == NULL) {
+			printf("  %-20s not found by TFOC_FindMaterial\n", mat->name);
+			nbad++;
+			continue;
+		}
+		dn = dk = 0.0;
+		for (j=0; j<=1750; j++) {
+			lambda = 250.0 + j;
+			MatDB_NK(db, mat, 1, &lambda, &n, &k);
+			nk = TFOC_FindNK(tfoc, lambda);
+			if (fabs(n-nk.x) > dn) dn = fabs(n-nk.x);
+			if (fabs(k-nk.y) > dk) dk = fabs(k-nk.y);
+		}
+		printf("  %-20s %10.3g %10.3g%s\n", mat->name, dn, dk, (dn > 1E-6 || dk > 1E-6) ? "  **" : "");
+		if (dn > 1E-6 || dk > 1E-6) nbad++;
+	}
+	fflush(stdout);
+	return nbad;
+}
+#endif
@@ -0,0 +1,74 @@
+/* notfoc.c - Stand-ins for the tfoc.lib entry points on builds without it */
+
+/* ===========================================================================
+-- tfoc.lib exists only for Windows.  The command line tools build on other
+-- systems with these in its place and take every material from the
+-- compiled database (nkcompile, MATDB_FILENAME).  TFOC_FindMaterial()
+-- finds nothing, so the other routines -- used by filmfit.c only for TFOC
+-- materials and doping profiles -- are never reached with a valid stack.
+=========================================================================== */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tfoc.h"
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void unavailable(char *rname);
+
+/* ===========================================================================
+-- No TFOC text database in this build
+--
+-- Return: NULL always (with a one time explanation on stderr)
+=========================================================================== */
+TFOC_MATERIAL *TFOC_FindMaterial(char *name, char *database) {
+	static int told = 0;
+
+	if (! told) {
+		fprintf(stderr, "NOTE: built without tfoc.lib -- materials must be in the compiled database (%s)\n", database);
+		fflush(stderr);
+		told = 1;
+	}
+	return NULL;
+}
+
+COMPLEX TFOC_FindNK(TFOC_MATERIAL *material, double lambda) {
+	COMPLEX n = {1.0, 0.0};
+
+	unavailable("TFOC_FindNK");
+	return n;
+}
+
+void TFOC_MakeLayers(TFOC_SAMPLE *sample, TFOC_LAYER *layers, double T, double lambda) {
+	unavailable("TFOC_MakeLayers");
+	return;
+}
+
+REFL TFOC_ReflN(double theta, POLARIZATION mode, double lambda, TFOC_LAYER layer[]) {
+	REFL refl = {0.0, 0.0};
+
+	unavailable("TFOC_ReflN");
+	return refl;
+}
+
+/* ===========================================================================
+-- A stack needing TFOC got this far -- nothing sensible can be returned
+=========================================================================== */
+static void unavailable(char *rname) {
+	fprintf(stderr, "ERROR: %s requires tfoc.lib, which is not part of this build (doping profiles are not supported)\n", rname);
+	fflush(stderr);
+	exit(3);
+}
@@ -0,0 +1,317 @@
+/* pipeline.c - Processing stages on their own threads, linked by bounded queues */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+	#define STRICT						/* define before including windows.h for stricter type checking */
+	#include <windows.h>				/* master include file for Windows applications */
+	#undef _POSIX_
+		#include <process.h>			/* for process control fuctions (e.g. threads, programs) */
+	#define _POSIX_
+#elif __linux__
+	#include <pthread.h>
+#else
+	#error "Unsupported OS"
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "pipeline.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION	PL_MUTEX;
+	typedef CONDITION_VARIABLE	PL_COND;
+	typedef HANDLE					PL_THREAD;
+	#define	PL_THREAD_FNC		static unsigned __stdcall
+	#define	PL_MUTEX_INIT(m)	(InitializeCriticalSection(m), 0)
+	#define	PL_MUTEX_FREE(m)	DeleteCriticalSection(m)
+	#define	PL_LOCK(m)			EnterCriticalSection(m)
+	#define	PL_UNLOCK(m)		LeaveCriticalSection(m)
+	#define	PL_COND_INIT(c)	(InitializeConditionVariable(c), 0)
+	#define	PL_COND_FREE(c)
+	#define	PL_WAIT(c,m)		SleepConditionVariableCS((c), (m), INFINITE)
+	#define	PL_BROADCAST(c)	WakeAllConditionVariable(c)
+#else
+	typedef pthread_mutex_t		PL_MUTEX;
+	typedef pthread_cond_t		PL_COND;
+	typedef pthread_t				PL_THREAD;
+	#define	PL_THREAD_FNC		static void *
+	#define	PL_MUTEX_INIT(m)	pthread_mutex_init((m), NULL)
+	#define	PL_MUTEX_FREE(m)	pthread_mutex_destroy(m)
+	#define	PL_LOCK(m)			pthread_mutex_lock(m)
+	#define	PL_UNLOCK(m)		pthread_mutex_unlock(m)
+	#define	PL_COND_INIT(c)	pthread_cond_init((c), NULL)
+	#define	PL_COND_FREE(c)	pthread_cond_destroy(c)
+	#define	PL_WAIT(c,m)		pthread_cond_wait((c), (m))
+	#define	PL_BROADCAST(c)	pthread_cond_broadcast(c)
+#endif
+
+/* Ring of items waiting for a stage */
+typedef struct _PL_QUEUE {
+	void **item;								/* [depth] */
+	int head, count;
+} PL_QUEUE;
+
+/* One thread -- step k+1 runs stage[k]; step 0 is Pipeline_Put() */
+typedef struct _PL_STEP {
+	struct _PIPELINE *pipe;
+	int index;
+	PL_THREAD thread;
+	int started;
+	int finished;								/* Thread has exited its loop */
+} PL_STEP;
+
+struct _PIPELINE {
+	int depth;
+	int nstage;
+	PIPE_STAGE *stage[PIPELINE_MAX_STAGES];
+	void *arg;
+
+	PL_MUTEX mutex;							/* Everything below */
+	PL_COND changed;							/* Broadcast on any change of state */
+	PL_QUEUE queue[PIPELINE_MAX_STAGES];	/* queue[k] feeds stage[k] */
+	PL_STEP step[PIPELINE_MAX_STAGES+1];
+	int outstanding;							/* Handed out, no Pipeline_Done() yet */
+	int stop;
+	int joined;
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+PL_THREAD_FNC step_thread(void *parm);
+static void stage_loop(PIPELINE *pipe, PL_STEP *step);
+static void put(PIPELINE *pipe, int k, void *item);
+
+/* ===========================================================================
+-- Start, stop and release
+=========================================================================== */
+PIPELINE *Pipeline_Start(int depth, int nstage, PIPE_STAGE **stage, void *arg) {
+	static char *rname = "Pipeline_Start";
+	PIPELINE *pipe;
+	int i, ok;
+
+	if (stage == NULL || nstage < 1 || nstage > PIPELINE_MAX_STAGES) return NULL;
+	if (depth <= 0) depth = PIPELINE_DFLT_DEPTH;
+
+	if ( (pipe = calloc(1, sizeof(*pipe))) == NULL) return NULL;
+	pipe->depth  = depth;
+	pipe->nstage = nstage;
+	pipe->arg    = arg;
+	for (i=0; i<nstage; i++) {
+		pipe->stage[i] = stage[i];
+		if ( (pipe->queue[i].item = calloc(depth, sizeof(void *))) == NULL) {
+			while (--i >= 0) free(pipe->queue[i].item);
+			free(pipe);
+			return NULL;
+		}
+	}
+	if (PL_MUTEX_INIT(&pipe->mutex) != 0 || PL_COND_INIT(&pipe->changed) != 0) {
+		fprintf(stderr, "ERROR: %s: unable to create synchronization objects\n", rname); fflush(stderr);
+		for (i=0; i<nstage; i++) free(pipe->queue[i].item);
+		free(pipe);
+		return NULL;
+	}
+
+	/* Downstream threads first; step 0 is the caller's Pipeline_Put() */
+	ok = TRUE;
+	for (i=nstage; i>0 && ok; i--) {
+		pipe->step[i].pipe  = pipe;
+		pipe->step[i].index = i;
+#ifdef _WIN32
+		pipe->step[i].thread  = (HANDLE) _beginthreadex(NULL, 0, step_thread, &pipe->step[i], 0, NULL);
+		pipe->step[i].started = (pipe->step[i].thread != 0);
+#else
+		pipe->step[i].started = (pthread_create(&pipe->step[i].thread, NULL, step_thread, &pipe->step[i]) == 0);
+#endif
+		ok = pipe->step[i].started;
+	}
+	if (! ok) {
+		fprintf(stderr, "ERROR: %s: unable to start the pipeline threads\n", rname); fflush(stderr);
+		PL_LOCK(&pipe->mutex);
+		for (i=0; i<=nstage; i++) {						/* Upstream of any running stage is finished */
+			if (! pipe->step[i].started) pipe->step[i].finished = TRUE;
+		}
+		PL_BROADCAST(&pipe->changed);
+		PL_UNLOCK(&pipe->mutex);
+		Pipeline_Free(pipe);
+		return NULL;
+	}
+	return pipe;
+}
+
+int Pipeline_Stop(PIPELINE *pipe) {
+	int i;
+
+	if (pipe == NULL || pipe->joined) return 0;
+
+	PL_LOCK(&pipe->mutex);
+	pipe->stop = TRUE;
+	pipe->step[0].finished = TRUE;							/* Nothing more will be put */
+	PL_BROADCAST(&pipe->changed);
+	PL_UNLOCK(&pipe->mutex);
+
+	for (i=0; i<=pipe->nstage; i++) {						/* In order, as each drains the next */
+		if (! pipe->step[i].started) continue;
+#ifdef _WIN32
+		WaitForSingleObject(pipe->step[i].thread, INFINITE);
+		CloseHandle(pipe->step[i].thread);
+#else
+		pthread_join(pipe->step[i].thread, NULL);
+#endif
+	}
+	pipe->joined = TRUE;
+	return 0;
+}
+
+void Pipeline_Free(PIPELINE *pipe) {
+	int i;
+
+	if (pipe == NULL) return;
+	Pipeline_Stop(pipe);
+	PL_COND_FREE(&pipe->changed);
+	PL_MUTEX_FREE(&pipe->mutex);
+	for (i=0; i<pipe->nstage; i++) free(pipe->queue[i].item);
+	free(pipe);
+	return;
+}
+
+/* ===========================================================================
+-- Acknowledge an item from the last stage
+=========================================================================== */
+int Pipeline_Done(PIPELINE *pipe) {
+
+	if (pipe == NULL) return 0;
+	PL_LOCK(&pipe->mutex);
+	if (pipe->outstanding > 0) pipe->outstanding--;
+	PL_BROADCAST(&pipe->changed);
+	PL_UNLOCK(&pipe->mutex);
+	return 0;
+}
+
+/* ===========================================================================
+-- Items from the caller's thread / queue length
+=========================================================================== */
+int Pipeline_Put(PIPELINE *pipe, void *item, int wait) {
+	PL_QUEUE *queue;
+	int rc;
+
+	if (pipe == NULL) return 2;
+	queue = &pipe->queue[0];
+
+	PL_LOCK(&pipe->mutex);
+	while (wait && queue->count >= pipe->depth && ! pipe->stop) PL_WAIT(&pipe->changed, &pipe->mutex);
+	if (pipe->stop || queue->count >= pipe->depth) {
+		rc = pipe->stop ? 2 : 1;
+		PL_UNLOCK(&pipe->mutex);
+		return rc;
+	}
+	queue->item[(queue->head+queue->count) % pipe->depth] = item;
+	queue->count++;
+	PL_BROADCAST(&pipe->changed);
+	PL_UNLOCK(&pipe->mutex);
+	return 0;
+}
+
+int Pipeline_Backlog(PIPELINE *pipe, int k) {
+	int count;
+
+	if (pipe == NULL || k < 0 || k >= pipe->nstage) return 0;
+	PL_LOCK(&pipe->mutex);
+	count = pipe->queue[k].count;
+	PL_UNLOCK(&pipe->mutex);
+	return count;
+}
+
+/* ===========================================================================
+-- Thread bodies
+--
+-- Stage k takes items from its queue until the step before it has
+-- finished and the queue is empty, so a stop drains every item that was
+-- put.  All state changes are broadcast on one condition; the rates
+-- involved (at most a few hundred items a second) make finer grained
+-- signalling pointless.
+=========================================================================== */
+PL_THREAD_FNC step_thread(void *parm) {
+	PL_STEP *step = (PL_STEP *) parm;
+	PIPELINE *pipe = step->pipe;
+
+	stage_loop(pipe, step);
+
+	PL_LOCK(&pipe->mutex);
+	step->finished = TRUE;
+	PL_BROADCAST(&pipe->changed);
+	PL_UNLOCK(&pipe->mutex);
+	return 0;
+}
+
+static void stage_loop(PIPELINE *pipe, PL_STEP *step) {
+	PL_QUEUE *queue;
+	void *item;
+	int k, last, rc;
+
+	k = step->index-1;
+	queue = &pipe->queue[k];
+	last = (k == pipe->nstage-1);
+
+	while (TRUE) {
+		PL_LOCK(&pipe->mutex);
+		while (queue->count == 0 && ! pipe->step[k].finished) PL_WAIT(&pipe->changed, &pipe->mutex);
+		if (queue->count == 0) { PL_UNLOCK(&pipe->mutex); break; }
+		item = queue->item[queue->head];
+		queue->head = (queue->head+1) % pipe->depth;
+		queue->count--;
+		PL_BROADCAST(&pipe->changed);							/* Room for the step before */
+
+		if (last) {													/* Hand out only when the receiver keeps up */
+			while (pipe->outstanding >= pipe->depth && ! pipe->stop) PL_WAIT(&pipe->changed, &pipe->mutex);
+			pipe->outstanding++;									/* Before the hand out, which may be answered at once */
+		}
+		PL_UNLOCK(&pipe->mutex);
+
+		rc = pipe->stage[k](pipe->arg, item);
+
+		if (last && rc != 0) {
+			PL_LOCK(&pipe->mutex);
+			if (pipe->outstanding > 0) pipe->outstanding--;
+			PL_UNLOCK(&pipe->mutex);
+		}
+
+		if (! last && rc == 0) put(pipe, k+1, item);
+	}
+	return;
+}
+
+/* Queue item for stage[k], waiting for room */
+static void put(PIPELINE *pipe, int k, void *item) {
+	PL_QUEUE *queue = &pipe->queue[k];
+
+	PL_LOCK(&pipe->mutex);
+	while (queue->count >= pipe->depth) PL_WAIT(&pipe->changed, &pipe->mutex);
+	queue->item[(queue->head+queue->count) % pipe->depth] = item;
+	queue->count++;
+	PL_BROADCAST(&pipe->changed);
+	PL_UNLOCK(&pipe->mutex);
+	return;
+}
@@ -0,0 +1,95 @@
+#ifndef _PIPELINE_H_LOADED
+#define _PIPELINE_H_LOADED
+
+/* ===========================================================================
+-- Staged processing pipeline with bounded queues.
+--
+-- Items are fed with Pipeline_Put() by the caller's own thread (for example
+-- a scheduler that paces acquisition) and pass through up to
+-- PIPELINE_MAX_STAGES stages, each on its own thread, connected by queues
+-- of at most depth items.  While stage 1 works on item N, the caller can
+-- already produce item N+1 and stage 2 finish item N-1, so the rate is set
+-- by the slowest step rather than by the sum of all of them.  A full queue
+-- holds back the step feeding it, so memory stays bounded and items keep
+-- their order.
+--
+-- Items leave through the last stage (for example posted to a window).
+-- They count as outstanding until the receiver calls Pipeline_Done(), and
+-- the last stage waits while depth items are outstanding, so a slow
+-- receiver holds back the pipeline instead of collecting a backlog.
+=========================================================================== */
+
+typedef struct _PIPELINE PIPELINE;				/* Opaque */
+
+#define	PIPELINE_MAX_STAGES	(8)				/* Stages after Pipeline_Put() */
+#define	PIPELINE_DFLT_DEPTH	(2)				/* Items queued between steps */
+
+/* Process an item in place.  Return 0 to pass it on (from the last stage:
+ * it has been handed out), !0 if the stage disposed of it */
+typedef int PIPE_STAGE(void *arg, void *item);
+
+/* ===========================================================================
+-- Start or stop a pipeline
+--
+-- Usage: PIPELINE *Pipeline_Start(int depth, int nstage, PIPE_STAGE **stage, void *arg);
+--        int Pipeline_Stop(PIPELINE *pipe);
+--        void Pipeline_Free(PIPELINE *pipe);
+--
+-- Inputs: depth  - items queued between steps (<= 0 for default)
+--         nstage - number of stages (1 ... PIPELINE_MAX_STAGES)
+--         stage  - [nstage] called in order as stage[k](arg, item)
+--         arg    - passed unchanged to the stages
+--
+-- Return: Pipeline_Start returns NULL if the threads cannot be started
+--         (message on stderr); callers then do the work serially.
+--         Pipeline_Stop returns 0.
+--
+-- Notes: Pipeline_Stop() passes every queued item through the remaining
+--        stages and joins the threads.  No Pipeline_Put() may be in
+--        progress or follow.  It does not wait for Pipeline_Done(), so the
+--        receiver may call it from its own thread.  Pipeline_Free() stops
+--        the pipeline if needed and releases it.
+=========================================================================== */
+PIPELINE *Pipeline_Start(int depth, int nstage, PIPE_STAGE **stage, void *arg);
+int Pipeline_Stop(PIPELINE *pipe);
+void Pipeline_Free(PIPELINE *pipe);
+
+/* ===========================================================================
+-- Acknowledge an item handed out by the last stage
+--
+-- Usage: int Pipeline_Done(PIPELINE *pipe);
+--
+-- Return: 0
+=========================================================================== */
+int Pipeline_Done(PIPELINE *pipe);
+
+/* ===========================================================================
+-- Feed an item to stage[0]
+--
+-- Usage: int Pipeline_Put(PIPELINE *pipe, void *item, int wait);
+--
+-- Inputs: item - next item, passed in turn to each stage
+--         wait - TRUE to wait for room in the queue, FALSE to return at once
+--
+-- Return: 0 if queued
+--         1 if the queue is full and wait is FALSE
+--         2 if the pipeline is stopping
+--         In the last two cases the caller still owns item.
+=========================================================================== */
+int Pipeline_Put(PIPELINE *pipe, void *item, int wait);
+
+/* ===========================================================================
+-- Items waiting for a stage
+--
+-- Usage: int Pipeline_Backlog(PIPELINE *pipe, int k);
+--
+-- Inputs: k - stage (0 ... nstage-1)
+--
+-- Return: items queued for stage[k] (0 if k is invalid)
+--
+-- Notes: Lets a stage that only needs the newest item (a display, a fit
+--        that is falling behind) pass older ones on untouched
+=========================================================================== */
+int Pipeline_Backlog(PIPELINE *pipe, int k);
+
+#endif		/* _PIPELINE_H_LOADED */
@@ -0,0 +1,262 @@
+/* recipe.c - Film recipe from FilmMeasure.ini for the offline tools */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tfoc.h"
+#include "matdb.h"
+#include "speclib.h"
+#include "filmfit.h"
+#include "inifile.h"
+#include "recipe.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int set_layer(TFOC_SAMPLE *sample, int nlayers, char *material, double nm, char *database, MATDB *db, int *tfoc_needed);
+static int is_none(char *material);
+static void read_range(INIFILE *ini, char *key, double *xmin, double *xmax);
+static void read_int(INIFILE *ini, char *key, int *value);
+
+/* ===========================================================================
+-- Read a recipe
+--
+-- Usage: int Recipe_Read(char *inifile, char *database, MATDB *db, RECIPE *recipe);
+--
+-- Return: 0 if successful, 1 if a material is missing, 2 if nothing varies
+=========================================================================== */
+int Recipe_Read(char *inifile, char *database, MATDB *db, RECIPE *recipe) {
+	RECIPE_FILM film;
+
+	memset(recipe, 0, sizeof(*recipe));
+	Recipe_Options(inifile, recipe);
+
+	/* Stack from the [Film] section, as FilmMeasure builds it */
+	Recipe_ReadFilm(inifile, "Film", &film);
+	return Recipe_SetFilm(recipe, &film, database, db);
+}
+
+/* ===========================================================================
+-- Read the fit options
+--
+-- Usage: int Recipe_Options(char *inifile, RECIPE *recipe);
+--
+-- Return: 0
+=========================================================================== */
+int Recipe_Options(char *inifile, RECIPE *recipe) {
+	FILMFIT_PARMS *parms;
+	INIFILE *ini;
+	char szBuf[256];
+
+	/* FilmMeasure defaults, then the [Fit] section */
+	parms = &recipe->parms;
+	parms->scaling = 1.0;
+	parms->lambda_min = 300.0;		parms->lambda_max = 800.0;
+	parms->scaling_min = 0.90;		parms->scaling_max = 1.10;
+	parms->analytic_deriv = TRUE;
+	parms->varpro = TRUE;
+	parms->broyden = parms->geodesic = parms->nielsen = FALSE;
+	parms->multistart = 32;
+	parms->multistart_budget = 1.0;
+	parms->warm_start = TRUE;
+	parms->multires = 0;
+	recipe->threads = 0;
+
+	ini = IniFile_Open(inifile);
+	read_range(ini, "Lambda_Range",  &parms->lambda_min,  &parms->lambda_max);
+	read_range(ini, "Scaling_Range", &parms->scaling_min, &parms->scaling_max);
+	read_int(ini, "Analytic_Derivatives",  &parms->analytic_deriv);
+	read_int(ini, "Variable_Projection",   &parms->varpro);
+	read_int(ini, "Broyden",               &parms->broyden);
+	read_int(ini, "Geodesic_Acceleration", &parms->geodesic);
+	read_int(ini, "Nielsen_Damping",       &parms->nielsen);
+	read_int(ini, "Multistart",            &parms->multistart);
+	read_int(ini, "Warm_Start",            &parms->warm_start);
+	read_int(ini, "Multires_Levels",       &parms->multires);
+	read_int(ini, "Threads",               &recipe->threads);
+	IniFile_GetString(ini, "Fit", "Multistart_Budget", "", szBuf, sizeof(szBuf));
+	if (*szBuf != '\0') parms->multistart_budget = strtod(szBuf, NULL);
+	IniFile_GetString(ini, "Fit", "Spectral_Library", SPECLIB_FILENAME, recipe->speclib, sizeof(recipe->speclib));
+	IniFile_Close(ini);
+	return 0;
+}
+
+/* ===========================================================================
+-- Read the description of a stack
+--
+-- Usage: int Recipe_ReadFilm(char *inifile, char *section, RECIPE_FILM *film);
+--
+-- Return: 0
+=========================================================================== */
+int Recipe_ReadFilm(char *inifile, char *section, RECIPE_FILM *film) {
+	INIFILE *ini;
+	char key[64], szBuf[256], *aptr;
+	int i;
+
+	memset(film, 0, sizeof(*film));
+	ini = IniFile_Open(inifile);
+	for (i=0; i<RECIPE_MAX_FILM; i++) {
+		sprintf(key, "Layer_%d_Material", i);
+		IniFile_GetString(ini, section, key, "none", film->layer[i].material, sizeof(film->layer[i].material));
+		sprintf(key, "Layer_%d_Thickness", i);
+		IniFile_GetString(ini, section, key, "0", szBuf, sizeof(szBuf));
+		film->layer[i].nm = strtod(szBuf, NULL);
+		sprintf(key, "Layer_%d_Vary", i);
+		IniFile_GetString(ini, section, key, "0", szBuf, sizeof(szBuf));
+		film->layer[i].vary = strtol(szBuf, NULL, 10) != 0;
+		sprintf(key, "Layer_%d_Limits", i);
+		IniFile_GetString(ini, section, key, "0", szBuf, sizeof(szBuf));
+		film->layer[i].lower = fabs(strtod(szBuf, &aptr));
+		film->layer[i].upper = fabs(strtod(aptr, NULL));
+	}
+	IniFile_GetString(ini, section, "Substrate", "Si", film->substrate, sizeof(film->substrate));
+	IniFile_GetString(ini, section, "Mirror", "0", szBuf, sizeof(szBuf));
+	film->mirror = strtol(szBuf, NULL, 10) != 0;
+	IniFile_Close(ini);
+	return 0;
+}
+
+/* ===========================================================================
+-- Replace the stack and varied layers of a recipe
+--
+-- Usage: int Recipe_SetFilm(RECIPE *recipe, RECIPE_FILM *film, char *database, MATDB *db);
+--
+-- Return: 0 if successful, 1 if a material is missing, 2 if nothing varies
+=========================================================================== */
+int Recipe_SetFilm(RECIPE *recipe, RECIPE_FILM *film, char *database, MATDB *db) {
+	FILMFIT_PARMS *parms;
+	int i, n;
+	double xmin, xmax;
+
+	parms = &recipe->parms;
+	parms->sample = recipe->sample;
+	parms->nvary = 0;
+	recipe->tfoc_needed = FALSE;
+	if ( (recipe->nlayers = Recipe_Stack(film, database, db, recipe->sample, &recipe->tfoc_needed)) < 0) {
+		recipe->nlayers = 0;
+		return 1;
+	}
+
+	for (i=0,n=0; i<RECIPE_MAX_FILM; i++) {
+		if (is_none(film->layer[i].material)) continue;
+		n++;														/* Index in sample[] (0 is air) */
+		if (! film->layer[i].vary) continue;
+		xmin = film->layer[i].lower;
+		xmax = film->layer[i].upper;
+		if (xmax < xmin) xmax = (xmin == 0) ? 100 : 2*xmin;
+		parms->layer[parms->nvary] = n;
+		parms->lower[parms->nvary] = xmin;
+		parms->upper[parms->nvary] = xmax;
+		parms->name[parms->nvary]  = recipe->sample[n].name;
+		parms->nvary++;
+	}
+	return (parms->nvary == 0) ? 2 : 0;
+}
+
+/* ===========================================================================
+-- Build an EOS terminated stack from a description
+--
+-- Usage: int Recipe_Stack(RECIPE_FILM *film, char *database, MATDB *db, TFOC_SAMPLE *sample, int *tfoc_needed);
+--
+-- Return: entries before the EOS, or -1 if a material is missing
+=========================================================================== */
+int Recipe_Stack(RECIPE_FILM *film, char *database, MATDB *db, TFOC_SAMPLE *sample, int *tfoc_needed) {
+	int i, n;
+
+	memset(sample, 0, (RECIPE_MAX_FILM+3)*sizeof(*sample));
+	if (set_layer(sample, 0, "air", 0.0, database, db, tfoc_needed) != 0) return -1;
+	sample[0].type = INCIDENT;
+	for (i=0,n=1; i<RECIPE_MAX_FILM; i++) {
+		if (is_none(film->layer[i].material)) continue;
+		if (set_layer(sample, n, film->layer[i].material, film->layer[i].nm, database, db, tfoc_needed) != 0) return -1;
+		sample[n++].type = SUBLAYER;
+	}
+	if (set_layer(sample, n, film->substrate, 100.0, database, db, tfoc_needed) != 0) return -1;
+	sample[n++].type = SUBSTRATE;
+	sample[n].type = EOS;
+	return n;
+}
+
+/* ===========================================================================
+-- Fill entry n of a stack
+--
+-- Return: 0 if successful, 1 if the material cannot be found
+=========================================================================== */
+static int set_layer(TFOC_SAMPLE *sample, int n, char *material, double nm, char *database, MATDB *db, int *tfoc_needed) {
+	TFOC_SAMPLE *layer;
+	char dir[1024];
+
+	layer = &sample[n];
+	layer->doping_profile = NO_DOPING;
+	layer->doping_layers  = 1;
+	layer->temperature    = -1;
+	layer->z = nm;
+	strncpy(layer->name, material, sizeof(layer->name)-1);
+	if (db == NULL || MatDB_Find(db, material) == NULL) {				/* Need the TFOC material */
+		sprintf(dir, "%.1000s/", database);
+		if ( (layer->material = TFOC_FindMaterial(material, dir)) == NULL) {
+			fprintf(stderr, "ERROR: material \"%s\" not found in \"%s\"\n", material, database); fflush(stderr);
+			return 1;
+		}
+		*tfoc_needed = TRUE;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Is a material slot empty ("" or "none" in any case)?
+=========================================================================== */
+static int is_none(char *material) {
+	static char *none = "none";
+	int i;
+
+	if (*material == '\0') return TRUE;
+	for (i=0; none[i] != '\0'; i++) if (tolower((unsigned char) material[i]) != none[i]) return FALSE;
+	return material[i] == '\0';
+}
+
+/* ===========================================================================
+-- [Fit] values of the form "min max" or a single integer (unchanged if absent)
+=========================================================================== */
+static void read_range(INIFILE *ini, char *key, double *xmin, double *xmax) {
+	char szBuf[256], *aptr;
+
+	IniFile_GetString(ini, "Fit", key, "", szBuf, sizeof(szBuf));
+	if (*szBuf != '\0') {
+		*xmin = strtod(szBuf, &aptr);
+		*xmax = strtod(aptr, NULL);
+	}
+	return;
+}
+
+static void read_int(INIFILE *ini, char *key, int *value) {
+	char szBuf[256];
+
+	IniFile_GetString(ini, "Fit", key, "", szBuf, sizeof(szBuf));
+	if (*szBuf != '\0') *value = strtol(szBuf, NULL, 10);
+	return;
+}
@@ -0,0 +1,122 @@
+#ifndef _RECIPE_H_LOADED
+#define _RECIPE_H_LOADED
+
+/* ===========================================================================
+-- Film recipe from FilmMeasure.ini for the offline tools.
+--
+-- Reads the [Film] stack (Layer_N_Material, _Thickness, _Vary, _Limits and
+-- Substrate) and the [Fit] options the same way FilmMeasure does, with the
+-- same defaults, and turns them into a TFOC sample stack plus a
+-- FILMFIT_PARMS template.  Materials are taken from the compiled database
+-- when it has them, otherwise from the TFOC text database.  The ini file is
+-- read with inifile.c, so nothing here needs Win32.
+--
+-- Requires tfoc.h and filmfit.h to be included first.
+=========================================================================== */
+
+#define	RECIPE_MAX_FILM	(5)				/* Film layers on the FilmMeasure dialog */
+#define	RECIPE_PATH_LENGTH	(1024)
+#define	RECIPE_NAME_LENGTH	(64)
+
+/* A stack as the ini file (and a saved spectrum) describes it */
+typedef struct _RECIPE_FILM {
+	struct {
+		char material[RECIPE_NAME_LENGTH];	/* "" or "none" for an empty slot			*/
+		double nm;									/* Thickness										*/
+		double lower, upper;						/* Fit limits										*/
+		int vary;
+	} layer[RECIPE_MAX_FILM];
+	char substrate[RECIPE_NAME_LENGTH];
+	int mirror;										/* [Reference] Mirror -- stack not used	*/
+} RECIPE_FILM;
+
+typedef struct _RECIPE {
+	TFOC_SAMPLE sample[RECIPE_MAX_FILM+3];	/* Incident medium, film layers, substrate, EOS */
+	int nlayers;									/* Entries of sample[] before the EOS		*/
+	int tfoc_needed;								/* Some material is not in the compiled db	*/
+	FILMFIT_PARMS parms;							/* Fit range, varied layers and options		*/
+	char speclib[RECIPE_PATH_LENGTH];		/* [Fit] Spectral_Library (may be empty)	*/
+	int threads;									/* [Fit] Threads (0 = all processors)		*/
+} RECIPE;
+
+/* ===========================================================================
+-- Read a recipe
+--
+-- Usage: int Recipe_Read(char *inifile, char *database, MATDB *db, RECIPE *recipe);
+--
+-- Inputs: inifile  - FilmMeasure.ini style file
+--         database - directory of the TFOC text database
+--         db       - compiled database (NULL to use TFOC only)
+--         recipe   - structure to fill
+--
+-- Output: recipe->sample  - EOS terminated stack, thicknesses from the file
+--         recipe->parms   - sample, lambda_min/max, scaling_min/max, nvary,
+--                           layer[], lower[], upper[], name[] and the fit
+--                           options; the spectrum fields are left zero
+--
+-- Return: 0 if successful
+--         1 if a material cannot be found (reported on stderr)
+--         2 if no layer is marked to vary
+--
+-- Notes: recipe->parms.sample and name[] point into the recipe itself, so
+--        a copy of the structure must repoint them.  Limits with upper <
+--        lower become lower to 2*lower (0 to 100 nm for a lower of 0).
+=========================================================================== */
+int Recipe_Read(char *inifile, char *database, MATDB *db, RECIPE *recipe);
+
+/* ===========================================================================
+-- Read only the fit options
+--
+-- Usage: int Recipe_Options(char *inifile, RECIPE *recipe);
+--
+-- Inputs: inifile - FilmMeasure.ini style file (NULL for the defaults)
+--         recipe  - structure to update
+--
+-- Output: recipe->parms options, recipe->speclib and recipe->threads; the
+--         stack and the varied layers are not touched
+--
+-- Notes: These are the defaults and [Fit] keys of FilmMeasure itself, which
+--        fills its fit controls from here
+--
+-- Return: 0
+=========================================================================== */
+int Recipe_Options(char *inifile, RECIPE *recipe);
+
+/* ===========================================================================
+-- Read the description of a stack
+--
+-- Usage: int Recipe_ReadFilm(char *inifile, char *section, RECIPE_FILM *film);
+--
+-- Inputs: inifile - FilmMeasure.ini style file
+--         section - "Film" for the sample, "Reference" for the reference
+--         film    - structure to fill
+--
+-- Return: 0 (missing keys take the FilmMeasure defaults)
+=========================================================================== */
+int Recipe_ReadFilm(char *inifile, char *section, RECIPE_FILM *film);
+
+/* ===========================================================================
+-- Build stacks from a description
+--
+-- Usage: int Recipe_SetFilm(RECIPE *recipe, RECIPE_FILM *film, char *database, MATDB *db);
+--        int Recipe_Stack(RECIPE_FILM *film, char *database, MATDB *db, TFOC_SAMPLE *sample, int *tfoc_needed);
+--
+-- Inputs: film     - stack description
+--         database - directory of the TFOC text database
+--         db       - compiled database (NULL to use TFOC only)
+--         sample   - [RECIPE_MAX_FILM+3] array to receive the stack
+--
+-- Output: Recipe_SetFilm replaces the stack and varied layers of a recipe
+--         and keeps its fit options.  Recipe_Stack sets *tfoc_needed TRUE
+--         if some material had to come from TFOC (unchanged otherwise).
+--
+-- Return: Recipe_SetFilm returns as Recipe_Read().  Recipe_Stack returns
+--         the number of entries before the EOS, or -1 if a material cannot
+--         be found (reported on stderr).
+--
+-- Notes: Limits are adjusted as for Recipe_Read()
+=========================================================================== */
+int Recipe_SetFilm(RECIPE *recipe, RECIPE_FILM *film, char *database, MATDB *db);
+int Recipe_Stack(RECIPE_FILM *film, char *database, MATDB *db, TFOC_SAMPLE *sample, int *tfoc_needed);
+
+#endif		/* _RECIPE_H_LOADED */
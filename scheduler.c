@@ -0,0 +1,315 @@
+/* scheduler.c - Fixed-rate calls on a dedicated thread, with a choice of overrun policy */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+	#define STRICT						/* define before including windows.h for stricter type checking */
+	#include <windows.h>				/* master include file for Windows applications */
+	#undef _POSIX_
+		#include <process.h>			/* for process control fuctions (e.g. threads, programs) */
+	#define _POSIX_
+#elif __linux__
+	#include <pthread.h>
+	#include <sched.h>
+#else
+	#error "Unsupported OS"
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tpool.h"							/* TPool_Timer() */
+#include "scheduler.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+/* Condition waits end early by this much and the rest is spent yielding.
+ * Windows sleeps in whole milliseconds (with timeBeginPeriod(1), else in
+ * 15.6 ms steps), which is not close enough at 50 Hz */
+#ifdef _WIN32
+	#define	SCHED_SPIN	(0.002)
+#else
+	#define	SCHED_SPIN	(0.0)
+#endif
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION	SC_MUTEX;
+	typedef CONDITION_VARIABLE	SC_COND;
+	typedef HANDLE					SC_THREAD;
+	#define	SC_THREAD_FNC		static unsigned __stdcall
+	#define	SC_MUTEX_INIT(m)	(InitializeCriticalSection(m), 0)
+	#define	SC_MUTEX_FREE(m)	DeleteCriticalSection(m)
+	#define	SC_LOCK(m)			EnterCriticalSection(m)
+	#define	SC_UNLOCK(m)		LeaveCriticalSection(m)
+	#define	SC_COND_FREE(c)
+	#define	SC_BROADCAST(c)	WakeAllConditionVariable(c)
+	#define	SC_YIELD()			SwitchToThread()
+#else
+	typedef pthread_mutex_t		SC_MUTEX;
+	typedef pthread_cond_t		SC_COND;
+	typedef pthread_t				SC_THREAD;
+	#define	SC_THREAD_FNC		static void *
+	#define	SC_MUTEX_INIT(m)	pthread_mutex_init((m), NULL)
+	#define	SC_MUTEX_FREE(m)	pthread_mutex_destroy(m)
+	#define	SC_LOCK(m)			pthread_mutex_lock(m)
+	#define	SC_UNLOCK(m)		pthread_mutex_unlock(m)
+	#define	SC_COND_FREE(c)	pthread_cond_destroy(c)
+	#define	SC_BROADCAST(c)	pthread_cond_broadcast(c)
+	#define	SC_YIELD()			sched_yield()
+#endif
+
+struct _SCHEDULER {
+	SCHED_TICK *tick;
+	void *arg;
+	int overrun;
+	SC_THREAD thread;
+	int joined;
+
+	SC_MUTEX mutex;							/* Everything below */
+	SC_COND changed;							/* Stop or new period */
+	double period;
+	int reset;									/* Period changed since the last call */
+	int stop;
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+SC_THREAD_FNC sched_thread(void *parm);
+static int cond_init(SC_COND *cond);
+static void timed_wait(SCHEDULER *sched, double dt);
+
+/* ===========================================================================
+-- Start, stop and release
+=========================================================================== */
+SCHEDULER *Sched_Start(double period, int overrun, SCHED_TICK *tick, void *arg) {
+	static char *rname = "Sched_Start";
+	SCHEDULER *sched;
+	int ok;
+
+	if (tick == NULL) return NULL;
+	if (overrun != SCHED_SKIP && overrun != SCHED_QUEUE && overrun != SCHED_COALESCE) overrun = SCHED_SKIP;
+
+	if ( (sched = calloc(1, sizeof(*sched))) == NULL) return NULL;
+	sched->tick    = tick;
+	sched->arg     = arg;
+	sched->overrun = overrun;
+	sched->period  = (period > 0) ? period : 0.0;
+	if (SC_MUTEX_INIT(&sched->mutex) != 0 || cond_init(&sched->changed) != 0) {
+		fprintf(stderr, "ERROR: %s: unable to create synchronization objects\n", rname); fflush(stderr);
+		free(sched);
+		return NULL;
+	}
+
+#ifdef _WIN32
+	sched->thread = (HANDLE) _beginthreadex(NULL, 0, sched_thread, sched, 0, NULL);
+	ok = (sched->thread != 0);
+	if (ok) SetThreadPriority(sched->thread, THREAD_PRIORITY_ABOVE_NORMAL);	/* Wake-ups stay on time under fit load */
+#else
+	ok = (pthread_create(&sched->thread, NULL, sched_thread, sched) == 0);
+#endif
+	if (! ok) {
+		fprintf(stderr, "ERROR: %s: unable to start the scheduler thread\n", rname); fflush(stderr);
+		sched->joined = TRUE;
+		Sched_Free(sched);
+		return NULL;
+	}
+	return sched;
+}
+
+int Sched_Stop(SCHEDULER *sched) {
+
+	if (sched == NULL || sched->joined) return 0;
+
+	SC_LOCK(&sched->mutex);
+	sched->stop = TRUE;
+	SC_BROADCAST(&sched->changed);
+	SC_UNLOCK(&sched->mutex);
+
+#ifdef _WIN32
+	WaitForSingleObject(sched->thread, INFINITE);
+	CloseHandle(sched->thread);
+#else
+	pthread_join(sched->thread, NULL);
+#endif
+	sched->joined = TRUE;
+	return 0;
+}
+
+void Sched_Free(SCHEDULER *sched) {
+
+	if (sched == NULL) return;
+	Sched_Stop(sched);
+	SC_COND_FREE(&sched->changed);
+	SC_MUTEX_FREE(&sched->mutex);
+	free(sched);
+	return;
+}
+
+/* ===========================================================================
+-- Change the period
+=========================================================================== */
+int Sched_SetPeriod(SCHEDULER *sched, double period) {
+
+	if (sched == NULL) return 1;
+	SC_LOCK(&sched->mutex);
+	sched->period = (period > 0) ? period : 0.0;
+	sched->reset  = TRUE;
+	SC_BROADCAST(&sched->changed);
+	SC_UNLOCK(&sched->mutex);
+	return 0;
+}
+
+/* ===========================================================================
+-- Wall clock with a fraction of a second
+=========================================================================== */
+double Sched_Clock(void) {
+#ifdef _WIN32
+	FILETIME ft;
+	ULARGE_INTEGER t;
+
+	GetSystemTimePreciseAsFileTime(&ft);				/* 100 ns units since 1601 */
+	t.LowPart  = ft.dwLowDateTime;
+	t.HighPart = ft.dwHighDateTime;
+	return (t.QuadPart - 116444736000000000ULL) * 1E-7;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + 1E-9*ts.tv_nsec;
+#endif
+}
+
+/* ===========================================================================
+-- Thread body
+--
+-- Waits for each deadline on the condition (so a stop or new period wakes
+-- it at once), makes the call, and then places the next deadline by the
+-- overrun policy.  Deadline k is start + k*period in TPool_Timer() time;
+-- only a change of period moves the origin.
+=========================================================================== */
+SC_THREAD_FNC sched_thread(void *parm) {
+	SCHEDULER *sched = (SCHEDULER *) parm;
+	double wall0, t0, now, next, last, period, dt;
+	long n, due, ndrop;
+	int rc;
+
+#ifdef _WIN32
+	timeBeginPeriod(1);
+#endif
+	wall0 = Sched_Clock();
+	t0 = now = next = last = TPool_Timer();
+	n = 0;
+
+	while (TRUE) {
+		SC_LOCK(&sched->mutex);
+		while (! sched->stop) {
+			if (sched->reset) {										/* New period counts from the last call */
+				sched->reset = FALSE;
+				next = last + sched->period;
+			}
+			now = TPool_Timer();
+			if (now >= next) break;
+			dt = next-now-SCHED_SPIN;
+			if (dt > 0) {
+				timed_wait(sched, dt);
+			} else {
+				SC_UNLOCK(&sched->mutex);
+				SC_YIELD();
+				SC_LOCK(&sched->mutex);
+			}
+		}
+		if (sched->stop) { SC_UNLOCK(&sched->mutex); break; }
+		period = sched->period;
+		SC_UNLOCK(&sched->mutex);
+
+		last = now;
+		rc = sched->tick(sched->arg, n, wall0 + (now-t0));
+		now = TPool_Timer();
+
+		/* Deadlines that passed during the call (the next one included) */
+		n++;
+		ndrop = 0;
+		if (period <= 0) {
+			next = now;
+		} else {
+			next += period;
+			if (now >= next) {
+				due = (long) ((now-next)/period) + 1;
+				if (sched->overrun == SCHED_SKIP) {
+					ndrop = due;
+				} else if (sched->overrun == SCHED_COALESCE) {
+					ndrop = due-1;									/* The latest one is made now */
+				} else if (due > SCHED_MAX_BACKLOG) {
+					ndrop = due-SCHED_MAX_BACKLOG;				/* Oldest beyond the backlog */
+				}
+				next += ndrop*period;
+				n    += ndrop;
+			}
+		}
+
+		if (rc != 0) break;
+	}
+
+#ifdef _WIN32
+	timeEndPeriod(1);
+#endif
+	return 0;
+}
+
+/* ===========================================================================
+-- Condition on the monotonic clock, and a wait of up to dt seconds on it
+--
+-- Notes: timed_wait() is called with the mutex held and returns with it
+--        held; it may return early
+=========================================================================== */
+static int cond_init(SC_COND *cond) {
+#ifdef _WIN32
+	InitializeConditionVariable(cond);
+	return 0;
+#else
+	pthread_condattr_t attr;
+	int rc;
+
+	if (pthread_condattr_init(&attr) != 0) return 1;
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);				/* Same clock as TPool_Timer() */
+	rc = pthread_cond_init(cond, &attr);
+	pthread_condattr_destroy(&attr);
+	return rc;
+#endif
+}
+
+static void timed_wait(SCHEDULER *sched, double dt) {
+#ifdef _WIN32
+	SleepConditionVariableCS(&sched->changed, &sched->mutex, (DWORD) (1000*dt));
+#else
+	struct timespec ts;
+	long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns = ts.tv_nsec + (long) (1E9*(dt-(long) dt));
+	ts.tv_sec += (time_t) dt + ns/1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	pthread_cond_timedwait(&sched->changed, &sched->mutex, &ts);
+#endif
+	return;
+}
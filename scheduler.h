@@ -0,0 +1,83 @@
+#ifndef _SCHEDULER_H_LOADED
+#define _SCHEDULER_H_LOADED
+
+/* ===========================================================================
+-- Fixed-rate scheduler on a dedicated thread.
+--
+-- The thread calls tick(arg, n, when) at start + n*period.  Deadlines are
+-- absolute, so the rate does not drift when a call or a wake-up is late,
+-- and nothing on the thread depends on a message loop.  With a period of
+-- zero the calls follow each other as fast as the work allows.
+--
+-- A call that runs past one or more deadlines is an overrun.  What happens
+-- to the deadlines that passed meanwhile is set by the overrun policy:
+--    SCHED_SKIP     - drop them; the next call is at the next deadline
+--    SCHED_QUEUE    - make every one of them, back to back, until caught
+--                     up (at most SCHED_MAX_BACKLOG; older ones are dropped)
+--    SCHED_COALESCE - make one call for all of them at once
+-- Either way the schedule keeps its original phase.
+--
+-- The time passed to each call is the wall clock (seconds since 1970, see
+-- Sched_Clock) taken just before the call, advanced with the monotonic
+-- timer so it never steps backwards during a run.
+=========================================================================== */
+
+typedef struct _SCHEDULER SCHEDULER;			/* Opaque */
+
+#define	SCHED_SKIP				(0)			/* Overrun policies */
+#define	SCHED_QUEUE				(1)
+#define	SCHED_COALESCE			(2)
+
+#define	SCHED_MAX_BACKLOG		(100)			/* Deadlines kept by SCHED_QUEUE */
+
+/* Work for one deadline.  n counts deadlines from 0 (it skips those that
+ * were dropped), when is the wall clock.  Return 0 to continue, !0 to end
+ * the schedule */
+typedef int SCHED_TICK(void *arg, long n, double when);
+
+/* ===========================================================================
+-- Start or stop a schedule
+--
+-- Usage: SCHEDULER *Sched_Start(double period, int overrun, SCHED_TICK *tick, void *arg);
+--        int Sched_Stop(SCHEDULER *sched);
+--        void Sched_Free(SCHEDULER *sched);
+--
+-- Inputs: period  - seconds between calls (<= 0 for as fast as possible)
+--         overrun - SCHED_SKIP, SCHED_QUEUE or SCHED_COALESCE
+--         tick    - called as tick(arg, n, when); the first call is at once
+--         arg     - passed unchanged to tick
+--
+-- Return: Sched_Start returns NULL if the thread cannot be started (message
+--         on stderr).  Sched_Stop returns 0.
+--
+-- Notes: Sched_Stop() lets a call in progress complete and joins the
+--        thread; no further calls are made.  Sched_Free() stops the
+--        schedule if needed and releases it.
+=========================================================================== */
+SCHEDULER *Sched_Start(double period, int overrun, SCHED_TICK *tick, void *arg);
+int Sched_Stop(SCHEDULER *sched);
+void Sched_Free(SCHEDULER *sched);
+
+/* ===========================================================================
+-- Change the rate of a running schedule
+--
+-- Usage: int Sched_SetPeriod(SCHEDULER *sched, double period);
+--
+-- Inputs: period - seconds between calls (<= 0 for as fast as possible)
+--
+-- Return: 0 if successful, 1 if sched is NULL
+--
+-- Notes: The new schedule starts one period after the last call
+=========================================================================== */
+int Sched_SetPeriod(SCHEDULER *sched, double period);
+
+/* ===========================================================================
+-- Wall clock with sub-second resolution
+--
+-- Usage: double Sched_Clock(void);
+--
+-- Return: Seconds since 1970-01-01 UTC, as time() but with a fraction
+=========================================================================== */
+double Sched_Clock(void);
+
+#endif		/* _SCHEDULER_H_LOADED */
@@ -0,0 +1,681 @@
+/* speclib.c - Precomputed, PCA compressed spectral library with k-d tree lookup */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+#ifdef __linux__
+	#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef _WIN32
+	#define STRICT						/* define before including windows.h for stricter type checking */
+	#include <windows.h>				/* master include file for Windows applications */
+#elif __linux__
+	#include <sys/types.h>
+	#include <sys/stat.h>
+	#include <sys/mman.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#else
+	#error "Unsupported OS"
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "speclib.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	PCA_SAMPLE		(4096)					/* Grid points used to find the components */
+#define	PCA_RESIDUAL	(1E-6)					/* Relative variance left out when ncomp = 0 */
+
+struct _SPECLIB {
+	char *base;									/* Start of mapped file					*/
+	size_t size;								/* Size of mapping						*/
+	SPECLIB_HEADER *hdr;
+	double *lambda, *mean, *comp;
+	float *coef, *norm;
+	uint32_t *perm;
+	uint8_t *split;
+};
+
+/* Nearest neighbour search state */
+typedef struct _KD_SEARCH {
+	SPECLIB *lib;
+	double q[SPECLIB_MAX_COMP];				/* Query coefficients					*/
+	double best;								/* Squared distance of best so far	*/
+	uint32_t ibest;							/* Entry of best so far					*/
+} KD_SEARCH;
+
+/* Working data while building the k-d tree */
+typedef struct _KD_BUILD {
+	float *coef;
+	int ncomp;
+	uint32_t *perm;
+	uint8_t *split;
+} KD_BUILD;
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int fold_cmp(const char *a, const char *b);
+static int validate(SPECLIB *lib);
+static void grid_point(SPECLIB_HEADER *hdr, uint32_t e, double *z);
+static void kd_search(KD_SEARCH *s, uint32_t lo, uint32_t hi);
+static void kd_build(KD_BUILD *b, uint32_t lo, uint32_t hi);
+static void kd_select(KD_BUILD *b, uint32_t lo, uint32_t hi, uint32_t k, int dim);
+static int jacobi_eigen(int n, double *a, double *eval, double *evec);
+static int normalize(int n, double *r, double *pnorm);
+
+/* ===========================================================================
+-- Case-folded comparison of two names (ASCII only, locale independent)
+=========================================================================== */
+static int fold_cmp(const char *a, const char *b) {
+	int ca, cb;
+
+	do {
+		ca = tolower((unsigned char) *a++);
+		cb = tolower((unsigned char) *b++);
+	} while (ca == cb && ca != '\0');
+	return ca - cb;
+}
+
+/* ===========================================================================
+-- Open (map) or close a library
+--
+-- Usage: SPECLIB *SpecLib_Open(char *path);
+--        void SpecLib_Close(SPECLIB *lib);
+--
+-- Inputs: path - library file from SpecLib_Build()
+--
+-- Return: SpecLib_Open returns NULL if the file is missing or not valid
+=========================================================================== */
+SPECLIB *SpecLib_Open(char *path) {
+	static char *rname = "SpecLib_Open";
+	SPECLIB *lib;
+
+#ifdef _WIN32
+	HANDLE hfile, hmap;
+	LARGE_INTEGER size;
+#else
+	int fd;
+	struct stat info;
+	void *map;
+#endif
+
+	if (path == NULL) return NULL;
+	if ( (lib = calloc(1, sizeof(*lib))) == NULL) return NULL;
+
+#ifdef _WIN32
+	hfile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hfile == INVALID_HANDLE_VALUE) { free(lib); return NULL; }
+	if (! GetFileSizeEx(hfile, &size) || size.QuadPart < (LONGLONG) sizeof(SPECLIB_HEADER)) {
+		CloseHandle(hfile); free(lib); return NULL;
+	}
+	hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(hfile);
+	if (hmap == NULL) { free(lib); return NULL; }
+	lib->base = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(hmap);													/* View keeps the mapping alive */
+	if (lib->base == NULL) { free(lib); return NULL; }
+	lib->size = (size_t) size.QuadPart;
+#else
+	if ( (fd = open(path, O_RDONLY)) < 0) { free(lib); return NULL; }
+	if (fstat(fd, &info) != 0 || info.st_size < (off_t) sizeof(SPECLIB_HEADER)) {
+		close(fd); free(lib); return NULL;
+	}
+	map = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);																/* Mapping stays valid */
+	if (map == MAP_FAILED) { free(lib); return NULL; }
+	lib->base = map;
+	lib->size = (size_t) info.st_size;
+#endif
+
+	if (validate(lib) != 0) {
+		fprintf(stderr, "ERROR: %s: \"%s\" is not a valid spectral library (version %d expected)\n", rname, path, SPECLIB_VERSION); fflush(stderr);
+		SpecLib_Close(lib);
+		return NULL;
+	}
+	return lib;
+}
+
+void SpecLib_Close(SPECLIB *lib) {
+	if (lib == NULL) return;
+	if (lib->base != NULL) {
+#ifdef _WIN32
+		UnmapViewOfFile(lib->base);
+#else
+		munmap(lib->base, lib->size);
+#endif
+	}
+	free(lib);
+	return;
+}
+
+/* ===========================================================================
+-- Check the header and block offsets against the mapped size so lookups
+-- never need to range check
+--
+-- Return: 0 if valid, 1 otherwise
+=========================================================================== */
+static int validate(SPECLIB *lib) {
+	SPECLIB_HEADER *hdr;
+	uint64_t n, size;
+	uint32_t i;
+	int v;
+
+	hdr  = (SPECLIB_HEADER *) lib->base;
+	size = lib->size;
+	if (memcmp(hdr->magic, SPECLIB_MAGIC, sizeof(hdr->magic)) != 0) return 1;
+	if (hdr->version != SPECLIB_VERSION || hdr->header_size != sizeof(SPECLIB_HEADER)) return 1;
+	if (hdr->file_size != size) return 1;
+	if (hdr->nwave < 2 || hdr->nwave > SPECLIB_MAX_WAVE) return 1;
+	if (hdr->ncomp < 1 || hdr->ncomp > SPECLIB_MAX_COMP || hdr->ncomp > hdr->nwave) return 1;
+	if (hdr->nvary < 1 || hdr->nvary > SPECLIB_MAX_VARS) return 1;
+	if (hdr->nlayers < 2 || hdr->nlayers > SPECLIB_MAX_LAYERS) return 1;
+	if (hdr->nentry < 1 || hdr->nentry > SPECLIB_MAX_ENTRY) return 1;
+	for (n=1,v=0; v<(int) hdr->nvary; v++) {
+		if (hdr->nstep[v] < 1 || hdr->layer[v] >= hdr->nlayers) return 1;
+		n *= hdr->nstep[v];
+	}
+	if (n != hdr->nentry) return 1;
+	for (i=0; i<hdr->nlayers; i++) if (memchr(hdr->name[i], '\0', SPECLIB_NAME_LENGTH) == NULL) return 1;
+
+#define	BLOCK_OK(offset, bytes)	((offset) % 8 == 0 && (offset) <= size && (bytes) <= size - (offset))
+	if (! BLOCK_OK(hdr->lambda_offset, hdr->nwave*sizeof(double))) return 1;
+	if (! BLOCK_OK(hdr->mean_offset,   hdr->nwave*sizeof(double))) return 1;
+	if (! BLOCK_OK(hdr->comp_offset,   (uint64_t) hdr->ncomp*hdr->nwave*sizeof(double))) return 1;
+	if (! BLOCK_OK(hdr->coef_offset,   (uint64_t) hdr->nentry*hdr->ncomp*sizeof(float))) return 1;
+	if (! BLOCK_OK(hdr->norm_offset,   (uint64_t) hdr->nentry*sizeof(float))) return 1;
+	if (! BLOCK_OK(hdr->perm_offset,   (uint64_t) hdr->nentry*sizeof(uint32_t))) return 1;
+	if (! BLOCK_OK(hdr->split_offset,  (uint64_t) hdr->nentry*sizeof(uint8_t))) return 1;
+#undef	BLOCK_OK
+
+	lib->hdr    = hdr;
+	lib->lambda = (double *)   (lib->base + hdr->lambda_offset);
+	lib->mean   = (double *)   (lib->base + hdr->mean_offset);
+	lib->comp   = (double *)   (lib->base + hdr->comp_offset);
+	lib->coef   = (float *)    (lib->base + hdr->coef_offset);
+	lib->norm   = (float *)    (lib->base + hdr->norm_offset);
+	lib->perm   = (uint32_t *) (lib->base + hdr->perm_offset);
+	lib->split  = (uint8_t *)  (lib->base + hdr->split_offset);
+
+	/* Tree must be a permutation with valid split coefficients */
+	for (i=0; i<hdr->nentry; i++) {
+		if (lib->perm[i] >= hdr->nentry || lib->split[i] >= hdr->ncomp) return 1;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Thicknesses of grid point e
+=========================================================================== */
+static void grid_point(SPECLIB_HEADER *hdr, uint32_t e, double *z) {
+	uint32_t v;
+
+	for (v=0; v<hdr->nvary; v++) {
+		z[v] = hdr->lower[v] + (e % hdr->nstep[v]) * hdr->step[v];
+		e /= hdr->nstep[v];
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Determine whether a library was built for a recipe
+--
+-- Usage: int SpecLib_Matches(SPECLIB *lib, SPECLIB_RECIPE *recipe);
+--
+-- Return: TRUE if materials, fixed sublayer thicknesses and varied layers agree
+=========================================================================== */
+int SpecLib_Matches(SPECLIB *lib, SPECLIB_RECIPE *recipe) {
+	SPECLIB_HEADER *hdr;
+	int i, v, varied;
+
+	if (lib == NULL || recipe == NULL) return FALSE;
+	hdr = lib->hdr;
+	if (recipe->nlayers != (int) hdr->nlayers || recipe->nvary != (int) hdr->nvary) return FALSE;
+	for (v=0; v<recipe->nvary; v++) if (recipe->layer[v] != (int) hdr->layer[v]) return FALSE;
+	for (i=0; i<recipe->nlayers; i++) {
+		if (fold_cmp(recipe->name[i], hdr->name[i]) != 0) return FALSE;
+		if (i == 0 || i == recipe->nlayers-1) continue;			/* Incident and substrate -- no thickness */
+		for (varied=FALSE,v=0; v<recipe->nvary; v++) if (recipe->layer[v] == i) varied = TRUE;
+		if (! varied && fabs(recipe->z[i] - hdr->z[i]) > 1E-3) return FALSE;
+	}
+	return TRUE;
+}
+
+/* ===========================================================================
+-- Scale a vector to unit length
+--
+-- Return: 0 if successful, 1 if the vector is zero
+=========================================================================== */
+static int normalize(int n, double *r, double *pnorm) {
+	int i;
+	double sum;
+
+	for (sum=0,i=0; i<n; i++) sum += r[i]*r[i];
+	if (sum <= 0) return 1;
+	sum = sqrt(sum);
+	for (i=0; i<n; i++) r[i] /= sum;
+	if (pnorm != NULL) *pnorm = sum;
+	return 0;
+}
+
+/* ===========================================================================
+-- Nearest neighbour in the implicit k-d tree over perm[lo..hi)
+=========================================================================== */
+static void kd_search(KD_SEARCH *s, uint32_t lo, uint32_t hi) {
+	uint32_t mid, e, ncomp;
+	int c;
+	float *coef;
+	double d, diff;
+
+	while (lo < hi) {
+		mid   = lo + (hi-lo)/2;
+		e     = s->lib->perm[mid];
+		ncomp = s->lib->hdr->ncomp;
+		coef  = s->lib->coef + (size_t) e*ncomp;
+
+		for (d=0,c=0; c<(int) ncomp && d < s->best; c++) d += (s->q[c]-coef[c])*(s->q[c]-coef[c]);
+		if (d < s->best) { s->best = d; s->ibest = e; }
+
+		diff = s->q[s->lib->split[mid]] - coef[s->lib->split[mid]];
+		if (diff < 0) {											/* Near side first, far side only if it can be closer */
+			kd_search(s, lo, mid);
+			if (diff*diff >= s->best) return;
+			lo = mid+1;
+		} else {
+			kd_search(s, mid+1, hi);
+			if (diff*diff >= s->best) return;
+			hi = mid;
+		}
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Find the library spectrum closest to a measured spectrum
+--
+-- Usage: int SpecLib_Lookup(SPECLIB *lib, int npt, double *lambda, double *refl, double *z, double *scaling);
+--
+-- Inputs: lib     - open library
+--         npt     - number of points in the measurement
+--         lambda  - [npt] wavelengths (nm), monotonic
+--         refl    - [npt] measured reflectance
+--         z       - [nvary] array to receive the varied thicknesses
+--         scaling - pointer to receive the scaling (model/measured)
+--
+-- Return: 0 if successful, 1 on invalid parameters, 2 if the measurement
+--         does not cover the library wavelengths
+=========================================================================== */
+int SpecLib_Lookup(SPECLIB *lib, int npt, double *lambda, double *refl, double *z, double *scaling) {
+	SPECLIB_HEADER *hdr;
+	KD_SEARCH search;
+	double u[SPECLIB_MAX_WAVE], norm, x, f, sum;
+	int i, j, c, nwave, lo, hi, mid, ascending;
+
+	if (lib == NULL || npt < 2 || lambda == NULL || refl == NULL || z == NULL) return 1;
+	hdr = lib->hdr;
+	nwave = hdr->nwave;
+
+	ascending = lambda[npt-1] > lambda[0];
+	if (ascending) {
+		if (lambda[0] > hdr->lambda_min || lambda[npt-1] < hdr->lambda_max) return 2;
+	} else {
+		if (lambda[npt-1] > hdr->lambda_min || lambda[0] < hdr->lambda_max) return 2;
+	}
+
+	/* Interpolate the measurement onto the library wavelengths */
+	for (i=0; i<nwave; i++) {
+		x = lib->lambda[i];
+		lo = 0; hi = npt-1;
+		while (hi-lo > 1) {											/* Bracket x in either order */
+			mid = (lo+hi)/2;
+			if ((lambda[mid] <= x) == ascending) lo = mid; else hi = mid;
+		}
+		f = (lambda[hi] != lambda[lo]) ? (x-lambda[lo])/(lambda[hi]-lambda[lo]) : 0.0;
+		u[i] = refl[lo] + f*(refl[hi]-refl[lo]);
+	}
+	if (normalize(nwave, u, &norm) != 0) return 1;
+
+	/* Project onto the components */
+	memset(&search, 0, sizeof(search));
+	search.lib = lib;
+	for (c=0; c<(int) hdr->ncomp; c++) {
+		for (sum=0,j=0; j<nwave; j++) sum += lib->comp[c*nwave+j] * (u[j]-lib->mean[j]);
+		search.q[c] = sum;
+	}
+	search.best  = HUGE_VAL;
+	search.ibest = 0;
+	kd_search(&search, 0, hdr->nentry);
+
+	grid_point(hdr, search.ibest, z);
+	if (scaling != NULL) *scaling = lib->norm[search.ibest] / norm;
+	return 0;
+}
+
+/* ===========================================================================
+-- Partition perm[lo..hi) so perm[k] holds the median on coefficient dim
+-- (quickselect; elements before k are <=, after are >=)
+=========================================================================== */
+static void kd_select(KD_BUILD *b, uint32_t lo, uint32_t hi, uint32_t k, int dim) {
+	uint32_t i, j, t;
+	float pivot;
+
+	hi--;																	/* Inclusive from here */
+	while (lo < hi) {
+		pivot = b->coef[(size_t) b->perm[lo + (hi-lo)/2]*b->ncomp + dim];
+		i = lo; j = hi;
+		while (i <= j) {
+			while (b->coef[(size_t) b->perm[i]*b->ncomp + dim] < pivot) i++;
+			while (b->coef[(size_t) b->perm[j]*b->ncomp + dim] > pivot) j--;
+			if (i <= j) {
+				t = b->perm[i]; b->perm[i] = b->perm[j]; b->perm[j] = t;
+				i++;
+				if (j == 0) break;
+				j--;
+			}
+		}
+		if (k <= j) {
+			hi = j;
+		} else if (k >= i) {
+			lo = i;
+		} else {
+			break;
+		}
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Build the implicit balanced k-d tree over perm[lo..hi).  The node for a
+-- range is its middle element, split on the coefficient of widest spread.
+=========================================================================== */
+static void kd_build(KD_BUILD *b, uint32_t lo, uint32_t hi) {
+	uint32_t i, mid;
+	int c, dim;
+	float v, vmin[SPECLIB_MAX_COMP], vmax[SPECLIB_MAX_COMP];
+
+	while (hi-lo > 1) {
+		for (c=0; c<b->ncomp; c++) { vmin[c] = HUGE_VAL; vmax[c] = -HUGE_VAL; }
+		for (i=lo; i<hi; i++) {
+			for (c=0; c<b->ncomp; c++) {
+				v = b->coef[(size_t) b->perm[i]*b->ncomp + c];
+				if (v < vmin[c]) vmin[c] = v;
+				if (v > vmax[c]) vmax[c] = v;
+			}
+		}
+		for (dim=0,c=1; c<b->ncomp; c++) if (vmax[c]-vmin[c] > vmax[dim]-vmin[dim]) dim = c;
+
+		mid = lo + (hi-lo)/2;
+		kd_select(b, lo, hi, mid, dim);
+		b->split[mid] = (uint8_t) dim;
+		kd_build(b, lo, mid);
+		lo = mid+1;
+	}
+	if (hi-lo == 1) b->split[lo] = 0;
+	return;
+}
+
+/* ===========================================================================
+-- Eigenvalues and vectors of a symmetric matrix (cyclic Jacobi)
+--
+-- Usage: int jacobi_eigen(int n, double *a, double *eval, double *evec);
+--
+-- Inputs: n    - order
+--         a    - [n][n] symmetric matrix (destroyed)
+--         eval - [n] to receive eigenvalues, descending
+--         evec - [n][n] to receive eigenvectors as rows, same order
+--
+-- Return: 0 if successful, 1 on memory failure
+=========================================================================== */
+static int jacobi_eigen(int n, double *a, double *eval, double *evec) {
+	int i, j, k, p, q, sweep, *order;
+	double off, theta, t, c, s, apq, aip, aiq, vip, viq, *tmp;
+
+	for (i=0; i<n; i++) for (j=0; j<n; j++) evec[i*n+j] = (i == j) ? 1.0 : 0.0;
+
+	for (sweep=0; sweep<100; sweep++) {
+		for (off=0,p=0; p<n; p++) for (q=p+1; q<n; q++) off += a[p*n+q]*a[p*n+q];
+		for (t=0,p=0; p<n; p++) t += a[p*n+p]*a[p*n+p];
+		if (off <= 1E-30*t) break;
+
+		for (p=0; p<n; p++) {
+			for (q=p+1; q<n; q++) {
+				apq = a[p*n+q];
+				if (fabs(apq) < 1E-300) continue;
+				theta = (a[q*n+q]-a[p*n+p]) / (2*apq);
+				t = ((theta >= 0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta*theta+1));
+				c = 1/sqrt(t*t+1);
+				s = t*c;
+				for (k=0; k<n; k++) {									/* Columns p,q */
+					aip = a[k*n+p]; aiq = a[k*n+q];
+					a[k*n+p] = c*aip - s*aiq;
+					a[k*n+q] = s*aip + c*aiq;
+				}
+				for (k=0; k<n; k++) {									/* Rows p,q */
+					aip = a[p*n+k]; aiq = a[q*n+k];
+					a[p*n+k] = c*aip - s*aiq;
+					a[q*n+k] = s*aip + c*aiq;
+				}
+				for (k=0; k<n; k++) {									/* Accumulate rotations (rows are vectors) */
+					vip = evec[p*n+k]; viq = evec[q*n+k];
+					evec[p*n+k] = c*vip - s*viq;
+					evec[q*n+k] = s*vip + c*viq;
+				}
+			}
+		}
+	}
+
+	/* Sort descending */
+	if ( (order = malloc(n*sizeof(*order))) == NULL || (tmp = malloc(n*n*sizeof(*tmp))) == NULL) {
+		free(order);
+		return 1;
+	}
+	for (i=0; i<n; i++) order[i] = i;
+	for (i=1; i<n; i++) {
+		for (j=i; j>0 && a[order[j]*n+order[j]] > a[order[j-1]*n+order[j-1]]; j--) {
+			k = order[j]; order[j] = order[j-1]; order[j-1] = k;
+		}
+	}
+	for (i=0; i<n; i++) {
+		eval[i] = a[order[i]*n+order[i]];
+		memcpy(tmp+i*n, evec+order[i]*n, n*sizeof(*tmp));
+	}
+	memcpy(evec, tmp, n*n*sizeof(*tmp));
+	free(tmp); free(order);
+	return 0;
+}
+
+/* ===========================================================================
+-- Build a library file
+--
+-- Usage: int SpecLib_Build(SPECLIB_RECIPE *recipe, double lambda_min, double lambda_max, int nwave, int ncomp,
+--                          SPECLIB_MODEL *model, void *parm, char *outfile, int verbose);
+--
+-- Return: Number of grid points written, or <0 on error
+=========================================================================== */
+int SpecLib_Build(SPECLIB_RECIPE *recipe, double lambda_min, double lambda_max, int nwave, int ncomp,
+						SPECLIB_MODEL *model, void *parm, char *outfile, int verbose) {
+	static char *rname = "SpecLib_Build";
+	SPECLIB_HEADER hdr;
+	KD_BUILD build;
+	double *lambda, *r, *mean, *cov, *eval, *evec, z[SPECLIB_MAX_VARS], norm, total, sum;
+	float *coef, *normv;
+	uint32_t *perm, e;
+	uint8_t *split;
+	uint64_t nentry, offset;
+	int i, j, c, v, rc, nsample, stride;
+	FILE *funit;
+
+	if (recipe == NULL || model == NULL || outfile == NULL) return -1;
+	if (recipe->nvary < 1 || recipe->nvary > SPECLIB_MAX_VARS) return -1;
+	if (recipe->nlayers < 2 || recipe->nlayers > SPECLIB_MAX_LAYERS) return -1;
+	if (nwave < 2 || nwave > SPECLIB_MAX_WAVE || lambda_max <= lambda_min) return -1;
+	if (ncomp < 0 || ncomp > SPECLIB_MAX_COMP || ncomp > nwave) return -1;
+
+	/* Header and grid */
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SPECLIB_MAGIC, sizeof(hdr.magic));
+	hdr.version     = SPECLIB_VERSION;
+	hdr.header_size = sizeof(SPECLIB_HEADER);
+	hdr.nwave       = nwave;
+	hdr.nlayers     = recipe->nlayers;
+	hdr.nvary       = recipe->nvary;
+	hdr.lambda_min  = lambda_min;
+	hdr.lambda_max  = lambda_max;
+	hdr.compiled    = (int64_t) time(NULL);
+	for (i=0; i<recipe->nlayers; i++) {
+		strncpy(hdr.name[i], recipe->name[i], SPECLIB_NAME_LENGTH-1);
+		hdr.z[i] = recipe->z[i];
+	}
+	for (nentry=1,v=0; v<recipe->nvary; v++) {
+		if (recipe->layer[v] <= 0 || recipe->layer[v] >= recipe->nlayers-1 || recipe->step[v] <= 0 || recipe->upper[v] < recipe->lower[v]) {
+			fprintf(stderr, "ERROR: %s: invalid grid for varied layer %d\n", rname, recipe->layer[v]); fflush(stderr);
+			return -1;
+		}
+		hdr.layer[v] = recipe->layer[v];
+		hdr.lower[v] = recipe->lower[v];
+		hdr.step[v]  = recipe->step[v];
+		hdr.nstep[v] = (uint32_t) floor((recipe->upper[v]-recipe->lower[v])/recipe->step[v] + 1E-9) + 1;
+		nentry *= hdr.nstep[v];
+	}
+	if (nentry > SPECLIB_MAX_ENTRY) {
+		fprintf(stderr, "ERROR: %s: grid of %.0f points exceeds the limit of %d -- use a larger step\n", rname, (double) nentry, SPECLIB_MAX_ENTRY); fflush(stderr);
+		return -1;
+	}
+	hdr.nentry = (uint32_t) nentry;
+
+	lambda = calloc(nwave, sizeof(*lambda));
+	r      = calloc(nwave, sizeof(*r));
+	mean   = calloc(nwave, sizeof(*mean));
+	cov    = calloc(nwave*nwave, sizeof(*cov));
+	eval   = calloc(nwave, sizeof(*eval));
+	evec   = calloc(nwave*nwave, sizeof(*evec));
+	perm   = NULL; split = NULL; coef = NULL; normv = NULL;
+	rc = -2;
+	if (lambda == NULL || r == NULL || mean == NULL || cov == NULL || eval == NULL || evec == NULL) goto cleanup;
+	for (i=0; i<nwave; i++) lambda[i] = lambda_min + i*(lambda_max-lambda_min)/(nwave-1);
+
+	/* Pass 1 -- components from a strided sample of the grid */
+	stride  = (int) ((nentry + PCA_SAMPLE-1) / PCA_SAMPLE);
+	nsample = 0;
+	for (e=0; e<hdr.nentry; e+=stride) {
+		grid_point(&hdr, e, z);
+		if (model(parm, z, nwave, lambda, r) != 0 || normalize(nwave, r, NULL) != 0) { rc = -4; goto model_failed; }
+		for (i=0; i<nwave; i++) {
+			mean[i] += r[i];
+			for (j=0; j<=i; j++) cov[i*nwave+j] += r[i]*r[j];
+		}
+		nsample++;
+	}
+	for (i=0; i<nwave; i++) mean[i] /= nsample;
+	for (i=0; i<nwave; i++) {
+		for (j=0; j<=i; j++) cov[i*nwave+j] = cov[j*nwave+i] = cov[i*nwave+j]/nsample - mean[i]*mean[j];
+	}
+	if (jacobi_eigen(nwave, cov, eval, evec) != 0) goto cleanup;
+
+	for (total=0,i=0; i<nwave; i++) if (eval[i] > 0) total += eval[i];
+	if (ncomp == 0) {
+		for (sum=0,ncomp=0; ncomp<SPECLIB_MAX_COMP && ncomp<nwave; ncomp++) {
+			if (total <= 0 || total-sum <= PCA_RESIDUAL*total) break;
+			sum += eval[ncomp];
+		}
+		if (ncomp < 1) ncomp = 1;
+	}
+	hdr.ncomp = ncomp;
+	if (verbose) {
+		for (sum=0,c=0; c<ncomp; c++) sum += eval[c];
+		printf("%u grid points, %d components from %d samples (residual variance %.2g)\n", hdr.nentry, ncomp, nsample,
+				 (total > 0) ? (total-sum)/total : 0.0);
+		fflush(stdout);
+	}
+
+	/* Pass 2 -- project every grid point */
+	coef  = malloc((size_t) nentry*ncomp*sizeof(*coef));
+	normv = malloc((size_t) nentry*sizeof(*normv));
+	perm  = malloc((size_t) nentry*sizeof(*perm));
+	split = calloc((size_t) nentry, sizeof(*split));
+	if (coef == NULL || normv == NULL || perm == NULL || split == NULL) goto cleanup;
+	for (e=0; e<hdr.nentry; e++) {
+		grid_point(&hdr, e, z);
+		if (model(parm, z, nwave, lambda, r) != 0 || normalize(nwave, r, &norm) != 0) { rc = -4; goto model_failed; }
+		normv[e] = (float) norm;
+		for (c=0; c<ncomp; c++) {
+			for (sum=0,i=0; i<nwave; i++) sum += evec[c*nwave+i]*(r[i]-mean[i]);
+			coef[(size_t) e*ncomp+c] = (float) sum;
+		}
+		perm[e] = e;
+		if (verbose && hdr.nentry >= 100000 && e % 100000 == 0 && e != 0) { printf("  %u of %u\n", e, hdr.nentry); fflush(stdout); }
+	}
+	build.coef = coef; build.ncomp = ncomp; build.perm = perm; build.split = split;
+	kd_build(&build, 0, hdr.nentry);
+
+	/* Layout and write */
+	offset = sizeof(SPECLIB_HEADER);
+	hdr.lambda_offset = offset; offset += nwave*sizeof(double);
+	hdr.mean_offset   = offset; offset += nwave*sizeof(double);
+	hdr.comp_offset   = offset; offset += (uint64_t) ncomp*nwave*sizeof(double);
+	hdr.coef_offset   = offset; offset += (nentry*ncomp*sizeof(float) + 7) & ~7ULL;
+	hdr.norm_offset   = offset; offset += (nentry*sizeof(float) + 7) & ~7ULL;
+	hdr.perm_offset   = offset; offset += (nentry*sizeof(uint32_t) + 7) & ~7ULL;
+	hdr.split_offset  = offset; offset += (nentry*sizeof(uint8_t) + 7) & ~7ULL;
+	hdr.file_size     = offset;
+
+	if ( (funit = fopen(outfile, "wb")) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to create \"%s\"\n", rname, outfile); fflush(stderr);
+		rc = -3; goto cleanup;
+	}
+	rc = fwrite(&hdr, sizeof(hdr), 1, funit) == 1;
+#define	WRITE_BLOCK(ptr, count, offset_next)	\
+	if (rc) {												\
+		rc = fwrite((ptr), sizeof(*(ptr)), (count), funit) == (size_t) (count);	\
+		while (rc && (uint64_t) ftell(funit) < (offset_next)) rc = fputc(0, funit) != EOF;	\
+	}
+	WRITE_BLOCK(lambda, nwave, hdr.mean_offset);
+	WRITE_BLOCK(mean, nwave, hdr.comp_offset);
+	WRITE_BLOCK(evec, ncomp*nwave, hdr.coef_offset);
+	WRITE_BLOCK(coef, nentry*ncomp, hdr.norm_offset);
+	WRITE_BLOCK(normv, nentry, hdr.perm_offset);
+	WRITE_BLOCK(perm, nentry, hdr.split_offset);
+	WRITE_BLOCK(split, nentry, hdr.file_size);
+#undef	WRITE_BLOCK
+	if (fclose(funit) != 0) rc = FALSE;
+	if (! rc) {
+		fprintf(stderr, "ERROR: %s: failed writing \"%s\"\n", rname, outfile); fflush(stderr);
+		remove(outfile);
+		rc = -3; goto cleanup;
+	}
+	rc = hdr.nentry;
+	goto cleanup;
+
+model_failed:
+	grid_point(&hdr, e, z);
+	fprintf(stderr, "ERROR: %s: model evaluation failed at grid point %u (z[0] = %g)\n", rname, e, z[0]); fflush(stderr);
+
+cleanup:
+	if (rc == -2) { fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr); }
+	free(lambda); free(r); free(mean); free(cov); free(eval); free(evec);
+	free(coef); free(normv); free(perm); free(split);
+	return rc;
+}
@@ -0,0 +1,149 @@
+#ifndef _SPECLIB_H_LOADED
+#define _SPECLIB_H_LOADED
+
+/* ===========================================================================
+-- Precomputed spectral library for a fixed recipe.
+--
+-- For a production recipe (fixed materials, 1-3 varying thicknesses) the
+-- model spectrum is tabulated offline on a regular thickness grid over the
+-- layer limits.  Each spectrum is normalized to unit length (so the lamp
+-- scaling drops out), and the set is compressed by principal components: the
+-- file holds the mean, ncomp components and ncomp coefficients per grid
+-- point, plus a balanced k-d tree over the coefficients.  The file is memory
+-- mapped read only and may be shared by any number of threads.
+--
+-- At measurement time the spectrum is interpolated onto the library
+-- wavelengths, normalized and projected, and the k-d tree returns the
+-- nearest grid point.  The fit then only has to polish that point.
+--
+-- File layout (little endian, every block 8 byte aligned):
+--     SPECLIB_HEADER
+--     lambda[nwave]             library wavelengths (nm)
+--     mean[nwave]               mean normalized spectrum
+--     comp[ncomp][nwave]        principal components (orthonormal)
+--     coef[nentry][ncomp]       float -- projection of each grid point
+--     norm[nentry]              float -- length of the unnormalized spectrum
+--     perm[nentry]              uint32 -- k-d tree order (implicit, balanced)
+--     split[nentry]             uint8  -- split coefficient of each node
+--
+-- Grid point e has indices i_v = (e / (nstep_0 ... nstep_(v-1))) % nstep_v
+-- and thicknesses z_v = lower_v + i_v*step_v.
+=========================================================================== */
+
+#include <stdint.h>
+
+#define	SPECLIB_MAGIC			"FMSPLIB\032"	/* 8 bytes including terminating NUL */
+#define	SPECLIB_VERSION		(1)
+#define	SPECLIB_FILENAME		"FilmMeasure.splib"
+
+#define	SPECLIB_MAX_VARS		(3)				/* Varied thicknesses */
+#define	SPECLIB_MAX_LAYERS	(16)				/* Layers incl. incident medium and substrate */
+#define	SPECLIB_NAME_LENGTH	(64)
+#define	SPECLIB_MAX_WAVE		(512)				/* Library wavelengths */
+#define	SPECLIB_MAX_COMP		(32)				/* Principal components kept */
+#define	SPECLIB_MAX_ENTRY		(4000000)		/* Grid points */
+
+/* Recipe a library is built for, and that a fit must match to use it */
+typedef struct _SPECLIB_RECIPE {
+	int nlayers;										/* Layers incl. incident medium and substrate */
+	char name[SPECLIB_MAX_LAYERS][SPECLIB_NAME_LENGTH];	/* Material of each layer	*/
+	double z[SPECLIB_MAX_LAYERS];					/* Thickness (nm) of the fixed layers	*/
+	int nvary;											/* Number of varied thicknesses			*/
+	int layer[SPECLIB_MAX_VARS];					/* Index of each varied layer				*/
+	double lower[SPECLIB_MAX_VARS];				/* Grid of each varied thickness (nm)	*/
+	double upper[SPECLIB_MAX_VARS];
+	double step[SPECLIB_MAX_VARS];
+} SPECLIB_RECIPE;
+
+typedef struct _SPECLIB_HEADER {
+	char magic[8];										/* SPECLIB_MAGIC							*/
+	uint32_t version;									/* SPECLIB_VERSION						*/
+	uint32_t header_size;							/* sizeof(SPECLIB_HEADER)				*/
+	uint32_t nwave, ncomp, nentry;
+	uint32_t nlayers, nvary, reserved;
+	uint32_t layer[SPECLIB_MAX_VARS];
+	uint32_t nstep[SPECLIB_MAX_VARS];
+	double lower[SPECLIB_MAX_VARS], step[SPECLIB_MAX_VARS];
+	double z[SPECLIB_MAX_LAYERS];
+	char name[SPECLIB_MAX_LAYERS][SPECLIB_NAME_LENGTH];
+	double lambda_min, lambda_max;
+	uint64_t lambda_offset, mean_offset, comp_offset, coef_offset;
+	uint64_t norm_offset, perm_offset, split_offset, file_size;
+	int64_t compiled;									/* time() when built						*/
+} SPECLIB_HEADER;
+
+typedef struct _SPECLIB SPECLIB;					/* Opaque -- an open (mapped) library */
+
+/* Routine to calculate the (unscaled) model reflectance with the varied
+ * thicknesses set to z[nvary].  parm is the pointer given to SpecLib_Build().
+ * Returns 0 if successful */
+typedef int SPECLIB_MODEL(void *parm, double *z, int nwave, double *lambda, double *refl);
+
+/* ===========================================================================
+-- Open (map) or close a library
+--
+-- Usage: SPECLIB *SpecLib_Open(char *path);
+--        void SpecLib_Close(SPECLIB *lib);
+--
+-- Return: SpecLib_Open returns NULL if the file is missing or not valid
+=========================================================================== */
+SPECLIB *SpecLib_Open(char *path);
+void SpecLib_Close(SPECLIB *lib);
+
+/* ===========================================================================
+-- Determine whether a library was built for a recipe
+--
+-- Usage: int SpecLib_Matches(SPECLIB *lib, SPECLIB_RECIPE *recipe);
+--
+-- Inputs: lib    - open library
+--         recipe - stack being fit; lower/upper/step are ignored
+--
+-- Return: TRUE if the materials (case insensitive), the fixed thicknesses of
+--         the sublayers and the varied layers are all the same
+=========================================================================== */
+int SpecLib_Matches(SPECLIB *lib, SPECLIB_RECIPE *recipe);
+
+/* ===========================================================================
+-- Find the library spectrum closest to a measured spectrum
+--
+-- Usage: int SpecLib_Lookup(SPECLIB *lib, int npt, double *lambda, double *refl, double *z, double *scaling);
+--
+-- Inputs: lib     - open library
+--         npt     - number of points in the measurement
+--         lambda  - [npt] wavelengths (nm), monotonic
+--         refl    - [npt] measured reflectance
+--         z       - [nvary] array to receive the varied thicknesses
+--         scaling - pointer to receive the scaling (model/measured)
+--
+-- Return: 0 if successful
+--         1 on invalid parameters
+--         2 if the measurement does not cover the library wavelengths
+=========================================================================== */
+int SpecLib_Lookup(SPECLIB *lib, int npt, double *lambda, double *refl, double *z, double *scaling);
+
+/* ===========================================================================
+-- Build a library file
+--
+-- Usage: int SpecLib_Build(SPECLIB_RECIPE *recipe, double lambda_min, double lambda_max, int nwave, int ncomp,
+--                          SPECLIB_MODEL *model, void *parm, char *outfile, int verbose);
+--
+-- Inputs: recipe     - stack and thickness grid (lower to upper by step)
+--         lambda_min - wavelength range tabulated (normally the fit range)
+--         lambda_max
+--         nwave      - number of wavelengths (<= SPECLIB_MAX_WAVE)
+--         ncomp      - principal components to keep, or 0 to keep enough
+--                      for a relative residual variance of 1E-6
+--         model      - routine evaluating the reflectance
+--         parm       - passed unchanged to model
+--         outfile    - file to create
+--         verbose    - if TRUE, report progress to stdout
+--
+-- Return: Number of grid points written, or <0 on error
+--
+-- Notes: The model is called once for every grid point plus once for each
+--        of up to 4096 points used to determine the components.
+=========================================================================== */
+int SpecLib_Build(SPECLIB_RECIPE *recipe, double lambda_min, double lambda_max, int nwave, int ncomp,
+						SPECLIB_MODEL *model, void *parm, char *outfile, int verbose);
+
+#endif		/* _SPECLIB_H_LOADED */
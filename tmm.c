@@ -0,0 +1,718 @@
+/* tmm.c - Native vectorized transfer-matrix reflectance engine */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define	TMM_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tpool.h"
+#include "tmm.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+/* Which SIMD versions can be compiled with this compiler */
+#if defined(TMM_X86) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1800))
+	#define	TMM_BUILD_AVX2
+#endif
+#if defined(TMM_X86) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1910))
+	#define	TMM_BUILD_AVX512
+#endif
+
+/* Wavelength chunks evaluated in parallel */
+#define	TMM_MAX_CHUNKS	(64)
+#define	TMM_CHUNK_MIN	(128)					/* Fewer points not worth a thread */
+
+typedef struct _TMM_CHUNK {
+	TMM_WORK *work;						/* Workspace owned by this chunk			*/
+	int i0;									/* First wavelength of the chunk			*/
+	TMM_STACK stack;						/* Stack restricted to the chunk			*/
+	double *n[TMM_MAX_LAYERS], *k[TMM_MAX_LAYERS];
+	double *dRdz[TMM_MAX_LAYERS];
+	double sin_theta, *R;
+	int mode, deriv, rc;
+} TMM_CHUNK;
+
+/* Workspace (one per thread) */
+struct _TMM_WORK {
+	double *scratch;					/* Per-layer values saved for derivatives */
+	int dim_scratch;
+
+	/* Partial products around a single varying layer (see TMM_ReflectanceDeriv) */
+	double *pcache;					/* [npol][TMM_PC_N][npad] */
+	int dim_pcache;
+	int jc;								/* Layer cached, or -1 if none valid */
+	int npad, npol;
+
+	/* Description of the last stack evaluated (key for the cache) */
+	int k_valid;
+	int k_npt, k_nlayers, k_mode;
+	double k_sin, *k_lambda;
+	double *k_n[TMM_MAX_LAYERS], *k_k[TMM_MAX_LAYERS], k_z[TMM_MAX_LAYERS];
+
+	/* Parallel evaluation (see TMM_SetThreadPool) */
+	TPOOL *pool;
+	TMM_CHUNK *chunk;					/* [TMM_MAX_CHUNKS] once used */
+};
+
+/* Per-layer values saved by the kernel for the derivative pass */
+#define	TMM_SV_COSR	(0)
+#define	TMM_SV_COSI	(1)
+#define	TMM_SV_SINR	(2)
+#define	TMM_SV_SINI	(3)
+#define	TMM_SV_ETAR	(4)
+#define	TMM_SV_ETAI	(5)
+#define	TMM_SV_IVR	(6)
+#define	TMM_SV_IVI	(7)
+#define	TMM_SV_KQR	(8)
+#define	TMM_SV_KQI	(9)
+#define	TMM_SV_BR	(10)
+#define	TMM_SV_BI	(11)
+#define	TMM_SV_CR	(12)
+#define	TMM_SV_CI	(13)
+#define	TMM_SV_N		(14)
+#define	TMM_VLEN_MAX	(8)					/* Widest vector (AVX-512) */
+
+/* Partial-product cache for one layer, per wavelength */
+#define	TMM_PC_A1R	(0)					/* Row [eta0,-1] M_1..M_(jc-1) */
+#define	TMM_PC_A1I	(1)
+#define	TMM_PC_A2R	(2)
+#define	TMM_PC_A2I	(3)
+#define	TMM_PC_B1R	(4)					/* Row [eta0, 1] M_1..M_(jc-1) */
+#define	TMM_PC_B1I	(5)
+#define	TMM_PC_B2R	(6)
+#define	TMM_PC_B2I	(7)
+#define	TMM_PC_VBR	(8)					/* Suffix vector M_(jc+1)..M_L [1,eta_s] */
+#define	TMM_PC_VBI	(9)
+#define	TMM_PC_VCR	(10)
+#define	TMM_PC_VCI	(11)
+#define	TMM_PC_ETAR	(12)					/* Admittance of layer jc and inverse */
+#define	TMM_PC_ETAI	(13)
+#define	TMM_PC_IVR	(14)
+#define	TMM_PC_IVI	(15)
+#define	TMM_PC_KQR	(16)					/* k0 q of layer jc (d = k0 q z) */
+#define	TMM_PC_KQI	(17)
+#define	TMM_PC_N		(18)
+
+/* Constants used by the kernels */
+#define	TMM_TWOPI	(6.28318530717958647692)
+#define	TMM_2_PI		(6.36619772367581382433e-01)		/* 2/pi */
+#define	TMM_PIO2_1	(1.57079632673412561417e+00)		/* pi/2 in three parts */
+#define	TMM_PIO2_2	(6.07710050630396597660e-11)
+#define	TMM_PIO2_3	(2.02226624879595063154e-21)
+#define	TMM_S1		(-1.66666666666666324348e-01)		/* fdlibm __kernel_sin */
+#define	TMM_S2		( 8.33333333332248946124e-03)
+#define	TMM_S3		(-1.98412698298579493134e-04)
+#define	TMM_S4		( 2.75573137070700676789e-06)
+#define	TMM_S5		(-2.50507602534068634195e-08)
+#define	TMM_S6		( 1.58969099521155010221e-10)
+#define	TMM_C1		( 4.16666666666666019037e-02)		/* fdlibm __kernel_cos */
+#define	TMM_C2		(-1.38888888888741095749e-03)
+#define	TMM_C3		( 2.48015872894767294178e-05)
+#define	TMM_C4		(-2.75573143513906633035e-07)
+#define	TMM_C5		( 2.08757232129817482790e-09)
+#define	TMM_C6		(-1.13596475577881948265e-11)
+#define	TMM_LOG2E	(1.44269504088896338700e+00)
+#define	TMM_LN2_HI	(6.93147180369123816490e-01)
+#define	TMM_LN2_LO	(1.90821492927058770002e-10)
+#define	TMM_EXP_MAX	(700.0)								/* Keeps cosh/sinh finite */
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static int cpu_simd_level(void);
+static int check_scratch(TMM_WORK *work, int nlayers);
+static int refl_serial(TMM_WORK *work, TMM_STACK *stack, double sin_theta, int mode, double *R, double **dRdz);
+static void refl_chunk(void *arg, int itask);
+
+/* ------------------------------- */
+/* Locally defined global vars     */
+/* ------------------------------- */
+static int simd_level = -1;			/* Level in use (-1 until first call).  Threads racing on */
+										/* the first call all store the same detected value */
+
+/* ===========================================================================
+-- Scalar instance of the kernel (always available)
+=========================================================================== */
+#define	VLEN				(1)
+#define	VEC				double
+#define	VMASK				int
+#define	TMM_TARGET
+#define	TMM_FN(name)	name##_scalar
+#define	VLOAD(p)			(*(p))
+#define	VSTORE(p,v)		(*(p) = (v))
+#define	VSET1(x)			((double) (x))
+#define	VADD(a,b)		((a)+(b))
+#define	VSUB(a,b)		((a)-(b))
+#define	VMUL(a,b)		((a)*(b))
+#define	VDIV(a,b)		((a)/(b))
+#define	VSQRT(a)			sqrt(a)
+#define	VFMA(a,b,c)		((a)*(b)+(c))
+#define	VMIN(a,b)		fmin(a,b)
+#define	VMAX(a,b)		fmax(a,b)
+#define	VABS(a)			fabs(a)
+#define	VROUND(a)		floor((a)+0.5)
+#define	VFLOOR(a)		floor(a)
+#define	VLDEXP(p,k)		ldexp(p, (int) (k))
+#define	VCMPLT(a,b)		((a) < (b))
+#define	VCMPEQ(a,b)		((a) == (b))
+#define	VOR(a,b)			((a) || (b))
+#define	VSELECT(m,a,b)	((m) ? (a) : (b))
+#include "tmm_kernel.h"
+#undef	VLEN
+#undef	VEC
+#undef	VMASK
+#undef	TMM_TARGET
+#undef	TMM_FN
+#undef	VLOAD
+#undef	VSTORE
+#undef	VSET1
+#undef	VADD
+#undef	VSUB
+#undef	VMUL
+#undef	VDIV
+#undef	VSQRT
+#undef	VFMA
+#undef	VMIN
+#undef	VMAX
+#undef	VABS
+#undef	VROUND
+#undef	VFLOOR
+#undef	VLDEXP
+#undef	VCMPLT
+#undef	VCMPEQ
+#undef	VOR
+#undef	VSELECT
+
+/* ===========================================================================
+-- AVX2 + FMA instance (4 wavelengths per register)
+=========================================================================== */
+#ifdef TMM_BUILD_AVX2
+#define	VLEN				(4)
+#define	VEC				__m256d
+#define	VMASK				__m256d
+#ifdef __GNUC__
+	#define	TMM_TARGET	__attribute__((target("avx2,fma")))
+#else
+	#define	TMM_TARGET
+#endif
+#define	TMM_FN(name)	name##_avx2
+#define	VLOAD(p)			_mm256_loadu_pd(p)
+#define	VSTORE(p,v)		_mm256_storeu_pd((p),(v))
+#define	VSET1(x)			_mm256_set1_pd(x)
+#define	VADD(a,b)		_mm256_add_pd(a,b)
+#define	VSUB(a,b)		_mm256_sub_pd(a,b)
+#define	VMUL(a,b)		_mm256_mul_pd(a,b)
+#define	VDIV(a,b)		_mm256_div_pd(a,b)
+#define	VSQRT(a)			_mm256_sqrt_pd(a)
+#define	VFMA(a,b,c)		_mm256_fmadd_pd(a,b,c)
+#define	VMIN(a,b)		_mm256_min_pd(a,b)
+#define	VMAX(a,b)		_mm256_max_pd(a,b)
+#define	VABS(a)			_mm256_andnot_pd(_mm256_set1_pd(-0.0), a)
+#define	VROUND(a)		_mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define	VFLOOR(a)		_mm256_floor_pd(a)
+#define	VLDEXP(p,k)		_mm256_mul_pd(p, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)), _mm256_set1_epi64x(1023)), 52)))
+#define	VCMPLT(a,b)		_mm256_cmp_pd(a,b,_CMP_LT_OQ)
+#define	VCMPEQ(a,b)		_mm256_cmp_pd(a,b,_CMP_EQ_OQ)
+#define	VOR(a,b)			_mm256_or_pd(a,b)
+#define	VSELECT(m,a,b)	_mm256_blendv_pd(b,a,m)
+#include "tmm_kernel.h"
+#undef	VLEN
+#undef	VEC
+#undef	VMASK
+#undef	TMM_TARGET
+#undef	TMM_FN
+#undef	VLOAD
+#undef	VSTORE
+#undef	VSET1
+#undef	VADD
+#undef	VSUB
+#undef	VMUL
+#undef	VDIV
+#undef	VSQRT
+#undef	VFMA
+#undef	VMIN
+#undef	VMAX
+#undef	VABS
+#undef	VROUND
+#undef	VFLOOR
+#undef	VLDEXP
+#undef	VCMPLT
+#undef	VCMPEQ
+#undef	VOR
+#undef	VSELECT
+#endif
+
+/* ===========================================================================
+-- AVX-512F instance (8 wavelengths per register)
+=========================================================================== */
+#ifdef TMM_BUILD_AVX512
+#define	VLEN				(8)
+#define	VEC				__m512d
+#define	VMASK				__mmask8
+#ifdef __GNUC__
+	#define	TMM_TARGET	__attribute__((target("avx512f")))
+#else
+	#define	TMM_TARGET
+#endif
+#define	TMM_FN(name)	name##_avx512
+#define	VLOAD(p)			_mm512_loadu_pd(p)
+#define	VSTORE(p,v)		_mm512_storeu_pd((p),(v))
+#define	VSET1(x)			_mm512_set1_pd(x)
+#define	VADD(a,b)		_mm512_add_pd(a,b)
+#define	VSUB(a,b)		_mm512_sub_pd(a,b)
+#define	VMUL(a,b)		_mm512_mul_pd(a,b)
+#define	VDIV(a,b)		_mm512_div_pd(a,b)
+#define	VSQRT(a)			_mm512_sqrt_pd(a)
+#define	VFMA(a,b,c)		_mm512_fmadd_pd(a,b,c)
+#define	VMIN(a,b)		_mm512_min_pd(a,b)
+#define	VMAX(a,b)		_mm512_max_pd(a,b)
+#define	VABS(a)			_mm512_abs_pd(a)
+#define	VROUND(a)		_mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define	VFLOOR(a)		_mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)
+#define	VLDEXP(p,k)		_mm512_scalef_pd(p,k)
+#define	VCMPLT(a,b)		_mm512_cmp_pd_mask(a,b,_CMP_LT_OQ)
+#define	VCMPEQ(a,b)		_mm512_cmp_pd_mask(a,b,_CMP_EQ_OQ)
+#define	VOR(a,b)			((__mmask8) ((a) | (b)))
+#define	VSELECT(m,a,b)	_mm512_mask_blend_pd(m,b,a)
+#include "tmm_kernel.h"
+#undef	VLEN
+#undef	VEC
+#undef	VMASK
+#undef	TMM_TARGET
+#undef	TMM_FN
+#undef	VLOAD
+#undef	VSTORE
+#undef	VSET1
+#undef	VADD
+#undef	VSUB
+#undef	VMUL
+#undef	VDIV
+#undef	VSQRT
+#undef	VFMA
+#undef	VMIN
+#undef	VMAX
+#undef	VABS
+#undef	VROUND
+#undef	VFLOOR
+#undef	VLDEXP
+#undef	VCMPLT
+#undef	VCMPEQ
+#undef	VOR
+#undef	VSELECT
+#endif
+
+/* ===========================================================================
+-- Determine the best SIMD level supported by both CPU and operating system
+--
+-- Usage: int cpu_simd_level(void);
+--
+-- Return: TMM_SIMD_AVX512, TMM_SIMD_AVX2 or TMM_SIMD_SCALAR
+=========================================================================== */
+static int cpu_simd_level(void) {
+	int level = TMM_SIMD_SCALAR;
+
+#if defined(TMM_X86) && defined(_MSC_VER)
+	int info[4];
+	unsigned __int64 xcr0;
+	int fma, avx2, avx512;
+
+	__cpuid(info, 0);
+	if (info[0] < 7) return TMM_SIMD_SCALAR;
+	__cpuid(info, 1);
+	if (! (info[2] & (1 << 27))) return TMM_SIMD_SCALAR;		/* OS uses XSAVE */
+	fma = (info[2] & (1 << 12)) != 0;
+	xcr0 = _xgetbv(0);
+	if ((xcr0 & 0x06) != 0x06) return TMM_SIMD_SCALAR;			/* OS saves YMM */
+	__cpuidex(info, 7, 0);
+	avx2   = (info[1] & (1 << 5))  != 0;
+	avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xE6) == 0xE6;
+	if (avx2 && fma) level = TMM_SIMD_AVX2;
+	if (avx512) level = TMM_SIMD_AVX512;
+
+#elif defined(TMM_X86) && defined(__GNUC__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) level = TMM_SIMD_AVX2;
+	if (__builtin_cpu_supports("avx512f")) level = TMM_SIMD_AVX512;
+#endif
+
+#ifndef TMM_BUILD_AVX512
+	if (level > TMM_SIMD_AVX2) level = TMM_SIMD_AVX2;
+#endif
+#ifndef TMM_BUILD_AVX2
+	level = TMM_SIMD_SCALAR;
+#endif
+	return level;
+}
+
+/* ===========================================================================
+-- Query or override the SIMD implementation used by the engine
+--
+-- Usage: int TMM_SimdLevel(void);
+--        int TMM_SetSimdLevel(int level);
+--
+-- Inputs: level - requested level, or -1 for automatic detection
+--
+-- Return: Level in use
+=========================================================================== */
+int TMM_SimdLevel(void) {
+	if (simd_level < 0) simd_level = cpu_simd_level();
+	return simd_level;
+}
+
+int TMM_SetSimdLevel(int level) {
+	int best;
+
+	best = cpu_simd_level();
+	simd_level = (level < 0 || level > best) ? best : level;
+	return simd_level;
+}
+
+/* ===========================================================================
+-- Create / release a workspace for the reflectance engine
+--
+-- Usage: TMM_WORK *TMM_CreateWork(void);
+--        void TMM_FreeWork(TMM_WORK *work);
+--
+-- Return: TMM_CreateWork returns NULL if memory not available
+=========================================================================== */
+TMM_WORK *TMM_CreateWork(void) {
+	TMM_WORK *work;
+
+	if ( (work = calloc(1, sizeof(*work))) == NULL) return NULL;
+	work->jc = -1;
+	TMM_SimdLevel();								/* Detect now rather than inside a thread */
+	return work;
+}
+
+void TMM_FreeWork(TMM_WORK *work) {
+	int i;
+
+	if (work == NULL) return;
+	if (work->chunk != NULL) {
+		for (i=0; i<TMM_MAX_CHUNKS; i++) TMM_FreeWork(work->chunk[i].work);
+		free(work->chunk);
+	}
+	if (work->scratch != NULL) free(work->scratch);
+	if (work->pcache  != NULL) free(work->pcache);
+	free(work);
+	return;
+}
+
+/* ===========================================================================
+-- Attach a thread pool to a workspace
+--
+-- Usage: void TMM_SetThreadPool(TMM_WORK *work, TPOOL *pool);
+--
+-- Inputs: work - workspace
+--         pool - pool used to split wavelengths, or NULL for serial
+=========================================================================== */
+void TMM_SetThreadPool(TMM_WORK *work, TPOOL *pool) {
+	if (work == NULL) return;
+	work->pool = pool;
+	return;
+}
+
+/* ===========================================================================
+-- Forget the partial-product cache
+--
+-- Usage: void TMM_ClearCache(TMM_WORK *work);
+--
+-- Notes: Needed only if n, k or lambda arrays are modified in place.  Changes
+--        to the pointers, thicknesses, angle or mode are detected.
+=========================================================================== */
+void TMM_ClearCache(TMM_WORK *work) {
+	int i;
+
+	if (work == NULL) return;
+	work->k_valid = FALSE;
+	work->jc = -1;
+	if (work->chunk != NULL) {
+		for (i=0; i<TMM_MAX_CHUNKS; i++) TMM_ClearCache(work->chunk[i].work);
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Make sure the per-block scratch space is large enough
+--
+-- Return: 0 if successful, 2 on memory failure
+=========================================================================== */
+static int check_scratch(TMM_WORK *work, int nlayers) {
+	static char *rname = "TMM_ReflectanceDeriv";
+	int need;
+
+	need = (TMM_SV_N+2) * nlayers * TMM_VLEN_MAX;
+	if (need > work->dim_scratch) {
+		if (work->scratch != NULL) free(work->scratch);
+		if ( (work->scratch = malloc(need*sizeof(*work->scratch))) == NULL) {
+			work->dim_scratch = 0;
+			fprintf(stderr, "ERROR: %s: unable to allocate derivative workspace\n", rname); fflush(stderr);
+			return 2;
+		}
+		work->dim_scratch = need;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Calculate reflectance of a stack at every wavelength
+--
+-- Usage: int TMM_Reflectance(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R);
+--
+-- Inputs: work  - workspace from TMM_CreateWork()
+--         stack - layer and wavelength description
+--         theta - angle of incidence (radians)
+--         mode  - TMM_TE, TMM_TM or TMM_UNPOLARIZED
+--         R     - array of stack->npt values to receive the reflectance
+--
+-- Output: R[i] - absolute reflectance at stack->lambda[i]
+--
+-- Return: 0 if successful, 1 on invalid parameters
+=========================================================================== */
+int TMM_Reflectance(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R) {
+	return TMM_ReflectanceDeriv(work, stack, theta, mode, R, NULL);
+}
+
+/* ===========================================================================
+-- Calculate reflectance and its derivative with respect to layer thickness
+--
+-- Usage: int TMM_ReflectanceDeriv(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R, double **dRdz);
+--
+-- Inputs: work  - workspace from TMM_CreateWork()
+--         stack - layer and wavelength description
+--         theta - angle of incidence (radians)
+--         mode  - TMM_TE, TMM_TM or TMM_UNPOLARIZED
+--         R     - array of stack->npt values to receive the reflectance
+--         dRdz  - NULL, or array of stack->nlayers pointers.  Each is NULL
+--                 (derivative not needed) or an array of stack->npt values
+--
+-- Output: R[i]       - absolute reflectance at stack->lambda[i]
+--         dRdz[j][i] - dR/dz_j (per nm) at stack->lambda[i].  Set to zero for
+--                      the incident medium and substrate.
+--
+-- Return: 0 if successful, 1 on invalid parameters, 2 on memory failure
+--
+-- Notes: When dRdz is NULL and the stack differs from the previous call
+--        only in the thickness of one interior layer, the partial products
+--        above and below that layer are saved in the workspace.  Following
+--        calls that again change only that thickness (LM steps or a scan of
+--        one layer) cost one layer matrix per wavelength.
+=========================================================================== */
+int TMM_ReflectanceDeriv(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R, double **dRdz) {
+	static char *rname = "TMM_ReflectanceDeriv";
+	double sin_theta;
+	int l, ic, nchunk, chunk_pts, rc;
+	TMM_CHUNK *chunk;
+	TMM_WORK *child;
+
+	if (work == NULL || stack == NULL || R == NULL || stack->lambda == NULL ||
+		 stack->z == NULL || stack->n == NULL || stack->k == NULL) {
+		fprintf(stderr, "ERROR: %s called with NULL pointer\n", rname); fflush(stderr);
+		return 1;
+	}
+	if (stack->nlayers < 2 || stack->nlayers > TMM_MAX_LAYERS) {
+		fprintf(stderr, "ERROR: %s called with invalid number of layers (%d)\n", rname, stack->nlayers); fflush(stderr);
+		return 1;
+	}
+	if (mode != TMM_TE && mode != TMM_TM) mode = TMM_UNPOLARIZED;
+	if (stack->npt <= 0) return 0;
+
+	sin_theta = (theta == 0.0) ? 0.0 : sin(theta);
+
+	/* Number of wavelength chunks -- depends only on npt and the pool size */
+	nchunk = TPool_Threads(work->pool);
+	if (nchunk > stack->npt/TMM_CHUNK_MIN) nchunk = stack->npt/TMM_CHUNK_MIN;
+	if (nchunk > TMM_MAX_CHUNKS) nchunk = TMM_MAX_CHUNKS;
+	if (nchunk <= 1) return refl_serial(work, stack, sin_theta, mode, R, dRdz);
+
+	/* Make sure each chunk has a workspace of its own */
+	if (work->chunk == NULL && (work->chunk = calloc(TMM_MAX_CHUNKS, sizeof(*work->chunk))) == NULL) {
+		return refl_serial(work, stack, sin_theta, mode, R, dRdz);
+	}
+	for (ic=0; ic<nchunk; ic++) {
+		if (work->chunk[ic].work == NULL) {
+			if ( (child = TMM_CreateWork()) == NULL) return refl_serial(work, stack, sin_theta, mode, R, dRdz);
+			work->chunk[ic].work = child;
+		}
+	}
+	work->k_valid = FALSE;										/* Serial path cache no longer current */
+
+	/* Split into fixed ranges aligned to the widest vector */
+	chunk_pts = (stack->npt + nchunk-1) / nchunk;
+	chunk_pts = (chunk_pts + TMM_VLEN_MAX-1) / TMM_VLEN_MAX * TMM_VLEN_MAX;
+	for (ic=0; ic<nchunk; ic++) {
+		chunk = &work->chunk[ic];
+		chunk->i0 = ic*chunk_pts;
+		chunk->stack.npt = stack->npt - chunk->i0;
+		if (chunk->stack.npt > chunk_pts) chunk->stack.npt = chunk_pts;
+		if (chunk->stack.npt < 0) chunk->stack.npt = 0;
+		chunk->stack.nlayers = stack->nlayers;
+		chunk->stack.lambda  = stack->lambda + chunk->i0;
+		chunk->stack.z = stack->z;
+		chunk->stack.n = chunk->n;
+		chunk->stack.k = chunk->k;
+		for (l=0; l<stack->nlayers; l++) {
+			chunk->n[l] = stack->n[l] + chunk->i0;
+			chunk->k[l] = stack->k[l] + chunk->i0;
+			if (dRdz != NULL) chunk->dRdz[l] = (dRdz[l] == NULL) ? NULL : dRdz[l] + chunk->i0;
+		}
+		chunk->sin_theta = sin_theta;
+		chunk->mode = mode;
+		chunk->R    = R + chunk->i0;
+		chunk->deriv = (dRdz != NULL);
+		chunk->rc   = 0;
+	}
+	TPool_Run(work->pool, nchunk, refl_chunk, work->chunk);
+
+	rc = 0;
+	for (ic=0; ic<nchunk; ic++) if (work->chunk[ic].rc > rc) rc = work->chunk[ic].rc;
+	return rc;
+}
+
+/* ===========================================================================
+-- Evaluate one wavelength chunk (task routine for the thread pool)
+=========================================================================== */
+static void refl_chunk(void *arg, int itask) {
+	TMM_CHUNK *chunk;
+
+	chunk = ((TMM_CHUNK *) arg) + itask;
+	if (chunk->stack.npt <= 0) return;
+	chunk->rc = refl_serial(chunk->work, &chunk->stack, chunk->sin_theta, chunk->mode, chunk->R, chunk->deriv ? chunk->dRdz : NULL);
+	return;
+}
+
+/* ===========================================================================
+-- Single-threaded evaluation of a complete stack (parameters already checked)
+--
+-- Usage: int refl_serial(TMM_WORK *work, TMM_STACK *stack, double sin_theta, int mode, double *R, double **dRdz);
+--
+-- Return: 0 if successful, 2 on memory failure
+=========================================================================== */
+static int refl_serial(TMM_WORK *work, TMM_STACK *stack, double sin_theta, int mode, double *R, double **dRdz) {
+	double *pc;
+	int i, l, nl, ndiff, jdiff, jbuild, npol, npad, eff_mode;
+	int same;
+
+	nl = stack->nlayers;
+
+	/* Derivatives need scratch space for the per-layer values in a block */
+	if (dRdz != NULL) {
+		if (check_scratch(work, nl) != 0) return 2;
+		for (i=0; i<stack->npt; i++) {
+			if (dRdz[0] != NULL) dRdz[0][i] = 0.0;
+			if (dRdz[nl-1] != NULL) dRdz[nl-1][i] = 0.0;
+		}
+	}
+
+	/* ----------------------------------------------------------
+	-- Compare with the previous stack to see if only one layer
+	-- thickness changed.  Derivative calls bypass the cache.
+	---------------------------------------------------------- */
+	jbuild = -1;
+	eff_mode = (sin_theta == 0.0 && mode == TMM_UNPOLARIZED) ? TMM_TE : mode;
+	npol = (eff_mode == TMM_UNPOLARIZED) ? 2 : 1;
+	npad = (stack->npt + TMM_VLEN_MAX-1) / TMM_VLEN_MAX * TMM_VLEN_MAX;
+	if (dRdz == NULL) {
+		same = work->k_valid && work->k_npt == stack->npt && work->k_lambda == stack->lambda &&
+				 work->k_nlayers == nl && work->k_mode == eff_mode && work->k_sin == sin_theta;
+		for (l=0; same && l<nl; l++) same = (work->k_n[l] == stack->n[l] && work->k_k[l] == stack->k[l]);
+		ndiff = 0; jdiff = -1;
+		for (l=1; same && l<nl-1; l++) {
+			if (work->k_z[l] != stack->z[l]) { ndiff++; jdiff = l; }
+		}
+
+		/* Cache is valid for this layer -- only it can have changed */
+		if (same && work->jc > 0 && (ndiff == 0 || (ndiff == 1 && jdiff == work->jc))) {
+			switch (TMM_SimdLevel()) {
+#ifdef TMM_BUILD_AVX512
+				case TMM_SIMD_AVX512:
+					refl_vary_avx512(stack->npt, stack->z[work->jc], work->npol, work->pcache, work->npad, R);
+					break;
+#endif
+#ifdef TMM_BUILD_AVX2
+				case TMM_SIMD_AVX2:
+					refl_vary_avx2(stack->npt, stack->z[work->jc], work->npol, work->pcache, work->npad, R);
+					break;
+#endif
+				default:
+					refl_vary_scalar(stack->npt, stack->z[work->jc], work->npol, work->pcache, work->npad, R);
+					break;
+			}
+			work->k_z[work->jc] = stack->z[work->jc];
+			return 0;
+		}
+
+		/* Exactly one layer changed since last call -- build the cache for it this time */
+		if (same && ndiff == 1) jbuild = jdiff;
+		if (jbuild > 0 && check_scratch(work, nl) != 0) jbuild = -1;
+		if (jbuild > 0 && npol*TMM_PC_N*npad > work->dim_pcache) {
+			if (work->pcache != NULL) free(work->pcache);
+			work->dim_pcache = npol*TMM_PC_N*npad;
+			if ( (work->pcache = malloc(work->dim_pcache*sizeof(*work->pcache))) == NULL) {
+				work->dim_pcache = 0;
+				jbuild = -1;
+			}
+		}
+
+		/* Save description of this stack as the key for the next call */
+		work->k_valid   = TRUE;
+		work->k_npt     = stack->npt;
+		work->k_lambda  = stack->lambda;
+		work->k_nlayers = nl;
+		work->k_mode    = eff_mode;
+		work->k_sin     = sin_theta;
+		for (l=0; l<nl; l++) {
+			work->k_n[l] = stack->n[l];
+			work->k_k[l] = stack->k[l];
+			work->k_z[l] = stack->z[l];
+		}
+		work->jc   = jbuild;
+		work->npol = npol;
+		work->npad = npad;
+	}
+	pc = (jbuild > 0) ? work->pcache : NULL;
+
+	switch (TMM_SimdLevel()) {
+#ifdef TMM_BUILD_AVX512
+		case TMM_SIMD_AVX512:
+			refl_all_avx512(stack, sin_theta, mode, R, dRdz, work->scratch, jbuild, pc, npad);
+			break;
+#endif
+#ifdef TMM_BUILD_AVX2
+		case TMM_SIMD_AVX2:
+			refl_all_avx2(stack, sin_theta, mode, R, dRdz, work->scratch, jbuild, pc, npad);
+			break;
+#endif
+		default:
+			refl_all_scalar(stack, sin_theta, mode, R, dRdz, work->scratch, jbuild, pc, npad);
+			break;
+	}
+
+	return 0;
+}
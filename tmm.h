@@ -0,0 +1,153 @@
+#ifndef _TMM_H_LOADED
+#define _TMM_H_LOADED
+
+/* ===========================================================================
+-- Native transfer-matrix (characteristic matrix) reflectance engine.
+--
+-- Computes the reflectance of a planar multilayer stack for a whole array of
+-- wavelengths in one call.  The n,k values are passed as structure-of-arrays
+-- (one [npt] vector per layer) so the inner loop runs across wavelengths and
+-- maps directly onto AVX2 / AVX-512 registers.  The instruction set is chosen
+-- at run time from what the CPU supports, with a plain C fallback.
+--
+-- Code is standard C with no dependence on Windows or tfoc.lib so it builds
+-- on Linux as well.
+--
+-- A workspace may be given a thread pool (TMM_SetThreadPool), in which case
+-- long spectra are split into fixed wavelength chunks evaluated in parallel.
+-- Every wavelength is computed independently, so results are bit-identical
+-- to the serial calculation whatever the number of threads.
+=========================================================================== */
+
+/* Make sure we have enough #includes to run */
+#include "tpool.h"
+
+/* Polarization modes -- same numerical values as POLARIZATION in tfoc.h */
+#define	TMM_TE				(0)
+#define	TMM_TM				(1)
+#define	TMM_UNPOLARIZED	(2)
+
+/* SIMD implementation actually in use (see TMM_SimdLevel) */
+#define	TMM_SIMD_SCALAR	(0)
+#define	TMM_SIMD_AVX2		(1)
+#define	TMM_SIMD_AVX512	(2)
+
+#define	TMM_MAX_LAYERS		(64)		/* Max layers including incident and substrate */
+
+/* Description of a stack over a wavelength grid.
+ * Layer 0 is the incident medium, layer nlayers-1 the substrate.  The complex
+ * index is N = n - ik (k >= 0 absorbing).  Thickness of layer 0 and the
+ * substrate are ignored.
+ */
+typedef struct _TMM_STACK {
+	int npt;						/* Number of wavelengths						*/
+	double *lambda;			/* [npt] wavelengths (nm)						*/
+	int nlayers;				/* Layers including incident and substrate	*/
+	double *z;					/* [nlayers] layer thickness (nm)			*/
+	double **n;					/* [nlayers] ptrs to [npt] real index		*/
+	double **k;					/* [nlayers] ptrs to [npt] extinction coef */
+} TMM_STACK;
+
+/* Workspace private to the engine (opaque) */
+typedef struct _TMM_WORK TMM_WORK;
+
+/* ===========================================================================
+-- Create / release a workspace for the reflectance engine
+--
+-- Usage: TMM_WORK *TMM_CreateWork(void);
+--        void TMM_FreeWork(TMM_WORK *work);
+--
+-- Return: TMM_CreateWork returns NULL if memory not available
+--
+-- Notes: A workspace may only be used by one thread at a time.  Independent
+--        calculations in separate threads each need their own workspace.
+=========================================================================== */
+TMM_WORK *TMM_CreateWork(void);
+void TMM_FreeWork(TMM_WORK *work);
+
+/* ===========================================================================
+-- Forget the cached partial products held in a workspace
+--
+-- Usage: void TMM_ClearCache(TMM_WORK *work);
+--
+-- Notes: The workspace remembers the last stack evaluated.  When successive
+--        calls differ only in the thickness of one interior layer, the
+--        products of the layer matrices above and below it are kept so
+--        each further call costs a single layer matrix.  Changes in array
+--        pointers, thicknesses, angle and mode are detected automatically;
+--        call this only if n, k or lambda values are modified in place.
+=========================================================================== */
+void TMM_ClearCache(TMM_WORK *work);
+
+/* ===========================================================================
+-- Attach a thread pool to a workspace for wavelength-parallel evaluation
+--
+-- Usage: void TMM_SetThreadPool(TMM_WORK *work, TPOOL *pool);
+--
+-- Inputs: work - workspace from TMM_CreateWork()
+--         pool - pool from TPool_Create() or TPool_Default(), NULL for serial
+--
+-- Notes: Spectra are split into at most one chunk per pool thread, each at
+--        least 128 points.  Each chunk keeps its own scratch space and
+--        partial-product cache, so single-layer updates stay cheap.  The
+--        workspace itself must still be used by only one thread at a time.
+=========================================================================== */
+void TMM_SetThreadPool(TMM_WORK *work, TPOOL *pool);
+
+/* ===========================================================================
+-- Calculate reflectance of a stack at every wavelength
+--
+-- Usage: int TMM_Reflectance(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R);
+--
+-- Inputs: work  - workspace from TMM_CreateWork()
+--         stack - layer and wavelength description (see TMM_STACK)
+--         theta - angle of incidence (radians) in the incident medium
+--         mode  - TMM_TE, TMM_TM or TMM_UNPOLARIZED
+--         R     - array of stack->npt values to receive the reflectance
+--
+-- Output: R[i] - absolute reflectance (0-1) at stack->lambda[i]
+--
+-- Return: 0 if successful
+--         1 ==> invalid parameters (NULL pointers, too few/many layers)
+=========================================================================== */
+int TMM_Reflectance(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R);
+
+/* ===========================================================================
+-- Calculate reflectance and dR/dz for every layer in the same pass
+--
+-- Usage: int TMM_ReflectanceDeriv(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R, double **dRdz);
+--
+-- Inputs: work, stack, theta, mode, R - as for TMM_Reflectance()
+--         dRdz - NULL, or array of stack->nlayers pointers, each either NULL
+--                (derivative not needed) or an array of stack->npt values
+--
+-- Output: R[i]       - absolute reflectance at stack->lambda[i]
+--         dRdz[j][i] - analytic dR/dz_j (per nm).  Zero for the incident
+--                      medium and substrate.
+--
+-- Return: 0 if successful
+--         1 ==> invalid parameters
+--         2 ==> unable to allocate workspace
+--
+-- Notes: Cost is roughly twice TMM_Reflectance() regardless of the number
+--        of layers, compared to one extra evaluation per layer for finite
+--        differences.
+=========================================================================== */
+int TMM_ReflectanceDeriv(TMM_WORK *work, TMM_STACK *stack, double theta, int mode, double *R, double **dRdz);
+
+/* ===========================================================================
+-- Query or override the SIMD implementation used by the engine
+--
+-- Usage: int TMM_SimdLevel(void);
+--        int TMM_SetSimdLevel(int level);
+--
+-- Inputs: level - TMM_SIMD_SCALAR, TMM_SIMD_AVX2 or TMM_SIMD_AVX512.  Value is
+--                 reduced to the best level the CPU actually supports.  Use
+--                 -1 to return to automatic detection.
+--
+-- Return: Level in use (after any change)
+=========================================================================== */
+int TMM_SimdLevel(void);
+int TMM_SetSimdLevel(int level);
+
+#endif		/* _TMM_H_LOADED */
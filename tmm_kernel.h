@@ -0,0 +1,489 @@
+/* tmm_kernel.h - Wavelength-parallel kernel body for the TMM engine
+ *
+ * This file is not a normal header.  It is included by tmm.c once per
+ * instruction set after defining the vector abstraction macros:
+ *
+ *   VLEN, VEC, VMASK, TMM_TARGET, TMM_FN(name)
+ *   VLOAD, VSTORE, VSET1, VADD, VSUB, VMUL, VDIV, VSQRT, VFMA, VMIN, VMAX
+ *   VABS, VROUND, VFLOOR, VLDEXP, VCMPLT, VCMPEQ, VOR, VSELECT
+ *
+ * All arithmetic is written in terms of these macros so the scalar, AVX2 and
+ * AVX-512 versions are the same source.  Every lane is an independent
+ * wavelength; there is no cross-lane communication.
+ */
+
+/* Coefficients shared by all instances are defined once in tmm.c */
+
+/* ===========================================================================
+-- Vector sin and cos of the same argument
+--
+-- Cody-Waite reduction by pi/2 followed by the fdlibm minimax kernels on
+-- [-pi/4,pi/4].  Accurate to a few ulp for |x| < 1E5, far beyond any phase
+-- thickness that matters for thin films.
+=========================================================================== */
+TMM_TARGET static void TMM_FN(vsincos)(VEC x, VEC *s, VEC *c) {
+	VEC k, r, z, ps, pc, m4, sv, cv;
+	VMASK swap, sneg, cneg;
+
+	k = VROUND(VMUL(x, VSET1(TMM_2_PI)));
+	r = VSUB(x, VMUL(k, VSET1(TMM_PIO2_1)));
+	r = VSUB(r, VMUL(k, VSET1(TMM_PIO2_2)));
+	r = VSUB(r, VMUL(k, VSET1(TMM_PIO2_3)));
+	z = VMUL(r,r);
+
+	ps = VFMA(z, VSET1(TMM_S6), VSET1(TMM_S5));
+	ps = VFMA(z, ps, VSET1(TMM_S4));
+	ps = VFMA(z, ps, VSET1(TMM_S3));
+	ps = VFMA(z, ps, VSET1(TMM_S2));
+	ps = VFMA(z, ps, VSET1(TMM_S1));
+	ps = VFMA(VMUL(z,r), ps, r);									/* sin(r) */
+
+	pc = VFMA(z, VSET1(TMM_C6), VSET1(TMM_C5));
+	pc = VFMA(z, pc, VSET1(TMM_C4));
+	pc = VFMA(z, pc, VSET1(TMM_C3));
+	pc = VFMA(z, pc, VSET1(TMM_C2));
+	pc = VFMA(z, pc, VSET1(TMM_C1));
+	pc = VFMA(VMUL(z,z), pc, VFMA(z, VSET1(-0.5), VSET1(1.0)));	/* cos(r) */
+
+	/* Quadrant k mod 4 determines swap and signs */
+	m4 = VSUB(k, VMUL(VSET1(4.0), VFLOOR(VMUL(k, VSET1(0.25)))));
+	swap = VOR(VCMPEQ(m4, VSET1(1.0)), VCMPEQ(m4, VSET1(3.0)));
+	sneg = VCMPLT(VSET1(1.5), m4);										/* 2,3 */
+	cneg = VOR(VCMPEQ(m4, VSET1(1.0)), VCMPEQ(m4, VSET1(2.0)));
+
+	sv = VSELECT(swap, pc, ps);
+	cv = VSELECT(swap, ps, pc);
+	*s = VSELECT(sneg, VSUB(VSET1(0.0), sv), sv);
+	*c = VSELECT(cneg, VSUB(VSET1(0.0), cv), cv);
+	return;
+}
+
+/* ===========================================================================
+-- Vector exp(x) with argument clamped to +/- TMM_EXP_MAX
+=========================================================================== */
+TMM_TARGET static VEC TMM_FN(vexp)(VEC x) {
+	VEC k, r, p;
+
+	x = VMIN(VMAX(x, VSET1(-TMM_EXP_MAX)), VSET1(TMM_EXP_MAX));
+	k = VROUND(VMUL(x, VSET1(TMM_LOG2E)));
+	r = VSUB(x, VMUL(k, VSET1(TMM_LN2_HI)));
+	r = VSUB(r, VMUL(k, VSET1(TMM_LN2_LO)));
+
+	/* Taylor series to r^12 -- |r| <= ln(2)/2 gives < 2E-16 error */
+	p = VFMA(r, VSET1(1.0/479001600.0), VSET1(1.0/39916800.0));
+	p = VFMA(r, p, VSET1(1.0/3628800.0));
+	p = VFMA(r, p, VSET1(1.0/362880.0));
+	p = VFMA(r, p, VSET1(1.0/40320.0));
+	p = VFMA(r, p, VSET1(1.0/5040.0));
+	p = VFMA(r, p, VSET1(1.0/720.0));
+	p = VFMA(r, p, VSET1(1.0/120.0));
+	p = VFMA(r, p, VSET1(1.0/24.0));
+	p = VFMA(r, p, VSET1(1.0/6.0));
+	p = VFMA(r, p, VSET1(0.5));
+	p = VFMA(r, p, VSET1(1.0));
+	p = VFMA(r, p, VSET1(1.0));
+	return VLDEXP(p, k);
+}
+
+/* ===========================================================================
+-- Principal complex square root (re >= 0) of (a + ib)
+=========================================================================== */
+TMM_TARGET static void TMM_FN(vcsqrt)(VEC a, VEC b, VEC *re, VEC *im) {
+	VEC m, t, u, sgn;
+	VMASK neg;
+
+	m = VSQRT(VFMA(a,a, VMUL(b,b)));
+	t = VSQRT(VMUL(VSET1(0.5), VADD(m, VABS(a))));			/* Larger of |re|,|im| */
+	u = VDIV(VABS(b), VMAX(VADD(t,t), VSET1(1E-300)));		/* The other */
+	sgn = VSELECT(VCMPLT(b, VSET1(0.0)), VSET1(-1.0), VSET1(1.0));
+	neg = VCMPLT(a, VSET1(0.0));
+	*re = VSELECT(neg, u, t);
+	*im = VMUL(sgn, VSELECT(neg, t, u));
+	return;
+}
+
+/* ===========================================================================
+-- Load VLEN doubles starting at p[i], padding past npt with the last value
+=========================================================================== */
+TMM_TARGET static VEC TMM_FN(vload_pad)(const double *p, int i, int npt) {
+	double tmp[VLEN];
+	int j;
+
+	if (i+VLEN <= npt) return VLOAD(p+i);
+	for (j=0; j<VLEN; j++) tmp[j] = (i+j < npt) ? p[i+j] : p[npt-1];
+	return VLOAD(tmp);
+}
+
+/* Complex multiply helpers (real and imaginary parts of a*b) */
+#define	CMR(ar,ai,br,bi)	VSUB(VMUL(ar,br), VMUL(ai,bi))
+#define	CMI(ar,ai,br,bi)	VFMA(ar,bi, VMUL(ai,br))
+
+/* ===========================================================================
+-- Reflectance of one polarization for a block of VLEN wavelengths
+--
+-- Inputs: stack - stack description
+--         i     - first wavelength index of the block
+--         k0    - 2 pi / lambda for the block
+--         s0r,s0i - N0 sin(theta) (complex) for the block
+--         oblique - if FALSE, s0 is zero and q = N directly
+--         tm    - if TRUE, TM admittance N^2/q is used in place of q
+--         save  - NULL, or scratch of TMM_SV_N*nlayers*VLEN doubles to hold
+--                 per-layer values for the derivative pass
+--         dR    - NULL, or nlayers*VLEN doubles to receive dR/dz for each
+--                 interior layer (VLEN values per layer).  Requires save.
+--         jc    - layer whose partial products are cached (if pc != NULL)
+--         pc    - NULL, or TMM_PC_N*npad doubles to receive the cached
+--                 prefix rows and suffix vector for layer jc.  Requires save.
+--         npad  - stride of the pc arrays (npt rounded up to TMM_VLEN_MAX)
+--
+-- Return: Block of reflectance values
+--
+-- Characteristic matrix of layer j (N = n - ik, q = N cos(theta_j)):
+--    M = | cos(d)            i sin(d)/eta |     d   = k0 q z
+--        | i eta sin(d)      cos(d)       |     eta = q (TE) or N^2/q (TM)
+-- and [B,C] = M_1 ... M_L [1, eta_s],  r = (eta_0 B - C) / (eta_0 B + C).
+-- The product is accumulated from the substrate upward as a matrix-vector
+-- sweep so only the running (B,C) vector is kept.
+--
+-- Derivatives use the adjoint row h_j = dr/d[B,C] M_1 ... M_(j-1), swept
+-- back down the stack, so that
+--    dr/dz_j = k0 q_j h_j (dM_j/dd) [B,C]_(j+1)
+-- with dM/dd = -sin(d) I + cos(d) A for the same A as M.  All layers come
+-- out of one extra pass over the saved per-layer values.
+--
+-- For the partial-product cache, r = (a.u)/(b.u) where u = M_jc [B,C]_(jc+1)
+-- and the rows a = [eta0,-1] M_1..M_(jc-1), b = [eta0,1] M_1..M_(jc-1).
+-- Storing a, b, the suffix vector and eta of layer jc lets refl_vary()
+-- recompute R for a new thickness of that layer alone.
+=========================================================================== */
+TMM_TARGET static VEC TMM_FN(refl_block)(TMM_STACK *stack, int i, VEC k0, VEC s0r, VEC s0i, int oblique, int tm, double *save, double *dR, int jc, double *pc, int npad) {
+	int j, npt, nl;
+	VEC nr, ni, qr, qi, er, ei, t, dr, di, den;
+	VEC sr, cr, em, ch, sh;
+	VEC cosr, cosi, sinr, sini, ivr, ivi;
+	VEC Br, Bi, Cr, Ci, tBr, tBi;
+	VEC m12r, m12i, m21r, m21i;
+	VEC e0r, e0i, ar, ai, br, bi;
+	VEC rr, ri, h1r, h1i, h2r, h2i, p1r, p1i, p2r, p2i, ur, ui;
+	VEC a1r, a1i, a2r, a2i, b1r, b1i, b2r, b2i;
+
+	npt = stack->npt;
+	nl  = stack->nlayers;
+
+/* Admittance of layer j (qr,qi) -> (er,ei); nr,ni is N = n - ik */
+#define	TMM_ADMITTANCE(jj)																	\
+	nr = TMM_FN(vload_pad)(stack->n[jj], i, npt);										\
+	ni = VSUB(VSET1(0.0), TMM_FN(vload_pad)(stack->k[jj], i, npt));				\
+	if (oblique) {																				\
+		TMM_FN(vcsqrt)(VSUB(VFMA(nr,nr,VMUL(ni,VSUB(VSET1(0.0),ni))), VSUB(VMUL(s0r,s0r),VMUL(s0i,s0i))), \
+							VSUB(VMUL(VSET1(2.0),VMUL(nr,ni)), VMUL(VSET1(2.0),VMUL(s0r,s0i))), &qr, &qi);	\
+		/* Keep the decaying branch for N = n - ik (Im(q) <= 0) */					\
+		t = VSELECT(VCMPLT(VSET1(0.0), qi), VSET1(-1.0), VSET1(1.0));				\
+		qr = VMUL(qr,t); qi = VMUL(qi,t);													\
+	} else {																						\
+		qr = nr; qi = ni;																		\
+	}																								\
+	if (tm) {																					\
+		ar = VSUB(VMUL(nr,nr), VMUL(ni,ni)); ai = VMUL(VSET1(2.0), VMUL(nr,ni));	\
+		den = VFMA(qr,qr, VMUL(qi,qi));														\
+		er = VDIV(VFMA(ar,qr, VMUL(ai,qi)), den);											\
+		ei = VDIV(VSUB(VMUL(ai,qr), VMUL(ar,qi)), den);									\
+	} else {																						\
+		er = qr; ei = qi;																		\
+	}
+
+/* Address of a saved per-layer value */
+#define	SV(jj,idx)	(save + ((jj)*TMM_SV_N + (idx))*VLEN)
+
+	/* Substrate */
+	TMM_ADMITTANCE(nl-1);
+	Br = VSET1(1.0); Bi = VSET1(0.0);
+	Cr = er;         Ci = ei;
+
+	for (j=nl-2; j>=1; j--) {
+		TMM_ADMITTANCE(j);
+
+		/* Phase thickness d = k0 z q */
+		t  = VMUL(k0, VSET1(stack->z[j]));
+		dr = VMUL(t, qr);
+		di = VMUL(t, qi);
+
+		/* cosh/sinh of di scaled by exp(-|di|).  A common factor in M does not
+		 * change r, and this never overflows for thick absorbing layers */
+		TMM_FN(vsincos)(dr, &sr, &cr);
+		em = TMM_FN(vexp)(VMUL(VSET1(-2.0), VABS(di)));
+		ch = VMUL(VSET1(0.5), VADD(VSET1(1.0), em));
+		sh = VMUL(VSELECT(VCMPLT(di, VSET1(0.0)), VSET1(-0.5), VSET1(0.5)), VSUB(VSET1(1.0), em));
+		cosr = VMUL(cr, ch); cosi = VMUL(VSUB(VSET1(0.0),sr), sh);		/* cos(dr + i di) */
+		sinr = VMUL(sr, ch); sini = VMUL(cr, sh);							/* sin(dr + i di) */
+
+		/* m21 = i eta sin(d) */
+		m21r = VSUB(VSET1(0.0), CMI(er,ei, sinr,sini));
+		m21i = CMR(er,ei, sinr,sini);
+		/* m12 = i sin(d) / eta */
+		den  = VDIV(VSET1(1.0), VFMA(er,er, VMUL(ei,ei)));
+		ivr  = VMUL(er, den);												/* 1/eta */
+		ivi  = VMUL(VSUB(VSET1(0.0),ei), den);
+		m12r = VSUB(VSET1(0.0), CMI(sinr,sini, ivr,ivi));
+		m12i = CMR(sinr,sini, ivr,ivi);
+
+		if (save != NULL) {
+			VSTORE(SV(j,TMM_SV_COSR), cosr); VSTORE(SV(j,TMM_SV_COSI), cosi);
+			VSTORE(SV(j,TMM_SV_SINR), sinr); VSTORE(SV(j,TMM_SV_SINI), sini);
+			VSTORE(SV(j,TMM_SV_ETAR), er);   VSTORE(SV(j,TMM_SV_ETAI), ei);
+			VSTORE(SV(j,TMM_SV_IVR),  ivr);  VSTORE(SV(j,TMM_SV_IVI),  ivi);
+			VSTORE(SV(j,TMM_SV_KQR),  VMUL(k0,qr)); VSTORE(SV(j,TMM_SV_KQI), VMUL(k0,qi));
+			VSTORE(SV(j,TMM_SV_BR),   Br);   VSTORE(SV(j,TMM_SV_BI),   Bi);
+			VSTORE(SV(j,TMM_SV_CR),   Cr);   VSTORE(SV(j,TMM_SV_CI),   Ci);
+		}
+
+		/* [B,C] <- M [B,C] */
+		tBr = VADD(CMR(cosr,cosi, Br,Bi), CMR(m12r,m12i, Cr,Ci));
+		tBi = VADD(CMI(cosr,cosi, Br,Bi), CMI(m12r,m12i, Cr,Ci));
+		ar  = VADD(CMR(m21r,m21i, Br,Bi), CMR(cosr,cosi, Cr,Ci));
+		ai  = VADD(CMI(m21r,m21i, Br,Bi), CMI(cosr,cosi, Cr,Ci));
+		Br = tBr; Bi = tBi; Cr = ar; Ci = ai;
+	}
+
+	/* Incident medium */
+	TMM_ADMITTANCE(0);
+#undef TMM_ADMITTANCE
+	e0r = er; e0i = ei;
+
+	/* r = (eta0 B - C)/(eta0 B + C);  R = |num|^2 / |den|^2 */
+	t  = CMR(e0r,e0i, Br,Bi);
+	dr = CMI(e0r,e0i, Br,Bi);
+	ar = VSUB(t, Cr);  ai = VSUB(dr, Ci);
+	br = VADD(t, Cr);  bi = VADD(dr, Ci);
+	den = VDIV(VSET1(1.0), VFMA(br,br, VMUL(bi,bi)));
+
+	if (dR != NULL) {
+		/* r itself = num conj(den) / |den|^2 */
+		rr = VMUL(VFMA(ar,br, VMUL(ai,bi)), den);
+		ri = VMUL(VSUB(VMUL(ai,br), VMUL(ar,bi)), den);
+
+		/* h_1 = dr/d[B,C] = 2 eta0 [C, -B] / (eta0 B + C)^2 */
+		ur = VMUL(VMUL(VSET1(2.0), VSUB(VMUL(br,br), VMUL(bi,bi))), VMUL(den,den));	/* conj(D^2)/|D|^4 */
+		ui = VMUL(VMUL(VSET1(-4.0), VMUL(br,bi)), VMUL(den,den));
+		t  = CMR(e0r,e0i, ur,ui);  dr = CMI(e0r,e0i, ur,ui);		/* 2 eta0 / D^2 */
+		h1r = CMR(t,dr, Cr,Ci);    h1i = CMI(t,dr, Cr,Ci);
+		h2r = VSUB(VSET1(0.0), CMR(t,dr, Br,Bi));
+		h2i = VSUB(VSET1(0.0), CMI(t,dr, Br,Bi));
+
+		for (j=1; j<=nl-2; j++) {
+			cosr = VLOAD(SV(j,TMM_SV_COSR)); cosi = VLOAD(SV(j,TMM_SV_COSI));
+			sinr = VLOAD(SV(j,TMM_SV_SINR)); sini = VLOAD(SV(j,TMM_SV_SINI));
+			er   = VLOAD(SV(j,TMM_SV_ETAR)); ei   = VLOAD(SV(j,TMM_SV_ETAI));
+			ivr  = VLOAD(SV(j,TMM_SV_IVR));  ivi  = VLOAD(SV(j,TMM_SV_IVI));
+			Br   = VLOAD(SV(j,TMM_SV_BR));   Bi   = VLOAD(SV(j,TMM_SV_BI));
+			Cr   = VLOAD(SV(j,TMM_SV_CR));   Ci   = VLOAD(SV(j,TMM_SV_CI));
+
+			/* p = (dM/dd) v:  p1 = -sin B + i cos/eta C,  p2 = i eta cos B - sin C */
+			t  = CMR(cosr,cosi, ivr,ivi);  dr = CMI(cosr,cosi, ivr,ivi);		/* cos/eta */
+			p1r = VSUB(VSUB(VSET1(0.0), CMR(sinr,sini, Br,Bi)), CMI(t,dr, Cr,Ci));
+			p1i = VSUB(CMR(t,dr, Cr,Ci), CMI(sinr,sini, Br,Bi));
+			t  = CMR(er,ei, cosr,cosi);    dr = CMI(er,ei, cosr,cosi);			/* eta cos */
+			p2r = VSUB(VSUB(VSET1(0.0), CMI(t,dr, Br,Bi)), CMR(sinr,sini, Cr,Ci));
+			p2i = VSUB(CMR(t,dr, Br,Bi), CMI(sinr,sini, Cr,Ci));
+
+			/* dr/dz = k0 q (h1 p1 + h2 p2);  dR/dz = 2 Re(conj(r) dr/dz) */
+			ur = VADD(CMR(h1r,h1i, p1r,p1i), CMR(h2r,h2i, p2r,p2i));
+			ui = VADD(CMI(h1r,h1i, p1r,p1i), CMI(h2r,h2i, p2r,p2i));
+			t  = VLOAD(SV(j,TMM_SV_KQR));  dr = VLOAD(SV(j,TMM_SV_KQI));
+			p1r = CMR(t,dr, ur,ui);        p1i = CMI(t,dr, ur,ui);
+			VSTORE(dR + j*VLEN, VMUL(VSET1(2.0), VFMA(rr,p1r, VMUL(ri,p1i))));
+
+			/* h <- h M:  h1' = h1 cos + h2 m21,  h2' = h1 m12 + h2 cos */
+			m21r = VSUB(VSET1(0.0), CMI(er,ei, sinr,sini));
+			m21i = CMR(er,ei, sinr,sini);
+			m12r = VSUB(VSET1(0.0), CMI(sinr,sini, ivr,ivi));
+			m12i = CMR(sinr,sini, ivr,ivi);
+			tBr = VADD(CMR(h1r,h1i, cosr,cosi), CMR(h2r,h2i, m21r,m21i));
+			tBi = VADD(CMI(h1r,h1i, cosr,cosi), CMI(h2r,h2i, m21r,m21i));
+			ur  = VADD(CMR(h1r,h1i, m12r,m12i), CMR(h2r,h2i, cosr,cosi));
+			ui  = VADD(CMI(h1r,h1i, m12r,m12i), CMI(h2r,h2i, cosr,cosi));
+			h1r = tBr; h1i = tBi; h2r = ur; h2i = ui;
+		}
+	}
+
+	if (pc != NULL) {
+		/* Rows a = [eta0,-1], b = [eta0,1] carried down through M_1 .. M_(jc-1) */
+		a1r = b1r = e0r; a1i = b1i = e0i;
+		a2r = VSET1(-1.0); b2r = VSET1(1.0); a2i = b2i = VSET1(0.0);
+		for (j=1; j<jc; j++) {
+			cosr = VLOAD(SV(j,TMM_SV_COSR)); cosi = VLOAD(SV(j,TMM_SV_COSI));
+			sinr = VLOAD(SV(j,TMM_SV_SINR)); sini = VLOAD(SV(j,TMM_SV_SINI));
+			er   = VLOAD(SV(j,TMM_SV_ETAR)); ei   = VLOAD(SV(j,TMM_SV_ETAI));
+			ivr  = VLOAD(SV(j,TMM_SV_IVR));  ivi  = VLOAD(SV(j,TMM_SV_IVI));
+			m21r = VSUB(VSET1(0.0), CMI(er,ei, sinr,sini));
+			m21i = CMR(er,ei, sinr,sini);
+			m12r = VSUB(VSET1(0.0), CMI(sinr,sini, ivr,ivi));
+			m12i = CMR(sinr,sini, ivr,ivi);
+
+			tBr = VADD(CMR(a1r,a1i, cosr,cosi), CMR(a2r,a2i, m21r,m21i));
+			tBi = VADD(CMI(a1r,a1i, cosr,cosi), CMI(a2r,a2i, m21r,m21i));
+			ur  = VADD(CMR(a1r,a1i, m12r,m12i), CMR(a2r,a2i, cosr,cosi));
+			ui  = VADD(CMI(a1r,a1i, m12r,m12i), CMI(a2r,a2i, cosr,cosi));
+			a1r = tBr; a1i = tBi; a2r = ur; a2i = ui;
+
+			tBr = VADD(CMR(b1r,b1i, cosr,cosi), CMR(b2r,b2i, m21r,m21i));
+			tBi = VADD(CMI(b1r,b1i, cosr,cosi), CMI(b2r,b2i, m21r,m21i));
+			ur  = VADD(CMR(b1r,b1i, m12r,m12i), CMR(b2r,b2i, cosr,cosi));
+			ui  = VADD(CMI(b1r,b1i, m12r,m12i), CMI(b2r,b2i, cosr,cosi));
+			b1r = tBr; b1i = tBi; b2r = ur; b2i = ui;
+		}
+		VSTORE(pc+TMM_PC_A1R*npad+i, a1r); VSTORE(pc+TMM_PC_A1I*npad+i, a1i);
+		VSTORE(pc+TMM_PC_A2R*npad+i, a2r); VSTORE(pc+TMM_PC_A2I*npad+i, a2i);
+		VSTORE(pc+TMM_PC_B1R*npad+i, b1r); VSTORE(pc+TMM_PC_B1I*npad+i, b1i);
+		VSTORE(pc+TMM_PC_B2R*npad+i, b2r); VSTORE(pc+TMM_PC_B2I*npad+i, b2i);
+		VSTORE(pc+TMM_PC_VBR*npad+i, VLOAD(SV(jc,TMM_SV_BR))); VSTORE(pc+TMM_PC_VBI*npad+i, VLOAD(SV(jc,TMM_SV_BI)));
+		VSTORE(pc+TMM_PC_VCR*npad+i, VLOAD(SV(jc,TMM_SV_CR))); VSTORE(pc+TMM_PC_VCI*npad+i, VLOAD(SV(jc,TMM_SV_CI)));
+		VSTORE(pc+TMM_PC_ETAR*npad+i, VLOAD(SV(jc,TMM_SV_ETAR))); VSTORE(pc+TMM_PC_ETAI*npad+i, VLOAD(SV(jc,TMM_SV_ETAI)));
+		VSTORE(pc+TMM_PC_IVR*npad+i,  VLOAD(SV(jc,TMM_SV_IVR)));  VSTORE(pc+TMM_PC_IVI*npad+i,  VLOAD(SV(jc,TMM_SV_IVI)));
+		VSTORE(pc+TMM_PC_KQR*npad+i,  VLOAD(SV(jc,TMM_SV_KQR)));  VSTORE(pc+TMM_PC_KQI*npad+i,  VLOAD(SV(jc,TMM_SV_KQI)));
+	}
+#undef SV
+
+	return VMUL(VFMA(ar,ar, VMUL(ai,ai)), den);
+}
+
+/* ===========================================================================
+-- Reflectance (and optionally dR/dz) over the whole wavelength array
+--
+-- Inputs: stack     - stack description
+--         sin_theta - sine of angle of incidence
+--         mode      - TMM_TE, TMM_TM or TMM_UNPOLARIZED
+--         R         - [npt] to receive reflectance
+--         dRdz      - NULL, or [nlayers] pointers (NULL or [npt]) for dR/dz
+--         scratch   - if dRdz or pc != NULL, (TMM_SV_N+2)*nlayers*TMM_VLEN_MAX doubles
+--         jc,pc,npad - NULL pc, or build the partial-product cache for layer jc
+--                     (2*TMM_PC_N*npad doubles, TE/first followed by TM)
+=========================================================================== */
+TMM_TARGET static void TMM_FN(refl_all)(TMM_STACK *stack, double sin_theta, int mode, double *R, double **dRdz, double *scratch, int jc, double *pc, int npad) {
+	int i, j, l, npt, nl;
+	int oblique;
+	double tmp[VLEN], *save, *d1, *d2;
+	VEC lam, k0, s0r, s0i, Rv;
+
+	npt = stack->npt;
+	nl  = stack->nlayers;
+	oblique = (sin_theta != 0.0);
+	if (! oblique && mode == TMM_UNPOLARIZED) mode = TMM_TE;	/* Identical at normal incidence */
+
+	save = d1 = d2 = NULL;
+	if (dRdz != NULL || pc != NULL) save = scratch;
+	if (dRdz != NULL) {
+		d1 = save + TMM_SV_N*nl*VLEN;
+		d2 = d1 + nl*VLEN;
+	}
+
+	for (i=0; i<npt; i+=VLEN) {
+		lam = TMM_FN(vload_pad)(stack->lambda, i, npt);
+		k0  = VDIV(VSET1(TMM_TWOPI), lam);
+
+		/* s0 = N0 sin(theta), N0 = n0 - i k0 of incident medium */
+		s0r = VMUL(VSET1(sin_theta), TMM_FN(vload_pad)(stack->n[0], i, npt));
+		s0i = VMUL(VSET1(-sin_theta), TMM_FN(vload_pad)(stack->k[0], i, npt));
+
+		if (mode == TMM_UNPOLARIZED) {
+			Rv = VMUL(VSET1(0.5), VADD(TMM_FN(refl_block)(stack, i, k0, s0r, s0i, oblique, FALSE, save, d1, jc, pc, npad),
+												TMM_FN(refl_block)(stack, i, k0, s0r, s0i, oblique, TRUE,  save, d2, jc, (pc != NULL) ? pc+TMM_PC_N*npad : NULL, npad)));
+			if (d1 != NULL) {
+				for (l=1; l<nl-1; l++) VSTORE(d1+l*VLEN, VMUL(VSET1(0.5), VADD(VLOAD(d1+l*VLEN), VLOAD(d2+l*VLEN))));
+			}
+		} else {
+			Rv = TMM_FN(refl_block)(stack, i, k0, s0r, s0i, oblique, mode == TMM_TM, save, d1, jc, pc, npad);
+		}
+
+		if (i+VLEN <= npt) {
+			VSTORE(R+i, Rv);
+		} else {
+			VSTORE(tmp, Rv);
+			for (j=0; i+j<npt; j++) R[i+j] = tmp[j];
+		}
+
+		if (d1 != NULL) {
+			for (l=1; l<nl-1; l++) {
+				if (dRdz[l] == NULL) continue;
+				for (j=0; j<VLEN && i+j<npt; j++) dRdz[l][i+j] = d1[l*VLEN+j];
+			}
+		}
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Reflectance using the partial-product cache when only layer jc changed
+--
+-- Inputs: npt  - number of wavelengths
+--         z    - new thickness of the cached layer
+--         npol - 1 (single polarization) or 2 (average of TE and TM)
+--         pc   - cache built by refl_all() (npol blocks of TMM_PC_N*npad)
+--         npad - stride of the cache arrays
+--         R    - [npt] to receive the reflectance
+--
+-- Cost is one layer matrix and two row-vector products per wavelength.
+=========================================================================== */
+TMM_TARGET static void TMM_FN(refl_vary)(int npt, double z, int npol, double *pc, int npad, double *R) {
+	int i, j, p;
+	double tmp[VLEN], *c;
+	VEC Rv, dr, di, sr, cr, em, ch, sh, t, u;
+	VEC cosr, cosi, sinr, sini, er, ei, ivr, ivi, m12r, m12i, m21r, m21i;
+	VEC vBr, vBi, vCr, vCi, u1r, u1i, u2r, u2i, nr, ni, dnr, dni;
+
+	for (i=0; i<npt; i+=VLEN) {
+		Rv = VSET1(0.0);
+		for (p=0; p<npol; p++) {
+			c = pc + p*TMM_PC_N*npad + i;
+			dr = VMUL(VSET1(z), VLOAD(c+TMM_PC_KQR*npad));
+			di = VMUL(VSET1(z), VLOAD(c+TMM_PC_KQI*npad));
+
+			/* Same scaled cos/sin as refl_block -- common factor cancels in R */
+			TMM_FN(vsincos)(dr, &sr, &cr);
+			em = TMM_FN(vexp)(VMUL(VSET1(-2.0), VABS(di)));
+			ch = VMUL(VSET1(0.5), VADD(VSET1(1.0), em));
+			sh = VMUL(VSELECT(VCMPLT(di, VSET1(0.0)), VSET1(-0.5), VSET1(0.5)), VSUB(VSET1(1.0), em));
+			cosr = VMUL(cr, ch); cosi = VMUL(VSUB(VSET1(0.0),sr), sh);
+			sinr = VMUL(sr, ch); sini = VMUL(cr, sh);
+
+			er  = VLOAD(c+TMM_PC_ETAR*npad); ei  = VLOAD(c+TMM_PC_ETAI*npad);
+			ivr = VLOAD(c+TMM_PC_IVR*npad);  ivi = VLOAD(c+TMM_PC_IVI*npad);
+			m21r = VSUB(VSET1(0.0), CMI(er,ei, sinr,sini));
+			m21i = CMR(er,ei, sinr,sini);
+			m12r = VSUB(VSET1(0.0), CMI(sinr,sini, ivr,ivi));
+			m12i = CMR(sinr,sini, ivr,ivi);
+
+			/* u = M_jc v */
+			vBr = VLOAD(c+TMM_PC_VBR*npad); vBi = VLOAD(c+TMM_PC_VBI*npad);
+			vCr = VLOAD(c+TMM_PC_VCR*npad); vCi = VLOAD(c+TMM_PC_VCI*npad);
+			u1r = VADD(CMR(cosr,cosi, vBr,vBi), CMR(m12r,m12i, vCr,vCi));
+			u1i = VADD(CMI(cosr,cosi, vBr,vBi), CMI(m12r,m12i, vCr,vCi));
+			u2r = VADD(CMR(m21r,m21i, vBr,vBi), CMR(cosr,cosi, vCr,vCi));
+			u2i = VADD(CMI(m21r,m21i, vBr,vBi), CMI(cosr,cosi, vCr,vCi));
+
+			/* num = a.u, den = b.u */
+			t  = VLOAD(c+TMM_PC_A1R*npad); u = VLOAD(c+TMM_PC_A1I*npad);
+			nr = CMR(t,u, u1r,u1i);  ni = CMI(t,u, u1r,u1i);
+			t  = VLOAD(c+TMM_PC_A2R*npad); u = VLOAD(c+TMM_PC_A2I*npad);
+			nr = VADD(nr, CMR(t,u, u2r,u2i));  ni = VADD(ni, CMI(t,u, u2r,u2i));
+			t  = VLOAD(c+TMM_PC_B1R*npad); u = VLOAD(c+TMM_PC_B1I*npad);
+			dnr = CMR(t,u, u1r,u1i);  dni = CMI(t,u, u1r,u1i);
+			t  = VLOAD(c+TMM_PC_B2R*npad); u = VLOAD(c+TMM_PC_B2I*npad);
+			dnr = VADD(dnr, CMR(t,u, u2r,u2i));  dni = VADD(dni, CMI(t,u, u2r,u2i));
+
+			Rv = VADD(Rv, VDIV(VFMA(nr,nr, VMUL(ni,ni)), VFMA(dnr,dnr, VMUL(dni,dni))));
+		}
+		if (npol > 1) Rv = VMUL(VSET1(0.5), Rv);
+
+		if (i+VLEN <= npt) {
+			VSTORE(R+i, Rv);
+		} else {
+			VSTORE(tmp, Rv);
+			for (j=0; i+j<npt; j++) R[i+j] = tmp[j];
+		}
+	}
+	return;
+}
+
+#undef	CMR
+#undef	CMI
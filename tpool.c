@@ -0,0 +1,342 @@
+/* tpool.c - Persistent pool of worker threads for data-parallel loops */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+#ifdef __linux__
+	#define _POSIX_C_SOURCE 200809L
+#endif
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+	#define STRICT						/* define before including windows.h for stricter type checking */
+	#include <windows.h>				/* master include file for Windows applications */
+	#undef _POSIX_
+		#include <process.h>			/* for process control fuctions (e.g. threads, programs) */
+	#define _POSIX_
+#elif __linux__
+	#include <pthread.h>
+	#include <unistd.h>
+	#include <time.h>
+#else
+	#error "Unsupported OS"
+#endif
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tpool.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef FALSE
+	#define	FALSE	(0)
+#endif
+
+#define	TPOOL_MAX_THREADS	(256)
+
+#ifdef _WIN32
+	typedef CRITICAL_SECTION	TP_MUTEX;
+	typedef CONDITION_VARIABLE	TP_COND;
+	typedef HANDLE					TP_THREAD;
+	#define	TP_THREAD_FNC		static unsigned __stdcall
+	#define	TP_MUTEX_INIT(m)	(InitializeCriticalSection(m), 0)
+	#define	TP_MUTEX_FREE(m)	DeleteCriticalSection(m)
+	#define	TP_LOCK(m)			EnterCriticalSection(m)
+	#define	TP_UNLOCK(m)		LeaveCriticalSection(m)
+	#define	TP_COND_INIT(c)	(InitializeConditionVariable(c), 0)
+	#define	TP_COND_FREE(c)
+	#define	TP_WAIT(c,m)		SleepConditionVariableCS((c), (m), INFINITE)
+	#define	TP_BROADCAST(c)	WakeAllConditionVariable(c)
+	#define	TP_SIGNAL(c)		WakeConditionVariable(c)
+#else
+	typedef pthread_mutex_t		TP_MUTEX;
+	typedef pthread_cond_t		TP_COND;
+	typedef pthread_t				TP_THREAD;
+	#define	TP_THREAD_FNC		static void *
+	#define	TP_MUTEX_INIT(m)	pthread_mutex_init((m), NULL)
+	#define	TP_MUTEX_FREE(m)	pthread_mutex_destroy(m)
+	#define	TP_LOCK(m)			pthread_mutex_lock(m)
+	#define	TP_UNLOCK(m)		pthread_mutex_unlock(m)
+	#define	TP_COND_INIT(c)	pthread_cond_init((c), NULL)
+	#define	TP_COND_FREE(c)	pthread_cond_destroy(c)
+	#define	TP_WAIT(c,m)		pthread_cond_wait((c), (m))
+	#define	TP_BROADCAST(c)	pthread_cond_broadcast(c)
+	#define	TP_SIGNAL(c)		pthread_cond_signal(c)
+#endif
+
+struct _TPOOL {
+	int nthreads;							/* Total including the caller				*/
+	int nworkers;							/* Worker threads actually started		*/
+	TP_THREAD *thread;					/* [nworkers] handles						*/
+
+	TP_MUTEX mutex;						/* Protects everything below				*/
+	TP_COND wake;							/* Signalled when a job is posted			*/
+	TP_COND done;							/* Signalled when last worker finishes	*/
+	int shutdown;							/* Workers should exit						*/
+	int busy;								/* A job is in progress						*/
+	unsigned long job;					/* Incremented for every job				*/
+	TPOOL_TASK *task;						/* Current job									*/
+	void *arg;
+	int ntask, next;						/* Tasks in job / next to hand out		*/
+	int active;								/* Workers that have not finished job	*/
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+TP_THREAD_FNC worker_thread(void *parm);
+static void run_tasks(TPOOL *pool);
+
+/* ------------------------------- */
+/* Locally defined global vars     */
+/* ------------------------------- */
+static TPOOL *default_pool = NULL;
+static int default_threads = 0;
+static int default_failed = FALSE;
+
+/* ===========================================================================
+-- Number of logical processors available to the process
+--
+-- Usage: int TPool_CPUCount(void);
+--
+-- Return: Processor count (at least 1)
+=========================================================================== */
+int TPool_CPUCount(void) {
+	int ncpu;
+
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	ncpu = info.dwNumberOfProcessors;
+#else
+	ncpu = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return (ncpu < 1) ? 1 : ncpu;
+}
+
+/* ===========================================================================
+-- Monotonic wall-clock time
+--
+-- Usage: double TPool_Timer(void);
+--
+-- Return: Seconds from an arbitrary origin
+=========================================================================== */
+double TPool_Timer(void) {
+#ifdef _WIN32
+	LARGE_INTEGER count, freq;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&freq);
+	return (double) count.QuadPart / (double) freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1E-9*ts.tv_nsec;
+#endif
+}
+
+/* ===========================================================================
+-- Hand out tasks of the current job until none remain
+--
+-- Usage: void run_tasks(TPOOL *pool);
+--
+-- Notes: Called with the pool mutex held; returns with it held.  The mutex
+--        is released while each task runs.
+=========================================================================== */
+static void run_tasks(TPOOL *pool) {
+	int itask;
+
+	while (pool->next < pool->ntask) {
+		itask = pool->next++;
+		TP_UNLOCK(&pool->mutex);
+		pool->task(pool->arg, itask);
+		TP_LOCK(&pool->mutex);
+	}
+	return;
+}
+
+/* ===========================================================================
+-- Worker thread -- waits for jobs and runs tasks until told to exit
+=========================================================================== */
+TP_THREAD_FNC worker_thread(void *parm) {
+	TPOOL *pool = (TPOOL *) parm;
+	unsigned long seen = 0;				/* Pool starts at job 0, so never miss the first */
+
+	TP_LOCK(&pool->mutex);
+	while (TRUE) {
+		while (! pool->shutdown && pool->job == seen) TP_WAIT(&pool->wake, &pool->mutex);
+		if (pool->shutdown) break;
+		seen = pool->job;
+		run_tasks(pool);
+		if (--pool->active == 0) TP_SIGNAL(&pool->done);
+	}
+	TP_UNLOCK(&pool->mutex);
+
+	return 0;
+}
+
+/* ===========================================================================
+-- Create or destroy a thread pool
+--
+-- Usage: TPOOL *TPool_Create(int nthreads);
+--        void TPool_Free(TPOOL *pool);
+--
+-- Inputs: nthreads - total threads including the caller (<= 0 for processors)
+--
+-- Return: TPool_Create returns NULL on error.  If some worker threads cannot
+--         be started the pool is still returned with fewer threads.
+=========================================================================== */
+TPOOL *TPool_Create(int nthreads) {
+	static char *rname = "TPool_Create";
+	TPOOL *pool;
+	int i;
+
+	if (nthreads <= 0) nthreads = TPool_CPUCount();
+	if (nthreads > TPOOL_MAX_THREADS) nthreads = TPOOL_MAX_THREADS;
+
+	if ( (pool = calloc(1, sizeof(*pool))) == NULL) return NULL;
+	if (nthreads > 1 && (pool->thread = calloc(nthreads-1, sizeof(*pool->thread))) == NULL) {
+		free(pool);
+		return NULL;
+	}
+	if (TP_MUTEX_INIT(&pool->mutex) != 0 || TP_COND_INIT(&pool->wake) != 0 || TP_COND_INIT(&pool->done) != 0) {
+		fprintf(stderr, "ERROR: %s: unable to create synchronization objects\n", rname); fflush(stderr);
+		free(pool->thread); free(pool);
+		return NULL;
+	}
+
+	for (i=0; i<nthreads-1; i++) {
+#ifdef _WIN32
+		pool->thread[i] = (HANDLE) _beginthreadex(NULL, 0, worker_thread, pool, 0, NULL);
+		if (pool->thread[i] == 0) break;
+#else
+		if (pthread_create(&pool->thread[i], NULL, worker_thread, pool) != 0) break;
+#endif
+	}
+	if (i < nthreads-1) {
+		fprintf(stderr, "WARNING: %s: only able to start %d of %d worker threads\n", rname, i, nthreads-1); fflush(stderr);
+	}
+	pool->nworkers = i;
+	pool->nthreads = i+1;
+
+	return pool;
+}
+
+void TPool_Free(TPOOL *pool) {
+	int i;
+
+	if (pool == NULL) return;
+
+	TP_LOCK(&pool->mutex);
+	pool->shutdown = TRUE;
+	TP_BROADCAST(&pool->wake);
+	TP_UNLOCK(&pool->mutex);
+
+	for (i=0; i<pool->nworkers; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(pool->thread[i], INFINITE);
+		CloseHandle(pool->thread[i]);
+#else
+		pthread_join(pool->thread[i], NULL);
+#endif
+	}
+
+	TP_COND_FREE(&pool->done);
+	TP_COND_FREE(&pool->wake);
+	TP_MUTEX_FREE(&pool->mutex);
+	if (pool == default_pool) default_pool = NULL;
+	free(pool->thread);
+	free(pool);
+	return;
+}
+
+/* ===========================================================================
+-- Number of threads (including the caller) that a pool can use
+--
+-- Usage: int TPool_Threads(TPOOL *pool);
+=========================================================================== */
+int TPool_Threads(TPOOL *pool) {
+	return (pool == NULL) ? 1 : pool->nthreads;
+}
+
+/* ===========================================================================
+-- Run ntask tasks across the pool and wait for all to complete
+--
+-- Usage: int TPool_Run(TPOOL *pool, int ntask, TPOOL_TASK *task, void *arg);
+--
+-- Inputs: pool  - thread pool (NULL to run serially)
+--         ntask - number of tasks
+--         task  - routine called as task(arg, itask) for itask 0..ntask-1
+--         arg   - passed to every task
+--
+-- Return: 0 if successful, 1 on invalid parameters
+--
+-- Notes: If the pool is already running a job (another thread, or a call
+--        from inside a task) the tasks are run serially by the caller.
+=========================================================================== */
+int TPool_Run(TPOOL *pool, int ntask, TPOOL_TASK *task, void *arg) {
+	int i;
+
+	if (task == NULL) return 1;
+	if (ntask <= 0) return 0;
+
+	if (pool != NULL && pool->nworkers > 0 && ntask > 1) {
+		TP_LOCK(&pool->mutex);
+		if (! pool->busy) {
+			pool->busy   = TRUE;
+			pool->task   = task;
+			pool->arg    = arg;
+			pool->ntask  = ntask;
+			pool->next   = 0;
+			pool->active = pool->nworkers;
+			pool->job++;
+			TP_BROADCAST(&pool->wake);
+
+			run_tasks(pool);								/* Caller works too */
+			while (pool->active > 0) TP_WAIT(&pool->done, &pool->mutex);
+
+			pool->busy = FALSE;
+			pool->task = NULL;
+			TP_UNLOCK(&pool->mutex);
+			return 0;
+		}
+		TP_UNLOCK(&pool->mutex);
+	}
+
+	/* Serial -- no pool, no workers, or pool already in use */
+	for (i=0; i<ntask; i++) task(arg, i);
+	return 0;
+}
+
+/* ===========================================================================
+-- Process-wide shared pool
+--
+-- Usage: TPOOL *TPool_Default(void);
+--        int TPool_SetDefaultThreads(int nthreads);
+--
+-- Return: TPool_Default returns the shared pool (NULL if it cannot be created)
+--         TPool_SetDefaultThreads returns 0 if recorded, 1 if pool exists
+=========================================================================== */
+TPOOL *TPool_Default(void) {
+	if (default_pool == NULL && ! default_failed) {
+		if ( (default_pool = TPool_Create(default_threads)) == NULL) default_failed = TRUE;
+	}
+	return default_pool;
+}
+
+int TPool_SetDefaultThreads(int nthreads) {
+	if (default_pool != NULL) return 1;
+	default_threads = nthreads;
+	default_failed = FALSE;
+	return 0;
+}
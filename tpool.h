@@ -0,0 +1,106 @@
+#ifndef _TPOOL_H_LOADED
+#define _TPOOL_H_LOADED
+
+/* ===========================================================================
+-- Persistent pool of worker threads for data-parallel loops.
+--
+-- A pool is created once (normally sized to the number of processors) and
+-- reused for every parallel loop.  TPool_Run() splits a job into ntask
+-- independent tasks, wakes the workers, runs tasks in the calling thread as
+-- well, and returns only when every task has finished.  Tasks are handed out
+-- dynamically, so which thread runs a given task is not fixed; callers that
+-- need deterministic results must make each task's output depend only on
+-- its index (for example a fixed range of wavelengths), never on the thread.
+--
+-- If the pool is already busy with another job, or TPool_Run() is called
+-- from inside one of its own tasks, the tasks are simply run serially in the
+-- calling thread.  Nothing can deadlock, but only one job uses the workers
+-- at a time.
+--
+-- TPool_Default() returns a process-wide pool shared by the fitter and any
+-- batch tools so the program never holds more than one set of workers.
+=========================================================================== */
+
+typedef struct _TPOOL TPOOL;							/* Opaque */
+
+/* Routine executed for each task.  itask runs from 0 to ntask-1 */
+typedef void TPOOL_TASK(void *arg, int itask);
+
+/* ===========================================================================
+-- Create or destroy a thread pool
+--
+-- Usage: TPOOL *TPool_Create(int nthreads);
+--        void TPool_Free(TPOOL *pool);
+--
+-- Inputs: nthreads - total threads to use including the caller of
+--                    TPool_Run().  <= 0 selects the number of processors.
+--
+-- Return: TPool_Create returns NULL on error.  A pool of one thread is
+--         valid and simply runs every job in the caller.
+--
+-- Notes: TPool_Free() must not be called while a job is running.
+=========================================================================== */
+TPOOL *TPool_Create(int nthreads);
+void TPool_Free(TPOOL *pool);
+
+/* ===========================================================================
+-- Number of threads (including the caller) that a pool can use
+--
+-- Usage: int TPool_Threads(TPOOL *pool);
+--
+-- Return: Thread count, 1 if pool is NULL
+=========================================================================== */
+int TPool_Threads(TPOOL *pool);
+
+/* ===========================================================================
+-- Run ntask tasks across the pool and wait for all to complete
+--
+-- Usage: int TPool_Run(TPOOL *pool, int ntask, TPOOL_TASK *task, void *arg);
+--
+-- Inputs: pool  - pool from TPool_Create() or TPool_Default().  NULL runs
+--                 the tasks serially in the calling thread.
+--         ntask - number of tasks
+--         task  - routine called as task(arg, itask)
+--         arg   - passed unchanged to every task
+--
+-- Return: 0 if successful, 1 on invalid parameters
+=========================================================================== */
+int TPool_Run(TPOOL *pool, int ntask, TPOOL_TASK *task, void *arg);
+
+/* ===========================================================================
+-- Process-wide shared pool
+--
+-- Usage: TPOOL *TPool_Default(void);
+--        int TPool_SetDefaultThreads(int nthreads);
+--
+-- Inputs: nthreads - size for the shared pool (<= 0 for number of processors)
+--
+-- Return: TPool_Default returns the shared pool, created on first call, or
+--         NULL if it could not be created (callers then run serially).
+--         TPool_SetDefaultThreads returns 0 if the size was recorded, or
+--         1 if the shared pool already exists and was left unchanged.
+--
+-- Notes: The first call to TPool_Default() should be made from the main
+--        thread before other threads can use it.  Call
+--        TPool_SetDefaultThreads() before that if the size is configured.
+=========================================================================== */
+TPOOL *TPool_Default(void);
+int TPool_SetDefaultThreads(int nthreads);
+
+/* ===========================================================================
+-- Number of logical processors available to the process
+--
+-- Usage: int TPool_CPUCount(void);
+=========================================================================== */
+int TPool_CPUCount(void);
+
+/* ===========================================================================
+-- Monotonic wall-clock time for time budgets of parallel work
+--
+-- Usage: double TPool_Timer(void);
+--
+-- Return: Seconds from an arbitrary origin (high resolution)
+=========================================================================== */
+double TPool_Timer(void);
+
+#endif		/* _TPOOL_H_LOADED */
@@ -0,0 +1,164 @@
+/* tsconvert.c - Convert FilmMeasure time series between the binary and text layouts */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tseries.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef	TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef	FALSE
+	#define	FALSE	(0)
+#endif
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static void usage(void);
+
+/* ===========================================================================
+-- Usage: tsconvert [-q] [-double] [-raw | -refl] [-fits file] input output
+--
+-- Copies a time series record by record.  The layout of the output is set
+-- by its name as for FilmMeasure (*.csv is the original text layout,
+-- anything else binary), so the same tool converts binary files back to
+-- CSV for existing scripts, or old CSV files to binary.
+--
+-- The text layout has no fit values; -fits writes those of a binary input
+-- to a separate CSV file as time,index,<names...>.  Binary output holds
+-- float values unless -double is given.  Whether the rows are raw counts
+-- is taken from a binary input, and otherwise guessed from the first row
+-- unless -raw or -refl is given.
+=========================================================================== */
+int main(int argc, char *argv[]) {
+
+	char *infile, *outfile, *fitfile, **names;
+	int i, rc, verbose, value_bytes, raw, npt, nfit;
+	int64_t count, start_time;
+	double time, *row, *ref, *dark, *tref, *fit;
+	FILE *funit;
+	TSERIES *in, *out;
+
+	infile = outfile = fitfile = NULL;
+	value_bytes = sizeof(float);
+	raw = -1;
+	verbose = TRUE;
+	for (i=1; i<argc; i++) {
+		if (strcmp(argv[i], "-q") == 0) {
+			verbose = FALSE;
+		} else if (strcmp(argv[i], "-double") == 0) {
+			value_bytes = sizeof(double);
+		} else if (strcmp(argv[i], "-raw") == 0) {
+			raw = TRUE;
+		} else if (strcmp(argv[i], "-refl") == 0) {
+			raw = FALSE;
+		} else if (strcmp(argv[i], "-fits") == 0 && i+1 < argc) {
+			fitfile = argv[++i];
+		} else if (*argv[i] == '-' || i < argc-2) {
+			usage();
+			return 1;
+		} else if (infile == NULL) {
+			infile = argv[i];
+		} else {
+			outfile = argv[i];
+		}
+	}
+	if (infile == NULL || outfile == NULL) {
+		usage();
+		return 1;
+	}
+
+	if ( (in = TSeries_Open(infile)) == NULL) return 2;
+	npt  = TSeries_Points(in);
+	nfit = TSeries_Fits(in, &names);
+	TSeries_Header(in, &ref, &dark, &tref, &start_time);
+	if (raw < 0) raw = TSeries_Raw(in);
+
+	if ( (row = malloc(npt*sizeof(double))) == NULL) {
+		fprintf(stderr, "ERROR: unable to allocate memory\n"); fflush(stderr);
+		TSeries_Close(in);
+		return 3;
+	}
+
+	funit = NULL;
+	if (fitfile != NULL && nfit > 0) {
+		if ( (funit = fopen(fitfile, "w")) == NULL) {
+			fprintf(stderr, "ERROR: unable to create \"%s\"\n", fitfile); fflush(stderr);
+			free(row); TSeries_Close(in);
+			return 2;
+		}
+		fprintf(funit, "# time,index");
+		for (i=0; i<nfit; i++) fprintf(funit, ",%s", names[i]);
+		fprintf(funit, "\n");
+	} else if (fitfile != NULL) {
+		fprintf(stderr, "WARNING: \"%s\" holds no fit values\n", infile); fflush(stderr);
+	}
+
+	/* Output is created at the first row so a text input can be classified */
+	out = NULL;
+	rc = 0;
+	for (count=0; (rc = TSeries_Read(in, &time, row)) == 0 || rc == 2; count++) {
+		if (rc == 2) { fprintf(stderr, "WARNING: spectrum %lld is short; missing values set to 0\n", (long long) count); fflush(stderr); }
+		if (out == NULL) {
+			if (raw < 0) raw = TSeries_IsRaw(in, row);
+			if ( (out = TSeries_Create(outfile, npt, ref, dark, tref, TSeries_Lambda(in), raw, nfit, names, value_bytes, start_time)) == NULL) {
+				rc = 2;
+				break;
+			}
+		}
+		fit = TSeries_FitValues(in);
+		if (TSeries_Write(out, time, fit, row) != 0) {
+			fprintf(stderr, "ERROR: failed writing \"%s\"\n", outfile); fflush(stderr);
+			rc = 2;
+			break;
+		}
+		if (funit != NULL) {
+			fprintf(funit, "%.3f,%lld", time, (long long) count);
+			for (i=0; i<nfit; i++) fprintf(funit, ",%g", fit[i]);
+			fprintf(funit, "\n");
+		}
+	}
+	if (rc < 0) rc = 3;
+	if (rc == 1) rc = 0;												/* Normal end of file */
+
+	if (out == NULL && rc == 0) {
+		fprintf(stderr, "WARNING: \"%s\" holds no spectra; nothing written\n", infile); fflush(stderr);
+	} else if (verbose && rc == 0) {
+		fprintf(stderr, "%lld spectra (%d points, %s) copied to \"%s\"\n", (long long) count, npt, raw ? "raw counts" : "reflectance", outfile);
+		fflush(stderr);
+	}
+
+	if (funit != NULL) fclose(funit);
+	TSeries_Close(out);
+	TSeries_Close(in);
+	free(row);
+	return rc;
+}
+
+static void usage(void) {
+	fprintf(stderr, "Usage: tsconvert [-q] [-double] [-raw | -refl] [-fits file] input output\n"
+						 "   output    *.csv for the text layout, any other name for binary\n"
+						 "   -double   binary values as double (default float)\n"
+						 "   -raw      spectra are raw counts (default: from the file, or decided from the first)\n"
+						 "   -refl     spectra are reflectance\n"
+						 "   -fits     also write the fit values of a binary input to this CSV file\n");
+	fflush(stderr);
+	return;
+}
@@ -0,0 +1,656 @@
+/* tseries.c - Reading and writing of FilmMeasure time-series files */
+
+/* ------------------------------ */
+/* Feature test macros            */
+/* ------------------------------ */
+#define _CRT_SECURE_NO_WARNINGS
+
+/* ------------------------------ */
+/* Standard include files         */
+/* ------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <stdarg.h>
+
+/* ------------------------------ */
+/* Local include files            */
+/* ------------------------------ */
+#include "tseries.h"
+
+/* ------------------------------- */
+/* My local typedef's and defines  */
+/* ------------------------------- */
+#ifndef	TRUE
+	#define	TRUE	(1)
+#endif
+#ifndef	FALSE
+	#define	FALSE	(0)
+#endif
+#define	MAX(a,b)	(((a) > (b)) ? (a) : (b))
+#define	MIN(a,b)	(((a) < (b)) ? (a) : (b))
+
+#define	LINE_CHUNK	(65536)						/* Growth of the line buffer */
+
+#ifdef _WIN32										/* Files well beyond 2 GB */
+	#define	fseek64	_fseeki64
+	#define	ftell64	_ftelli64
+#else
+	#define	fseek64	fseeko
+	#define	ftell64	ftello
+#endif
+
+/* Fixed part of the binary header (layout in tseries.h) */
+typedef struct _TSERIES_HEADER {
+	char magic[8];
+	int32_t version, npt, nfit, value_bytes, raw, header_bytes, record_bytes, reserved;
+	int64_t start_time, spare[2];
+} TSERIES_HEADER;
+
+struct _TSERIES {
+	FILE *funit;
+	int binary;										/* Binary records rather than text rows */
+	int writing;									/* Created by TSeries_Create() or TSeries_Encoder() */
+	char *line;										/* Current line (grows as needed) */
+	size_t dim;
+	int64_t data_start;							/* Text: offset of the first measurement row */
+	int version;									/* Binary: 1 had int64 record times */
+	int npt, nfit, raw, value_bytes;
+	int64_t start_time;
+	int64_t header_bytes, record_bytes;		/* Binary: offset of record 0 and record size */
+	unsigned char *record;						/* Binary: one record */
+	char *out;										/* Encoded header or text row */
+	size_t out_dim, out_len;
+	char names[TSERIES_MAX_FIT][TSERIES_NAME_LENGTH];
+	char *name_ptr[TSERIES_MAX_FIT];
+	double fit[TSERIES_MAX_FIT];				/* Fit values of the last record read */
+	double *ref, *dark, *tref, *lambda;		/* [npt] header rows */
+};
+
+/* ------------------------------- */
+/* My internal function prototypes */
+/* ------------------------------- */
+static TSERIES *open_text(TSERIES *ts, char *path);
+static TSERIES *open_binary(TSERIES *ts, char *path);
+static int alloc_header(TSERIES *ts);
+static int record_size(TSERIES *ts);
+static int is_text_name(char *path);
+static int out_reserve(TSERIES *ts, size_t len);
+static int out_printf(TSERIES *ts, char *fmt, ...);
+static int read_line(TSERIES *ts);
+static int parse_row(char *line, double *time, int npt, double *row);
+static int count_values(char *line);
+
+/* ===========================================================================
+-- Open a time series and read its header rows
+=========================================================================== */
+TSERIES *TSeries_Open(char *path) {
+	static char *rname = "TSeries_Open";
+	TSERIES *ts;
+	char magic[sizeof(TSERIES_MAGIC)-1];
+
+	if ( (ts = calloc(1, sizeof(*ts))) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		return NULL;
+	}
+	if ( (ts->funit = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to open \"%s\"\n", rname, path); fflush(stderr);
+		free(ts);
+		return NULL;
+	}
+
+	/* The magic string decides the format */
+	if (fread(magic, 1, sizeof(magic), ts->funit) == sizeof(magic) && memcmp(magic, TSERIES_MAGIC, sizeof(magic)) == 0) {
+		rewind(ts->funit);
+		return open_binary(ts, path);
+	}
+	rewind(ts->funit);
+	return open_text(ts, path);
+}
+
+static TSERIES *open_text(TSERIES *ts, char *path) {
+	static char *rname = "TSeries_Open";
+	double **hdr[4], start_time;
+	int i, rc;
+
+	/* Skip comments; the first row sets the number of points */
+	hdr[0] = &ts->ref; hdr[1] = &ts->dark; hdr[2] = &ts->tref; hdr[3] = &ts->lambda;
+	for (i=0; i<4; i++) {
+		do {
+			if ( (rc = read_line(ts)) != 0) break;
+		} while (*ts->line == '#');
+		if (rc != 0) {
+			fprintf(stderr, "ERROR: %s: \"%s\" ends within the header rows\n", rname, path); fflush(stderr);
+			TSeries_Close(ts);
+			return NULL;
+		}
+		if (i == 0) {
+			ts->npt = count_values(ts->line);
+			if (ts->npt <= 0) break;
+			if (alloc_header(ts) != 0) {
+				TSeries_Close(ts);
+				return NULL;
+			}
+		}
+		if (parse_row(ts->line, (i == 0) ? &start_time : NULL, ts->npt, *hdr[i]) != 0 || count_values(ts->line) != ts->npt) break;
+		if (i == 0) ts->start_time = (int64_t) start_time;
+	}
+	if (i < 4) {
+		fprintf(stderr, "ERROR: %s: header row %d of \"%s\" does not match the others\n", rname, i+1, path); fflush(stderr);
+		TSeries_Close(ts);
+		return NULL;
+	}
+	ts->data_start = ftell64(ts->funit);
+	ts->raw = -1;										/* Not recorded in the text layout */
+	return ts;
+}
+
+static TSERIES *open_binary(TSERIES *ts, char *path) {
+	static char *rname = "TSeries_Open";
+	TSERIES_HEADER hdr;
+	int i, ok;
+
+	ok = fread(&hdr, sizeof(hdr), 1, ts->funit) == 1 && (hdr.version == 1 || hdr.version == TSERIES_VERSION) &&
+		  hdr.npt > 0 && hdr.nfit >= 0 && hdr.nfit <= TSERIES_MAX_FIT &&
+		  (hdr.value_bytes == sizeof(float) || hdr.value_bytes == sizeof(double));
+	if (ok) {
+		ts->binary      = TRUE;
+		ts->version     = hdr.version;
+		ts->npt         = hdr.npt;
+		ts->nfit        = hdr.nfit;
+		ts->raw         = hdr.raw;
+		ts->value_bytes = hdr.value_bytes;
+		ts->start_time  = hdr.start_time;
+		ok = record_size(ts) == 0 && ts->header_bytes == hdr.header_bytes && ts->record_bytes == hdr.record_bytes;
+	}
+	if (! ok) {
+		fprintf(stderr, "ERROR: %s: \"%s\" has an unsupported or damaged header\n", rname, path); fflush(stderr);
+		TSeries_Close(ts);
+		return NULL;
+	}
+	if (alloc_header(ts) != 0) {
+		TSeries_Close(ts);
+		return NULL;
+	}
+
+	ok = TRUE;
+	for (i=0; ok && i<ts->nfit; i++) {
+		ok = fread(ts->names[i], TSERIES_NAME_LENGTH, 1, ts->funit) == 1;
+		ts->names[i][TSERIES_NAME_LENGTH-1] = '\0';
+	}
+	ok = ok && fread(ts->ref,    sizeof(double), ts->npt, ts->funit) == (size_t) ts->npt;
+	ok = ok && fread(ts->dark,   sizeof(double), ts->npt, ts->funit) == (size_t) ts->npt;
+	ok = ok && fread(ts->tref,   sizeof(double), ts->npt, ts->funit) == (size_t) ts->npt;
+	ok = ok && fread(ts->lambda, sizeof(double), ts->npt, ts->funit) == (size_t) ts->npt;
+	if (! ok) {
+		fprintf(stderr, "ERROR: %s: \"%s\" ends within the header\n", rname, path); fflush(stderr);
+		TSeries_Close(ts);
+		return NULL;
+	}
+	return ts;
+}
+
+/* ===========================================================================
+-- Create a time series and write its header
+=========================================================================== */
+TSERIES *TSeries_Create(char *path, int npt, double *ref, double *dark, double *tref, double *lambda,
+								int raw, int nfit, char **names, int value_bytes, int64_t start_time) {
+	static char *rname = "TSeries_Create";
+	TSERIES *ts;
+	void *data;
+	size_t len;
+
+	if ( (ts = TSeries_Encoder(path, npt, ref, dark, tref, lambda, raw, nfit, names, value_bytes, start_time)) == NULL) return NULL;
+	if ( (ts->funit = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to create \"%s\"\n", rname, path); fflush(stderr);
+		TSeries_Close(ts);
+		return NULL;
+	}
+	if (TSeries_EncodeHeader(ts, &data, &len) != 0 || fwrite(data, 1, len, ts->funit) != len || fflush(ts->funit) != 0) {
+		fprintf(stderr, "ERROR: %s: unable to write the header of \"%s\"\n", rname, path); fflush(stderr);
+		TSeries_Close(ts);
+		return NULL;
+	}
+	return ts;
+}
+
+/* ===========================================================================
+-- Append one measurement (single write and flush)
+=========================================================================== */
+int TSeries_Write(TSERIES *ts, double time, double *fit, double *row) {
+	void *data;
+	size_t len;
+
+	if (ts == NULL || ts->funit == NULL || ! ts->writing) return 1;
+	if (TSeries_EncodeRecord(ts, time, fit, row, &data, &len) != 0) return 2;
+	if (fwrite(data, 1, len, ts->funit) != len) return 2;
+	return (fflush(ts->funit) != 0 || ferror(ts->funit)) ? 2 : 0;
+}
+
+/* ===========================================================================
+-- Encoder -- the bytes of a time series without a file of its own
+=========================================================================== */
+TSERIES *TSeries_Encoder(char *path, int npt, double *ref, double *dark, double *tref, double *lambda,
+								 int raw, int nfit, char **names, int value_bytes, int64_t start_time) {
+	static char *rname = "TSeries_Encoder";
+	TSERIES *ts;
+	int i;
+
+	if (npt <= 0 || nfit < 0 || nfit > TSERIES_MAX_FIT || (value_bytes != sizeof(float) && value_bytes != sizeof(double))) {
+		fprintf(stderr, "ERROR: %s: invalid parameters (npt=%d, nfit=%d, value_bytes=%d)\n", rname, npt, nfit, value_bytes); fflush(stderr);
+		return NULL;
+	}
+	if ( (ts = calloc(1, sizeof(*ts))) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		return NULL;
+	}
+	ts->writing     = TRUE;
+	ts->binary      = ! is_text_name(path);
+	ts->npt         = npt;
+	ts->nfit        = ts->binary ? nfit : 0;
+	ts->raw         = raw ? 1 : 0;
+	ts->value_bytes = value_bytes;
+	ts->start_time  = start_time;
+	if (alloc_header(ts) != 0 || (ts->binary && record_size(ts) != 0)) {
+		TSeries_Close(ts);
+		return NULL;
+	}
+	for (i=0; i<npt; i++) {
+		ts->ref[i]    = ref[i];
+		ts->dark[i]   = (dark != NULL) ? dark[i] : 0.0;
+		ts->tref[i]   = tref[i];
+		ts->lambda[i] = lambda[i];
+	}
+	for (i=0; i<ts->nfit; i++) strncpy(ts->names[i], (names != NULL && names[i] != NULL) ? names[i] : "", TSERIES_NAME_LENGTH-1);
+	return ts;
+}
+
+int TSeries_EncodeHeader(TSERIES *ts, void **data, size_t *len) {
+	TSERIES_HEADER hdr;
+	double *rows[4];
+	char *fmt[4] = {",%.1f", ",%.1f", ",%.3f", ",%.3f"};
+	int i, j, rc;
+
+	if (ts == NULL || ! ts->writing) return 1;
+	rows[0] = ts->ref; rows[1] = ts->dark; rows[2] = ts->tref; rows[3] = ts->lambda;
+	ts->out_len = 0;
+
+	if (! ts->binary) {										/* Exactly as FilmMeasure always wrote it */
+		rc = out_printf(ts, "# Line 1 = reference, Line 2 = dark, Line 3 = reference reflectance, Line 4 = lambda, Line n... data\n");
+		for (j=0; rc == 0 && j<4; j++) {
+			rc = out_printf(ts, "%lld", (long long) ts->start_time);
+			for (i=0; rc == 0 && i<ts->npt; i++) rc = out_printf(ts, fmt[j], rows[j][i]);
+			if (rc == 0) rc = out_printf(ts, "\n");
+		}
+		if (rc != 0) return 2;
+	} else {
+		if (out_reserve(ts, (size_t) ts->header_bytes) != 0) return 2;
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, TSERIES_MAGIC, sizeof(hdr.magic));
+		hdr.version      = TSERIES_VERSION;
+		hdr.npt          = ts->npt;
+		hdr.nfit         = ts->nfit;
+		hdr.value_bytes  = ts->value_bytes;
+		hdr.raw          = ts->raw;
+		hdr.header_bytes = (int32_t) ts->header_bytes;
+		hdr.record_bytes = (int32_t) ts->record_bytes;
+		hdr.start_time   = ts->start_time;
+		memcpy(ts->out, &hdr, sizeof(hdr));
+		ts->out_len = sizeof(hdr);
+		for (i=0; i<ts->nfit; i++) {
+			memcpy(ts->out+ts->out_len, ts->names[i], TSERIES_NAME_LENGTH);
+			ts->out_len += TSERIES_NAME_LENGTH;
+		}
+		for (j=0; j<4; j++) {
+			memcpy(ts->out+ts->out_len, rows[j], ts->npt*sizeof(double));
+			ts->out_len += ts->npt*sizeof(double);
+		}
+	}
+	*data = ts->out;
+	*len  = ts->out_len;
+	return 0;
+}
+
+int TSeries_EncodeRecord(TSERIES *ts, double time, double *fit, double *row, void **data, size_t *len) {
+	unsigned char *aptr;
+	float *fptr;
+	double *dptr;
+	int i, rc;
+
+	if (ts == NULL || ! ts->writing) return 1;
+
+	if (! ts->binary) {
+		ts->out_len = 0;
+		rc = out_printf(ts, "%.3f", time);
+		for (i=0; rc == 0 && i<ts->npt; i++) rc = out_printf(ts, ",%.4f", row[i]);
+		if (rc == 0) rc = out_printf(ts, "\n");
+		if (rc != 0) return 2;
+		*data = ts->out;
+		*len  = ts->out_len;
+	} else {
+		aptr = ts->record;
+		memcpy(aptr, &time, sizeof(time));
+		aptr += sizeof(time);
+		dptr = (double *) aptr;
+		for (i=0; i<ts->nfit; i++) dptr[i] = (fit != NULL) ? fit[i] : NAN;
+		aptr += ts->nfit*sizeof(double);
+		if (ts->value_bytes == sizeof(float)) {
+			fptr = (float *) aptr;
+			for (i=0; i<ts->npt; i++) fptr[i] = (float) row[i];
+		} else {
+			memcpy(aptr, row, ts->npt*sizeof(double));
+		}
+		*data = ts->record;
+		*len  = (size_t) ts->record_bytes;
+	}
+	return 0;
+}
+
+void TSeries_Close(TSERIES *ts) {
+	if (ts == NULL) return;
+	if (ts->funit != NULL) fclose(ts->funit);
+	if (ts->line   != NULL) free(ts->line);
+	if (ts->ref    != NULL) free(ts->ref);
+	if (ts->dark   != NULL) free(ts->dark);
+	if (ts->tref   != NULL) free(ts->tref);
+	if (ts->lambda != NULL) free(ts->lambda);
+	if (ts->record != NULL) free(ts->record);
+	if (ts->out    != NULL) free(ts->out);
+	free(ts);
+	return;
+}
+
+int TSeries_Points(TSERIES *ts) {
+	return (ts == NULL) ? 0 : ts->npt;
+}
+
+double *TSeries_Lambda(TSERIES *ts) {
+	return (ts == NULL) ? NULL : ts->lambda;
+}
+
+int TSeries_Header(TSERIES *ts, double **ref, double **dark, double **tref, int64_t *start_time) {
+	if (ref        != NULL) *ref  = ts->ref;
+	if (dark       != NULL) *dark = ts->dark;
+	if (tref       != NULL) *tref = ts->tref;
+	if (start_time != NULL) *start_time = ts->start_time;
+	return 0;
+}
+
+int TSeries_Raw(TSERIES *ts) {
+	return ts->raw;
+}
+
+int TSeries_Fits(TSERIES *ts, char ***names) {
+	int i;
+
+	for (i=0; i<ts->nfit; i++) ts->name_ptr[i] = ts->names[i];
+	if (names != NULL) *names = ts->name_ptr;
+	return ts->nfit;
+}
+
+double *TSeries_FitValues(TSERIES *ts) {
+	return (ts->nfit > 0) ? ts->fit : NULL;
+}
+
+/* ===========================================================================
+-- Read the next measurement row
+--
+-- Return: 0 if successful, 1 at end of file, 2 if short, <0 on memory failure
+=========================================================================== */
+int TSeries_Read(TSERIES *ts, double *time, double *row) {
+	unsigned char *aptr;
+	int64_t itime;
+	float *fptr;
+	int i, rc;
+
+	if (ts->writing) return -1;
+
+	/* Binary -- one fixed size record (a partial one is still being written) */
+	if (ts->binary) {
+		if (fread(ts->record, (size_t) ts->record_bytes, 1, ts->funit) != 1) return 1;
+		aptr = ts->record;
+		if (time != NULL && ts->version == 1) {			/* Whole seconds as int64 */
+			memcpy(&itime, aptr, sizeof(itime));
+			*time = (double) itime;
+		} else if (time != NULL) {
+			memcpy(time, aptr, sizeof(*time));
+		}
+		aptr += sizeof(double);
+		memcpy(ts->fit, aptr, ts->nfit*sizeof(double));
+		aptr += ts->nfit*sizeof(double);
+		if (ts->value_bytes == sizeof(float)) {
+			fptr = (float *) aptr;
+			for (i=0; i<ts->npt; i++) row[i] = fptr[i];
+		} else {
+			memcpy(row, aptr, ts->npt*sizeof(double));
+		}
+		return 0;
+	}
+
+	do {
+		if ( (rc = read_line(ts)) != 0) return rc;
+	} while (*ts->line == '#' || *ts->line == '\0');
+	return parse_row(ts->line, time, ts->npt, row);
+}
+
+/* ===========================================================================
+-- Records in a binary series, and positioning on a given record
+=========================================================================== */
+int64_t TSeries_Count(TSERIES *ts) {
+	int64_t here, size;
+
+	if (! ts->binary) return -1;
+	fflush(ts->funit);
+	here = ftell64(ts->funit);
+	fseek64(ts->funit, 0, SEEK_END);
+	size = ftell64(ts->funit);
+	fseek64(ts->funit, here, SEEK_SET);
+	return (size > ts->header_bytes) ? (size-ts->header_bytes)/ts->record_bytes : 0;
+}
+
+int TSeries_Seek(TSERIES *ts, int64_t index) {
+	int64_t i, here;
+
+	if (ts->writing || index < 0) return 1;
+	if (ts->binary) {
+		if (index >= TSeries_Count(ts)) return 1;
+		return fseek64(ts->funit, ts->header_bytes + index*ts->record_bytes, SEEK_SET) != 0;
+	}
+
+	/* Text -- count rows from the first measurement, then check row index exists */
+	if (fseek64(ts->funit, ts->data_start, SEEK_SET) != 0) return 1;
+	for (i=0; i<=index; i++) {
+		here = ftell64(ts->funit);
+		do {
+			if (read_line(ts) != 0) return 1;
+		} while (*ts->line == '#' || *ts->line == '\0');
+	}
+	return fseek64(ts->funit, here, SEEK_SET) != 0;
+}
+
+/* ===========================================================================
+-- Reflectance and uncertainty of a row (see WMP_RECALC_RAW_REFLECTANCE)
+=========================================================================== */
+int TSeries_Reflectance(TSERIES *ts, double *row, int raw, double *refl, double *sigma) {
+	double counts, signal, ref, dark, tref;
+	int i;
+
+	for (i=0; i<ts->npt; i++) {
+		ref  = ts->ref[i];
+		dark = ts->dark[i];
+		tref = ts->tref[i];
+		signal = MAX(1.0, fabs(ref-dark));
+
+		/* Sample counts -- given, or recovered from the reflectance */
+		if (raw) {
+			counts = row[i];
+		} else {
+			counts = (tref != 0) ? row[i]/tref * MAX(1.0, ref-dark) + dark : dark;
+		}
+
+		sigma[i] = pow(1.0/signal, 2) * fabs(counts);
+		sigma[i] += pow((counts-dark)/pow(signal,2), 2) * fabs(ref);
+		sigma[i] += pow(-1.0/signal + (counts-dark)/pow(signal,2), 2) * fabs(dark);
+		sigma[i] = sqrt(sigma[i]);
+		if (tref != 0) sigma[i] *= fabs(tref);
+
+		if (raw) {
+			refl[i] = (counts-dark) / MAX(1.0, ref-dark);
+			if (tref != 0) refl[i] *= tref;							/* Now absolute ... */
+			refl[i] = MAX(-1.0, MIN(2.0, refl[i]));
+		} else {
+			refl[i] = row[i];												/* Exactly as recorded */
+		}
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Guess whether a row holds raw counts rather than reflectance
+=========================================================================== */
+int TSeries_IsRaw(TSERIES *ts, double *row) {
+	int i;
+
+	for (i=0; i<ts->npt; i++) if (row[i] > 2.0) return TRUE;
+	return FALSE;
+}
+
+/* ===========================================================================
+-- Header rows, and the header/record sizes of the binary layout
+=========================================================================== */
+static int alloc_header(TSERIES *ts) {
+	static char *rname = "TSeries_Open";
+
+	ts->ref    = calloc(ts->npt, sizeof(double));
+	ts->dark   = calloc(ts->npt, sizeof(double));
+	ts->tref   = calloc(ts->npt, sizeof(double));
+	ts->lambda = calloc(ts->npt, sizeof(double));
+	if (ts->ref == NULL || ts->dark == NULL || ts->tref == NULL || ts->lambda == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		return 1;
+	}
+	return 0;
+}
+
+static int record_size(TSERIES *ts) {
+	static char *rname = "TSeries_Open";
+
+	ts->header_bytes = sizeof(TSERIES_HEADER) + (int64_t) ts->nfit*TSERIES_NAME_LENGTH + 4*(int64_t) ts->npt*sizeof(double);
+	ts->record_bytes = sizeof(double) + (int64_t) ts->nfit*sizeof(double) + (int64_t) ts->npt*ts->value_bytes;
+	ts->record_bytes = (ts->record_bytes+7) & ~7;					/* Keep every record 8 byte aligned */
+	if ( (ts->record = calloc(1, (size_t) ts->record_bytes)) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		return 1;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Encoding buffer -- room for len more bytes, and formatted appends
+=========================================================================== */
+static int out_reserve(TSERIES *ts, size_t len) {
+	static char *rname = "TSeries_Encode";
+	size_t dim;
+	char *out;
+
+	if (ts->out_len+len <= ts->out_dim) return 0;
+	dim = MAX(2*ts->out_dim, ts->out_len+len+LINE_CHUNK);
+	if ( (out = realloc(ts->out, dim)) == NULL) {
+		fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+		return 1;
+	}
+	ts->out = out;
+	ts->out_dim = dim;
+	return 0;
+}
+
+static int out_printf(TSERIES *ts, char *fmt, ...) {
+	va_list args;
+	int n;
+
+	while (TRUE) {
+		va_start(args, fmt);
+		n = vsnprintf(ts->out+ts->out_len, ts->out_dim-ts->out_len, fmt, args);
+		va_end(args);
+		if (n >= 0 && (size_t) n < ts->out_dim-ts->out_len) break;
+		if (out_reserve(ts, (n >= 0) ? n+1 : ts->out_dim+1) != 0) return 1;
+	}
+	ts->out_len += n;
+	return 0;
+}
+
+/* ===========================================================================
+-- Names ending in .csv get the text layout
+=========================================================================== */
+static int is_text_name(char *path) {
+	char *aptr;
+
+	if ( (aptr = strrchr(path, '.')) == NULL || strlen(aptr) != 4) return FALSE;
+	return tolower(aptr[1]) == 'c' && tolower(aptr[2]) == 's' && tolower(aptr[3]) == 'v';
+}
+
+/* ===========================================================================
+-- Read one line (any length) into ts->line, without the line terminator
+--
+-- Return: 0 if successful, 1 at end of file, -1 on memory failure
+=========================================================================== */
+static int read_line(TSERIES *ts) {
+	static char *rname = "TSeries_Read";
+	size_t len;
+	char *line;
+
+	len = 0;
+	while (TRUE) {
+		if (ts->dim - len < 2) {
+			if ( (line = realloc(ts->line, ts->dim+LINE_CHUNK)) == NULL) {
+				fprintf(stderr, "ERROR: %s: unable to allocate memory\n", rname); fflush(stderr);
+				return -1;
+			}
+			ts->line = line;
+			ts->dim += LINE_CHUNK;
+		}
+		if (fgets(ts->line+len, (int) (ts->dim-len), ts->funit) == NULL) {
+			if (len == 0) return 1;
+			break;
+		}
+		len += strlen(ts->line+len);
+		if (len > 0 && ts->line[len-1] == '\n') break;
+	}
+	while (len > 0 && (ts->line[len-1] == '\n' || ts->line[len-1] == '\r')) ts->line[--len] = '\0';
+	return 0;
+}
+
+/* ===========================================================================
+-- Split "time,v1,v2,..." into the time stamp and npt values
+--
+-- Return: 0 if successful, 2 if there are fewer than npt values (rest 0)
+=========================================================================== */
+static int parse_row(char *line, double *time, int npt, double *row) {
+	char *aptr, *endptr;
+	int i;
+
+	aptr = line;
+	if (time != NULL) *time = strtod(aptr, NULL);
+	for (i=0; i<npt; i++) {
+		if ( (aptr = strchr(aptr, ',')) == NULL) break;
+		row[i] = strtod(++aptr, &endptr);
+		aptr = endptr;
+	}
+	if (i < npt) {
+		for (; i<npt; i++) row[i] = 0.0;
+		return 2;
+	}
+	return 0;
+}
+
+/* ===========================================================================
+-- Number of values after the time stamp of a row
+=========================================================================== */
+static int count_values(char *line) {
+	int n;
+
+	for (n=0; (line = strchr(line, ',')) != NULL; line++) n++;
+	return n;
+}
@@ -0,0 +1,220 @@
+#ifndef _TSERIES_H_LOADED
+#define _TSERIES_H_LOADED
+
+/* ===========================================================================
+-- FilmMeasure time-series files.
+--
+-- Two formats, chosen by the file name when a series is created and by the
+-- contents when one is opened:
+--
+-- *.csv (original layout) -- a comment line, then four header rows --
+-- reference counts, dark counts, reflectance of the reference sample,
+-- wavelengths -- and then one row per measurement.  Every row starts with
+-- the time stamp (seconds since 1970, the header row as time() and the
+-- measurements to the millisecond) followed by one value per wavelength.
+-- Measurement rows hold either the reflectance or the raw sample counts.
+--
+-- Anything else is binary.  The headers are written once and every
+-- measurement is a fixed size record, so record n is at a known offset and
+-- the file can be memory mapped directly.  Native (little endian) byte
+-- order, every field 8 byte aligned:
+--
+--    offset  0  char    magic[8]          TSERIES_MAGIC
+--            8  int32   version           TSERIES_VERSION
+--           12  int32   npt               wavelengths per spectrum
+--           16  int32   nfit              fit values per record
+--           20  int32   value_bytes       4 (float) or 8 (double) per value
+--           24  int32   raw               1 if values are raw counts
+--           28  int32   header_bytes      offset of record 0
+--           32  int32   record_bytes      size of each record
+--           36  int32   (reserved)
+--           40  int64   start_time        time() when the series started
+--           48  int64   (reserved)[2]
+--           64  char    fit_name[nfit][TSERIES_NAME_LENGTH]
+--               double  ref[npt], dark[npt], tref[npt], lambda[npt]
+--  header_bytes         record[0], record[1], ...
+--
+--    record  double  time                 seconds since 1970 (version 1: int64 time())
+--            double  fit[nfit]            (NaN if no fit was done)
+--            float or double value[npt]   (padded to a multiple of 8)
+--
+-- The number of records follows from the file size, so a series being
+-- written can be read up to its last complete record.
+=========================================================================== */
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _TSERIES TSERIES;				/* Opaque -- an open time series */
+
+#define	TSERIES_MAGIC			"FMTSERIE"
+#define	TSERIES_VERSION		(2)				/* 1 had whole second int64 record times */
+#define	TSERIES_NAME_LENGTH	(32)				/* Bytes per fit value name */
+#define	TSERIES_MAX_FIT		(32)				/* Fit values per record */
+
+/* ===========================================================================
+-- Open or close a time series for reading
+--
+-- Usage: TSERIES *TSeries_Open(char *path);
+--        void TSeries_Close(TSERIES *ts);
+--
+-- Return: TSeries_Open returns NULL (with a message on stderr) if the file
+--         cannot be opened or its header rows are not consistent
+--
+-- Notes: TSeries_Close also closes series opened with TSeries_Create()
+=========================================================================== */
+TSERIES *TSeries_Open(char *path);
+void TSeries_Close(TSERIES *ts);
+
+/* ===========================================================================
+-- Create a time series for writing
+--
+-- Usage: TSERIES *TSeries_Create(char *path, int npt, double *ref, double *dark, double *tref, double *lambda,
+--                                int raw, int nfit, char **names, int value_bytes, int64_t start_time);
+--
+-- Inputs: path        - file to create (overwritten); *.csv for the text layout
+--         npt         - wavelengths per spectrum
+--         ref, dark   - [npt] reference and dark counts (dark may be NULL)
+--         tref        - [npt] reflectance of the reference sample
+--         lambda      - [npt] wavelengths (nm)
+--         raw         - TRUE if the records will hold raw counts
+--         nfit        - fit values per record (0 ... TSERIES_MAX_FIT)
+--         names       - [nfit] names of the fit values
+--         value_bytes - sizeof(float) or sizeof(double) for the values
+--         start_time  - time stamp of the header
+--
+-- Return: pointer to the series, or NULL on error (message on stderr)
+--
+-- Notes: The text layout has no place for fit values; they are dropped
+=========================================================================== */
+TSERIES *TSeries_Create(char *path, int npt, double *ref, double *dark, double *tref, double *lambda,
+								int raw, int nfit, char **names, int value_bytes, int64_t start_time);
+
+/* ===========================================================================
+-- Encode a time series in memory, for writers that own the file
+--
+-- Usage: TSERIES *TSeries_Encoder(char *path, int npt, double *ref, double *dark, double *tref, double *lambda,
+--                                 int raw, int nfit, char **names, int value_bytes, int64_t start_time);
+--        int TSeries_EncodeHeader(TSERIES *ts, void **data, size_t *len);
+--        int TSeries_EncodeRecord(TSERIES *ts, double time, double *fit, double *row, void **data, size_t *len);
+--
+-- Inputs: as TSeries_Create() and TSeries_Write(); path only selects the
+--         layout and is not opened
+--
+-- Output: *data, *len - bytes to append to the file (opened in binary mode);
+--                       owned by ts and valid until its next call
+--
+-- Return: TSeries_Encoder returns NULL on error; the others 0 if successful
+--
+-- Notes: TSeries_Create() and TSeries_Write() are these plus fwrite(), so
+--        the bytes are identical whichever way the file is written
+=========================================================================== */
+TSERIES *TSeries_Encoder(char *path, int npt, double *ref, double *dark, double *tref, double *lambda,
+								 int raw, int nfit, char **names, int value_bytes, int64_t start_time);
+int TSeries_EncodeHeader(TSERIES *ts, void **data, size_t *len);
+int TSeries_EncodeRecord(TSERIES *ts, double time, double *fit, double *row, void **data, size_t *len);
+
+/* ===========================================================================
+-- Append a measurement to a series from TSeries_Create()
+--
+-- Usage: int TSeries_Write(TSERIES *ts, double time, double *fit, double *row);
+--
+-- Inputs: ts   - series being written
+--         time - time stamp (seconds since 1970, with a fraction)
+--         fit  - [nfit] fit values (NULL to record NaN)
+--         row  - [npt] reflectance or raw counts
+--
+-- Return: 0 if successful, !0 on a write error
+--
+-- Notes: The record is flushed, so the file is complete after each call
+=========================================================================== */
+int TSeries_Write(TSERIES *ts, double time, double *fit, double *row);
+
+/* ===========================================================================
+-- Header of an open time series
+--
+-- Usage: int TSeries_Points(TSERIES *ts);
+--        double *TSeries_Lambda(TSERIES *ts);
+--        int TSeries_Header(TSERIES *ts, double **ref, double **dark, double **tref, int64_t *start_time);
+--        int TSeries_Raw(TSERIES *ts);
+--        int TSeries_Fits(TSERIES *ts, char ***names);
+--
+-- Return: TSeries_Points - number of wavelengths
+--         TSeries_Lambda - the [npt] wavelengths (nm) owned by ts
+--         TSeries_Header - 0; pointers to the [npt] header rows owned by ts
+--         TSeries_Raw    - 1 for raw counts, 0 for reflectance, -1 if not
+--                          recorded (text layout)
+--         TSeries_Fits   - number of fit values per record and (if names
+--                          is not NULL) their names
+=========================================================================== */
+int TSeries_Points(TSERIES *ts);
+double *TSeries_Lambda(TSERIES *ts);
+int TSeries_Header(TSERIES *ts, double **ref, double **dark, double **tref, int64_t *start_time);
+int TSeries_Raw(TSERIES *ts);
+int TSeries_Fits(TSERIES *ts, char ***names);
+
+/* ===========================================================================
+-- Read the next measurement row
+--
+-- Usage: int TSeries_Read(TSERIES *ts, double *time, double *row);
+--        double *TSeries_FitValues(TSERIES *ts);
+--
+-- Inputs: ts   - open time series
+--         time - pointer to receive the time stamp in seconds (NULL ok)
+--         row  - [npt] array to receive the values
+--
+-- Return: 0 if successful, 1 at end of file, 2 if the row is short
+--         (values not present are set to zero), <0 on memory failure
+--
+-- Notes: TSeries_FitValues() returns the [nfit] fit values of the row
+--        just read (owned by ts, NULL for the text layout)
+=========================================================================== */
+int TSeries_Read(TSERIES *ts, double *time, double *row);
+double *TSeries_FitValues(TSERIES *ts);
+
+/* ===========================================================================
+-- Random access by measurement index
+--
+-- Usage: int64_t TSeries_Count(TSERIES *ts);
+--        int TSeries_Seek(TSERIES *ts, int64_t index);
+--
+-- Return: TSeries_Count - complete records in the file (binary), or -1 if
+--                         unknown without reading it (text layout)
+--         TSeries_Seek  - 0 if the next TSeries_Read() returns row index,
+--                         1 if index is beyond the end
+--
+-- Notes: Binary files seek directly; the text layout rereads from the top
+=========================================================================== */
+int64_t TSeries_Count(TSERIES *ts);
+int TSeries_Seek(TSERIES *ts, int64_t index);
+
+/* ===========================================================================
+-- Reflectance and its uncertainty from a measurement row
+--
+-- Usage: int TSeries_Reflectance(TSERIES *ts, double *row, int raw, double *refl, double *sigma);
+--
+-- Inputs: ts    - open time series (reference, dark and reference reflectance)
+--         row   - [npt] values from TSeries_Read()
+--         raw   - TRUE if the row holds raw counts, FALSE for reflectance
+--         refl  - [npt] array to receive the reflectance
+--         sigma - [npt] array to receive its uncertainty
+--
+-- Return: 0 always
+--
+-- Notes: Same arithmetic as FilmMeasure (counting statistics of the
+--        sample, reference and dark).  For reflectance rows the sample
+--        counts are recovered from the reflectance to estimate sigma.
+=========================================================================== */
+int TSeries_Reflectance(TSERIES *ts, double *row, int raw, double *refl, double *sigma);
+
+/* ===========================================================================
+-- Guess whether a measurement row holds raw counts
+--
+-- Usage: int TSeries_IsRaw(TSERIES *ts, double *row);
+--
+-- Return: TRUE if any value is above 2 (FilmMeasure limits reflectance
+--         to -1 ... 2)
+=========================================================================== */
+int TSeries_IsRaw(TSERIES *ts, double *row);
+
+#endif		/* _TSERIES_H_LOADED */